@@ -9,8 +9,8 @@
 project = 'AppGuard'
 copyright = '2024, Oussama Ben Gatrane'
 author = 'Oussama Ben Gatrane'
-release = '1.01'
-version = '1.01'
+release = '2.00'
+version = '2.00'
 
 import os
 import sys
@@ -1,5 +1,6 @@
+from concurrent.futures import Future
 from functools import wraps
-from typing import Optional, Callable
+from typing import Optional, Callable, Dict, List, Tuple
 
 from .AppGuard import (
     AG_init,
@@ -7,12 +8,52 @@ from .AppGuard import (
     AG_is_loaded,
     AG_is_primary_instance,
     AG_create_IPCMsg,
+    AG_create_IPCMsg_bytes,
     AG_register_msg,
     AG_unregister_msg,
     AG_send_msg_request,
+    AG_send_bytes,
+    AG_send_msg_batch,
+    AG_send_msg_async,
+    AG_get_queue_stats,
+    AG_set_coalescing,
+    AG_set_gathering,
+    AG_get_event_fd,
+    AG_process_messages,
+    AG_send_msg_with_fds,
+    AG_call,
+    AG_sender_create,
+    AG_handle_id,
     AG_get_process_id,
     AG_focus_window,
-    IPCMsg
+    IPCMsg,
+    AGSender,
+    AGTransport,
+    AG_TRANSPORT_DEFAULT,
+    AG_TRANSPORT_SYSV_QUEUE,
+    AG_TRANSPORT_UNIX_SOCKET,
+    AG_TRANSPORT_SHARED_MEMORY,
+    AGOverflowPolicy,
+    AG_OVERFLOW_BLOCK,
+    AG_OVERFLOW_DROP_OLDEST,
+    AG_OVERFLOW_DROP_NEWEST,
+    AG_OVERFLOW_FAIL_FAST,
+    AGDispatchMode,
+    AG_DISPATCH_THREADS,
+    AG_DISPATCH_MANUAL,
+    AG_DISPATCH_SINGLE_THREAD,
+    AGWireHeader,
+    AG_WIRE_HEADER_NONE,
+    AG_WIRE_HEADER,
+    AG_WIRE_HEADER_CRC32C,
+    AGCoalescePolicy,
+    AG_COALESCE_NONE,
+    AG_COALESCE_DUPLICATES,
+    AG_COALESCE_LATEST,
+    AGSendStatus,
+    AG_SEND_DELIVERED,
+    AG_SEND_DROPPED,
+    AG_SEND_TIMED_OUT
 )
 
 
@@ -45,7 +86,14 @@ class AppGuard:
     """
 
     @classmethod
-    def init(cls, app_handle: str, on_quit_callback: Callable, quit_immediate: bool = True) -> None:
+    def init(cls, app_handle: str, on_quit_callback: Callable, quit_immediate: bool = True,
+             transport: AGTransport = AG_TRANSPORT_DEFAULT, queue_capacity: int = 65536,
+             transport_capacity: int = 0, overflow_policy: AGOverflowPolicy = AG_OVERFLOW_BLOCK,
+             send_timeout_ms: int = 1000, dispatch_threads: int = 1,
+             dispatch_mode: AGDispatchMode = AG_DISPATCH_THREADS, dispatch_thread_name: str = "",
+             dispatch_cpu: int = -1, dispatch_priority: int = 0,
+             wire_header: AGWireHeader = AG_WIRE_HEADER_NONE, require_wire_header: bool = False,
+             handle_ids: bool = False) -> None:
         """
         Initialize the AppGuard library for application instance management.
         
@@ -58,12 +106,45 @@ class AppGuard:
                 This callback will only be invoked on secondary instances if the quit_immediate boolean is set to true.
             quit_immediate (bool, optional): Whether to quit immediately when a secondary instance of the app is detected.
                 If set to False, the closing of the library/application will be left to the user. Defaults to True.
+            transport (AGTransport, optional): IPC transport used between instances. All instances of the application
+                must use the same transport. Defaults to AG_TRANSPORT_DEFAULT.
+            queue_capacity (int, optional): Most received messages waiting for their callbacks in the primary instance,
+                0 for no limit. Defaults to 65536.
+            transport_capacity (int, optional): Capacity of the transport in bytes, 0 for the transport default.
+                Defaults to 0.
+            overflow_policy (AGOverflowPolicy, optional): What happens to a message that finds no room in the transport
+                or in the queue: block, drop the oldest, drop the newest or fail fast. Defaults to AG_OVERFLOW_BLOCK.
+            send_timeout_ms (int, optional): How long a send waits for room under AG_OVERFLOW_BLOCK, in milliseconds.
+                Negative waits indefinitely. Defaults to 1000.
+            dispatch_threads (int, optional): Threads that run callbacks in the primary instance. With more than one,
+                callbacks for different message handles run concurrently, while those for one handle keep their order.
+                Defaults to 1.
+            dispatch_mode (AGDispatchMode, optional): AG_DISPATCH_MANUAL starts no threads: callbacks run on the
+                thread calling process_messages, when get_event_fd polls readable. AG_DISPATCH_SINGLE_THREAD receives
+                and runs callbacks on one library thread, without a hand-off between threads. Linux only. Defaults to
+                AG_DISPATCH_THREADS.
+            dispatch_thread_name (str, optional): Name of the thread under AG_DISPATCH_SINGLE_THREAD, as shown by top
+                and perf. Empty for "appguard-ipc". Defaults to "".
+            dispatch_cpu (int, optional): CPU the thread under AG_DISPATCH_SINGLE_THREAD is pinned to, -1 for any.
+                Defaults to -1.
+            dispatch_priority (int, optional): Nice value of the thread under AG_DISPATCH_SINGLE_THREAD, 0 to leave it
+                unchanged. Defaults to 0.
+            wire_header (AGWireHeader, optional): Header on the records this instance sends, which lets the primary
+                drop foreign and corrupted records. AG_WIRE_HEADER_CRC32C adds a checksum. Versions without the header
+                drop such records, so enable it once every instance reads it. Defaults to AG_WIRE_HEADER_NONE.
+            require_wire_header (bool, optional): Drop records that arrive without a header in the primary instance,
+                counted in the "invalid_records" entry of get_queue_stats(). Defaults to False.
+            handle_ids (bool, optional): Send named messages with the id of their handle, which the primary looks up
+                without hashing the handle. Versions without handle ids drop such messages, so enable it once every
+                instance reads them. Defaults to False.
                 
         Raises:
             AppGuardError: If initialization fails.
         """
         try:
-            AG_init(app_handle, on_quit_callback, quit_immediate)
+            AG_init(app_handle, on_quit_callback, quit_immediate, transport, queue_capacity, transport_capacity,
+                    overflow_policy, send_timeout_ms, dispatch_threads, dispatch_mode, dispatch_thread_name,
+                    dispatch_cpu, dispatch_priority, wire_header, require_wire_header, handle_ids)
         except Exception as e:
             raise AppGuardError(f"Error initializing AppGuard {str(e)}")
 
@@ -128,9 +209,12 @@ class AppGuard:
         The handle is used for message lookup. Through it, the library calls the function you provided, 
         passing an IPCMsgData as an argument. This is used in conjunction with the register_msg and 
         send_msg_request methods.
+        A handle containing '*' is a pattern: '*' matches any run of characters without a '.', and a trailing
+        '*' any rest of the handle, so "plugin.*" receives "plugin.editor.save". Pattern callbacks run after
+        those of the exact handle and see the handle the message was sent with.
         
         Args:
-            msg_handle (str): A message identifier.
+            msg_handle (str): A message identifier, or a pattern.
             callback (Callable): A callback function to be invoked using the message handle when an IPC message request is received.
             
         Returns:
@@ -141,17 +225,40 @@ class AppGuard:
         return ipc_msg
 
     @CheckInit
-    def register_msg(self, msg: IPCMsg) -> None:
+    def create_ipc_msg_bytes(self, msg_handle: str, callback: Callable) -> IPCMsg:
+        """
+        Create an IPC message whose callback receives the payload as bytes, without transcoding.
+        
+        The callback is called with (msg_handle, data): the bytes of messages sent with send_bytes, and the UTF-8
+        encoded data of the other messages of the handle. Patterns work as with create_ipc_msg.
+        
+        Args:
+            msg_handle (str): A message identifier, or a pattern.
+            callback (Callable): Called with the handle and the payload of each message received for the handle.
+            
+        Returns:
+            IPCMsg: The created IPC message structure.
+        """
+        ipc_msg: IPCMsg = IPCMsg()
+        AG_create_IPCMsg_bytes(ipc_msg, msg_handle, callback)
+        return ipc_msg
+
+    @CheckInit
+    def register_msg(self, msg: IPCMsg) -> bool:
         """
         Register an IPC message for receiving communications.
         
-        Call this function after creating the IPC message.
-        The function places an ID on the message struct which can be used to unregister the message.
+        Call this function after creating the IPC message. Its msg_id is used to unregister it.
+        Several messages may be registered for one handle; their callbacks run in registration order.
         
         Args:
             msg (IPCMsg): An IPCMsg structure to register.
+        
+        Returns:
+            bool: True if the message is registered. False if another registered handle has the same id,
+                in which case msg.msg_id is 0.
         """
-        AG_register_msg(msg)
+        return AG_register_msg(msg)
 
     @CheckInit
     def unregister_msg(self, msg: IPCMsg) -> None:
@@ -179,6 +286,217 @@ class AppGuard:
         """
         AG_send_msg_request(msg_handle, msg_data)
 
+    @CheckInit
+    def send_bytes(self, msg_handle: str, data: bytes) -> bool:
+        """
+        Send a binary message to the primary instance.
+        
+        The bytes are sent as they are, null bytes included. They reach the messages created with
+        create_ipc_msg_bytes; callbacks of create_ipc_msg are not called for them.
+        
+        Args:
+            msg_handle (str): The message handle identifier.
+            data (bytes): The bytes to send.
+            
+        Returns:
+            bool: Whether the message was handed to the transport. False on the primary instance.
+        """
+        return AG_send_bytes(msg_handle, data)
+
+    @CheckInit
+    def send_msg_batch(self, messages: List[Tuple[str, str]]) -> int:
+        """
+        Send several IPC message requests to another process instance at once.
+        
+        The messages are packed into as few transport messages as possible and are dispatched in order.
+        Use this instead of repeated send_msg_request calls when forwarding a burst of messages.
+        
+        Args:
+            messages (List[Tuple[str, str]]): (msg_handle, msg_data) pairs to send.
+            
+        Returns:
+            int: The number of messages sent.
+        """
+        return AG_send_msg_batch(messages)
+
+    @CheckInit
+    def send_msg_async(self, msg_handle: str, msg_data: str, timeout_ms: int = 1000) -> "Future[AGSendStatus]":
+        """
+        Queue an IPC message request for the primary instance without waiting for the transport.
+        
+        The message is sent from a background thread, in the order messages were queued, and is retried
+        while the transport is full until timeout_ms has passed. release() waits for the messages still queued.
+        
+        Args:
+            msg_handle (str): The message handle identifier.
+            msg_data (str): The message data to send.
+            timeout_ms (int, optional): The longest time to keep retrying while the transport is full, in milliseconds. Defaults to 1000.
+            
+        Returns:
+            Future[AGSendStatus]: Resolves to AG_SEND_DELIVERED, AG_SEND_DROPPED or AG_SEND_TIMED_OUT.
+            
+        Raises:
+            AppGuardError: If the message could not be queued.
+        """
+        future: "Future[AGSendStatus]" = Future()
+        send_id = AG_send_msg_async(msg_handle, msg_data, timeout_ms,
+                                    lambda _send_id, status: future.set_result(status))
+        if send_id == 0:
+            raise AppGuardError("The message could not be queued.")
+        return future
+
+    @CheckInit
+    def get_queue_stats(self) -> Dict[str, int]:
+        """
+        Report the dispatch queue length and the overflow counters of this instance.
+        
+        Returns:
+            Dict[str, int]: queue_length, queue_capacity, dropped_oldest, dropped_newest, rejected, timed_out,
+                coalesced and invalid_records.
+        """
+        return AG_get_queue_stats()
+
+    @CheckInit
+    def set_coalescing(self, msg_handle: str, policy: AGCoalescePolicy, window_ms: int = 0) -> bool:
+        """
+        Set how the primary instance coalesces the messages of a handle before running their callbacks.
+        
+        AG_COALESCE_DUPLICATES runs the callbacks once for identical data received within window_ms of each other,
+        AG_COALESCE_LATEST only for the newest of the messages waiting, and AG_COALESCE_NONE removes the rule.
+        Merged messages are counted in the "coalesced" entry of get_queue_stats().
+        
+        Args:
+            msg_handle (str): The message handle, without wildcards.
+            policy (AGCoalescePolicy): How its messages are coalesced.
+            window_ms (int, optional): For AG_COALESCE_DUPLICATES, how far apart identical messages are merged.
+                Defaults to 0.
+                
+        Returns:
+            bool: Whether the rule was set.
+        """
+        return AG_set_coalescing(msg_handle, policy, window_ms)
+
+    @CheckInit
+    def set_gathering(self, msg_handle: str, callback: Optional[Callable[[str, List[Optional[str]]], None]],
+                      max_delay_ms: int = 20, max_count: int = 0) -> bool:
+        """
+        Gather the messages of a handle that arrive close together into one call of a batch callback.
+        
+        A message arriving while the handle is idle is passed on at once. Under a launch storm a batch is passed on
+        once the messages stop coming, after max_delay_ms at the latest, or when it holds max_count messages.
+        Gathered messages no longer reach the callbacks registered for the handle; calls and messages with file
+        descriptors are never gathered.
+        
+        Args:
+            msg_handle (str): The message handle, without wildcards.
+            callback (Optional[Callable[[str, List[Optional[str]]], None]]): Called with the handle and the
+                payloads of each batch, in the order received, or None to stop gathering.
+            max_delay_ms (int, optional): How long a batch may stay open. Defaults to 20.
+            max_count (int, optional): How many messages a batch holds at most, or 0 for no limit. Defaults to 0.
+                
+        Returns:
+            bool: Whether the callback was set.
+        """
+        return AG_set_gathering(msg_handle, callback, max_delay_ms, max_count)
+
+    @CheckInit
+    def get_event_fd(self) -> int:
+        """
+        Get the descriptor to wait on in an event loop under AG_DISPATCH_MANUAL.
+        
+        It polls readable while process_messages has work, so it can be passed to selectors, asyncio's
+        loop.add_reader or a GUI toolkit's socket notifier. It belongs to the library and must not be closed.
+        
+        Returns:
+            int: The descriptor, or -1 when dispatch is not manual or this is not the primary instance.
+        """
+        return AG_get_event_fd()
+
+    @CheckInit
+    def process_messages(self, max_messages: int = 0, timeout_ms: int = 0) -> int:
+        """
+        Receive messages and run their callbacks on the calling thread under AG_DISPATCH_MANUAL.
+        
+        Args:
+            max_messages (int, optional): Most messages to run the callbacks of, 0 for all waiting. Defaults to 0.
+            timeout_ms (int, optional): How long to wait when no message is waiting, negative for no limit.
+                Defaults to 0.
+                
+        Returns:
+            int: How many messages had their callbacks run.
+        """
+        return AG_process_messages(max_messages, timeout_ms)
+
+    @CheckInit
+    def send_msg_with_fds(self, msg_handle: str, msg_data: str, fds: List[int]) -> bool:
+        """
+        Send an IPC message request with file descriptors attached.
+        
+        The descriptors are duplicated into the primary instance, which finds them in the "fds" entry of the
+        message passed to its callback. They are closed once the callback returns, so use os.dup() to keep one.
+        Supported on Linux with the AG_TRANSPORT_SYSV_QUEUE and AG_TRANSPORT_UNIX_SOCKET transports.
+        
+        Args:
+            msg_handle (str): The message handle identifier.
+            msg_data (str): The message data to send.
+            fds (List[int]): The file descriptors to pass, at most 64.
+            
+        Returns:
+            bool: True if the message was delivered to the primary instance, False otherwise.
+        """
+        return AG_send_msg_with_fds(msg_handle, msg_data, fds)
+
+    @CheckInit
+    def call(self, msg_handle: str, msg_data: str, timeout_ms: int = 1000) -> Optional[str]:
+        """
+        Send an IPC message request to the primary instance and wait for its reply.
+        
+        The callback registered for the handle answers by calling the "reply" entry of the message it receives,
+        e.g. msg["reply"]("result"), before it returns. Supported on Linux.
+        
+        Args:
+            msg_handle (str): The message handle identifier.
+            msg_data (str): The request data to send.
+            timeout_ms (int, optional): The longest time to wait for the reply, in milliseconds. Defaults to 1000.
+            
+        Returns:
+            Optional[str]: The reply, or None on timeout or when no callback answered the request.
+        """
+        return AG_call(msg_handle, msg_data, timeout_ms)
+
+    @CheckInit
+    def create_sender(self) -> AGSender:
+        """
+        Create a persistent sender for forwarding many messages to the primary instance.
+        
+        The sender resolves the primary instance once and reuses its buffers, so repeated sends skip the
+        per-call setup of send_msg_request. It has send(msg_handle, msg_data), send_id(handle_id, msg_data),
+        send_batch(messages) and close() methods, and is closed automatically on release().
+        
+        Returns:
+            AGSender: The new sender.
+            
+        Raises:
+            AppGuardError: If this is the primary instance.
+        """
+        sender = AG_sender_create()
+        if sender is None:
+            raise AppGuardError("A sender can only be created on a secondary instance.")
+        return sender
+
+    @staticmethod
+    def handle_id(msg_handle: str) -> int:
+        """
+        Get the 64-bit id a message handle travels under, for AGSender.send_id.
+        
+        Args:
+            msg_handle (str): The message handle.
+            
+        Returns:
+            int: The id of the handle.
+        """
+        return AG_handle_id(msg_handle)
+
     @CheckInit
     def focus_window(self, window_name: str) -> None:
         """
@@ -209,7 +527,40 @@ __all__ = [
     "AG_register_msg",
     "AG_unregister_msg",
     "AG_send_msg_request",
+    "AG_send_msg_batch",
+    "AG_send_msg_async",
+    "AG_get_queue_stats",
+    "AG_set_coalescing",
+    "AG_set_gathering",
+    "AG_get_event_fd",
+    "AG_process_messages",
+    "AG_send_msg_with_fds",
+    "AG_call",
+    "AG_sender_create",
     "AG_get_process_id",
     "AG_focus_window",
-    "IPCMsg"
+    "IPCMsg",
+    "AGSender",
+    "AGTransport",
+    "AG_TRANSPORT_DEFAULT",
+    "AG_TRANSPORT_SYSV_QUEUE",
+    "AG_TRANSPORT_UNIX_SOCKET",
+    "AG_TRANSPORT_SHARED_MEMORY",
+    "AGOverflowPolicy",
+    "AG_OVERFLOW_BLOCK",
+    "AG_OVERFLOW_DROP_OLDEST",
+    "AG_OVERFLOW_DROP_NEWEST",
+    "AG_OVERFLOW_FAIL_FAST",
+    "AGDispatchMode",
+    "AG_DISPATCH_THREADS",
+    "AG_DISPATCH_MANUAL",
+    "AG_DISPATCH_SINGLE_THREAD",
+    "AGCoalescePolicy",
+    "AG_COALESCE_NONE",
+    "AG_COALESCE_DUPLICATES",
+    "AG_COALESCE_LATEST",
+    "AGSendStatus",
+    "AG_SEND_DELIVERED",
+    "AG_SEND_DROPPED",
+    "AG_SEND_TIMED_OUT"
 ]
\ No newline at end of file
@@ -5,28 +5,57 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <set>
 #include <mutex>
 #include <cstring> 
 #include <iostream> 
 
-#if defined(__linux__) || defined(__APPLE__) || defined(__DARWIN__) || defined(__MACH__)
-#include <locale>
-#include <codecvt>
-#endif
-
 #include "AppGuard.h" 
+#include "../src/Utf8Codec.h"
 
 namespace py = pybind11;
 
 static py::function g_on_quit_callback_py;
-static std::map<std::string, py::function> g_ipc_msg_callbacks_py;
-static std::map<int, std::string> g_msg_id_to_handle_map;
-static std::map<int, py::object> g_active_ipc_msg_objects;
+// Python callbacks by msg_id. Several messages may share a handle.
+static std::map<uint64_t, py::function> g_ipc_msg_callbacks_py;
+static std::map<uint64_t, py::object> g_active_ipc_msg_objects;
+// Python batch callbacks by message handle, see AG_set_gathering.
+static std::map<std::string, py::function> g_ipc_batch_callbacks_py;
 static std::mutex g_callback_mutex;
 
+class PySender;
+static std::set<PySender*> g_live_senders;
+
 #pragma pack(push, 1)
 #pragma pack(pop)
 
+#if defined(__linux__) || defined(__APPLE__) || defined(__DARWIN__) || defined(__MACH__)
+// pybind11 hands out str as UTF-8, which never takes fewer bytes than wide characters.
+static void utf8_to_wstring(const std::string& utf8_str, std::wstring& holder) {
+    holder.resize(utf8_str.size());
+    size_t length = utf8_decode(utf8_str.data(), utf8_str.size(), &holder[0]);
+    if (length == UTF8_INVALID) {
+        throw py::value_error("String is not valid UTF-8.");
+    }
+    holder.resize(length);
+}
+#endif
+
+static const wchar_t* py_msg_data_to_wchar(const py::object& msg_data_py, std::wstring& holder, const char* function_name) {
+    if (msg_data_py.is_none()) {
+        return nullptr;
+    }
+    if (!py::isinstance<py::str>(msg_data_py)) { 
+        throw py::type_error(std::string(function_name) + ": msg_data must be a Python string or None.");
+    }
+#if defined(__linux__) || defined(__APPLE__) || defined(__DARWIN__) || defined(__MACH__)
+    utf8_to_wstring(msg_data_py.cast<std::string>(), holder);
+#else
+    holder = msg_data_py.cast<std::wstring>();
+#endif
+    return holder.c_str();
+}
+
 void app_on_quit_trampoline_c() {
     std::lock_guard<std::mutex> lock(g_callback_mutex);
     if (g_on_quit_callback_py && !g_on_quit_callback_py.is_none()) {
@@ -40,6 +69,21 @@ void app_on_quit_trampoline_c() {
     }
 }
 
+// The payload of a message as a Python str, or None. Needs the GIL.
+static py::object py_msg_payload(const wchar_t* msg_data) {
+    if (!msg_data) {
+        return py::none();
+    }
+#if defined(__linux__) || defined(__APPLE__) || defined(__DARWIN__) || defined(__MACH__)
+    size_t length = wcslen(msg_data);
+    std::string utf8_data(utf8_encoded_length(msg_data, length), '\0');
+    utf8_encode(msg_data, length, &utf8_data[0]);
+    return py::str(utf8_data);
+#else
+    return py::cast(std::wstring(msg_data));
+#endif
+}
+
 void ipc_msg_trampoline_c(const IPCMsgData* msg_data_c) {
     if (!msg_data_c || !msg_data_c->msg_handle) {
         return; 
@@ -50,7 +94,7 @@ void ipc_msg_trampoline_c(const IPCMsgData* msg_data_c) {
 
     {
         std::lock_guard<std::mutex> lock(g_callback_mutex);
-        auto it = g_ipc_msg_callbacks_py.find(msg_handle_str);
+        auto it = g_ipc_msg_callbacks_py.find(AG_get_msg_id(msg_data_c));
         if (it != g_ipc_msg_callbacks_py.end()) {
             python_callback = it->second;
         }
@@ -62,20 +106,21 @@ void ipc_msg_trampoline_c(const IPCMsgData* msg_data_c) {
 
             py::dict py_msg_data_dict;
             py_msg_data_dict["msg_handle"] = py::str(msg_data_c->msg_handle); 
-            
-            if (msg_data_c->msg_data) {
-#if defined(__linux__) || defined(__APPLE__) || defined(__DARWIN__) || defined(__MACH__)
-                std::string utf8_data = std::wstring_convert<std::codecvt_utf8<wchar_t>>().to_bytes(
-                    reinterpret_cast<const wchar_t*>(msg_data_c->msg_data)
-                );
-                py_msg_data_dict["msg_data"] = py::str(utf8_data);
-#else
-                std::wstring wstr_data(msg_data_c->msg_data);
-                py_msg_data_dict["msg_data"] = py::cast(wstr_data);
-#endif
-            } else {
-                py_msg_data_dict["msg_data"] = py::none();
+            py_msg_data_dict["msg_data"] = py_msg_payload(msg_data_c->msg_data);
+
+            const int* fds = nullptr;
+            size_t fd_count = AG_get_msg_fds(msg_data_c, &fds);
+            py::list py_fds;
+            for (size_t i = 0; i < fd_count; ++i) {
+                py_fds.append(fds[i]);
             }
+            py_msg_data_dict["fds"] = py_fds;
+            // Answers an AG_call request; only valid until this callback returns.
+            py_msg_data_dict["reply"] = py::cpp_function([msg_data_c](const py::object& reply_py) {
+                std::wstring reply_wstr_holder;
+                const wchar_t* reply_data = py_msg_data_to_wchar(reply_py, reply_wstr_holder, "reply");
+                return AG_reply(msg_data_c, reply_data);
+            }, py::arg("reply_data").none(true));
             
             python_callback(py_msg_data_dict);
 
@@ -86,6 +131,75 @@ void ipc_msg_trampoline_c(const IPCMsgData* msg_data_c) {
     }
 }
 
+// Calls the Python callback of a message created with AG_create_IPCMsg_bytes with (msg_handle, bytes).
+void ipc_msg_bytes_trampoline_c(const IPCMsgBytes* msg) {
+    if (!msg || !msg->msg_handle) {
+        return;
+    }
+
+    // Held until python_callback is destroyed, since copying and releasing it change its reference count.
+    py::gil_scoped_acquire acquire_gil;
+    py::function python_callback;
+    {
+        std::lock_guard<std::mutex> lock(g_callback_mutex);
+        auto it = g_ipc_msg_callbacks_py.find(msg->msg_id);
+        if (it != g_ipc_msg_callbacks_py.end()) {
+            python_callback = it->second;
+        }
+    }
+    if (!python_callback || python_callback.is_none()) {
+        return;
+    }
+
+    try {
+        python_callback(py::str(msg->msg_handle), py::bytes(static_cast<const char*>(msg->data), msg->length));
+    } catch (const py::error_already_set &e) {
+        py::print("[AppGuard Python] Error in bytes callback for handle '", msg->msg_handle, "':");
+        py::print(e.what());
+    }
+}
+
+// Calls the Python batch callback of the handle with (msg_handle, payloads).
+void ipc_batch_trampoline_c(const IPCMsgData* msgs, size_t count) {
+    std::string msg_handle_str(msgs[0].msg_handle);
+    py::gil_scoped_acquire acquire_gil;
+    py::function python_callback;
+    {
+        std::lock_guard<std::mutex> lock(g_callback_mutex);
+        auto it = g_ipc_batch_callbacks_py.find(msg_handle_str);
+        if (it != g_ipc_batch_callbacks_py.end()) {
+            python_callback = it->second;
+        }
+    }
+    if (!python_callback) {
+        return;
+    }
+
+    try {
+        py::list py_payloads;
+        for (size_t i = 0; i < count; ++i) {
+            py_payloads.append(py_msg_payload(msgs[i].msg_data));
+        }
+        python_callback(msg_handle_str, py_payloads);
+    } catch (const py::error_already_set &e) {
+        py::print("[AppGuard Python] Error in batch callback for handle '", msg_handle_str, "':");
+        py::print(e.what());
+    }
+}
+
+// user_data of an AG_send_msg_async call: a heap-held Python callable, released here once the outcome is known.
+void send_status_trampoline_c(uint64_t send_id, AGSendStatus status, void* user_data) {
+    py::gil_scoped_acquire acquire_gil;
+    py::function* python_callback = static_cast<py::function*>(user_data);
+    try {
+        (*python_callback)(send_id, status);
+    } catch (const py::error_already_set &e) {
+        py::print("[AppGuard Python] Error in send callback for send id", send_id, ":");
+        py::print(e.what());
+    }
+    delete python_callback;
+}
+
 class PyIPCMsg {
 public:
     IPCMsg c_msg_struct;          
@@ -101,23 +215,58 @@ public:
         c_msg_struct.msg_handle = this->msg_handle_copy.c_str();
         c_msg_struct.callback = ipc_msg_trampoline_c; 
 
-        {
-            std::lock_guard<std::mutex> lock(g_callback_mutex);
-            g_ipc_msg_callbacks_py[this->msg_handle_copy] = callback_fn_py;
-        }
-
         AG_create_IPCMsg(&c_msg_struct, this->msg_handle_copy.c_str(), ipc_msg_trampoline_c);
 
         if (c_msg_struct.msg_id != 0) { 
              std::lock_guard<std::mutex> lock(g_callback_mutex);
-             g_msg_id_to_handle_map[c_msg_struct.msg_id] = this->msg_handle_copy;
+             g_ipc_msg_callbacks_py[c_msg_struct.msg_id] = callback_fn_py;
+        }
+    }
+
+    void setup_bytes(const std::string& handle_str, py::function callback_fn_py) {
+        this->msg_handle_copy = handle_str;
+        AG_create_IPCMsg_bytes(&c_msg_struct, this->msg_handle_copy.c_str(), ipc_msg_bytes_trampoline_c);
+
+        if (c_msg_struct.msg_id != 0) {
+             std::lock_guard<std::mutex> lock(g_callback_mutex);
+             g_ipc_msg_callbacks_py[c_msg_struct.msg_id] = callback_fn_py;
         }
     }
 
-    int get_msg_id() const { return c_msg_struct.msg_id; }
+    uint64_t get_msg_id() const { return c_msg_struct.msg_id; }
     const char* get_msg_handle_c_str() const { return c_msg_struct.msg_handle; } 
 };
 
+class PySender {
+public:
+    AGSender* c_sender;
+
+    explicit PySender(AGSender* sender) : c_sender(sender) {
+        std::lock_guard<std::mutex> lock(g_callback_mutex);
+        g_live_senders.insert(this);
+    }
+
+    ~PySender() {
+        {
+            std::lock_guard<std::mutex> lock(g_callback_mutex);
+            g_live_senders.erase(this);
+        }
+        close();
+    }
+
+    void close() {
+        AG_sender_destroy(c_sender);
+        c_sender = nullptr;
+    }
+
+    AGSender* checked_sender() const {
+        if (c_sender == nullptr) {
+            throw py::value_error("AGSender is closed.");
+        }
+        return c_sender;
+    }
+};
+
 
 PYBIND11_MODULE(AppGuard, m) { 
     m.doc() = "Python bindings for the AppGuard C library";
@@ -132,7 +281,83 @@ PYBIND11_MODULE(AppGuard, m) {
             return py::none(); 
         });
 
-    m.def("AG_init", [](const std::string& app_handle, py::function on_quit_cb_py, bool quit_immediate) {
+    py::class_<PySender>(m, "AGSender")
+        .def("send", [](PySender& self, const std::string& msg_handle, const py::object& msg_data_py) {
+            AGSender* sender = self.checked_sender();
+            std::wstring msg_data_wstr_holder;
+            IPCMsgData c_msg_data_to_send;
+            c_msg_data_to_send.msg_handle = msg_handle.c_str();
+            c_msg_data_to_send.msg_data = py_msg_data_to_wchar(msg_data_py, msg_data_wstr_holder, "AGSender.send");
+
+            py::gil_scoped_release release_gil;
+            return AG_sender_send(sender, &c_msg_data_to_send);
+        }, py::arg("msg_handle"), py::arg("msg_data").none(true))
+        .def("send_id", [](PySender& self, uint64_t handle_id, const py::object& msg_data_py) {
+            AGSender* sender = self.checked_sender();
+            std::wstring msg_data_wstr_holder;
+            const wchar_t* msg_data = py_msg_data_to_wchar(msg_data_py, msg_data_wstr_holder, "AGSender.send_id");
+
+            py::gil_scoped_release release_gil;
+            return AG_sender_send_id(sender, handle_id, msg_data);
+        }, py::arg("handle_id"), py::arg("msg_data").none(true))
+        .def("send_bytes", [](PySender& self, const std::string& msg_handle, const py::bytes& data_py) {
+            AGSender* sender = self.checked_sender();
+            std::string_view data = data_py;
+
+            py::gil_scoped_release release_gil;
+            return AG_sender_send_bytes(sender, msg_handle.c_str(), data.data(), data.size());
+        }, py::arg("msg_handle"), py::arg("data"))
+        .def("send_batch", [](PySender& self, const std::vector<std::pair<std::string, py::object>>& messages) {
+            AGSender* sender = self.checked_sender();
+            std::vector<IPCMsgData> c_msgs(messages.size());
+            std::vector<std::wstring> msg_data_wstr_holders(messages.size());
+            for (size_t i = 0; i < messages.size(); ++i) {
+                c_msgs[i].msg_handle = messages[i].first.c_str();
+                c_msgs[i].msg_data = py_msg_data_to_wchar(messages[i].second, msg_data_wstr_holders[i], "AGSender.send_batch");
+            }
+
+            py::gil_scoped_release release_gil;
+            return AG_sender_send_batch(sender, c_msgs.data(), c_msgs.size());
+        }, py::arg("messages"))
+        .def("close", &PySender::close)
+        .def_property_readonly("closed", [](const PySender& self) { return self.c_sender == nullptr; });
+
+    py::enum_<AGTransport>(m, "AGTransport")
+        .value("AG_TRANSPORT_DEFAULT", AG_TRANSPORT_DEFAULT)
+        .value("AG_TRANSPORT_SYSV_QUEUE", AG_TRANSPORT_SYSV_QUEUE)
+        .value("AG_TRANSPORT_UNIX_SOCKET", AG_TRANSPORT_UNIX_SOCKET)
+        .value("AG_TRANSPORT_SHARED_MEMORY", AG_TRANSPORT_SHARED_MEMORY)
+        .export_values();
+
+    py::enum_<AGOverflowPolicy>(m, "AGOverflowPolicy")
+        .value("AG_OVERFLOW_BLOCK", AG_OVERFLOW_BLOCK)
+        .value("AG_OVERFLOW_DROP_OLDEST", AG_OVERFLOW_DROP_OLDEST)
+        .value("AG_OVERFLOW_DROP_NEWEST", AG_OVERFLOW_DROP_NEWEST)
+        .value("AG_OVERFLOW_FAIL_FAST", AG_OVERFLOW_FAIL_FAST)
+        .export_values();
+
+    py::enum_<AGDispatchMode>(m, "AGDispatchMode")
+        .value("AG_DISPATCH_THREADS", AG_DISPATCH_THREADS)
+        .value("AG_DISPATCH_MANUAL", AG_DISPATCH_MANUAL)
+        .value("AG_DISPATCH_SINGLE_THREAD", AG_DISPATCH_SINGLE_THREAD)
+        .export_values();
+
+    py::enum_<AGWireHeader>(m, "AGWireHeader")
+        .value("AG_WIRE_HEADER_NONE", AG_WIRE_HEADER_NONE)
+        .value("AG_WIRE_HEADER", AG_WIRE_HEADER)
+        .value("AG_WIRE_HEADER_CRC32C", AG_WIRE_HEADER_CRC32C)
+        .export_values();
+
+    py::enum_<AGSendStatus>(m, "AGSendStatus")
+        .value("AG_SEND_DELIVERED", AG_SEND_DELIVERED)
+        .value("AG_SEND_DROPPED", AG_SEND_DROPPED)
+        .value("AG_SEND_TIMED_OUT", AG_SEND_TIMED_OUT)
+        .export_values();
+
+    m.def("AG_init", [](const std::string& app_handle, py::function on_quit_cb_py, bool quit_immediate, AGTransport transport,
+                        size_t queue_capacity, size_t transport_capacity, AGOverflowPolicy overflow_policy, int send_timeout_ms,
+                        size_t dispatch_threads, AGDispatchMode dispatch_mode, const std::string& dispatch_thread_name,
+                        int dispatch_cpu, int dispatch_priority, AGWireHeader wire_header, bool require_wire_header, bool handle_ids) {
         AppOnQuitCallback c_on_quit_trampoline = nullptr;
         if (on_quit_cb_py && !on_quit_cb_py.is_none()) {
             std::lock_guard<std::mutex> lock(g_callback_mutex);
@@ -142,21 +367,56 @@ PYBIND11_MODULE(AppGuard, m) {
             std::lock_guard<std::mutex> lock(g_callback_mutex);
             g_on_quit_callback_py = py::function(); 
         }
-        AG_init(app_handle.c_str(), c_on_quit_trampoline, quit_immediate);
-    }, py::arg("app_handle"), py::arg("on_quit_callback").none(true), py::arg("quit_immediate"));
+        AGOptions options;
+        AG_init_options(&options);
+        options.transport = transport;
+        options.queue_capacity = queue_capacity;
+        options.transport_capacity = transport_capacity;
+        options.overflow_policy = overflow_policy;
+        options.send_timeout_ms = send_timeout_ms;
+        options.dispatch_threads = dispatch_threads;
+        options.dispatch_mode = dispatch_mode;
+        options.dispatch_thread_name = dispatch_thread_name.empty() ? nullptr : dispatch_thread_name.c_str();
+        options.dispatch_cpu = dispatch_cpu;
+        options.dispatch_priority = dispatch_priority;
+        options.wire_header = wire_header;
+        options.require_wire_header = require_wire_header ? 1 : 0;
+        options.handle_ids = handle_ids ? 1 : 0;
+        AG_init_ex(app_handle.c_str(), c_on_quit_trampoline, quit_immediate, &options);
+    }, py::arg("app_handle"), py::arg("on_quit_callback").none(true), py::arg("quit_immediate"),
+       py::arg("transport") = AG_TRANSPORT_DEFAULT, py::arg("queue_capacity") = 65536, py::arg("transport_capacity") = 0,
+       py::arg("overflow_policy") = AG_OVERFLOW_BLOCK, py::arg("send_timeout_ms") = 1000, py::arg("dispatch_threads") = 1,
+       py::arg("dispatch_mode") = AG_DISPATCH_THREADS, py::arg("dispatch_thread_name") = "", py::arg("dispatch_cpu") = -1,
+       py::arg("dispatch_priority") = 0, py::arg("wire_header") = AG_WIRE_HEADER_NONE, py::arg("require_wire_header") = false,
+       py::arg("handle_ids") = false);
 
     m.def("AG_release", []() {
-        AG_release();
+        {
+            // Senders must not outlive the library; any still held from Python are closed here.
+            std::lock_guard<std::mutex> lock(g_callback_mutex);
+            for (PySender* sender : g_live_senders) {
+                sender->close();
+            }
+        }
+        {
+            // Pending asynchronous sends report their outcome from another thread, which needs the GIL.
+            py::gil_scoped_release release_gil;
+            AG_release();
+        }
         std::lock_guard<std::mutex> lock(g_callback_mutex);
         g_on_quit_callback_py = py::function(); 
         g_ipc_msg_callbacks_py.clear();
-        g_msg_id_to_handle_map.clear();
+        g_ipc_batch_callbacks_py.clear();
         g_active_ipc_msg_objects.clear(); 
     });
 
     m.def("AG_is_loaded", &AG_is_loaded);
     m.def("AG_is_primary_instance", &AG_is_primary_instance);
 
+    m.def("AG_handle_id", [](const std::string& msg_handle) {
+        return AG_handle_id(msg_handle.c_str());
+    }, py::arg("msg_handle"));
+
     m.def("AG_create_IPCMsg", [](PyIPCMsg &msg_obj_py, const std::string& msg_handle, py::function callback_py) {
         if (!callback_py || callback_py.is_none()) {
             throw py::type_error("AG_create_IPCMsg: callback cannot be None.");
@@ -164,79 +424,197 @@ PYBIND11_MODULE(AppGuard, m) {
         msg_obj_py.setup_internal(msg_handle, callback_py);
     }, py::arg("msg_obj"), py::arg("msg_handle"), py::arg("callback"));
 
+    m.def("AG_create_IPCMsg_bytes", [](PyIPCMsg &msg_obj_py, const std::string& msg_handle, py::function callback_py) {
+        if (!callback_py || callback_py.is_none()) {
+            throw py::type_error("AG_create_IPCMsg_bytes: callback cannot be None.");
+        }
+        msg_obj_py.setup_bytes(msg_handle, callback_py);
+    }, py::arg("msg_obj"), py::arg("msg_handle"), py::arg("callback"));
+
     m.def("AG_register_msg", [](py::object msg_obj_py_generic) { 
         if (!py::isinstance<PyIPCMsg>(msg_obj_py_generic)) {
             throw py::type_error("AG_register_msg: msg_obj must be an instance of AppGuard.IPCMsg.");
         }
         PyIPCMsg& msg_obj_py = msg_obj_py_generic.cast<PyIPCMsg&>(); 
         
-        AG_register_msg(&(msg_obj_py.c_msg_struct));
+        uint64_t msg_id = msg_obj_py.c_msg_struct.msg_id;
+        bool registered = AG_register_msg(&(msg_obj_py.c_msg_struct));
 
-        if (msg_obj_py.c_msg_struct.msg_id != 0) {
-            std::lock_guard<std::mutex> lock(g_callback_mutex);
-            g_active_ipc_msg_objects[msg_obj_py.c_msg_struct.msg_id] = msg_obj_py_generic;
+        std::lock_guard<std::mutex> lock(g_callback_mutex);
+        if (registered) {
+            g_active_ipc_msg_objects[msg_id] = msg_obj_py_generic;
+        }
+        else if (msg_obj_py.c_msg_struct.msg_id == 0 && msg_id != 0) {
+            // The handle id is taken; the callback can never run under this msg_id.
+            g_ipc_msg_callbacks_py.erase(msg_id);
         }
+        return registered;
     }, py::arg("msg_obj"));
 
-    m.def("AG_unregister_msg", [](int msg_id) {
-        std::string handle_to_remove;
-        bool msg_was_active = false;
+    m.def("AG_unregister_msg", [](uint64_t msg_id) {
         {
-            std::lock_guard<std::mutex> lock(g_callback_mutex);
-            auto it_handle = g_msg_id_to_handle_map.find(msg_id);
-            if (it_handle != g_msg_id_to_handle_map.end()) {
-                handle_to_remove = it_handle->second;
-                g_msg_id_to_handle_map.erase(it_handle);
-            }
-            if (g_active_ipc_msg_objects.count(msg_id)) {
-                msg_was_active = true;
-            }
+            // Waits for a running callback, which needs the GIL to finish.
+            py::gil_scoped_release release;
+            AG_unregister_msg(msg_id);
         }
 
-        AG_unregister_msg(msg_id); 
+        std::lock_guard<std::mutex> lock(g_callback_mutex);
+        g_ipc_msg_callbacks_py.erase(msg_id);
+        g_active_ipc_msg_objects.erase(msg_id);
+    }, py::arg("msg_id"));
+
+    m.def("AG_send_msg_request", [](const std::string& msg_handle, const py::object& msg_data_py) {
+        IPCMsgData c_msg_data_to_send;
+        std::memset(&c_msg_data_to_send, 0, sizeof(IPCMsgData)); 
+        std::wstring msg_data_wstr_holder; 
 
+        c_msg_data_to_send.msg_handle = msg_handle.c_str();
+
+        c_msg_data_to_send.msg_data = py_msg_data_to_wchar(msg_data_py, msg_data_wstr_holder, "AG_send_msg_request");
+        
+        AG_send_msg_request(&c_msg_data_to_send);
+    }, py::arg("msg_handle"), py::arg("msg_data").none(true));
+
+    m.def("AG_send_bytes", [](const std::string& msg_handle, const py::bytes& data_py) {
+        std::string_view data = data_py;
+        py::gil_scoped_release release_gil;
+        return AG_send_bytes(msg_handle.c_str(), data.data(), data.size());
+    }, py::arg("msg_handle"), py::arg("data"));
+
+    m.def("AG_send_msg_batch", [](const std::vector<std::pair<std::string, py::object>>& messages) {
+        std::vector<IPCMsgData> c_msgs(messages.size());
+        std::vector<std::wstring> msg_data_wstr_holders(messages.size());
+
+        for (size_t i = 0; i < messages.size(); ++i) {
+            c_msgs[i].msg_handle = messages[i].first.c_str();
+            c_msgs[i].msg_data = py_msg_data_to_wchar(messages[i].second, msg_data_wstr_holders[i], "AG_send_msg_batch");
+        }
+
+        py::gil_scoped_release release_gil;
+        return AG_send_msg_batch(c_msgs.data(), c_msgs.size());
+    }, py::arg("messages"));
+
+    py::enum_<AGCoalescePolicy>(m, "AGCoalescePolicy")
+        .value("AG_COALESCE_NONE", AG_COALESCE_NONE)
+        .value("AG_COALESCE_DUPLICATES", AG_COALESCE_DUPLICATES)
+        .value("AG_COALESCE_LATEST", AG_COALESCE_LATEST)
+        .export_values();
+
+    m.def("AG_get_queue_stats", []() -> py::object {
+        AGQueueStats stats;
+        if (!AG_get_queue_stats(&stats)) {
+            return py::none();
+        }
+        py::dict stats_py;
+        stats_py["queue_length"] = stats.queue_length;
+        stats_py["queue_capacity"] = stats.queue_capacity;
+        stats_py["dropped_oldest"] = stats.dropped_oldest;
+        stats_py["dropped_newest"] = stats.dropped_newest;
+        stats_py["rejected"] = stats.rejected;
+        stats_py["timed_out"] = stats.timed_out;
+        stats_py["coalesced"] = stats.coalesced;
+        stats_py["invalid_records"] = stats.invalid_records;
+        return stats_py;
+    });
+
+    m.def("AG_set_coalescing", [](const std::string& msg_handle, AGCoalescePolicy policy, int window_ms) {
+        return AG_set_coalescing(msg_handle.c_str(), policy, window_ms);
+    }, py::arg("msg_handle"), py::arg("policy"), py::arg("window_ms") = 0);
+
+    m.def("AG_set_gathering", [](const std::string& msg_handle, py::object callback_py, int max_delay_ms, size_t max_count) {
+        bool gathering = !callback_py.is_none();
         {
             std::lock_guard<std::mutex> lock(g_callback_mutex);
-            if (!handle_to_remove.empty()) {
-                g_ipc_msg_callbacks_py.erase(handle_to_remove);
-            }
-            if (msg_was_active) {
-                 g_active_ipc_msg_objects.erase(msg_id); 
+            if (gathering) {
+                g_ipc_batch_callbacks_py[msg_handle] = callback_py.cast<py::function>();
             }
         }
-    }, py::arg("msg_id"));
+        bool set = AG_set_gathering(msg_handle.c_str(), gathering ? ipc_batch_trampoline_c : nullptr, max_delay_ms, max_count);
+        if (!gathering || !set) {
+            // A batch already open still finds no callback and is dropped.
+            std::lock_guard<std::mutex> lock(g_callback_mutex);
+            g_ipc_batch_callbacks_py.erase(msg_handle);
+        }
+        return set;
+    }, py::arg("msg_handle"), py::arg("callback").none(true), py::arg("max_delay_ms") = 20, py::arg("max_count") = 0);
 
-    m.def("AG_send_msg_request", [](const std::string& msg_handle, const py::object& msg_data_py) {
+    m.def("AG_get_event_fd", &AG_get_event_fd);
+
+    m.def("AG_process_messages", [](size_t max_messages, int timeout_ms) {
+        // Callbacks take the GIL back through their trampolines.
+        py::gil_scoped_release release_gil;
+        return AG_process_messages(max_messages, timeout_ms);
+    }, py::arg("max_messages") = 0, py::arg("timeout_ms") = 0);
+
+    m.def("AG_send_msg_async", [](const std::string& msg_handle, const py::object& msg_data_py, int timeout_ms,
+                                  const py::object& callback_py) {
+        IPCMsgData c_msg_data_to_send;
+        std::wstring msg_data_wstr_holder;
+        c_msg_data_to_send.msg_handle = msg_handle.c_str();
+        c_msg_data_to_send.msg_data = py_msg_data_to_wchar(msg_data_py, msg_data_wstr_holder, "AG_send_msg_async");
+
+        if (callback_py.is_none()) {
+            return AG_send_msg_async(&c_msg_data_to_send, timeout_ms, nullptr, nullptr);
+        }
+        py::function* python_callback = new py::function(callback_py.cast<py::function>());
+        uint64_t send_id = AG_send_msg_async(&c_msg_data_to_send, timeout_ms, send_status_trampoline_c, python_callback);
+        if (send_id == 0) {
+            delete python_callback;
+        }
+        return send_id;
+    }, py::arg("msg_handle"), py::arg("msg_data").none(true), py::arg("timeout_ms") = 1000,
+       py::arg("callback").none(true) = py::none());
+
+    m.def("AG_send_msg_with_fds", [](const std::string& msg_handle, const py::object& msg_data_py, const std::vector<int>& fds) {
         IPCMsgData c_msg_data_to_send;
         std::memset(&c_msg_data_to_send, 0, sizeof(IPCMsgData)); 
         std::wstring msg_data_wstr_holder; 
 
         c_msg_data_to_send.msg_handle = msg_handle.c_str();
+        c_msg_data_to_send.msg_data = py_msg_data_to_wchar(msg_data_py, msg_data_wstr_holder, "AG_send_msg_with_fds");
 
-        if (msg_data_py.is_none()) {
-            c_msg_data_to_send.msg_data = nullptr;
-        } else {
-            if (!py::isinstance<py::str>(msg_data_py)) { 
-                 throw py::type_error("AG_send_msg_request: msg_data must be a Python string or None.");
-            }
-#if defined(__linux__) || defined(__APPLE__) || defined(__DARWIN__) || defined(__MACH__)
-            std::string utf8_str = msg_data_py.cast<std::string>();
-            msg_data_wstr_holder = std::wstring_convert<std::codecvt_utf8<wchar_t>>().from_bytes(utf8_str);
-#else
-            msg_data_wstr_holder = msg_data_py.cast<std::wstring>();
-#endif
-            c_msg_data_to_send.msg_data = msg_data_wstr_holder.c_str();
+        py::gil_scoped_release release_gil;
+        return AG_send_msg_with_fds(&c_msg_data_to_send, fds.data(), fds.size());
+    }, py::arg("msg_handle"), py::arg("msg_data").none(true), py::arg("fds"));
+
+    m.def("AG_call", [](const std::string& msg_handle, const py::object& msg_data_py, int timeout_ms) -> py::object {
+        std::wstring msg_data_wstr_holder;
+        IPCMsgData c_msg_data_to_send;
+        c_msg_data_to_send.msg_handle = msg_handle.c_str();
+        c_msg_data_to_send.msg_data = py_msg_data_to_wchar(msg_data_py, msg_data_wstr_holder, "AG_call");
+
+        IPCMsgData c_reply;
+        bool answered;
+        {
+            py::gil_scoped_release release_gil;
+            answered = AG_call(&c_msg_data_to_send, timeout_ms, &c_reply);
         }
-        
-        AG_send_msg_request(&c_msg_data_to_send);
-    }, py::arg("msg_handle"), py::arg("msg_data").none(true));
+        if (!answered) {
+            return py::none();
+        }
+
+        py::object reply_py = py::str("");
+        if (c_reply.msg_data) {
+            reply_py = py_msg_payload(c_reply.msg_data);
+        }
+        AG_free_msg_data(&c_reply);
+        return reply_py;
+    }, py::arg("msg_handle"), py::arg("msg_data").none(true), py::arg("timeout_ms"));
+
+    m.def("AG_sender_create", []() -> py::object {
+        AGSender* sender = AG_sender_create();
+        if (sender == nullptr) {
+            return py::none();
+        }
+        return py::cast(new PySender(sender), py::return_value_policy::take_ownership);
+    });
 
     m.def("AG_get_process_id", &AG_get_process_id);
 
     m.def("AG_focus_window", [](const py::str& window_name_py_str) {
 #if defined(__linux__) || defined(__APPLE__) || defined(__DARWIN__) || defined(__MACH__)
-        std::string utf8_str = window_name_py_str.cast<std::string>();
-        std::wstring window_name_wstr = std::wstring_convert<std::codecvt_utf8<wchar_t>>().from_bytes(utf8_str);
+        std::wstring window_name_wstr;
+        utf8_to_wstring(window_name_py_str.cast<std::string>(), window_name_wstr);
 #else
         std::wstring window_name_wstr = window_name_py_str.cast<std::wstring>();
 #endif
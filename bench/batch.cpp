@@ -0,0 +1,85 @@
+// Throughput of AG_send_msg_batch against single sends from one secondary, checking that delivery stays in order.
+// Usage: batch [transport=1] [messages=20000] [batch_size=256]; a batch size of 1 sends one message at a time.
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cwchar>
+#include <string>
+#include <vector>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "../include/AppGuard.h"
+#include "bench_util.h"
+
+static std::atomic<long> received{ 0 };
+static std::atomic<long> out_of_order{ 0 };
+static long expected_index = 0;
+
+static void on_message(const IPCMsgData* msg_data) {
+    long index = wcstol(msg_data->msg_data, nullptr, 10);
+    if (index != expected_index) {
+        out_of_order++;
+    }
+    expected_index = index + 1;
+    received++;
+}
+
+int main(int argc, char** argv) {
+    AGOptions options;
+    AG_init_options(&options);
+    options.transport = static_cast<AGTransport>(arg_or(argc, argv, 1, AG_TRANSPORT_SYSV_QUEUE));
+    int messages = arg_or(argc, argv, 2, 20000);
+    int batch_size = arg_or(argc, argv, 3, 256);
+
+    int start[2];
+    if (pipe(start) == -1) {
+        return 1;
+    }
+    pid_t child = fork();
+    if (child == 0) {
+        close(start[1]);
+        char go;
+        read(start[0], &go, 1);
+        AG_init_ex("BenchBatch", nullptr, false, &options);
+        std::vector<std::wstring> payloads(messages);
+        std::vector<IPCMsgData> msgs(messages);
+        for (int i = 0; i < messages; ++i) {
+            payloads[i] = std::to_wstring(i) + L" --file=/home/user/documents/report.txt";
+            msgs[i] = { "Batch", payloads[i].c_str() };
+        }
+        size_t sent = 0;
+        for (int i = 0; i < messages; i += std::max(batch_size, 1)) {
+            if (batch_size <= 1) {
+                AG_send_msg_request(&msgs[i]);
+                sent++;
+            } else {
+                sent += AG_send_msg_batch(&msgs[i], std::min(batch_size, messages - i));
+            }
+        }
+        if (sent != static_cast<size_t>(messages)) {
+            fprintf(stderr, "sent %zu of %d\n", sent, messages);
+        }
+        AG_release();
+        _exit(0);
+    }
+
+    AG_init_ex("BenchBatch", nullptr, false, &options);
+    IPCMsg msg;
+    AG_create_IPCMsg(&msg, "Batch", on_message);
+    AG_register_msg(&msg);
+    usleep(100000);
+
+    auto started = std::chrono::steady_clock::now();
+    close(start[1]);
+    while (received < messages && seconds_since(started) < 60) {
+        usleep(100);
+    }
+    double elapsed = seconds_since(started);
+    waitpid(child, nullptr, 0);
+
+    printf("transport %d, batches of %d: %ld/%d received, %ld out of order, %.1fk msg/s\n", options.transport,
+           batch_size, received.load(), messages, out_of_order.load(), received / elapsed / 1000);
+    AG_release();
+    return 0;
+}
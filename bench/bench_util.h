@@ -0,0 +1,55 @@
+#pragma once
+
+// Helpers shared by the benchmarks under bench/. Linux only, as the benchmarks fork secondaries.
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <dirent.h>
+#include <fstream>
+#include <string>
+#include <vector>
+
+inline long long now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+inline double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// The value below which fraction of the samples fall. Sorts samples.
+inline double percentile(std::vector<double>& samples, double fraction) {
+    if (samples.empty()) {
+        return 0;
+    }
+    std::sort(samples.begin(), samples.end());
+    size_t index = std::min(samples.size() - 1, static_cast<size_t>(fraction * samples.size()));
+    return samples[index];
+}
+
+// Voluntary and involuntary context switches of every thread of this process so far.
+inline long context_switches() {
+    long total = 0;
+    DIR* tasks = opendir("/proc/self/task");
+    if (tasks == nullptr) {
+        return 0;
+    }
+    while (dirent* task = readdir(tasks)) {
+        if (task->d_name[0] == '.') {
+            continue;
+        }
+        std::ifstream status(std::string("/proc/self/task/") + task->d_name + "/status");
+        std::string line;
+        while (std::getline(status, line)) {
+            if (line.rfind("voluntary_ctxt_switches", 0) == 0 || line.rfind("nonvoluntary_ctxt_switches", 0) == 0) {
+                total += atol(line.c_str() + line.find(':') + 1);
+            }
+        }
+    }
+    closedir(tasks);
+    return total;
+}
+
+inline int arg_or(int argc, char** argv, int index, int fallback) {
+    return argc > index ? atoi(argv[index]) : fallback;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+// An IPCWatcher without a transport, for benchmarks that hand records to the receive path inside one process.
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include "IPCWatcher.h"
+#include "utils.h"
+
+class BenchWatcher : public IPCWatcher {
+public:
+    explicit BenchWatcher(const char* app_handle) : IPCWatcher(app_handle) {}
+    ~BenchWatcher() { stop(); }
+
+    void SendMsg(IPCMsgData& msg) override {}
+
+    // Hands one serialized record to the watcher, as a transport's receiver thread would.
+    void Feed(const std::string& record) {
+        std::vector<int> no_fds;
+        receive_record(record.data(), record.size(), no_fds);
+    }
+
+protected:
+    void process_messages() override {
+        while (processing) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+};
+
+inline std::string serialize_record(const char* msg_handle, const std::wstring& data) {
+    IPCMsgData msg = { msg_handle, data.c_str() };
+    std::string record(serialized_ipc_size(msg), '\0');
+    record.resize(serialize_for_ipc_into(msg, &record[0]));
+    return record;
+}
@@ -0,0 +1,101 @@
+// Round-trip latency of AG_call against an echo callback, from several caller threads in one secondary. Also checks
+// that unanswered calls fail at once.
+// Usage: call [transport=1] [callers=1] [calls_each=5000]
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cwchar>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "../include/AppGuard.h"
+#include "bench_util.h"
+
+static void on_call(const IPCMsgData* msg_data) {
+    if (wcscmp(msg_data->msg_data, L"silent") == 0) {
+        return;
+    }
+    std::wstring reply = std::wstring(L"echo:") + msg_data->msg_data;
+    AG_reply(msg_data, reply.c_str());
+}
+
+static void check_unanswered() {
+    IPCMsgData silent = { "Call", L"silent" };
+    IPCMsgData reply;
+    auto started = std::chrono::steady_clock::now();
+    bool answered = AG_call(&silent, 1000, &reply);
+    printf("unanswered call: %s in %.2f ms\n", answered ? "answered" : "failed", seconds_since(started) * 1000);
+    AG_free_msg_data(&reply);
+}
+
+static void make_calls(int caller, int calls, std::vector<double>& latencies_us, std::atomic<int>& failures) {
+    for (int i = 0; i < calls; ++i) {
+        std::wstring data = std::to_wstring(caller * calls + i);
+        IPCMsgData msg = { "Call", data.c_str() };
+        IPCMsgData reply;
+        long long started = now_ns();
+        bool answered = AG_call(&msg, 2000, &reply);
+        latencies_us.push_back((now_ns() - started) / 1000.0);
+        if (!answered || wcscmp(reply.msg_data, (L"echo:" + data).c_str()) != 0) {
+            failures++;
+        }
+        AG_free_msg_data(&reply);
+    }
+}
+
+int main(int argc, char** argv) {
+    AGOptions options;
+    AG_init_options(&options);
+    options.transport = static_cast<AGTransport>(arg_or(argc, argv, 1, AG_TRANSPORT_SYSV_QUEUE));
+    int callers = arg_or(argc, argv, 2, 1);
+    int calls_each = arg_or(argc, argv, 3, 5000);
+
+    int start[2];
+    if (pipe(start) == -1) {
+        return 1;
+    }
+    pid_t child = fork();
+    if (child == 0) {
+        close(start[1]);
+        char go;
+        read(start[0], &go, 1);
+        AG_init_ex("BenchCall", nullptr, false, &options);
+        check_unanswered();
+
+        std::vector<std::vector<double>> latencies_us(callers);
+        std::atomic<int> failures{ 0 };
+        std::vector<std::thread> threads;
+        auto started = std::chrono::steady_clock::now();
+        for (int caller = 0; caller < callers; ++caller) {
+            threads.emplace_back(make_calls, caller, calls_each, std::ref(latencies_us[caller]), std::ref(failures));
+        }
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+        double elapsed = seconds_since(started);
+
+        std::vector<double> all;
+        for (const std::vector<double>& caller_latencies : latencies_us) {
+            all.insert(all.end(), caller_latencies.begin(), caller_latencies.end());
+        }
+        printf("transport %d, %d callers: %zu calls, %d failed, p50 %.1f us, p99 %.1f us, %.1fk calls/s\n",
+               options.transport, callers, all.size(), failures.load(), percentile(all, 0.5), percentile(all, 0.99),
+               all.size() / elapsed / 1000);
+        fflush(stdout);
+        AG_release();
+        _exit(0);
+    }
+
+    AG_init_ex("BenchCall", nullptr, false, &options);
+    IPCMsg msg;
+    AG_create_IPCMsg(&msg, "Call", on_call);
+    AG_register_msg(&msg);
+    usleep(100000);
+
+    close(start[1]);
+    waitpid(child, nullptr, 0);
+    AG_release();
+    return 0;
+}
@@ -0,0 +1,90 @@
+// How long the receiver waits to hand a record to the watcher while some callbacks are slow and another thread keeps
+// registering and unregistering a handler, and how long those calls take.
+// Usage: contention [records=200000] [slow_every=1000] [slow_us=2000] [dispatch_threads=0]
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include "../include/AppGuard.h"
+#include "bench_util.h"
+#include "bench_watcher.h"
+
+static std::atomic<long> dispatched{ 0 };
+static int slow_us = 0;
+
+static void on_fast(const IPCMsgData* msg_data) {
+    dispatched++;
+}
+
+static void on_slow(const IPCMsgData* msg_data) {
+    usleep(slow_us);
+    dispatched++;
+}
+
+static void print_times(const char* name, std::vector<double>& times_us) {
+    printf("  %-17s n=%zu p50 %.1f us, p99 %.1f us, p99.9 %.1f us, max %.0f us\n", name, times_us.size(),
+           percentile(times_us, 0.5), percentile(times_us, 0.99), percentile(times_us, 0.999), percentile(times_us, 1));
+}
+
+int main(int argc, char** argv) {
+    long records = arg_or(argc, argv, 1, 200000);
+    int slow_every = arg_or(argc, argv, 2, 1000);
+    slow_us = arg_or(argc, argv, 3, 2000);
+    AGOptions options;
+    AG_init_options(&options);
+    options.dispatch_threads = arg_or(argc, argv, 4, 0);
+
+    BenchWatcher watcher("BenchContention");
+    watcher.Configure(options);
+    watcher.start();
+    IPCMsg fast = { 1, "Fast", on_fast, nullptr };
+    IPCMsg slow = { 2, "Slow", on_slow, nullptr };
+    watcher.RegisterIPCMsg(fast);
+    watcher.RegisterIPCMsg(slow);
+    std::wstring payload(32, L'x');
+    std::string fast_record = serialize_record("Fast", payload);
+    std::string slow_record = serialize_record("Slow", payload);
+
+    std::atomic<bool> feeding{ true };
+    std::vector<double> register_us;
+    std::vector<double> unregister_us;
+    std::thread registrar([&]() {
+        for (uint64_t msg_id = 100; feeding; ++msg_id) {
+            IPCMsg other = { msg_id, "Other", on_fast, nullptr };
+            long long started = now_ns();
+            watcher.RegisterIPCMsg(other);
+            long long registered = now_ns();
+            watcher.UnregisterIPCMsg(msg_id);
+            register_us.push_back((registered - started) / 1000.0);
+            unregister_us.push_back((now_ns() - registered) / 1000.0);
+            usleep(200);
+        }
+    });
+
+    std::vector<double> handoff_us;
+    handoff_us.reserve(records);
+    auto started = std::chrono::steady_clock::now();
+    for (long i = 0; i < records; ++i) {
+        bool is_slow = slow_every > 0 && i % slow_every == 0;
+        long long handoff_started = now_ns();
+        watcher.Feed(is_slow ? slow_record : fast_record);
+        handoff_us.push_back((now_ns() - handoff_started) / 1000.0);
+    }
+    double feed_ms = seconds_since(started) * 1000;
+    while (dispatched < records) {
+        usleep(1000);
+    }
+    double all_ms = seconds_since(started) * 1000;
+    feeding = false;
+    registrar.join();
+
+    printf("%ld records, 1 in %d sleeping %d us, %zu dispatch threads: fed in %.0f ms, dispatched in %.0f ms\n", records,
+           slow_every, slow_us, options.dispatch_threads, feed_ms, all_ms);
+    print_times("receiver handoff", handoff_us);
+    print_times("register", register_us);
+    print_times("unregister", unregister_us);
+    return 0;
+}
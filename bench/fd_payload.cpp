@@ -0,0 +1,105 @@
+// Throughput of a payload handed over as a memfd with AG_send_msg_with_fds, against the same size sent in-band.
+// Timed from the first send to the end of the last callback; the sender's time includes filling the memfd.
+// Usage: fd_payload [transport=1] [bytes=104857600] [memfd=1] [messages=1]
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <cwchar>
+#include <string>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "../include/AppGuard.h"
+#include "bench_util.h"
+
+static std::atomic<long> received{ 0 };
+static std::atomic<long long> received_bytes{ 0 };
+
+// Touches every page of a received memfd, so the payload is really read.
+static void on_message(const IPCMsgData* msg_data) {
+    const int* fds;
+    if (AG_get_msg_fds(msg_data, &fds) == 1) {
+        off_t size = lseek(fds[0], 0, SEEK_END);
+        void* mapped = mmap(nullptr, size, PROT_READ, MAP_SHARED, fds[0], 0);
+        if (mapped != MAP_FAILED) {
+            volatile unsigned char sum = 0;
+            for (off_t offset = 0; offset < size; offset += 4096) {
+                sum += static_cast<const unsigned char*>(mapped)[offset];
+            }
+            munmap(mapped, size);
+            received_bytes += size;
+        }
+    } else {
+        received_bytes += wcslen(msg_data->msg_data);
+    }
+    received++;
+}
+
+static void send_memfd(size_t size) {
+    int fd = memfd_create("payload", MFD_CLOEXEC);
+    if (fd == -1 || ftruncate(fd, size) == -1) {
+        return;
+    }
+    void* mapped = mmap(nullptr, size, PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapped != MAP_FAILED) {
+        memset(mapped, 1, size);
+        munmap(mapped, size);
+    }
+    IPCMsgData msg = { "Payload", L"memfd" };
+    if (!AG_send_msg_with_fds(&msg, &fd, 1)) {
+        fprintf(stderr, "AG_send_msg_with_fds failed\n");
+    }
+    close(fd);
+}
+
+int main(int argc, char** argv) {
+    AGOptions options;
+    AG_init_options(&options);
+    options.transport = static_cast<AGTransport>(arg_or(argc, argv, 1, AG_TRANSPORT_SYSV_QUEUE));
+    size_t size = arg_or(argc, argv, 2, 100 * 1024 * 1024);
+    bool memfd = arg_or(argc, argv, 3, 1) != 0;
+    int messages = arg_or(argc, argv, 4, 1);
+
+    int start[2];
+    if (pipe(start) == -1) {
+        return 1;
+    }
+    pid_t child = fork();
+    if (child == 0) {
+        close(start[1]);
+        char go;
+        read(start[0], &go, 1);
+        AG_init_ex("BenchFdPayload", nullptr, false, &options);
+        for (int i = 0; i < messages; ++i) {
+            if (memfd) {
+                send_memfd(size);
+            } else {
+                std::wstring payload(size, L'a');
+                IPCMsgData msg = { "Payload", payload.c_str() };
+                AG_send_msg_request(&msg);
+            }
+        }
+        AG_release();
+        _exit(0);
+    }
+
+    AG_init_ex("BenchFdPayload", nullptr, false, &options);
+    IPCMsg msg;
+    AG_create_IPCMsg(&msg, "Payload", on_message);
+    AG_register_msg(&msg);
+    usleep(100000);
+
+    auto started = std::chrono::steady_clock::now();
+    close(start[1]);
+    while (received < messages && seconds_since(started) < 60) {
+        usleep(200);
+    }
+    double elapsed = seconds_since(started);
+    waitpid(child, nullptr, 0);
+
+    printf("transport %d, %s: %d x %zu bytes, %ld received, %.1f MB/s\n", options.transport, memfd ? "memfd" : "in-band",
+           messages, size, received.load(), received_bytes / elapsed / 1e6);
+    AG_release();
+    return 0;
+}
@@ -0,0 +1,142 @@
+// Throughput of the receiver-to-dispatcher hand-off. "ring" and "mutex" time the hand-off alone: producers pass
+// IPCMsgRequest objects to one consumer that only counts them, through IPCRing and IPCDoorbell or through the mutex,
+// deque and condition variable they replaced. "watcher" feeds serialized records through an in-process watcher to a
+// no-op callback.
+// Usage: handoff [ring|mutex|watcher] [producers=1] [messages=2000000]
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../include/AppGuard.h"
+#include "IPCRing.h"
+#include "bench_util.h"
+#include "bench_watcher.h"
+
+static std::atomic<long> dispatched{ 0 };
+
+static void on_message(const IPCMsgData* msg_data) {
+    dispatched.fetch_add(1, std::memory_order_relaxed);
+}
+
+// Runs produce(producer) on each producer thread, all started at once. Returns the seconds until done() holds.
+template <typename Produce, typename Done>
+static double run_producers(int producers, Produce produce, Done done) {
+    std::atomic<bool> go{ false };
+    std::vector<std::thread> threads;
+    for (int producer = 0; producer < producers; ++producer) {
+        threads.emplace_back([&, producer]() {
+            while (!go) {
+            }
+            produce(producer);
+        });
+    }
+    auto started = std::chrono::steady_clock::now();
+    go = true;
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    while (!done()) {
+        std::this_thread::yield();
+    }
+    return seconds_since(started);
+}
+
+static double ring_handoff(int producers, long each) {
+    IPCRing<IPCMsgRequest> ring;
+    ring.reset(1024);
+    IPCDoorbell doorbell;
+    long total = producers * each;
+    std::atomic<long> consumed{ 0 };
+    std::thread consumer([&]() {
+        IPCMsgRequest request;
+        while (consumed < total) {
+            if (ring.try_pop(request)) {
+                consumed++;
+                continue;
+            }
+            doorbell.wait([&]() { return !ring.empty(); });
+        }
+    });
+    double elapsed = run_producers(producers, [&](int) {
+        for (long i = 0; i < each; ++i) {
+            IPCMsgRequest request;
+            while (!ring.try_push(request)) {
+                std::this_thread::yield();
+            }
+            doorbell.ring();
+        }
+    }, [&]() { return consumed == total; });
+    consumer.join();
+    return elapsed;
+}
+
+static double mutex_handoff(int producers, long each) {
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::deque<IPCMsgRequest> queue;
+    long total = producers * each;
+    std::atomic<long> consumed{ 0 };
+    std::thread consumer([&]() {
+        std::deque<IPCMsgRequest> batch;
+        while (consumed < total) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                ready.wait(lock, [&]() { return !queue.empty(); });
+                batch.swap(queue);
+            }
+            consumed += batch.size();
+            batch.clear();
+        }
+    });
+    double elapsed = run_producers(producers, [&](int) {
+        for (long i = 0; i < each; ++i) {
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.emplace_back();
+            ready.notify_one();
+        }
+    }, [&]() { return consumed == total; });
+    consumer.join();
+    return elapsed;
+}
+
+static double watcher_handoff(int producers, long each) {
+    BenchWatcher watcher("BenchHandoff");
+    AGOptions options;
+    AG_init_options(&options);
+    watcher.Configure(options);
+    watcher.start();
+    IPCMsg msg = { 1, "Handoff", on_message, nullptr };
+    watcher.RegisterIPCMsg(msg);
+    std::string record = serialize_record("Handoff", std::wstring(16, L'x'));
+    long total = producers * each;
+    return run_producers(producers, [&](int) {
+        for (long i = 0; i < each; ++i) {
+            watcher.Feed(record);
+        }
+    }, [&]() { return dispatched == total; });
+}
+
+int main(int argc, char** argv) {
+    const char* mode = argc > 1 ? argv[1] : "ring";
+    int producers = arg_or(argc, argv, 2, 1);
+    long each = arg_or(argc, argv, 3, 2000000) / producers;
+
+    double elapsed;
+    if (strcmp(mode, "mutex") == 0) {
+        elapsed = mutex_handoff(producers, each);
+    } else if (strcmp(mode, "watcher") == 0) {
+        elapsed = watcher_handoff(producers, each);
+    } else {
+        elapsed = ring_handoff(producers, each);
+    }
+    long total = producers * each;
+    printf("%s, %d producers: %ld messages, %.0f ns/msg, %.2f M msg/s\n", mode, producers, total, elapsed * 1e9 / total,
+           total / elapsed / 1e6);
+    return 0;
+}
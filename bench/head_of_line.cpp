@@ -0,0 +1,87 @@
+// Head-of-line blocking across message handles. Records arrive at a steady rate; one in slow_every is "OpenFiles",
+// whose callback sleeps slow_us, and the rest are "Focus". Reports the delay from hand-off to the start of each Focus
+// callback and counts callbacks that ran out of order within their handle.
+// Usage: head_of_line [dispatch_threads=1] [records=5000] [slow_every=40] [slow_us=5000] [gap_us=200]
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../include/AppGuard.h"
+#include "bench_util.h"
+#include "bench_watcher.h"
+
+static std::vector<std::chrono::steady_clock::time_point> fed;
+static std::vector<double> focus_delay;
+static std::atomic<long> finished{ 0 };
+static std::atomic<long> disorder{ 0 };
+static long last_focus = -1;
+static long last_open = -1;
+static int slow_us;
+
+static void on_focus(const IPCMsgData* msg_data) {
+    long index = std::stol(std::wstring(msg_data->msg_data));
+    focus_delay.push_back(seconds_since(fed[index]) * 1e6);
+    if (index < last_focus) {
+        disorder++;
+    }
+    last_focus = index;
+    finished++;
+}
+
+static void on_open_files(const IPCMsgData* msg_data) {
+    long index = std::stol(std::wstring(msg_data->msg_data));
+    if (index < last_open) {
+        disorder++;
+    }
+    last_open = index;
+    std::this_thread::sleep_for(std::chrono::microseconds(slow_us));
+    finished++;
+}
+
+int main(int argc, char** argv) {
+    int dispatch_threads = arg_or(argc, argv, 1, 1);
+    long records = arg_or(argc, argv, 2, 5000);
+    int slow_every = arg_or(argc, argv, 3, 40);
+    slow_us = arg_or(argc, argv, 4, 5000);
+    int gap_us = arg_or(argc, argv, 5, 200);
+
+    BenchWatcher watcher("BenchHeadOfLine");
+    AGOptions options;
+    AG_init_options(&options);
+    options.dispatch_threads = dispatch_threads;
+    watcher.Configure(options);
+    watcher.start();
+    IPCMsg focus = { 1, "Focus", on_focus, nullptr };
+    IPCMsg open_files = { 2, "OpenFiles", on_open_files, nullptr };
+    watcher.RegisterIPCMsg(focus);
+    watcher.RegisterIPCMsg(open_files);
+
+    std::vector<std::string> serialized;
+    for (long i = 0; i < records; ++i) {
+        serialized.push_back(serialize_record(i % slow_every == 0 ? "OpenFiles" : "Focus", std::to_wstring(i)));
+    }
+    fed.resize(records);
+    focus_delay.reserve(records);
+
+    auto started = std::chrono::steady_clock::now();
+    for (long i = 0; i < records; ++i) {
+        auto due = started + std::chrono::microseconds(gap_us * i);
+        while (std::chrono::steady_clock::now() < due) {
+            std::this_thread::sleep_for(std::chrono::microseconds(20));
+        }
+        fed[i] = std::chrono::steady_clock::now();
+        watcher.Feed(serialized[i]);
+    }
+    while (finished < records) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    double elapsed = seconds_since(started);
+
+    printf("dispatch_threads=%d: %ld records, 1 in %d slow, done in %.0f ms; Focus delay p50 %.0f us, p99 %.0f us, "
+           "max %.0f us; order violations %ld\n",
+           dispatch_threads, records, slow_every, elapsed * 1e3, percentile(focus_delay, 0.5),
+           percentile(focus_delay, 0.99), percentile(focus_delay, 1.0), disorder.load());
+    return 0;
+}
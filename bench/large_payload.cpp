@@ -0,0 +1,66 @@
+// Throughput of payloads larger than one transport message, sent in-band by one secondary.
+// Usage: large_payload [transport=1] [payload_chars=65536] [messages=100]
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cwchar>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "../include/AppGuard.h"
+#include "bench_util.h"
+
+static std::atomic<long> received{ 0 };
+static std::atomic<long long> received_chars{ 0 };
+
+static void on_message(const IPCMsgData* msg_data) {
+    received_chars += wcslen(msg_data->msg_data);
+    received++;
+}
+
+int main(int argc, char** argv) {
+    AGOptions options;
+    AG_init_options(&options);
+    options.transport = static_cast<AGTransport>(arg_or(argc, argv, 1, AG_TRANSPORT_SYSV_QUEUE));
+    long payload_chars = arg_or(argc, argv, 2, 65536);
+    int messages = arg_or(argc, argv, 3, 100);
+
+    int start[2];
+    if (pipe(start) == -1) {
+        return 1;
+    }
+    pid_t child = fork();
+    if (child == 0) {
+        close(start[1]);
+        char go;
+        read(start[0], &go, 1);
+        AG_init_ex("BenchLargePayload", nullptr, false, &options);
+        std::wstring payload(payload_chars, L'x');
+        IPCMsgData msg = { "Large", payload.c_str() };
+        for (int i = 0; i < messages; ++i) {
+            AG_send_msg_request(&msg);
+        }
+        AG_release();
+        _exit(0);
+    }
+
+    AG_init_ex("BenchLargePayload", nullptr, false, &options);
+    IPCMsg msg;
+    AG_create_IPCMsg(&msg, "Large", on_message);
+    AG_register_msg(&msg);
+    usleep(100000);
+
+    auto started = std::chrono::steady_clock::now();
+    close(start[1]);
+    for (int i = 0; i < 30000 && received < messages; ++i) {
+        usleep(2000);
+    }
+    double elapsed = seconds_since(started);
+    waitpid(child, nullptr, 0);
+
+    bool intact = received_chars == payload_chars * received;
+    printf("transport %d: %d x %ld chars, %ld received%s, %.1f MB/s\n", options.transport, messages, payload_chars,
+           received.load(), intact ? "" : " (truncated)", received_chars / elapsed / 1e6);
+    AG_release();
+    return 0;
+}
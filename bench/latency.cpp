@@ -0,0 +1,66 @@
+// Send-to-callback latency of a paced stream, and how often the idle primary wakes up afterwards.
+// Usage: latency [transport=1] [messages=200] [interval_us=2000]
+#include <atomic>
+#include <cstdio>
+#include <cwchar>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "../include/AppGuard.h"
+#include "bench_util.h"
+
+static std::mutex latencies_mutex;
+static std::vector<double> latencies_us;
+static std::atomic<int> received{ 0 };
+
+static void on_message(const IPCMsgData* msg_data) {
+    long long sent_ns = wcstoll(msg_data->msg_data, nullptr, 10);
+    std::lock_guard<std::mutex> lock(latencies_mutex);
+    latencies_us.push_back((now_ns() - sent_ns) / 1000.0);
+    received++;
+}
+
+int main(int argc, char** argv) {
+    AGOptions options;
+    AG_init_options(&options);
+    options.transport = static_cast<AGTransport>(arg_or(argc, argv, 1, AG_TRANSPORT_SYSV_QUEUE));
+    int messages = arg_or(argc, argv, 2, 200);
+    int interval_us = arg_or(argc, argv, 3, 2000);
+
+    pid_t child = fork();
+    if (child == 0) {
+        usleep(300000);
+        AG_init_ex("BenchLatency", nullptr, false, &options);
+        for (int i = 0; i < messages; ++i) {
+            std::wstring sent = std::to_wstring(now_ns());
+            IPCMsgData msg = { "Latency", sent.c_str() };
+            AG_send_msg_request(&msg);
+            usleep(interval_us);
+        }
+        AG_release();
+        _exit(0);
+    }
+
+    AG_init_ex("BenchLatency", nullptr, false, &options);
+    IPCMsg msg;
+    AG_create_IPCMsg(&msg, "Latency", on_message);
+    AG_register_msg(&msg);
+    waitpid(child, nullptr, 0);
+    for (int i = 0; i < 200 && received < messages; ++i) {
+        usleep(10000);
+    }
+
+    long idle_start = context_switches();
+    sleep(3);
+    double idle_wakeups = (context_switches() - idle_start) / 3.0;
+
+    std::lock_guard<std::mutex> lock(latencies_mutex);
+    size_t count = latencies_us.size();
+    printf("transport %d: %zu/%d messages, p50 %.1f us, p99 %.1f us, %.1f idle wakeups/s\n", options.transport, count,
+           messages, percentile(latencies_us, 0.5), percentile(latencies_us, 0.99), idle_wakeups);
+    AG_release();
+    return 0;
+}
@@ -0,0 +1,117 @@
+// Wildcard subscription lookup: time to match a handle against 100, 1k and 10k registered patterns through the
+// pattern trie, versus a linear scan with a glob matcher, plus the cost of registering and unregistering a pattern.
+// Usage: patterns
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+#include "IPCMsgTable.h"
+#include "bench_util.h"
+
+// '*' matches any run without a '.', a trailing '*' any rest of the handle.
+static bool glob(const std::string& pattern, size_t at, const std::string& handle, size_t from) {
+    if (at == pattern.size()) {
+        return from == handle.size();
+    }
+    if (pattern[at] == '*') {
+        size_t next = at + 1;
+        if (next == pattern.size()) {
+            return true;
+        }
+        for (size_t end = from;; ++end) {
+            if (glob(pattern, next, handle, end)) {
+                return true;
+            }
+            if (end == handle.size() || handle[end] == '.') {
+                return false;
+            }
+        }
+    }
+    return from < handle.size() && handle[from] == pattern[at] && glob(pattern, at + 1, handle, from + 1);
+}
+
+static void on_message(const IPCMsgData* msg_data) {}
+
+static std::vector<std::string> make_patterns(size_t count) {
+    const char* parts[] = { "editor", "browser", "terminal", "files", "search", "git", "debug", "notes" };
+    std::vector<std::string> patterns;
+    for (size_t i = 0; i < count; ++i) {
+        char pattern[96];
+        switch (i % 4) {
+        case 0:
+            snprintf(pattern, sizeof(pattern), "plugin.%s%zu.*", parts[i % 8], i);
+            break;
+        case 1:
+            snprintf(pattern, sizeof(pattern), "plugin.%s%zu.*.save", parts[i % 8], i);
+            break;
+        case 2:
+            snprintf(pattern, sizeof(pattern), "app%zu.*", i);
+            break;
+        default:
+            snprintf(pattern, sizeof(pattern), "plugin.%s%zu.open*", parts[i % 8], i);
+            break;
+        }
+        patterns.push_back(pattern);
+    }
+    return patterns;
+}
+
+int main() {
+    const std::vector<std::string> handles = { "plugin.browser1.tab.save", "plugin.editor0.tab.save.extra.long.handle.name",
+                                               "plugin.unknown.handle", "plugin.files3.open_repository_in_new_window" };
+    int mismatches = 0;
+    for (size_t count : { 100, 1000, 10000 }) {
+        std::vector<std::string> patterns = make_patterns(count);
+        std::unique_ptr<IPCMsgTable> table(new IPCMsgTable());
+        auto started = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < count; ++i) {
+            IPCMsg msg = { i + 1, "Pattern", on_message, nullptr };
+            table = table->with_pattern(patterns[i], msg);
+        }
+        double register_us = seconds_since(started) * 1e6 / count;
+
+        for (const std::string& handle : handles) {
+            std::vector<const std::vector<IPCMsg>*> matches;
+            size_t trie_hits = 0;
+            const int trie_rounds = 200000;
+            started = std::chrono::steady_clock::now();
+            for (int round = 0; round < trie_rounds; ++round) {
+                table->match(handle.data(), handle.size(), matches);
+                trie_hits += matches.size();
+                matches.clear();
+            }
+            double trie_ns = seconds_since(started) * 1e9 / trie_rounds;
+
+            size_t linear_hits = 0;
+            const int linear_rounds = std::max<int>(20, 2000000 / static_cast<int>(count));
+            started = std::chrono::steady_clock::now();
+            for (int round = 0; round < linear_rounds; ++round) {
+                for (const std::string& pattern : patterns) {
+                    linear_hits += glob(pattern, 0, handle, 0);
+                }
+            }
+            double linear_ns = seconds_since(started) * 1e9 / linear_rounds;
+            if (trie_hits / trie_rounds != linear_hits / linear_rounds) {
+                ++mismatches;
+            }
+            printf("%5zu patterns, handle length %2zu: trie %7.1f ns, linear %10.1f ns, %zu matching\n", count,
+                   handle.size(), trie_ns, linear_ns, trie_hits / trie_rounds);
+        }
+
+        started = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < count; ++i) {
+            table = table->without_pattern(patterns[i], i + 1);
+        }
+        printf("%5zu patterns: register %.2f us, unregister %.2f us per pattern\n", count, register_us,
+               seconds_since(started) * 1e6 / count);
+        if (table->has_patterns()) {
+            ++mismatches;
+        }
+    }
+    if (mismatches != 0) {
+        printf("%d mismatches against the glob matcher\n", mismatches);
+    }
+    return mismatches == 0 ? 0 : 1;
+}
@@ -0,0 +1,90 @@
+// Cost per send of AG_send_msg_request against a sender kept with AG_sender_create, measured in the secondary while
+// the primary drains the messages. Allocations are counted by interposing malloc.
+// Usage: sender [transport=1] [messages=20000] [use_sender=1]
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "../include/AppGuard.h"
+#include "bench_util.h"
+
+static std::atomic<long> allocations{ 0 };
+
+#if defined(__GLIBC__)
+extern "C" void* __libc_malloc(size_t size);
+
+extern "C" void* malloc(size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(size);
+}
+#endif
+
+static std::atomic<long> received{ 0 };
+
+static void on_message(const IPCMsgData* msg_data) {
+    received++;
+}
+
+int main(int argc, char** argv) {
+    AGOptions options;
+    AG_init_options(&options);
+    options.transport = static_cast<AGTransport>(arg_or(argc, argv, 1, AG_TRANSPORT_SYSV_QUEUE));
+    int messages = arg_or(argc, argv, 2, 20000);
+    bool use_sender = arg_or(argc, argv, 3, 1) != 0;
+
+    int start[2];
+    if (pipe(start) == -1) {
+        return 1;
+    }
+    pid_t child = fork();
+    if (child == 0) {
+        close(start[1]);
+        char go;
+        read(start[0], &go, 1);
+        AG_init_ex("BenchSender", nullptr, false, &options);
+        std::wstring payload = L"--open /home/user/documents/report-2024.txt";
+        IPCMsgData msg = { "Sender", payload.c_str() };
+        AGSender* sender = use_sender ? AG_sender_create() : nullptr;
+        auto send = [&]() {
+            if (sender != nullptr) {
+                AG_sender_send(sender, &msg);
+            } else {
+                AG_send_msg_request(&msg);
+            }
+        };
+
+        // The first send sets up what later ones reuse.
+        send();
+        long start_allocations = allocations;
+        auto started = std::chrono::steady_clock::now();
+        for (int i = 1; i < messages; ++i) {
+            send();
+        }
+        double ns_per_send = seconds_since(started) * 1e9 / (messages - 1);
+        double allocations_per_send = static_cast<double>(allocations - start_allocations) / (messages - 1);
+        printf("transport %d, %s: %.0f ns/send, %.2f allocations/send\n", options.transport,
+               use_sender ? "AG_sender_send" : "AG_send_msg_request", ns_per_send, allocations_per_send);
+        fflush(stdout);
+        AG_sender_destroy(sender);
+        AG_release();
+        _exit(0);
+    }
+
+    AG_init_ex("BenchSender", nullptr, false, &options);
+    IPCMsg msg;
+    AG_create_IPCMsg(&msg, "Sender", on_message);
+    AG_register_msg(&msg);
+    usleep(100000);
+
+    close(start[1]);
+    waitpid(child, nullptr, 0);
+    auto finished = std::chrono::steady_clock::now();
+    while (received < messages && seconds_since(finished) < 5) {
+        usleep(1000);
+    }
+    printf("  delivered %ld/%d\n", received.load(), messages);
+    AG_release();
+    return 0;
+}
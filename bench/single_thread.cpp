@@ -0,0 +1,90 @@
+// Send-to-callback latency and context switches of a paced stream, with callbacks on the library's dispatch thread
+// (dispatch_mode 0) or on the thread that received the message (dispatch_mode 2).
+// Usage: single_thread [transport=1] [dispatch_mode=2] [messages=3000] [interval_us=200]
+#include <atomic>
+#include <cstdio>
+#include <cwchar>
+#include <string>
+#include <thread>
+#include <vector>
+#include <dirent.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "../include/AppGuard.h"
+#include "bench_util.h"
+
+static std::vector<double> latencies_us;
+static std::atomic<int> received{ 0 };
+
+// Callbacks never overlap in either mode, so the samples need no lock.
+static void on_message(const IPCMsgData* msg_data) {
+    long long sent_ns = wcstoll(msg_data->msg_data, nullptr, 10);
+    latencies_us.push_back((now_ns() - sent_ns) / 1000.0);
+    received++;
+}
+
+static int thread_count() {
+    int threads = 0;
+    DIR* tasks = opendir("/proc/self/task");
+    while (dirent* task = readdir(tasks)) {
+        if (task->d_name[0] != '.') {
+            ++threads;
+        }
+    }
+    closedir(tasks);
+    return threads;
+}
+
+int main(int argc, char** argv) {
+    AGOptions options;
+    AG_init_options(&options);
+    options.transport = static_cast<AGTransport>(arg_or(argc, argv, 1, AG_TRANSPORT_SYSV_QUEUE));
+    options.dispatch_mode = static_cast<AGDispatchMode>(arg_or(argc, argv, 2, AG_DISPATCH_SINGLE_THREAD));
+    int messages = arg_or(argc, argv, 3, 3000);
+    int interval_us = arg_or(argc, argv, 4, 200);
+    latencies_us.reserve(messages);
+
+    int go[2];
+    if (pipe(go) == -1) {
+        return 2;
+    }
+    pid_t child = fork();
+    if (child == 0) {
+        char start;
+        if (read(go[0], &start, 1) != 1) {
+            _exit(2);
+        }
+        AG_init_ex("BenchSingleThread", nullptr, false, &options);
+        for (int i = 0; i < messages; ++i) {
+            std::wstring sent = std::to_wstring(now_ns());
+            IPCMsgData msg = { "Latency", sent.c_str() };
+            AG_send_msg_request(&msg);
+            std::this_thread::sleep_for(std::chrono::microseconds(interval_us));
+        }
+        AG_release();
+        _exit(0);
+    }
+
+    AG_init_ex("BenchSingleThread", nullptr, false, &options);
+    IPCMsg msg;
+    AG_create_IPCMsg(&msg, "Latency", on_message);
+    AG_register_msg(&msg);
+    usleep(100000);
+    int threads = thread_count();
+    long switches_start = context_switches();
+    if (write(go[1], "g", 1) != 1) {
+        return 2;
+    }
+    waitpid(child, nullptr, 0);
+    for (int i = 0; i < 200 && received < messages; ++i) {
+        usleep(10000);
+    }
+    double switches = static_cast<double>(context_switches() - switches_start) / std::max(received.load(), 1);
+
+    printf("transport %d, dispatch_mode %d: %d threads, %d/%d messages, p50 %.1f us, p99 %.1f us, %.2f context "
+           "switches/msg\n", options.transport, options.dispatch_mode, threads, received.load(), messages,
+           percentile(latencies_us, 0.5), percentile(latencies_us, 0.99), switches);
+    AG_unregister_msg(msg.msg_id);
+    AG_release();
+    return received == messages ? 0 : 1;
+}
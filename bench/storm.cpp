@@ -0,0 +1,142 @@
+// Launch storm: secondaries forked ahead of time each forward one distinct path to the primary at once. Every
+// callback run costs per_call_us of work, like a UI refresh, plus per_path_us for each path it gets. Reports how many
+// callbacks ran, the time until the primary had seen every path and the primary's CPU time, with gathering off or on.
+// Exits non-zero if a path is missing.
+// Usage: storm [transport=1] [secondaries=500] [gather=1] [max_delay_ms=20] [dispatch_mode=0]
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cwchar>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "../include/AppGuard.h"
+#include "bench_util.h"
+
+static const int per_call_us = 1000;
+static const int per_path_us = 20;
+
+static std::atomic<long> invocations{ 0 };
+static std::atomic<long> paths{ 0 };
+static std::mutex seen_mutex;
+static std::set<std::wstring> seen;
+static std::chrono::steady_clock::time_point last_seen;
+
+static void work(int us) {
+    auto until = std::chrono::steady_clock::now() + std::chrono::microseconds(us);
+    while (std::chrono::steady_clock::now() < until) {
+    }
+}
+
+static void see(const wchar_t* path) {
+    std::lock_guard<std::mutex> lock(seen_mutex);
+    seen.insert(path);
+    last_seen = std::chrono::steady_clock::now();
+}
+
+static void on_open(const IPCMsgData* msg_data) {
+    work(per_call_us);
+    see(msg_data->msg_data);
+    work(per_path_us);
+    paths++;
+    invocations++;
+}
+
+static void on_open_batch(const IPCMsgData* msgs, size_t count) {
+    work(per_call_us);
+    for (size_t i = 0; i < count; ++i) {
+        see(msgs[i].msg_data);
+        work(per_path_us);
+    }
+    paths += count;
+    invocations++;
+}
+
+static double cpu_seconds() {
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+int main(int argc, char** argv) {
+    AGOptions options;
+    AG_init_options(&options);
+    options.transport = static_cast<AGTransport>(arg_or(argc, argv, 1, AG_TRANSPORT_SYSV_QUEUE));
+    int secondaries = arg_or(argc, argv, 2, 500);
+    bool gather = arg_or(argc, argv, 3, 1) != 0;
+    int max_delay_ms = arg_or(argc, argv, 4, 20);
+    options.dispatch_mode = static_cast<AGDispatchMode>(arg_or(argc, argv, 5, AG_DISPATCH_THREADS));
+
+    int go[2];
+    if (pipe(go) == -1) {
+        return 2;
+    }
+    std::vector<pid_t> children;
+    for (int i = 0; i < secondaries; ++i) {
+        pid_t child = fork();
+        if (child == 0) {
+            char start;
+            if (read(go[0], &start, 1) != 1) {
+                _exit(2);
+            }
+            AG_init_ex("BenchStorm", nullptr, false, &options);
+            std::wstring path = L"/home/user/doc-" + std::to_wstring(i) + L".pdf";
+            IPCMsgData msg = { "Open", path.c_str() };
+            AG_send_msg_request(&msg);
+            AG_release();
+            _exit(0);
+        }
+        children.push_back(child);
+    }
+
+    AG_init_ex("BenchStorm", nullptr, false, &options);
+    IPCMsg msg;
+    AG_create_IPCMsg(&msg, "Open", on_open);
+    AG_register_msg(&msg);
+    if (gather) {
+        AG_set_gathering("Open", on_open_batch, max_delay_ms, 0);
+    }
+    std::atomic<bool> pumping{ true };
+    std::thread pump;
+    if (options.dispatch_mode == AG_DISPATCH_MANUAL) {
+        pump = std::thread([&]() {
+            while (pumping) {
+                AG_process_messages(0, 50);
+            }
+        });
+    }
+    usleep(100000);
+
+    double cpu_start = cpu_seconds();
+    auto started = std::chrono::steady_clock::now();
+    for (int i = 0; i < secondaries; ++i) {
+        if (write(go[1], "g", 1) != 1) {
+            return 2;
+        }
+    }
+    while (paths < secondaries && seconds_since(started) < 60) {
+        usleep(1000);
+    }
+    double cpu_ms = (cpu_seconds() - cpu_start) * 1e3;
+    for (pid_t child : children) {
+        waitpid(child, nullptr, 0);
+    }
+    pumping = false;
+    if (pump.joinable()) {
+        pump.join();
+    }
+
+    std::lock_guard<std::mutex> lock(seen_mutex);
+    double elapsed_ms = std::chrono::duration<double, std::milli>(last_seen - started).count();
+    printf("transport %d, %d secondaries, gathering %s: %zu distinct paths, %ld callbacks, %.0f ms end to end, "
+           "%.0f ms primary CPU\n", options.transport, secondaries, gather ? "on" : "off", seen.size(),
+           invocations.load(), elapsed_ms, cpu_ms);
+    AG_unregister_msg(msg.msg_id);
+    AG_release();
+    return seen.size() == static_cast<size_t>(secondaries) ? 0 : 1;
+}
@@ -0,0 +1,71 @@
+// Throughput of AG_send_msg_request from several secondaries at once, until the primary has dispatched everything.
+// Usage: throughput [transport=2] [secondaries=1] [messages_each=20000] [payload_chars=32]
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "../include/AppGuard.h"
+#include "bench_util.h"
+
+static std::atomic<long> received{ 0 };
+
+static void on_message(const IPCMsgData* msg_data) {
+    received++;
+}
+
+int main(int argc, char** argv) {
+    AGOptions options;
+    AG_init_options(&options);
+    options.transport = static_cast<AGTransport>(arg_or(argc, argv, 1, AG_TRANSPORT_UNIX_SOCKET));
+    int secondaries = arg_or(argc, argv, 2, 1);
+    int messages_each = arg_or(argc, argv, 3, 20000);
+    std::wstring payload(arg_or(argc, argv, 4, 32), L'x');
+
+    // Closing the write end starts every secondary at once.
+    int start[2];
+    if (pipe(start) == -1) {
+        return 1;
+    }
+    std::vector<pid_t> children;
+    for (int i = 0; i < secondaries; ++i) {
+        pid_t child = fork();
+        if (child == 0) {
+            close(start[1]);
+            char go;
+            read(start[0], &go, 1);
+            AG_init_ex("BenchThroughput", nullptr, false, &options);
+            IPCMsgData msg = { "Throughput", payload.c_str() };
+            for (int j = 0; j < messages_each; ++j) {
+                AG_send_msg_request(&msg);
+            }
+            AG_release();
+            _exit(0);
+        }
+        children.push_back(child);
+    }
+
+    AG_init_ex("BenchThroughput", nullptr, false, &options);
+    IPCMsg msg;
+    AG_create_IPCMsg(&msg, "Throughput", on_message);
+    AG_register_msg(&msg);
+    usleep(100000);
+
+    auto started = std::chrono::steady_clock::now();
+    close(start[1]);
+    for (pid_t child : children) {
+        waitpid(child, nullptr, 0);
+    }
+    long total = static_cast<long>(secondaries) * messages_each;
+    for (int i = 0; i < 500 && received < total; ++i) {
+        usleep(2000);
+    }
+    double elapsed = seconds_since(started);
+
+    printf("transport %d: %d x %d messages of %zu chars, %ld received, %.1fk msg/s\n", options.transport, secondaries,
+           messages_each, payload.size(), received.load(), received / elapsed / 1000);
+    AG_release();
+    return 0;
+}
@@ -0,0 +1,91 @@
+// UTF-8 conversion throughput of Utf8Codec against std::wstring_convert<std::codecvt_utf8>, on 64k characters of
+// ASCII, Latin and CJK text. Encoding includes the length pass. Figures are UTF-8 GB/s, best of 7. Exits non-zero if
+// the two disagree.
+// Usage: utf8 [characters=65536]
+#include <chrono>
+#include <codecvt>
+#include <cstdio>
+#include <locale>
+#include <string>
+#include <vector>
+#include "Utf8Codec.h"
+#include "bench_util.h"
+
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+
+static const int ROUNDS = 7;
+
+// Words of two to eight characters drawn from alphabet, each followed by separator.
+static std::wstring make_text(const std::wstring& alphabet, wchar_t separator, size_t characters) {
+    std::wstring text;
+    unsigned seed = 7;
+    while (text.size() < characters) {
+        seed = seed * 1103515245 + 12345;
+        size_t word = 2 + (seed >> 16) % 7;
+        for (size_t i = 0; i < word && text.size() < characters; ++i) {
+            seed = seed * 1103515245 + 12345;
+            text += alphabet[(seed >> 16) % alphabet.size()];
+        }
+        text += separator;
+    }
+    text.resize(characters);
+    return text;
+}
+
+// Best throughput of run over ROUNDS, in GB/s of UTF-8.
+template <typename Run>
+static double best_gbps(size_t utf8_bytes, Run run) {
+    double best = 0;
+    for (int round = 0; round < ROUNDS; ++round) {
+        auto started = std::chrono::steady_clock::now();
+        run();
+        best = std::max(best, utf8_bytes / seconds_since(started) / 1e9);
+    }
+    return best;
+}
+
+int main(int argc, char** argv) {
+    size_t characters = arg_or(argc, argv, 1, 65536);
+    struct Sample {
+        const char* name;
+        std::wstring alphabet;
+        wchar_t separator;
+    };
+    const Sample samples[] = {
+        { "ascii", L"abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789", L' ' },
+        { "latin", L"abcdefghijklmnopqrstuvwxyzàáâäçèéêëìíîïñòóôöùúûüßœæ", L' ' },
+        { "cjk", L"日本語のテキストを変換する漢字仮名交じり文中国语言文字处理한국어", L'、' },
+    };
+    std::wstring_convert<std::codecvt_utf8<wchar_t>> converter;
+    int mismatches = 0;
+    printf("kernel %s\n", utf8_kernel_name());
+    for (const Sample& sample : samples) {
+        std::wstring text = make_text(sample.alphabet, sample.separator, characters);
+        std::string reference = converter.to_bytes(text);
+        std::vector<char> encoded(utf8_encoded_length(text.data(), text.size()));
+        std::vector<wchar_t> decoded(reference.size());
+        size_t encoded_bytes = utf8_encode(text.data(), text.size(), encoded.data());
+        size_t decoded_characters = utf8_decode(reference.data(), reference.size(), decoded.data());
+        if (std::string(encoded.data(), encoded_bytes) != reference ||
+            std::wstring(decoded.data(), decoded_characters) != text) {
+            ++mismatches;
+        }
+
+        std::string old_encoded;
+        std::wstring old_decoded;
+        double encode_old = best_gbps(reference.size(), [&]() { old_encoded = converter.to_bytes(text); });
+        double encode_new = best_gbps(reference.size(), [&]() {
+            encoded.resize(utf8_encoded_length(text.data(), text.size()));
+            utf8_encode(text.data(), text.size(), encoded.data());
+        });
+        double decode_old = best_gbps(reference.size(), [&]() { old_decoded = converter.from_bytes(reference); });
+        double decode_new = best_gbps(reference.size(),
+                                      [&]() { utf8_decode(reference.data(), reference.size(), decoded.data()); });
+        printf("%-6s encode %.2f -> %.2f GB/s, decode %.2f -> %.2f GB/s\n", sample.name, encode_old, encode_new,
+               decode_old, decode_new);
+    }
+    if (mismatches != 0) {
+        printf("%d mismatches against std::wstring_convert\n", mismatches);
+    }
+    return mismatches == 0 ? 0 : 1;
+}
@@ -18,7 +18,11 @@ int main() {
     const char* app_handle = "TestApp";
     bool quit_immediate = false;
 
-    AG_init(app_handle, on_quit, quit_immediate);
+    // Callbacks run on this thread, from AG_process_messages below; the library starts no threads of its own.
+    AGOptions options;
+    AG_init_options(&options);
+    options.dispatch_mode = AG_DISPATCH_MANUAL;
+    AG_init_ex(app_handle, on_quit, quit_immediate, &options);
 
     if (AG_is_primary_instance()) {
         std::cout << "Primary instance running. Waiting for other instances...\n";
@@ -27,10 +31,9 @@ int main() {
         AG_create_IPCMsg(&ipc_msg, "InstanceStarted", handle_ipc_message);
         AG_register_msg(&ipc_msg);
 
+        // An event loop would wait on AG_get_event_fd() instead and process the messages when it polls readable.
         while (AG_is_primary_instance()) {
-            //AG_process_messages();  // Ensure messages are processed
-            std::this_thread::sleep_for(std::chrono::milliseconds(50));
-            //std::cout << "test";
+            AG_process_messages(0, 50);
         }
 
         AG_unregister_msg(ipc_msg.msg_id);
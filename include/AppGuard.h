@@ -8,7 +8,7 @@
 * This product is licensed under the MIT License. See the license file for the full license text.
 *
 * @see https://github.com/still-standing88/app-guard
-* Version: 1.01
+* Version: 2.00
 *  Author: Oussama Ben Gatrane
 * Description: Cross-platform C++ library for application instance management and inter-process communication.
 *
@@ -38,6 +38,7 @@
 extern "C" {
 #endif // __cplusplus
 #include <stdbool.h>
+#include <stddef.h>
 #include <wchar.h>
 #include "common.h"
 
@@ -56,6 +57,30 @@ extern "C" {
 	 */
 	APPGUARD_API void AG_init(const char* app_handle, AppOnQuitCallback on_quit_callback, bool quit_immediate);
 
+	/**
+	 * @brief Fills an AGOptions structure with the library defaults.
+	 * 
+	 * Call this before changing individual fields, so fields added in later versions keep their defaults.
+	 * The defaults write records every earlier version reads: wire_header is AG_WIRE_HEADER_NONE and handle_ids
+	 * is 0. Enable either only once no primary from before it can still be running.
+	 * 
+	 * @param options A pointer to the AGOptions structure to initialize.
+	 */
+	APPGUARD_API void AG_init_options(AGOptions* options);
+
+	/**
+	 * @brief Initializes the AppGuard library with explicit options.
+	 * 
+	 * Behaves like AG_init, with the IPC transport and other settings taken from options.
+	 * Every instance of the application must be initialized with the same transport.
+	 * 
+	 * @param app_handle A const char* representing the unique application identifier.
+	 * @param on_quit_callback A callback function to be called when the application quits immediately. See AG_init.
+	 * @param quit_immediate A boolean indicating whether to quit immediately when a secondary instance of the app is detected or not.
+	 * @param options A pointer to the initialization options. Passing a null pointer uses the defaults.
+	 */
+	APPGUARD_API void AG_init_ex(const char* app_handle, AppOnQuitCallback on_quit_callback, bool quit_immediate, const AGOptions* options);
+
 	/**
 	 * @brief Releases AppGuard resources and performs cleanup.
 	 * 
@@ -88,29 +113,66 @@ extern "C" {
 	 * Call this function to initialize the ipc message with a handle and a callback.
 	 * The handle is used for message lookup. Through it, the library calls the function you provided, passing an IPCMsgData as an argument.
 	 * This is used in conjunction with the AG_register_msg and  AG_send_msg_request functions.
+	 * A handle containing '*' is a pattern that receives every message whose handle it matches: '*' stands for any
+	 * run of characters without a '.', and a trailing '*' for any rest of the handle. "plugin.*" matches
+	 * "plugin.editor.save", "plugin.*.save" matches "plugin.editor.save" only, and "plugin.editor.*" subscribes to
+	 * every handle under "plugin.editor.". Pattern callbacks run after those of the exact handle, and see the
+	 * handle the message was sent with.
 	 * 
 	 * @param msg A pointer to an IPCMsg structure to be initialized.
-	 * @param msg_handle A const char* representing the message identifier.
+	 * @param msg_handle A const char* representing the message identifier, or a pattern.
 	 * @param callback A callback function to be invoked using the message handle when an IPC message request is received.
 	 */
 	APPGUARD_API void AG_create_IPCMsg(IPCMsg* msg, const char* msg_handle, IPCMsgCallback callback);
 
+	/**
+	 * @brief Initializes an IPC message whose callback receives the payload as bytes, without any transcoding.
+	 * 
+	 * Works as AG_create_IPCMsg, patterns included. The callback is called for messages sent with AG_send_bytes,
+	 * with their bytes, and for the other messages of the handle, with their data as the UTF-8 it travels as.
+	 * The id of the message comes with the IPCMsgBytes; AG_get_msg_fds and AG_reply are not available to it.
+	 * 
+	 * @param msg A pointer to an IPCMsg structure to be initialized.
+	 * @param msg_handle A const char* representing the message identifier, or a pattern.
+	 * @param callback A callback function to be invoked with the payload of each message received for the handle.
+	 */
+	APPGUARD_API void AG_create_IPCMsg_bytes(IPCMsg* msg, const char* msg_handle, IPCMsgBytesCallback callback);
+
+	/**
+	 * @brief Returns the 64-bit id a message handle travels under between instances.
+	 * 
+	 * The id is the FNV-1a hash of the handle's bytes. Registering a handle whose id is already taken by another
+	 * registered handle fails; see AG_register_msg.
+	 * 
+	 * @param msg_handle The message handle.
+	 * @return The id of msg_handle.
+	 */
+	APPGUARD_API uint64_t AG_handle_id(const char* msg_handle);
+
 	/**
 	 * @brief Registers an IPC message for receiving communications.
 	 * 
-	 * Call this function after creating the IPC message.
-	 * The function places an id on the message struct which can be used to unregister the message
+	 * Call this function after creating the IPC message. The id AG_create_IPCMsg placed on the message struct is used to unregister it.
+	 * Several messages may be registered for one handle; their callbacks are called in registration order with the same IPCMsgData.
+	 * Registering a message that is already registered has no effect.
+	 * Callbacks run without any lock held, so they may register and unregister messages themselves.
 	 * 
 	 * @param msg A pointer to an IPCMsg structure to register.
+	 * @return true if the message is registered. false if the library is not initialized, or if another registered
+	 *         handle has the same id (see AG_handle_id), in which case msg->msg_id is set to 0.
 	 */
-	APPGUARD_API void AG_register_msg(IPCMsg* msg);
+	APPGUARD_API bool AG_register_msg(IPCMsg* msg);
 
 	/**
 	 * @brief Unregisters an IPC message by its ID.
 	 * 
-	 * @param msg_id An integer representing the message ID to unregister.
+	 * If the message's callback is running or about to run when the message is unregistered, waits for it to
+	 * return, so the callback is not called after this function returns. Callbacks of other handles do not hold it
+	 * up. Called from inside a callback, it returns at once.
+	 * 
+	 * @param msg_id The ID of the message to unregister.
 	 */
-	APPGUARD_API void AG_unregister_msg(int msg_id);
+	APPGUARD_API void AG_unregister_msg(uint64_t msg_id);
 
 	/**
 	 * @brief Sends an IPC message request to another process instance.
@@ -123,6 +185,258 @@ extern "C" {
 	 */
 	APPGUARD_API void AG_send_msg_request(IPCMsgData* msg_request);
 
+	/**
+	 * @brief Sends a binary message to the primary instance.
+	 * 
+	 * The bytes are sent as they are, embedded null bytes included, and are neither converted from wchar_t nor
+	 * decoded on arrival. They reach the messages created with AG_create_IPCMsg_bytes for the handle and its
+	 * patterns; messages created with AG_create_IPCMsg are not called, and gathering does not apply.
+	 * Size limits are those of IPCMsgData::msg_data.
+	 * 
+	 * @param msg_handle The message handle.
+	 * @param data The bytes to send. May be a null pointer when length is 0.
+	 * @param length The number of bytes in data.
+	 * @return A bool indicating whether the message was handed to the transport. Always false on the primary
+	 * instance and on the Windows transport.
+	 */
+	APPGUARD_API bool AG_send_bytes(const char* msg_handle, const void* data, size_t length);
+
+	/**
+	 * @brief Sends several IPC message requests to the primary instance at once.
+	 * 
+	 * The messages are packed into as few transport messages as possible and are dispatched in order,
+	 * which makes forwarding a burst of small messages much cheaper than calling AG_send_msg_request for each one.
+	 * 
+	 * @param msg_requests An array of IPCMsgData structures containing the messages to send.
+	 * @param count The number of messages in msg_requests.
+	 * @return The number of messages sent. Sending stops at the first message the transport fails to deliver.
+	 * Messages discarded under a drop overflow policy count as sent.
+	 */
+	APPGUARD_API size_t AG_send_msg_batch(IPCMsgData* msg_requests, size_t count);
+
+	/**
+	 * @brief Queues an IPC message request for the primary instance and returns without waiting for the transport.
+	 * 
+	 * The message is copied and sent from a background thread, in the order messages were queued. While the transport
+	 * is full the send is retried until timeout_ms has passed. The outcome is reported once through the callback, on the background thread.
+	 * AG_release waits until every queued message has been sent or has timed out.
+	 * 
+	 * @param msg_request A pointer to an IPCMsgData structure containing the message to send.
+	 * @param timeout_ms The longest time to keep retrying while the transport is full, in milliseconds.
+	 * @param callback Called with the outcome of the send. May be a null pointer.
+	 * @param user_data Passed to the callback unchanged.
+	 * @return A non-zero id identifying the send in the callback, or 0 if the message could not be queued.
+	 */
+	APPGUARD_API uint64_t AG_send_msg_async(IPCMsgData* msg_request, int timeout_ms, AGSendCallback callback, void* user_data);
+
+	/**
+	 * @brief Reports the dispatch queue length and the overflow counters of this instance.
+	 * 
+	 * The counters cover messages this instance discarded, refused or gave up on, both when sending and, on the primary
+	 * instance, when queueing received messages. See AGOptions for the queue and transport capacities and the overflow policy.
+	 * 
+	 * @param stats A pointer to the AGQueueStats structure to fill.
+	 * @return A bool indicating whether stats was filled. False when the library is not initialized.
+	 */
+	APPGUARD_API bool AG_get_queue_stats(AGQueueStats* stats);
+
+	/**
+	 * @brief Sets how the primary instance coalesces the messages of a handle before running their callbacks.
+	 * 
+	 * Under a launch storm, secondaries often send the same message many times over. AG_COALESCE_DUPLICATES runs the
+	 * callbacks once for identical data received within window_ms of each other, and AG_COALESCE_LATEST only for
+	 * the newest of the messages waiting in the queue. Merged messages are counted in AGQueueStats.coalesced. The
+	 * rule applies to messages sent with exactly this handle, whoever subscribed to them; calls and messages with
+	 * file descriptors always run. A new rule replaces the handle's previous one, and AG_COALESCE_NONE removes it.
+	 * 
+	 * @param msg_handle The message handle, without wildcards.
+	 * @param policy How its messages are coalesced.
+	 * @param window_ms For AG_COALESCE_DUPLICATES, how far apart identical messages are merged, in milliseconds.
+	 * @return A bool indicating whether the rule was set. False when the library is not initialized or the handle
+	 * is a pattern.
+	 */
+	APPGUARD_API bool AG_set_coalescing(const char* msg_handle, enum AGCoalescePolicy policy, int window_ms);
+
+	/**
+	 * @brief Gathers the messages of a handle that arrive close together into one call of a batch callback.
+	 * 
+	 * Meant for launch storms, where many secondaries forward their arguments at once. A message arriving while the
+	 * handle is idle is passed on at once, in a batch of one. Under load the window adapts to the gap between
+	 * arrivals and a batch is passed on once the messages stop coming, after max_delay_ms at the latest, or when it
+	 * holds max_count messages. Gathered messages go to the batch callback instead of the callbacks registered for
+	 * the handle or matching patterns. Calls and messages with file descriptors are never gathered. Under
+	 * AG_DISPATCH_MANUAL batches fall due while AG_process_messages() is not running, making the event descriptor
+	 * readable; under AG_DISPATCH_SINGLE_THREAD every message is passed on at once.
+	 * 
+	 * @param msg_handle The message handle, without wildcards.
+	 * @param callback Called with each batch, or NULL to stop gathering.
+	 * @param max_delay_ms How long a batch may stay open, in milliseconds.
+	 * @param max_count How many messages a batch holds at most, or 0 for no limit.
+	 * @return A bool indicating whether the callback was set. False when the library is not initialized or the
+	 * handle is a pattern.
+	 */
+	APPGUARD_API bool AG_set_gathering(const char* msg_handle, IPCMsgBatchCallback callback, int max_delay_ms, size_t max_count);
+
+	/**
+	 * @brief Returns a descriptor to wait on in the application's event loop under AG_DISPATCH_MANUAL.
+	 * 
+	 * The descriptor polls readable while AG_process_messages has messages to receive or callbacks to run. Add it to
+	 * epoll, poll, a GLib main loop or a QSocketNotifier and call AG_process_messages when it fires. It belongs to the
+	 * library: do not read from or close it. With the default transport, whose System V queue cannot be polled, it
+	 * also fires every few milliseconds while the queue is read for new messages.
+	 * 
+	 * @return The descriptor, or -1 when dispatch is not manual, this is not the primary instance or the platform is not Linux.
+	 */
+	APPGUARD_API int AG_get_event_fd();
+
+	/**
+	 * @brief Receives messages and runs their callbacks on the calling thread under AG_DISPATCH_MANUAL.
+	 * 
+	 * Runs the callbacks of up to max_messages messages, all waiting ones for 0, and returns as soon as any ran.
+	 * When none is waiting it waits up to timeout_ms for one, without waiting for 0 and forever for a negative
+	 * timeout. Only one thread processes messages at a time; called from inside a callback it returns 0 at once.
+	 * In the other dispatch modes the library's threads run the callbacks, and this only waits out a positive timeout.
+	 * 
+	 * @param max_messages Most messages to run the callbacks of, or 0 for no limit.
+	 * @param timeout_ms How long to wait for a message, in milliseconds.
+	 * @return How many messages had their callbacks run.
+	 */
+	APPGUARD_API size_t AG_process_messages(size_t max_messages, int timeout_ms);
+
+	/**
+	 * @brief Sends an IPC message request with file descriptors attached.
+	 * 
+	 * The descriptors are duplicated into the primary instance, so large payloads can be handed over as a memfd
+	 * or shared file without copying them through the message. The caller keeps its own descriptors and may close them once this returns.
+	 * Supported on Linux with the AG_TRANSPORT_SYSV_QUEUE and AG_TRANSPORT_UNIX_SOCKET transports.
+	 * 
+	 * @param msg_request A pointer to an IPCMsgData structure containing the message to send.
+	 * @param fds An array of file descriptors to pass along with the message.
+	 * @param fd_count The number of descriptors in fds, at most 64.
+	 * @return A bool indicating whether the message was delivered to the primary instance.
+	 */
+	APPGUARD_API bool AG_send_msg_with_fds(IPCMsgData* msg_request, const int* fds, size_t fd_count);
+
+	/**
+	 * @brief Retrieves the ID of the registered message whose callback is running.
+	 * 
+	 * Lets one callback function serve several registered messages. Only valid inside an IPC message callback,
+	 * for the IPCMsgData passed to it.
+	 * 
+	 * @param msg_data The IPCMsgData received by the callback.
+	 * @return The msg_id of the message being called, or 0 outside a callback.
+	 */
+	APPGUARD_API uint64_t AG_get_msg_id(const IPCMsgData* msg_data);
+
+	/**
+	 * @brief Retrieves the file descriptors that arrived with a message.
+	 * 
+	 * Only valid inside an IPC message callback, for the IPCMsgData passed to it.
+	 * The descriptors are closed once the callback returns; dup() any descriptor that must outlive the callback.
+	 * 
+	 * @param msg_data The IPCMsgData received by the callback.
+	 * @param fds Receives a pointer to the descriptor array. May be null to query the count only.
+	 * @return The number of descriptors attached to the message.
+	 */
+	APPGUARD_API size_t AG_get_msg_fds(const IPCMsgData* msg_data, const int** fds);
+
+	/**
+	 * @brief Sends an IPC message request to the primary instance and waits for its reply.
+	 * 
+	 * The callback registered for the handle answers with AG_reply. Calls are matched to their replies by a
+	 * correlation id, so any number of threads may have calls in flight at once. Supported on Linux.
+	 * 
+	 * @param msg_request A pointer to an IPCMsgData structure containing the request.
+	 * @param timeout_ms The longest time to wait for the reply, in milliseconds. A negative value waits indefinitely.
+	 * @param reply Receives the reply. On success it must be released with AG_free_msg_data.
+	 * @return A bool indicating whether a reply arrived. False on timeout, or when no callback answered the request.
+	 */
+	APPGUARD_API bool AG_call(IPCMsgData* msg_request, int timeout_ms, IPCMsgData* reply);
+
+	/**
+	 * @brief Answers a request sent with AG_call.
+	 * 
+	 * Only valid inside an IPC message callback, for the IPCMsgData passed to it. Only the first reply is sent;
+	 * a request the callback does not answer fails on the calling side straight away.
+	 * 
+	 * @param msg_data The IPCMsgData received by the callback.
+	 * @param reply_data The reply content. May be a null pointer for an empty reply.
+	 * @return A bool indicating whether the reply was sent. False if the message was not sent with AG_call.
+	 */
+	APPGUARD_API bool AG_reply(const IPCMsgData* msg_data, const wchar_t* reply_data);
+
+	/**
+	 * @brief Releases message data allocated by the library, such as a reply returned by AG_call.
+	 * 
+	 * @param msg_data A pointer to the IPCMsgData whose contents to release. Its fields are reset to null.
+	 */
+	APPGUARD_API void AG_free_msg_data(IPCMsgData* msg_data);
+
+	/**
+	 * @brief Creates a persistent sender for forwarding many messages to the primary instance.
+	 * 
+	 * A sender resolves the primary instance once and keeps its send buffers between calls, so repeated sends
+	 * skip the per-call setup of AG_send_msg_request. It reconnects on its own when the primary instance goes away and a new one takes over.
+	 * Sends through one sender are serialized; use one sender per thread for parallel sends.
+	 * AG_release closes the senders still alive: sends through them fail from then on, and each must still be
+	 * released with AG_sender_destroy.
+	 * 
+	 * @return A pointer to the new sender, or a null pointer on the primary instance or when the library is not initialized.
+	 */
+	APPGUARD_API AGSender* AG_sender_create();
+
+	/**
+	 * @brief Sends an IPC message request through a persistent sender.
+	 * 
+	 * @param sender A sender created with AG_sender_create.
+	 * @param msg_request A pointer to an IPCMsgData structure containing the message to send.
+	 * @return A bool indicating whether the message was handed to the transport, or discarded under a drop overflow policy.
+	 */
+	APPGUARD_API bool AG_sender_send(AGSender* sender, IPCMsgData* msg_request);
+
+	/**
+	 * @brief Sends an IPC message through a persistent sender, addressed by the id of its handle.
+	 * 
+	 * The message travels under a 64-bit id of its handle. Passing an id computed once, with AG_handle_id or
+	 * AG_constexpr_handle_id in C++, saves hashing the handle string on every send. The handle itself is not sent,
+	 * so the message reaches the messages registered for its exact handle and no pattern. Primaries from before
+	 * handle ids drop it, whatever AGOptions.handle_ids is set to.
+	 * 
+	 * @param sender A sender created with AG_sender_create.
+	 * @param handle_id The id of the message handle.
+	 * @param msg_data The message data, or a null pointer for none.
+	 * @return A bool indicating whether the message was handed to the transport. Always false on the Windows transport.
+	 */
+	APPGUARD_API bool AG_sender_send_id(AGSender* sender, uint64_t handle_id, const wchar_t* msg_data);
+
+	/**
+	 * @brief Sends a binary message through a persistent sender. See AG_send_bytes.
+	 * 
+	 * @param sender A sender created with AG_sender_create.
+	 * @param msg_handle The message handle.
+	 * @param data The bytes to send. May be a null pointer when length is 0.
+	 * @param length The number of bytes in data.
+	 * @return A bool indicating whether the message was handed to the transport. Always false on the Windows transport.
+	 */
+	APPGUARD_API bool AG_sender_send_bytes(AGSender* sender, const char* msg_handle, const void* data, size_t length);
+
+	/**
+	 * @brief Sends several IPC message requests through a persistent sender. See AG_send_msg_batch.
+	 * 
+	 * @param sender A sender created with AG_sender_create.
+	 * @param msg_requests An array of IPCMsgData structures containing the messages to send.
+	 * @param count The number of messages in msg_requests.
+	 * @return The number of messages sent.
+	 */
+	APPGUARD_API size_t AG_sender_send_batch(AGSender* sender, IPCMsgData* msg_requests, size_t count);
+
+	/**
+	 * @brief Releases a sender created with AG_sender_create.
+	 * 
+	 * @param sender The sender to release. Passing a null pointer is allowed.
+	 */
+	APPGUARD_API void AG_sender_destroy(AGSender* sender);
+
 	/**
 	 * @brief Retrieves the current process ID.
 	 * 
@@ -140,4 +454,18 @@ extern "C" {
 #ifdef __cplusplus
 } // extern "C"
 #endif // cplusplus
+
+#ifdef __cplusplus
+/**
+ * @brief AG_handle_id usable in constant expressions, for handles known at compile time.
+ * 
+ * @code
+ * constexpr uint64_t FOCUS_ID = AG_constexpr_handle_id("Focus");
+ * @endcode
+ */
+constexpr uint64_t AG_constexpr_handle_id(const char* msg_handle, uint64_t hash = 14695981039346656037ULL) {
+	return *msg_handle == '\0' ? hash :
+		AG_constexpr_handle_id(msg_handle + 1, (hash ^ static_cast<unsigned char>(*msg_handle)) * 1099511628211ULL);
+}
+#endif // __cplusplus
 #endif // APP_GUARD_H
\ No newline at end of file
@@ -8,7 +8,7 @@
 * This product is licensed under the MIT License. See the license file for the full license text.
 *
 * @see https://github.com/still-standing88/app-guard/
-* Version: 1.01
+* Version: 2.00
 *  Author: Oussama Ben Gatrane
 * Description: Shared data structures and callback definitions for inter-process communication and application management.
 *
@@ -19,8 +19,20 @@
 #define APP_GUARD_COMMON_H
 #pragma once
 
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Version of these headers, as major * 100 + minor. A new major version breaks binary compatibility, and
+ * applications built against an earlier one must be rebuilt.
+ * 
+ * 2.00 widened IPCMsg.msg_id to 64 bits and added IPCMsg.bytes_callback.
+ */
+#define APP_GUARD_VERSION 200
+
 // Forward declaration
 struct IPCMsgData;
+struct IPCMsgBytes;
 
 /**
  * @brief Callback function type for handling IPC messages.
@@ -29,12 +41,62 @@ struct IPCMsgData;
  */
 typedef void(*IPCMsgCallback)(const IPCMsgData* msg_data);
 
+/**
+ * @brief Callback function type for handling IPC messages as bytes. See AG_create_IPCMsg_bytes.
+ * 
+ * @param msg The received message. It and the data it points to are valid until the callback returns.
+ */
+typedef void(*IPCMsgBytesCallback)(const IPCMsgBytes* msg);
+
+/**
+ * @brief Callback function type for messages gathered into a batch. See AG_set_gathering.
+ * 
+ * @param msgs The messages, in the order received. They are valid until the callback returns.
+ * @param count How many messages msgs holds, at least 1.
+ */
+typedef void(*IPCMsgBatchCallback)(const IPCMsgData* msgs, size_t count);
+
 /**
  * @brief Callback function type for application quit notifications.
  * 
  */
 typedef void(*AppOnQuitCallback)();
 
+/**
+ * @brief Outcome of a message sent with AG_send_msg_async.
+ * 
+ */
+enum AGSendStatus {
+	/**
+	 * @brief The message was handed to the transport of the primary instance.
+	 * 
+	 */
+	AG_SEND_DELIVERED = 0,
+
+	/**
+	 * @brief The message could not be sent: no primary instance, a message too large for the transport, or the library was released.
+	 * 
+	 */
+	AG_SEND_DROPPED = 1,
+
+	/**
+	 * @brief The transport stayed full until the send timeout passed.
+	 * 
+	 */
+	AG_SEND_TIMED_OUT = 2
+};
+
+/**
+ * @brief Callback function type reporting the outcome of an asynchronous send.
+ * 
+ * Called on the library's background sender thread.
+ * 
+ * @param send_id The id returned by AG_send_msg_async.
+ * @param status The outcome of the send.
+ * @param user_data The pointer passed to AG_send_msg_async.
+ */
+typedef void(*AGSendCallback)(uint64_t send_id, enum AGSendStatus status, void* user_data);
+
 /**
  * @brief Structure representing IPC message data.
  * 
@@ -50,22 +112,355 @@ struct IPCMsgData {
 	/**
 	 * @brief The actual message content.
 	 * 
-	 * Message data. String content. 8 KB max.
+	 * Message data. String content, sent as UTF-8. Size limits depend on the transport:
+	 * 64 MB on System V queues (larger messages travel as fragments), 128 KB on the socket transport,
+	 * 256 KB on the shared-memory transport and 10 MB on Windows.
 	 */
 	const wchar_t* msg_data;
 };
 
+/**
+ * @brief A received message as handed to a bytes callback.
+ * 
+ */
+struct IPCMsgBytes {
+	/**
+	 * @brief The handle of the registered message, or the handle as sent for a pattern.
+	 * 
+	 */
+	const char* msg_handle;
+
+	/**
+	 * @brief The payload as it came off the wire: the bytes of a message sent with AG_send_bytes, or the UTF-8 text
+	 * of any other message. Not null-terminated.
+	 * 
+	 */
+	const void* data;
+
+	/**
+	 * @brief The number of bytes data holds.
+	 * 
+	 */
+	size_t length;
+
+	/**
+	 * @brief The id of the registered message whose callback is called.
+	 * 
+	 */
+	uint64_t msg_id;
+};
+
+/**
+ * @brief IPC transport used to forward messages between instances.
+ * 
+ * All instances of an application must use the same transport.
+ */
+enum AGTransport {
+	/**
+	 * @brief Platform default. Named pipe on Windows, System V message queue on Unix.
+	 * 
+	 */
+	AG_TRANSPORT_DEFAULT = 0,
+
+	/**
+	 * @brief System V message queue. Unix only.
+	 * 
+	 */
+	AG_TRANSPORT_SYSV_QUEUE = 1,
+
+	/**
+	 * @brief Abstract namespace SOCK_SEQPACKET socket served with epoll. Linux only, other platforms use the default.
+	 * 
+	 */
+	AG_TRANSPORT_UNIX_SOCKET = 2,
+
+	/**
+	 * @brief Shared-memory ring with futex wakeups. Linux only, other platforms use the default.
+	 * 
+	 */
+	AG_TRANSPORT_SHARED_MEMORY = 3
+};
+
+/**
+ * @brief What happens to a message that finds no room, in the transport when sending or in the dispatch queue of the primary instance.
+ * 
+ */
+enum AGOverflowPolicy {
+	/**
+	 * @brief Senders wait up to send_timeout_ms for room. The primary instance stops reading from the transport until its queue drains.
+	 * 
+	 */
+	AG_OVERFLOW_BLOCK = 0,
+
+	/**
+	 * @brief The oldest queued messages are discarded to make room. Senders can only do this on the System V queue;
+	 * on the other transports they discard the new message instead.
+	 * 
+	 */
+	AG_OVERFLOW_DROP_OLDEST = 1,
+
+	/**
+	 * @brief The new message is discarded and counted. The send still reports success.
+	 * 
+	 */
+	AG_OVERFLOW_DROP_NEWEST = 2,
+
+	/**
+	 * @brief The new message is refused at once and the send reports failure.
+	 * 
+	 */
+	AG_OVERFLOW_FAIL_FAST = 3
+};
+
+/**
+ * @brief Where the callbacks of the primary instance run.
+ * 
+ */
+enum AGDispatchMode {
+	/**
+	 * @brief The library receives messages and runs callbacks on threads of its own.
+	 * 
+	 */
+	AG_DISPATCH_THREADS = 0,
+
+	/**
+	 * @brief The library starts no threads. The application waits on AG_get_event_fd in its own event loop and runs
+	 * the callbacks on its own thread with AG_process_messages. Linux only, other platforms use AG_DISPATCH_THREADS.
+	 * 
+	 */
+	AG_DISPATCH_MANUAL = 1,
+
+	/**
+	 * @brief One library thread receives messages and runs each callback as soon as it is read, without handing it
+	 * to a second thread. Its name, CPU and priority are set through AGOptions. Linux only, other platforms use
+	 * AG_DISPATCH_THREADS.
+	 * 
+	 */
+	AG_DISPATCH_SINGLE_THREAD = 2
+};
+
+/**
+ * @brief How the primary instance coalesces the messages of one handle before running their callbacks.
+ * 
+ */
+enum AGCoalescePolicy {
+	/**
+	 * @brief Every message runs the callbacks.
+	 * 
+	 */
+	AG_COALESCE_NONE = 0,
+
+	/**
+	 * @brief A message whose data equals that of a message received for the handle within the window before it,
+	 * and which ran, is merged into that one.
+	 * 
+	 */
+	AG_COALESCE_DUPLICATES = 1,
+
+	/**
+	 * @brief Last value wins: a message is merged into a newer one for the handle that is already waiting for
+	 * dispatch. The window is not used.
+	 * 
+	 */
+	AG_COALESCE_LATEST = 2
+};
+
+/**
+ * @brief Header put in front of each record an instance sends, which lets the primary instance drop traffic that is
+ * not from AppGuard, such as messages from another program on a colliding System V key, before reading it.
+ * 
+ */
+enum AGWireHeader {
+	/**
+	 * @brief No header. Records are written as by versions without it, which every version reads.
+	 * 
+	 */
+	AG_WIRE_HEADER_NONE = 0,
+
+	/**
+	 * @brief A 24-byte header with a magic number, the format version, a sequence number and a send timestamp.
+	 * Versions without the header drop these records, so enable it once every instance of the application reads it.
+	 * 
+	 */
+	AG_WIRE_HEADER = 1,
+
+	/**
+	 * @brief The header with a CRC32C of the record, which the primary instance checks before reading it.
+	 * 
+	 */
+	AG_WIRE_HEADER_CRC32C = 2
+};
+
+/**
+ * @brief Structure holding library initialization options.
+ * 
+ * Fill it with AG_init_options before changing individual fields.
+ */
+struct AGOptions {
+	/**
+	 * @brief IPC transport to use.
+	 * 
+	 */
+	enum AGTransport transport;
+
+	/**
+	 * @brief Most received messages waiting for their callbacks in the primary instance. 0 means unbounded. Defaults to 65536.
+	 * 
+	 */
+	size_t queue_capacity;
+
+	/**
+	 * @brief Capacity of the transport in bytes, 0 for the transport default. Sets msg_qbytes of the System V queue
+	 * (raising it above the system limit needs CAP_SYS_RESOURCE), the size of the shared-memory ring (rounded up to a
+	 * power of two, at least 1 MiB) and the send buffer of each socket connection.
+	 * 
+	 */
+	size_t transport_capacity;
+
+	/**
+	 * @brief Overflow policy for sends from this instance and for the dispatch queue of the primary instance. Defaults to AG_OVERFLOW_BLOCK.
+	 * 
+	 */
+	enum AGOverflowPolicy overflow_policy;
+
+	/**
+	 * @brief How long a send waits for room under AG_OVERFLOW_BLOCK, in milliseconds. A negative value waits indefinitely. Defaults to 1000.
+	 * 
+	 */
+	int send_timeout_ms;
+
+	/**
+	 * @brief Threads that run callbacks in the primary instance. With more than one, callbacks for different message
+	 * handles run concurrently, while those for one handle still run one at a time and in the order received. Defaults to 1.
+	 * 
+	 */
+	size_t dispatch_threads;
+
+	/**
+	 * @brief Where callbacks run in the primary instance. dispatch_threads is ignored unless this is
+	 * AG_DISPATCH_THREADS. Defaults to AG_DISPATCH_THREADS.
+	 * 
+	 */
+	enum AGDispatchMode dispatch_mode;
+
+	/**
+	 * @brief Name of the thread under AG_DISPATCH_SINGLE_THREAD, as shown by top and perf. Linux keeps the first 15
+	 * characters. NULL keeps the default name, "appguard-ipc".
+	 * 
+	 */
+	const char* dispatch_thread_name;
+
+	/**
+	 * @brief CPU the thread under AG_DISPATCH_SINGLE_THREAD is pinned to, or -1 to let it run on any. Defaults to -1.
+	 * 
+	 */
+	int dispatch_cpu;
+
+	/**
+	 * @brief Nice value of the thread under AG_DISPATCH_SINGLE_THREAD, from -20 (highest priority) to 19. Values
+	 * below the current one need CAP_SYS_NICE and are otherwise ignored. 0 leaves it unchanged. Defaults to 0.
+	 * 
+	 */
+	int dispatch_priority;
+
+	/**
+	 * @brief Header on the records this instance sends. Records with a header are read by this version and later
+	 * whatever their own setting. Defaults to AG_WIRE_HEADER_NONE.
+	 * 
+	 */
+	enum AGWireHeader wire_header;
+
+	/**
+	 * @brief Non-zero makes the primary instance drop records that arrive without a header, counted in
+	 * invalid_records. Set it once every sender has wire_header enabled. Defaults to 0.
+	 * 
+	 */
+	int require_wire_header;
+
+	/**
+	 * @brief Non-zero sends named messages under the 64-bit id of their handle, which the primary looks up without
+	 * hashing the handle. Primaries from before handle ids drop such messages, so enable it once every instance
+	 * reads them. Defaults to 0, the named form every version reads.
+	 * 
+	 */
+	int handle_ids;
+};
+
+/**
+ * @brief Queue state and overflow counters of this instance, filled by AG_get_queue_stats.
+ * 
+ */
+struct AGQueueStats {
+	/**
+	 * @brief Received messages waiting for their callbacks. Always 0 on a secondary instance.
+	 * 
+	 */
+	size_t queue_length;
+
+	/**
+	 * @brief The configured queue_capacity.
+	 * 
+	 */
+	size_t queue_capacity;
+
+	/**
+	 * @brief Queued messages discarded to make room under AG_OVERFLOW_DROP_OLDEST.
+	 * 
+	 */
+	uint64_t dropped_oldest;
+
+	/**
+	 * @brief New messages discarded under AG_OVERFLOW_DROP_NEWEST, and under AG_OVERFLOW_DROP_OLDEST when nothing older could be discarded.
+	 * 
+	 */
+	uint64_t dropped_newest;
+
+	/**
+	 * @brief Messages refused under AG_OVERFLOW_FAIL_FAST.
+	 * 
+	 */
+	uint64_t rejected;
+
+	/**
+	 * @brief Sends that gave up after send_timeout_ms under AG_OVERFLOW_BLOCK.
+	 * 
+	 */
+	uint64_t timed_out;
+
+	/**
+	 * @brief Received messages whose callbacks did not run because a coalescing rule merged them into another
+	 * message. See AG_set_coalescing.
+	 * 
+	 */
+	uint64_t coalesced;
+
+	/**
+	 * @brief Received records dropped for a header with a wrong magic number, an unknown version or a checksum
+	 * mismatch, or for having no header under require_wire_header.
+	 * 
+	 */
+	uint64_t invalid_records;
+};
+
+/**
+ * @brief Opaque handle to a persistent message sender.
+ * 
+ * Created with AG_sender_create and released with AG_sender_destroy.
+ */
+typedef struct AGSender AGSender;
+
 /**
  * @brief Structure representing a registered IPC message handler.
  * 
+ * Its layout changed in version 2.00. See APP_GUARD_VERSION.
  */
 struct IPCMsg {
 	/**
 	 * @brief Unique message identifier.
 	 * 
-	 * Handle used for invoking message callbacks.
+	 * Assigned by AG_create_IPCMsg from a counter, so ids are never reused within a process. Used to unregister the message.
 	 */
-	int msg_id;
+	uint64_t msg_id;
 	
 	/**
 	 * @brief Message handle string.
@@ -74,10 +469,18 @@ struct IPCMsg {
 	const char* msg_handle;
 	
 	/**
-	 * @brief Callback function for handling messages.
+	 * @brief Callback function for handling messages. Null for a message created with AG_create_IPCMsg_bytes.
 	 * 
+	 * Not called for messages sent with AG_send_bytes.
 	 */
 	IPCMsgCallback callback;
+
+	/**
+	 * @brief Callback function for handling messages as bytes, set by AG_create_IPCMsg_bytes. Used only when
+	 * callback is null.
+	 * 
+	 */
+	IPCMsgBytesCallback bytes_callback;
 };
 
 #endif // APP_GUARD_COMMON_H
\ No newline at end of file
@@ -114,7 +114,7 @@ ext_modules = [
 
 setup(
     name="AppGuard",
-    version="1.0.2",
+    version="2.0.0",
     author="still-standing88",
     url="https://github.com/still-standing88/app-guard",
     description="Python wrapper for the AppGuard library (pybind11)",
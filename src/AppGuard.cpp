@@ -3,25 +3,83 @@
 #include "AppInstance.h"
 #include "IPCWatcher.h"
 #include "PlatformIPCWatcher.h"
+#include "SocketIPCWatcher.h"
+#include "ShmIPCWatcher.h"
+#include "IPCAsyncSender.h"
 #include "utils.h"
 #include "../include/AppGuard.h"
 
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <unordered_set>
+
 IPCWatcher* ipc_watcher = nullptr;
+// Created by the first AG_send_msg_async call.
+std::unique_ptr<IPCAsyncSender> async_sender;
+std::mutex async_sender_mutex;
+// Ids handed out by AG_create_IPCMsg.
+static std::atomic<uint64_t> next_msg_id{ 1 };
 AppInstance* app_instance = nullptr;
 extern bool is_initialized = false;
 
+struct AGSender {
+	std::unique_ptr<IPCSender> ipc_sender;
+};
+// Senders not yet destroyed. AG_release closes them, since they refer to the watcher it deletes.
+static std::unordered_set<AGSender*> live_senders;
+static std::mutex live_senders_mutex;
+
+
+static IPCWatcher* create_ipc_watcher(const char* app_handle, const AGOptions& options) {
+#ifdef _WIN32
+	return new WindowsIPCWatcher(app_handle);
+#else
+#if defined(__linux__)
+	if (options.transport == AG_TRANSPORT_UNIX_SOCKET) {
+		return new SocketIPCWatcher(app_handle);
+	}
+	if (options.transport == AG_TRANSPORT_SHARED_MEMORY) {
+		return new ShmIPCWatcher(app_handle);
+	}
+#endif // __linux__
+	return new UnixIPCWatcher(app_handle);
+#endif // _WIN32
+}
+
+extern "C" APPGUARD_API void AG_init_options(AGOptions* options) {
+	if (options == nullptr) { return; }
+	options->transport = AG_TRANSPORT_DEFAULT;
+	options->queue_capacity = 65536;
+	options->transport_capacity = 0;
+	options->overflow_policy = AG_OVERFLOW_BLOCK;
+	options->send_timeout_ms = 1000;
+	options->dispatch_threads = 1;
+	options->dispatch_mode = AG_DISPATCH_THREADS;
+	options->dispatch_thread_name = nullptr;
+	options->dispatch_cpu = -1;
+	options->dispatch_priority = 0;
+	options->wire_header = AG_WIRE_HEADER_NONE;
+	options->require_wire_header = 0;
+	options->handle_ids = 0;
+}
 
 extern "C" APPGUARD_API void AG_init(const char* app_handle, AppOnQuitCallback on_quit_callback, bool quit_immediate) {
+	AG_init_ex(app_handle, on_quit_callback, quit_immediate, nullptr);
+}
+
+extern "C" APPGUARD_API void AG_init_ex(const char* app_handle, AppOnQuitCallback on_quit_callback, bool quit_immediate, const AGOptions* options) {
+	AGOptions init_options;
+	AG_init_options(&init_options);
+	if (options != nullptr) {
+		init_options = *options;
+	}
+
 	if (!is_initialized || ipc_watcher == nullptr || app_instance == nullptr) {
 		if (ipc_watcher == nullptr) {
-#ifdef _WIN32
-			ipc_watcher = new WindowsIPCWatcher(app_handle);
-#elif defined(__linux__) || defined(__unix__)
-			ipc_watcher = new UnixIPCWatcher(app_handle);
-#elif defined(__APPLE__) || defined(__DARWIN__)
-			ipc_watcher = new UnixIPCWatcher(app_handle);
-#endif // _WIN32
-				ipc_watcher->start();
+			ipc_watcher = create_ipc_watcher(app_handle, init_options);
+			ipc_watcher->Configure(init_options);
+			ipc_watcher->start();
 		}
 
 		if (app_instance == nullptr) {
@@ -56,6 +114,18 @@ extern "C" APPGUARD_API void AG_release() {
 		delete app_instance;
 		app_instance = nullptr;
 	}
+	{
+		// Flushes the queued sends while the watcher they go through still exists.
+		std::lock_guard<std::mutex> lock(async_sender_mutex);
+		async_sender.reset();
+	}
+	{
+		std::lock_guard<std::mutex> lock(live_senders_mutex);
+		for (AGSender* sender : live_senders) {
+			sender->ipc_sender.reset();
+		}
+		live_senders.clear();
+	}
 	if (ipc_watcher != nullptr) {
 		ipc_watcher->stop();
 		delete ipc_watcher;
@@ -75,22 +145,42 @@ extern "C" APPGUARD_API bool AG_is_primary_instance() {
 	return false;
 }
 
+// FNV-1a test vector; ipc_handle_id computes the same hash at run time.
+static_assert(AG_constexpr_handle_id("a") == 0xaf63dc4c8601ec8cULL, "AG_constexpr_handle_id must be 64-bit FNV-1a");
+
+extern "C" APPGUARD_API uint64_t AG_handle_id(const char* msg_handle) {
+	return ipc_handle_id(msg_handle);
+}
+
 extern "C" APPGUARD_API void AG_create_IPCMsg(IPCMsg* msg, const char* msg_handle, IPCMsgCallback callback) {
 	if (msg == nullptr ) { return; }
 	if (msg_handle == nullptr) { return; }
 	if (callback == nullptr ) { return; }
-	msg->msg_id = random_number(1000, 9999);
+	msg->msg_id = next_msg_id++;
 	msg->msg_handle = msg_handle;
 	msg->callback = callback;
+	msg->bytes_callback = nullptr;
+}
+
+extern "C" APPGUARD_API void AG_create_IPCMsg_bytes(IPCMsg* msg, const char* msg_handle, IPCMsgBytesCallback callback) {
+	if (msg == nullptr || msg_handle == nullptr || callback == nullptr) { return; }
+	msg->msg_id = next_msg_id++;
+	msg->msg_handle = msg_handle;
+	msg->callback = nullptr;
+	msg->bytes_callback = callback;
 }
 
-extern "C" APPGUARD_API void AG_register_msg(IPCMsg* msg) {
-	if (ipc_watcher != nullptr && msg != nullptr ) {
-		ipc_watcher->RegisterIPCMsg(*msg);
+extern "C" APPGUARD_API bool AG_register_msg(IPCMsg* msg) {
+	if (ipc_watcher == nullptr || msg == nullptr || msg->msg_handle == nullptr) { return false; }
+	if (!ipc_watcher->RegisterIPCMsg(*msg)) {
+		// So that the id is not mistaken for a registration.
+		msg->msg_id = 0;
+		return false;
 	}
+	return true;
 }
 
-extern "C" APPGUARD_API void AG_unregister_msg(int msg_id) {
+extern "C" APPGUARD_API void AG_unregister_msg(uint64_t msg_id) {
 	if (ipc_watcher != nullptr) {
 		ipc_watcher->UnregisterIPCMsg(msg_id);
 	}
@@ -102,6 +192,171 @@ extern "C" APPGUARD_API void AG_send_msg_request(IPCMsgData* msg_request) {
 	}
 }
 
+extern "C" APPGUARD_API bool AG_send_bytes(const char* msg_handle, const void* data, size_t length) {
+	if (AG_is_primary_instance() || ipc_watcher == nullptr || msg_handle == nullptr) { return false; }
+	if ((data == nullptr && length > 0) || length > UINT32_MAX) { return false; }
+	return ipc_watcher->SendBytes(msg_handle, data, length);
+}
+
+extern "C" APPGUARD_API size_t AG_send_msg_batch(IPCMsgData* msg_requests, size_t count) {
+	if (!AG_is_primary_instance() && ipc_watcher != nullptr && msg_requests != nullptr) {
+		return ipc_watcher->SendMsgBatch(msg_requests, count);
+	}
+	return 0;
+}
+
+extern "C" APPGUARD_API bool AG_get_queue_stats(AGQueueStats* stats) {
+	if (ipc_watcher == nullptr || stats == nullptr) {
+		return false;
+	}
+	ipc_watcher->GetQueueStats(*stats);
+	return true;
+}
+
+extern "C" APPGUARD_API bool AG_set_coalescing(const char* msg_handle, AGCoalescePolicy policy, int window_ms) {
+	if (ipc_watcher == nullptr || msg_handle == nullptr || is_ipc_pattern(msg_handle)) {
+		return false;
+	}
+	ipc_watcher->SetCoalescing(msg_handle, policy, window_ms);
+	return true;
+}
+
+extern "C" APPGUARD_API bool AG_set_gathering(const char* msg_handle, IPCMsgBatchCallback callback, int max_delay_ms, size_t max_count) {
+	if (ipc_watcher == nullptr || msg_handle == nullptr || is_ipc_pattern(msg_handle)) {
+		return false;
+	}
+	ipc_watcher->SetGathering(msg_handle, callback, max_delay_ms, max_count);
+	return true;
+}
+
+extern "C" APPGUARD_API int AG_get_event_fd() {
+	if (ipc_watcher == nullptr || !AG_is_primary_instance()) {
+		return -1;
+	}
+	return ipc_watcher->EventFd();
+}
+
+extern "C" APPGUARD_API size_t AG_process_messages(size_t max_messages, int timeout_ms) {
+	if (ipc_watcher == nullptr) {
+		return 0;
+	}
+	return ipc_watcher->ProcessMessages(max_messages, timeout_ms);
+}
+
+extern "C" APPGUARD_API uint64_t AG_send_msg_async(IPCMsgData* msg_request, int timeout_ms, AGSendCallback callback, void* user_data) {
+	if (AG_is_primary_instance() || ipc_watcher == nullptr || msg_request == nullptr) {
+		return 0;
+	}
+
+	std::lock_guard<std::mutex> lock(async_sender_mutex);
+	if (!async_sender) {
+		IPCSender* ipc_sender = ipc_watcher->CreateSender();
+		if (ipc_sender == nullptr) {
+			return 0;
+		}
+		async_sender.reset(new IPCAsyncSender(ipc_sender));
+	}
+	return async_sender->Enqueue(*msg_request, timeout_ms, callback, user_data);
+}
+
+extern "C" APPGUARD_API bool AG_send_msg_with_fds(IPCMsgData* msg_request, const int* fds, size_t fd_count) {
+	if (!AG_is_primary_instance() && ipc_watcher != nullptr && msg_request != nullptr) {
+		if (fd_count > 0 && fds == nullptr) { return false; }
+		return ipc_watcher->SendMsgWithFds(*msg_request, fds, fd_count);
+	}
+	return false;
+}
+
+extern "C" APPGUARD_API uint64_t AG_get_msg_id(const IPCMsgData* msg_data) {
+	const IPCMsgRequest* request = IPCWatcher::current_request(msg_data);
+	if (request == nullptr) {
+		return 0;
+	}
+	return request->msg_id;
+}
+
+extern "C" APPGUARD_API size_t AG_get_msg_fds(const IPCMsgData* msg_data, const int** fds) {
+	const IPCMsgRequest* request = IPCWatcher::current_request(msg_data);
+	if (fds != nullptr) {
+		*fds = nullptr;
+	}
+	if (request == nullptr || request->fds.empty()) {
+		return 0;
+	}
+	if (fds != nullptr) {
+		*fds = request->fds.data();
+	}
+	return request->fds.size();
+}
+
+extern "C" APPGUARD_API bool AG_call(IPCMsgData* msg_request, int timeout_ms, IPCMsgData* reply) {
+	if (reply != nullptr) {
+		*reply = { nullptr, nullptr };
+	}
+	if (!AG_is_primary_instance() && ipc_watcher != nullptr && msg_request != nullptr && reply != nullptr) {
+		return ipc_watcher->Call(*msg_request, timeout_ms, *reply);
+	}
+	return false;
+}
+
+extern "C" APPGUARD_API bool AG_reply(const IPCMsgData* msg_data, const wchar_t* reply_data) {
+	if (msg_data == nullptr) { return false; }
+	IPCMsgData reply = { msg_data->msg_handle, reply_data };
+	return IPCWatcher::Reply(msg_data, reply);
+}
+
+extern "C" APPGUARD_API void AG_free_msg_data(IPCMsgData* msg_data) {
+	if (msg_data != nullptr) {
+		free_ipc_msg_data(*msg_data);
+	}
+}
+
+extern "C" APPGUARD_API AGSender* AG_sender_create() {
+	if (AG_is_primary_instance() || ipc_watcher == nullptr) {
+		return nullptr;
+	}
+
+	IPCSender* ipc_sender = ipc_watcher->CreateSender();
+	if (ipc_sender == nullptr) {
+		return nullptr;
+	}
+	AGSender* sender = new AGSender();
+	sender->ipc_sender.reset(ipc_sender);
+	std::lock_guard<std::mutex> lock(live_senders_mutex);
+	live_senders.insert(sender);
+	return sender;
+}
+
+extern "C" APPGUARD_API bool AG_sender_send(AGSender* sender, IPCMsgData* msg_request) {
+	if (sender == nullptr || sender->ipc_sender == nullptr || msg_request == nullptr) { return false; }
+	return sender->ipc_sender->Send(*msg_request);
+}
+
+extern "C" APPGUARD_API bool AG_sender_send_id(AGSender* sender, uint64_t handle_id, const wchar_t* msg_data) {
+	if (sender == nullptr || sender->ipc_sender == nullptr) { return false; }
+	return sender->ipc_sender->SendId(handle_id, msg_data);
+}
+
+extern "C" APPGUARD_API bool AG_sender_send_bytes(AGSender* sender, const char* msg_handle, const void* data, size_t length) {
+	if (sender == nullptr || sender->ipc_sender == nullptr || msg_handle == nullptr) { return false; }
+	if ((data == nullptr && length > 0) || length > UINT32_MAX) { return false; }
+	return sender->ipc_sender->SendBytes(msg_handle, data, length);
+}
+
+extern "C" APPGUARD_API size_t AG_sender_send_batch(AGSender* sender, IPCMsgData* msg_requests, size_t count) {
+	if (sender == nullptr || sender->ipc_sender == nullptr || msg_requests == nullptr) { return 0; }
+	return sender->ipc_sender->SendBatch(msg_requests, count);
+}
+
+extern "C" APPGUARD_API void AG_sender_destroy(AGSender* sender) {
+	if (sender == nullptr) { return; }
+	{
+		std::lock_guard<std::mutex> lock(live_senders_mutex);
+		live_senders.erase(sender);
+	}
+	delete sender;
+}
+
 extern "C" APPGUARD_API int AG_get_process_id() {
 	if (app_instance != nullptr) {
 		return app_instance->get_process_id();
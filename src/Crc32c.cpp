@@ -0,0 +1,307 @@
+#include "Crc32c.h"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define CRC32C_X86 1
+#include <nmmintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define CRC32C_TARGET_SSE42
+#else
+#define CRC32C_TARGET_SSE42 __attribute__((target("sse4.2")))
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define CRC32C_ARM 1
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define CRC32C_TARGET_CRC
+#else
+#include <arm_acle.h>
+#if defined(__ARM_FEATURE_CRC32)
+#define CRC32C_TARGET_CRC
+#elif defined(__clang__)
+#define CRC32C_TARGET_CRC __attribute__((target("crc")))
+#else
+#define CRC32C_TARGET_CRC __attribute__((target("+crc")))
+#endif
+#if defined(__linux__)
+#include <sys/auxv.h>
+#endif
+#endif
+#endif
+
+
+namespace {
+
+// Bit-reflected Castagnoli polynomial.
+const uint32_t CRC32C_POLYNOMIAL = 0x82F63B78;
+
+// Slicing-by-8: table[k][b] is the CRC of byte b followed by k zero bytes.
+struct Crc32cTable {
+    uint32_t table[8][256];
+};
+
+constexpr Crc32cTable make_crc32c_table() {
+    Crc32cTable result = {};
+    for (uint32_t b = 0; b < 256; ++b) {
+        uint32_t crc = b;
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc >> 1) ^ ((crc & 1) ? CRC32C_POLYNOMIAL : 0);
+        }
+        result.table[0][b] = crc;
+    }
+    for (uint32_t b = 0; b < 256; ++b) {
+        for (int k = 1; k < 8; ++k) {
+            uint32_t previous = result.table[k - 1][b];
+            result.table[k][b] = (previous >> 8) ^ result.table[0][previous & 0xFF];
+        }
+    }
+    return result;
+}
+
+constexpr Crc32cTable CRC32C_TABLE = make_crc32c_table();
+
+// The hardware kernels run three streams over adjacent blocks, joined by shifting CRCs over the bytes after them.
+const size_t CRC32C_LONG_BLOCK = 8192;
+const size_t CRC32C_SHORT_BLOCK = 256;
+
+// A linear map on CRC values over GF(2), as the images of the 32 single-bit values.
+struct Crc32cOperator {
+    uint32_t column[32];
+};
+
+constexpr uint32_t apply_operator(const Crc32cOperator& op, uint32_t crc) {
+    uint32_t result = 0;
+    for (int bit = 0; crc != 0; ++bit, crc >>= 1) {
+        if (crc & 1) {
+            result ^= op.column[bit];
+        }
+    }
+    return result;
+}
+
+constexpr Crc32cOperator compose_operators(const Crc32cOperator& outer, const Crc32cOperator& inner) {
+    Crc32cOperator result = {};
+    for (int bit = 0; bit < 32; ++bit) {
+        result.column[bit] = apply_operator(outer, inner.column[bit]);
+    }
+    return result;
+}
+
+// The effect of appending length zero bytes to the data: the shift applied to the CRC of the first of two blocks.
+constexpr Crc32cOperator make_zeros_operator(size_t length) {
+    Crc32cOperator zero_bit = {};
+    zero_bit.column[0] = CRC32C_POLYNOMIAL;
+    for (int bit = 1; bit < 32; ++bit) {
+        zero_bit.column[bit] = 1u << (bit - 1);
+    }
+    Crc32cOperator power = compose_operators(zero_bit, zero_bit);
+    power = compose_operators(power, power);
+    power = compose_operators(power, power);
+
+    Crc32cOperator result = {};
+    for (int bit = 0; bit < 32; ++bit) {
+        result.column[bit] = 1u << bit;
+    }
+    for (; length != 0; length >>= 1) {
+        if (length & 1) {
+            result = compose_operators(power, result);
+        }
+        power = compose_operators(power, power);
+    }
+    return result;
+}
+
+struct Crc32cShift {
+    uint32_t table[4][256];
+};
+
+constexpr Crc32cShift make_crc32c_shift(size_t length) {
+    Crc32cOperator zeros = make_zeros_operator(length);
+    Crc32cShift result = {};
+    for (int k = 0; k < 4; ++k) {
+        for (uint32_t b = 0; b < 256; ++b) {
+            result.table[k][b] = apply_operator(zeros, b << (8 * k));
+        }
+    }
+    return result;
+}
+
+constexpr Crc32cShift CRC32C_LONG_SHIFT = make_crc32c_shift(CRC32C_LONG_BLOCK);
+constexpr Crc32cShift CRC32C_SHORT_SHIFT = make_crc32c_shift(CRC32C_SHORT_BLOCK);
+
+inline uint32_t shift_crc32c(const Crc32cShift& shift, uint32_t crc) {
+    return shift.table[0][crc & 0xFF] ^ shift.table[1][(crc >> 8) & 0xFF] ^ shift.table[2][(crc >> 16) & 0xFF] ^
+           shift.table[3][crc >> 24];
+}
+
+inline uint64_t load_word(const unsigned char* data) {
+    uint64_t word;
+    memcpy(&word, data, sizeof(word));
+    return word;
+}
+
+// The kernels take and return the CRC register, which crc32c inverts on the way in and out.
+typedef uint32_t (*Crc32cKernel)(uint32_t crc, const unsigned char* data, size_t length);
+
+uint32_t crc32c_table(uint32_t crc, const unsigned char* data, size_t length) {
+    const uint32_t (&table)[8][256] = CRC32C_TABLE.table;
+    for (; length >= 8; data += 8, length -= 8) {
+        // Little-endian regardless of the host, as the hardware instructions read it.
+        uint32_t low = crc ^ (static_cast<uint32_t>(data[0]) | static_cast<uint32_t>(data[1]) << 8 |
+                              static_cast<uint32_t>(data[2]) << 16 | static_cast<uint32_t>(data[3]) << 24);
+        crc = table[7][low & 0xFF] ^ table[6][(low >> 8) & 0xFF] ^ table[5][(low >> 16) & 0xFF] ^ table[4][low >> 24] ^
+              table[3][data[4]] ^ table[2][data[5]] ^ table[1][data[6]] ^ table[0][data[7]];
+    }
+    for (; length > 0; ++data, --length) {
+        crc = (crc >> 8) ^ table[0][(crc ^ *data) & 0xFF];
+    }
+    return crc;
+}
+
+#if defined(CRC32C_X86)
+
+// Runs three streams over the blocks at data, data + block and data + 2 * block, and joins them.
+CRC32C_TARGET_SSE42 uint32_t crc32c_sse42_blocks(uint32_t crc, const unsigned char* data, size_t block,
+                                                 const Crc32cShift& shift) {
+    uint64_t crc0 = crc;
+    uint64_t crc1 = 0;
+    uint64_t crc2 = 0;
+    for (const unsigned char* end = data + block; data < end; data += 8) {
+        crc0 = _mm_crc32_u64(crc0, load_word(data));
+        crc1 = _mm_crc32_u64(crc1, load_word(data + block));
+        crc2 = _mm_crc32_u64(crc2, load_word(data + 2 * block));
+    }
+    crc = shift_crc32c(shift, static_cast<uint32_t>(crc0)) ^ static_cast<uint32_t>(crc1);
+    return shift_crc32c(shift, crc) ^ static_cast<uint32_t>(crc2);
+}
+
+CRC32C_TARGET_SSE42 uint32_t crc32c_sse42(uint32_t crc, const unsigned char* data, size_t length) {
+    for (; length >= 3 * CRC32C_LONG_BLOCK; data += 3 * CRC32C_LONG_BLOCK, length -= 3 * CRC32C_LONG_BLOCK) {
+        crc = crc32c_sse42_blocks(crc, data, CRC32C_LONG_BLOCK, CRC32C_LONG_SHIFT);
+    }
+    for (; length >= 3 * CRC32C_SHORT_BLOCK; data += 3 * CRC32C_SHORT_BLOCK, length -= 3 * CRC32C_SHORT_BLOCK) {
+        crc = crc32c_sse42_blocks(crc, data, CRC32C_SHORT_BLOCK, CRC32C_SHORT_SHIFT);
+    }
+    uint64_t crc64 = crc;
+    for (; length >= 8; data += 8, length -= 8) {
+        crc64 = _mm_crc32_u64(crc64, load_word(data));
+    }
+    crc = static_cast<uint32_t>(crc64);
+    for (; length > 0; ++data, --length) {
+        crc = _mm_crc32_u8(crc, *data);
+    }
+    return crc;
+}
+
+bool cpu_has_sse42() {
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 20)) != 0;
+#else
+    return __builtin_cpu_supports("sse4.2");
+#endif
+}
+
+#elif defined(CRC32C_ARM)
+
+// Runs three streams over the blocks at data, data + block and data + 2 * block, and joins them.
+CRC32C_TARGET_CRC uint32_t crc32c_armv8_blocks(uint32_t crc, const unsigned char* data, size_t block,
+                                               const Crc32cShift& shift) {
+    uint32_t crc1 = 0;
+    uint32_t crc2 = 0;
+    for (const unsigned char* end = data + block; data < end; data += 8) {
+        crc = __crc32cd(crc, load_word(data));
+        crc1 = __crc32cd(crc1, load_word(data + block));
+        crc2 = __crc32cd(crc2, load_word(data + 2 * block));
+    }
+    crc = shift_crc32c(shift, crc) ^ crc1;
+    return shift_crc32c(shift, crc) ^ crc2;
+}
+
+CRC32C_TARGET_CRC uint32_t crc32c_armv8(uint32_t crc, const unsigned char* data, size_t length) {
+    for (; length >= 3 * CRC32C_LONG_BLOCK; data += 3 * CRC32C_LONG_BLOCK, length -= 3 * CRC32C_LONG_BLOCK) {
+        crc = crc32c_armv8_blocks(crc, data, CRC32C_LONG_BLOCK, CRC32C_LONG_SHIFT);
+    }
+    for (; length >= 3 * CRC32C_SHORT_BLOCK; data += 3 * CRC32C_SHORT_BLOCK, length -= 3 * CRC32C_SHORT_BLOCK) {
+        crc = crc32c_armv8_blocks(crc, data, CRC32C_SHORT_BLOCK, CRC32C_SHORT_SHIFT);
+    }
+    for (; length >= 8; data += 8, length -= 8) {
+        crc = __crc32cd(crc, load_word(data));
+    }
+    for (; length > 0; ++data, --length) {
+        crc = __crc32cb(crc, *data);
+    }
+    return crc;
+}
+
+bool cpu_has_crc() {
+#if defined(__ARM_FEATURE_CRC32) || defined(_M_ARM64) || defined(__APPLE__)
+    // Part of every ARMv8.1 core, which Apple silicon and Windows on ARM require.
+    return true;
+#elif defined(__linux__) && defined(HWCAP_CRC32)
+    return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+#else
+    return false;
+#endif
+}
+
+#endif
+
+struct Crc32cImplementation {
+    const char* name;
+    Crc32cKernel kernel;
+};
+
+// The implementations this build and CPU can run, fastest first.
+size_t available_implementations(Crc32cImplementation* out) {
+    size_t count = 0;
+#if defined(CRC32C_X86)
+    if (cpu_has_sse42()) {
+        out[count++] = { "sse4.2", crc32c_sse42 };
+    }
+#elif defined(CRC32C_ARM)
+    if (cpu_has_crc()) {
+        out[count++] = { "armv8-crc", crc32c_armv8 };
+    }
+#endif
+    out[count++] = { "table", crc32c_table };
+    return count;
+}
+
+const size_t MAX_IMPLEMENTATIONS = 2;
+
+Crc32cImplementation select_implementation() {
+    Crc32cImplementation available[MAX_IMPLEMENTATIONS];
+    available_implementations(available);
+    return available[0];
+}
+
+Crc32cImplementation& implementation() {
+    static Crc32cImplementation selected = select_implementation();
+    return selected;
+}
+
+} // namespace
+
+uint32_t crc32c(uint32_t crc, const void* data, size_t length) {
+    return ~implementation().kernel(~crc, static_cast<const unsigned char*>(data), length);
+}
+
+const char* crc32c_kernel_name() {
+    return implementation().name;
+}
+
+bool crc32c_use_kernel(const char* name) {
+    Crc32cImplementation available[MAX_IMPLEMENTATIONS];
+    size_t count = available_implementations(available);
+    for (size_t i = 0; i < count; ++i) {
+        if (strcmp(available[i].name, name) == 0) {
+            implementation() = available[i];
+            return true;
+        }
+    }
+    return false;
+}
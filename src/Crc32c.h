@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+
+// CRC-32C of wire records, with SSE4.2 or ARMv8 CRC instructions picked at run time, or a slicing-by-8 table.
+
+// Extends crc, the value returned for the bytes before data, over length more bytes. Start with 0.
+uint32_t crc32c(uint32_t crc, const void* data, size_t length);
+// Name of the implementation in use: "sse4.2", "armv8-crc" or "table".
+const char* crc32c_kernel_name();
+// Switches to the named implementation, for tests; false if this build or CPU lacks it. Not while computing.
+bool crc32c_use_kernel(const char* name);
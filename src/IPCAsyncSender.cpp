@@ -0,0 +1,83 @@
+#include "IPCAsyncSender.h"
+
+#include <algorithm>
+
+
+IPCAsyncSender::IPCAsyncSender(IPCSender* sender) : sender_(sender) {
+	this->thread_ = std::thread([this]() { run(); });
+}
+
+IPCAsyncSender::~IPCAsyncSender() {
+	{
+		std::lock_guard<std::mutex> lock(this->mutex_);
+		this->stopping_ = true;
+	}
+	this->cv_.notify_all();
+	if (this->thread_.joinable()) {
+		this->thread_.join();
+	}
+}
+
+uint64_t IPCAsyncSender::Enqueue(const IPCMsgData& msg, int timeout_ms, AGSendCallback callback, void* user_data) {
+	PendingSend pending;
+	pending.msg_handle = msg.msg_handle ? msg.msg_handle : "";
+	pending.has_data = msg.msg_data != nullptr;
+	if (pending.has_data) {
+		pending.msg_data = msg.msg_data;
+	}
+	pending.deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(std::max(timeout_ms, 0));
+	pending.callback = callback;
+	pending.user_data = user_data;
+
+	std::lock_guard<std::mutex> lock(this->mutex_);
+	if (this->stopping_ || this->pending_.size() >= MAX_PENDING_SENDS) {
+		return 0;
+	}
+	pending.send_id = this->next_send_id_++;
+	this->pending_.push_back(std::move(pending));
+	this->cv_.notify_one();
+	return this->pending_.back().send_id;
+}
+
+AGSendStatus IPCAsyncSender::deliver(PendingSend& pending) {
+	IPCMsgData msg = { pending.msg_handle.c_str(), pending.has_data ? pending.msg_data.c_str() : nullptr };
+	auto backoff = std::chrono::microseconds(20);
+
+	while (true) {
+		IPCSendResult result = this->sender_ ? this->sender_->TrySend(msg) : IPCSendResult::Failed;
+		if (result == IPCSendResult::Sent) {
+			return AG_SEND_DELIVERED;
+		}
+		if (result == IPCSendResult::Failed) {
+			return AG_SEND_DROPPED;
+		}
+
+		auto now = std::chrono::steady_clock::now();
+		if (now >= pending.deadline) {
+			return AG_SEND_TIMED_OUT;
+		}
+		std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(backoff, pending.deadline - now));
+		backoff = std::min(backoff * 2, std::chrono::microseconds(2000));
+	}
+}
+
+void IPCAsyncSender::run() {
+	while (true) {
+		std::unique_lock<std::mutex> lock(this->mutex_);
+		this->cv_.wait(lock, [&]() {
+			return !this->pending_.empty() || this->stopping_;
+			});
+		if (this->pending_.empty()) {
+			break;
+		}
+
+		PendingSend pending = std::move(this->pending_.front());
+		this->pending_.pop_front();
+		lock.unlock();
+
+		AGSendStatus status = deliver(pending);
+		if (pending.callback != nullptr) {
+			pending.callback(pending.send_id, status, pending.user_data);
+		}
+	}
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <string>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstdint>
+#include "IPCWatcher.h"
+#include "../include/common.h"
+
+
+// Sends queued messages in order from a background thread, each reporting one outcome through its callback.
+class IPCAsyncSender {
+private:
+	struct PendingSend {
+		uint64_t send_id;
+		std::string msg_handle;
+		std::wstring msg_data;
+		bool has_data;
+		std::chrono::steady_clock::time_point deadline;
+		AGSendCallback callback;
+		void* user_data;
+	};
+
+	std::unique_ptr<IPCSender> sender_;
+	std::deque<PendingSend> pending_;
+	std::mutex mutex_;
+	std::condition_variable cv_;
+	std::thread thread_;
+	bool stopping_ = false;
+	uint64_t next_send_id_ = 1;
+
+	static const size_t MAX_PENDING_SENDS = 65536;
+
+	void run();
+	AGSendStatus deliver(PendingSend& pending);
+
+public:
+	explicit IPCAsyncSender(IPCSender* sender);
+	// Waits until every queued message has been sent or has passed its deadline.
+	~IPCAsyncSender();
+
+	// Copies the message and queues it. Returns the send id, or 0 when the queue is full.
+	uint64_t Enqueue(const IPCMsgData& msg, int timeout_ms, AGSendCallback callback, void* user_data);
+};
@@ -0,0 +1,118 @@
+#include "IPCCoalescer.h"
+#include <algorithm>
+#include <cwchar>
+
+
+void IPCCoalescer::SetRule(uint64_t handle_id, AGCoalescePolicy policy, int window_ms) {
+	std::lock_guard<std::mutex> lock(this->mutex_);
+	auto found = this->rules_.find(handle_id);
+	if (policy == AG_COALESCE_NONE) {
+		if (found != this->rules_.end()) {
+			if (found->second.waiting == 0) {
+				this->rules_.erase(found);
+			}
+			else {
+				found->second.policy = AG_COALESCE_NONE;
+				found->second.seen.clear();
+			}
+		}
+	}
+	else {
+		Rule& rule = found != this->rules_.end() ? found->second : this->rules_[handle_id];
+		rule.policy = policy;
+		rule.window = std::chrono::milliseconds(std::max(window_ms, 0));
+		rule.seen.clear();
+	}
+	this->active_.store(!this->rules_.empty(), std::memory_order_relaxed);
+}
+
+void IPCCoalescer::Received(IPCMsgRequest& request) {
+	if (request.call_id != 0 || !request.fds.empty()) {
+		return;
+	}
+	std::lock_guard<std::mutex> lock(this->mutex_);
+	auto found = this->rules_.find(request.handle_id);
+	if (found == this->rules_.end() || found->second.policy == AG_COALESCE_NONE) {
+		return;
+	}
+	found->second.waiting++;
+	request.coalescing = true;
+	request.received = std::chrono::steady_clock::now();
+}
+
+void IPCCoalescer::Discarded(const IPCMsgRequest& request) {
+	if (!request.coalescing) {
+		return;
+	}
+	std::lock_guard<std::mutex> lock(this->mutex_);
+	this->count_out(request);
+}
+
+bool IPCCoalescer::Admit(const IPCMsgRequest& request) {
+	if (!request.coalescing) {
+		return true;
+	}
+	std::lock_guard<std::mutex> lock(this->mutex_);
+	Rule* rule = this->count_out(request);
+	if (rule == nullptr) {
+		return true;
+	}
+
+	switch (rule->policy) {
+	case AG_COALESCE_LATEST:
+		if (rule->waiting == 0) {
+			return true;
+		}
+		// A newer message for the handle is already on its way to the dispatcher.
+		this->coalesced_++;
+		return false;
+	case AG_COALESCE_DUPLICATES: {
+		// Payloads are compared as received. Strict UTF-8 has one encoding per text, so equal texts are equal bytes.
+		std::string data(request.bytes != nullptr ? request.bytes : "", request.bytes_length);
+		// Requests of one handle are admitted in the order received, so the payloads seen are too.
+		while (!rule->seen.empty() && request.received - rule->seen.front().received > rule->window) {
+			rule->seen.pop_front();
+		}
+		for (const SeenPayload& seen : rule->seen) {
+			if (seen.binary == request.binary && seen.data == data) {
+				this->coalesced_++;
+				return false;
+			}
+		}
+		rule->seen.push_back({ request.received, std::move(data), request.binary });
+		return true;
+	}
+	default:
+		return true;
+	}
+}
+
+void IPCCoalescer::Reset() {
+	std::lock_guard<std::mutex> lock(this->mutex_);
+	for (auto rule = this->rules_.begin(); rule != this->rules_.end();) {
+		if (rule->second.policy == AG_COALESCE_NONE) {
+			rule = this->rules_.erase(rule);
+			continue;
+		}
+		rule->second.waiting = 0;
+		rule->second.seen.clear();
+		++rule;
+	}
+	this->active_.store(!this->rules_.empty(), std::memory_order_relaxed);
+}
+
+IPCCoalescer::Rule* IPCCoalescer::count_out(const IPCMsgRequest& request) {
+	auto found = this->rules_.find(request.handle_id);
+	if (found == this->rules_.end()) {
+		return nullptr;
+	}
+	found->second.waiting--;
+	if (found->second.policy == AG_COALESCE_NONE) {
+		if (found->second.waiting == 0) {
+			this->rules_.erase(found);
+			this->active_.store(!this->rules_.empty(), std::memory_order_relaxed);
+		}
+		return nullptr;
+	}
+	return &found->second;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <chrono>
+#include <atomic>
+#include <mutex>
+#include "IPCWatcher.h"
+
+
+// Skips the callbacks of repeated or superseded messages of a handle; calls and descriptors always run.
+class IPCCoalescer {
+public:
+	// Sets the rule of handle_id, replacing the one it had. AG_COALESCE_NONE removes it.
+	void SetRule(uint64_t handle_id, AGCoalescePolicy policy, int window_ms);
+	// Whether any rule is set. Until one is, receivers and dispatchers need not call in.
+	bool Active() const { return this->active_.load(std::memory_order_relaxed); }
+
+	// Counts a request in as it is received, before it is queued or dispatched.
+	void Received(IPCMsgRequest& request);
+	// Counts out a request the queue discarded without dispatching it.
+	void Discarded(const IPCMsgRequest& request);
+	// Counts out a request about to be dispatched. Returns false when a rule merged it into another message.
+	bool Admit(const IPCMsgRequest& request);
+	// Forgets the requests counted in and the payloads seen, keeping the rules. Only once nothing is queued.
+	void Reset();
+
+	// Messages merged so far.
+	uint64_t Coalesced() const { return this->coalesced_; }
+
+private:
+	struct SeenPayload {
+		std::chrono::steady_clock::time_point received;
+		std::string data;
+		bool binary;
+	};
+
+	struct Rule {
+		AGCoalescePolicy policy = AG_COALESCE_NONE;
+		std::chrono::milliseconds window{ 0 };
+		// Requests counted in and not yet admitted or discarded.
+		size_t waiting = 0;
+		// Payloads of the messages admitted within the window, oldest first.
+		std::deque<SeenPayload> seen;
+	};
+
+	std::mutex mutex_;
+	// Rules by handle id. A removed rule stays until the requests it counted in are gone.
+	std::unordered_map<uint64_t, Rule> rules_;
+	std::atomic<bool> active_{ false };
+	std::atomic<uint64_t> coalesced_{ 0 };
+
+	// Counts out a request that was counted in, with mutex_ held. Returns its rule, or nullptr if it had none.
+	Rule* count_out(const IPCMsgRequest& request);
+};
@@ -0,0 +1,73 @@
+#include "IPCDispatchPool.h"
+
+
+IPCDispatchPool::IPCDispatchPool(size_t worker_count, const RunRequest& run) : run_(run) {
+	for (size_t worker = 0; worker < worker_count; ++worker) {
+		this->workers_.emplace_back([this, worker]() { work(worker); });
+	}
+}
+
+IPCDispatchPool::~IPCDispatchPool() {
+	{
+		std::lock_guard<std::mutex> lock(this->mutex_);
+		this->stopping_ = true;
+	}
+	this->cv_.notify_all();
+	for (auto& worker : this->workers_) {
+		worker.join();
+	}
+
+	for (auto& strand : this->strands_) {
+		for (; !strand.second.requests.empty(); strand.second.requests.pop_front()) {
+			release_ipc_request(strand.second.requests.front());
+		}
+	}
+}
+
+void IPCDispatchPool::Submit(IPCMsgRequest&& request) {
+	std::lock_guard<std::mutex> lock(this->mutex_);
+	StrandEntry& entry = *this->strands_.try_emplace(request.handle_id).first;
+	entry.second.requests.push_back(std::move(request));
+	this->pending_++;
+
+	if (!entry.second.scheduled) {
+		entry.second.scheduled = true;
+		this->ready_.push_back(&entry);
+		this->cv_.notify_one();
+	}
+}
+
+void IPCDispatchPool::work(size_t worker) {
+	IPCMsgRequest request;
+	std::unique_lock<std::mutex> lock(this->mutex_);
+
+	while (true) {
+		this->cv_.wait(lock, [&]() {
+			return !this->ready_.empty() || this->stopping_;
+			});
+		if (this->stopping_) {
+			break;
+		}
+
+		StrandEntry* entry = this->ready_.front();
+		this->ready_.pop_front();
+		request = std::move(entry->second.requests.front());
+		entry->second.requests.pop_front();
+		this->pending_--;
+
+		lock.unlock();
+		this->run_(request, worker);
+		lock.lock();
+
+		if (entry->second.requests.empty()) {
+			entry->second.scheduled = false;
+			if (this->strands_.size() > MAX_KEPT_STRANDS) {
+				this->strands_.erase(this->strands_.find(entry->first));
+			}
+		}
+		else {
+			// Behind the strands already waiting. This worker picks up the front one next.
+			this->ready_.push_back(entry);
+		}
+	}
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <unordered_map>
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include "IPCWatcher.h"
+
+
+// Runs requests on worker threads, in order per handle and concurrently across handles.
+class IPCDispatchPool {
+public:
+	// Called on worker thread number worker with no lock held.
+	typedef std::function<void(IPCMsgRequest& request, size_t worker)> RunRequest;
+
+	IPCDispatchPool(size_t worker_count, const RunRequest& run);
+	// Waits for the requests that are running and releases the ones that never ran.
+	~IPCDispatchPool();
+
+	void Submit(IPCMsgRequest&& request);
+	// Requests submitted and not yet taken by a worker.
+	size_t Pending() const { return this->pending_; }
+
+private:
+	// A queue over a vector, which keeps its capacity.
+	template <typename T>
+	struct Fifo {
+		std::vector<T> items;
+		size_t head = 0;
+
+		bool empty() const { return this->head == this->items.size(); }
+		T& front() { return this->items[this->head]; }
+		void push_back(T item) { this->items.push_back(std::move(item)); }
+		void pop_front() {
+			if (++this->head == this->items.size()) {
+				this->items.clear();
+				this->head = 0;
+			}
+			else if (this->head >= 64 && this->head * 2 >= this->items.size()) {
+				// Never empty under steady load: drop the taken items once they are half of it.
+				this->items.erase(this->items.begin(), this->items.begin() + this->head);
+				this->head = 0;
+			}
+		}
+	};
+
+	struct Strand {
+		Fifo<IPCMsgRequest> requests;
+		bool scheduled = false;
+	};
+	typedef std::unordered_map<uint64_t, Strand>::value_type StrandEntry;
+
+	RunRequest run_;
+	std::vector<std::thread> workers_;
+	std::mutex mutex_;
+	std::condition_variable cv_;
+	// Strands by handle id; up to MAX_KEPT_STRANDS idle ones are kept.
+	std::unordered_map<uint64_t, Strand> strands_;
+	// Scheduled strands waiting for a worker, in the order they became ready.
+	Fifo<StrandEntry*> ready_;
+	std::atomic<size_t> pending_{ 0 };
+	bool stopping_ = false;
+
+	static const size_t MAX_KEPT_STRANDS = 256;
+
+	void work(size_t worker);
+};
@@ -0,0 +1,122 @@
+#include "IPCGatherer.h"
+#include <algorithm>
+
+
+void IPCGatherer::SetRule(uint64_t handle_id, const char* msg_handle, IPCMsgBatchCallback callback, int max_delay_ms, size_t max_count) {
+	std::lock_guard<std::mutex> lock(this->mutex_);
+	auto found = this->rules_.find(handle_id);
+	if (callback == nullptr) {
+		if (found != this->rules_.end()) {
+			if (found->second.open.requests.empty()) {
+				this->rules_.erase(found);
+			}
+			else {
+				// TakeDue() passes the open batch on and drops the rule.
+				found->second.callback = nullptr;
+			}
+		}
+	}
+	else {
+		Rule& rule = found != this->rules_.end() ? found->second : this->rules_[handle_id];
+		rule.callback = callback;
+		rule.msg_handle = msg_handle;
+		rule.max_delay = std::chrono::milliseconds(std::max(max_delay_ms, 0));
+		rule.max_count = max_count;
+	}
+	this->update_active();
+}
+
+bool IPCGatherer::Add(IPCMsgRequest& request, bool can_wait, std::vector<Batch>& ready) {
+	if (request.call_id != 0 || !request.fds.empty()) {
+		return false;
+	}
+	std::lock_guard<std::mutex> lock(this->mutex_);
+	auto found = this->rules_.find(request.handle_id);
+	if (found == this->rules_.end() || found->second.callback == nullptr) {
+		return false;
+	}
+
+	Rule& rule = found->second;
+	Clock::time_point now = Clock::now();
+	// Idle: nothing arrived for the handle within the longest a batch may wait.
+	bool idle = !rule.has_arrived || now - rule.last_arrival >= rule.max_delay;
+	if (rule.has_arrived) {
+		Clock::duration sample = std::min<Clock::duration>(now - rule.last_arrival, rule.max_delay);
+		rule.gap = rule.gap == Clock::duration::zero() ? sample : (rule.gap * 7 + sample) / 8;
+	}
+	rule.has_arrived = true;
+	rule.last_arrival = now;
+
+	if (rule.open.requests.empty()) {
+		rule.open.callback = rule.callback;
+		rule.open.msg_handle = rule.msg_handle;
+		rule.opened = now;
+	}
+	rule.open.requests.push_back(std::move(request));
+	if (idle || !can_wait || (rule.max_count != 0 && rule.open.requests.size() >= rule.max_count)) {
+		take(rule, ready);
+	}
+	return true;
+}
+
+int IPCGatherer::TakeDue(std::vector<Batch>& ready) {
+	std::lock_guard<std::mutex> lock(this->mutex_);
+	Clock::time_point now = Clock::now();
+	Clock::time_point next = Clock::time_point::max();
+	for (auto found = this->rules_.begin(); found != this->rules_.end();) {
+		Rule& rule = found->second;
+		if (!rule.open.requests.empty()) {
+			Clock::time_point at = rule.callback != nullptr ? due(rule) : now;
+			if (at <= now) {
+				take(rule, ready);
+			}
+			else {
+				next = std::min(next, at);
+			}
+		}
+		if (rule.callback == nullptr && rule.open.requests.empty()) {
+			found = this->rules_.erase(found);
+			continue;
+		}
+		++found;
+	}
+	this->update_active();
+
+	if (next == Clock::time_point::max()) {
+		return -1;
+	}
+	// Rounded up, so a wait for less than a millisecond does not spin.
+	auto delay = std::chrono::duration_cast<std::chrono::microseconds>(next - now).count();
+	return static_cast<int>((delay + 999) / 1000);
+}
+
+void IPCGatherer::Clear() {
+	std::lock_guard<std::mutex> lock(this->mutex_);
+	for (auto found = this->rules_.begin(); found != this->rules_.end();) {
+		for (auto& request : found->second.open.requests) {
+			release_ipc_request(request);
+		}
+		found->second.open.requests.clear();
+		if (found->second.callback == nullptr) {
+			found = this->rules_.erase(found);
+			continue;
+		}
+		++found;
+	}
+	this->update_active();
+}
+
+IPCGatherer::Clock::time_point IPCGatherer::due(const Rule& rule) {
+	// The batch stays open while messages keep coming about as often as they have been.
+	Clock::duration linger = std::min<Clock::duration>(std::max<Clock::duration>(rule.gap * 2, std::chrono::milliseconds(1)), rule.max_delay);
+	return std::min(rule.opened + rule.max_delay, rule.last_arrival + linger);
+}
+
+void IPCGatherer::take(Rule& rule, std::vector<Batch>& ready) {
+	ready.push_back(std::move(rule.open));
+	rule.open = Batch();
+}
+
+void IPCGatherer::update_active() {
+	this->active_.store(!this->rules_.empty(), std::memory_order_relaxed);
+}
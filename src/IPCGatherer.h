@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <chrono>
+#include <atomic>
+#include <mutex>
+#include "IPCWatcher.h"
+
+
+// Batches a handle's messages for one callback, open for twice their usual gap; calls and descriptors pass through.
+class IPCGatherer {
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	// A batch taken out of the gatherer for its callback to run.
+	struct Batch {
+		IPCMsgBatchCallback callback = nullptr;
+		std::string msg_handle;
+		std::vector<IPCMsgRequest> requests;
+	};
+
+	// A null callback stops gathering; an open batch keeps the callback it was gathered for.
+	void SetRule(uint64_t handle_id, const char* msg_handle, IPCMsgBatchCallback callback, int max_delay_ms, size_t max_count);
+	// Whether any handle is gathered. Until one is, dispatchers need not call in.
+	bool Active() const { return this->active_.load(std::memory_order_relaxed); }
+
+	// False for handles that are not gathered. Without can_wait, batches are passed on at once. Dispatch thread only.
+	bool Add(IPCMsgRequest& request, bool can_wait, std::vector<Batch>& ready);
+	// Returns the milliseconds until the next batch is due, or -1 when none is open. Dispatch thread only.
+	int TakeDue(std::vector<Batch>& ready);
+	// Releases the messages of the open batches.
+	void Clear();
+
+private:
+	struct Rule {
+		IPCMsgBatchCallback callback = nullptr;
+		std::string msg_handle;
+		Clock::duration max_delay{ 0 };
+		size_t max_count = 0;
+		// When the last message arrived, once one has, and the smoothed gap between arrivals.
+		bool has_arrived = false;
+		Clock::time_point last_arrival;
+		Clock::duration gap{ 0 };
+		// The batch being gathered, empty when none is open, and when it was opened.
+		Batch open;
+		Clock::time_point opened;
+	};
+
+	std::mutex mutex_;
+	// Rules by handle id. A rule whose callback was cleared stays until its open batch is passed on.
+	std::unordered_map<uint64_t, Rule> rules_;
+	std::atomic<bool> active_{ false };
+
+	// When the open batch of rule is due, with mutex_ held.
+	static Clock::time_point due(const Rule& rule);
+	// Moves the open batch of rule to ready, with mutex_ held.
+	static void take(Rule& rule, std::vector<Batch>& ready);
+	void update_active();
+};
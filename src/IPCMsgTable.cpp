@@ -0,0 +1,288 @@
+#include "IPCMsgTable.h"
+#include <algorithm>
+#include <cstring>
+
+
+size_t IPCMsgTable::home(uint64_t handle_id) const {
+	return static_cast<size_t>(handle_id ^ (handle_id >> 32)) & (this->slots_.size() - 1);
+}
+
+size_t IPCMsgTable::probe(uint64_t handle_id) const {
+	size_t mask = this->slots_.size() - 1;
+	size_t slot = this->home(handle_id);
+	while (this->slots_[slot].handlers != nullptr && this->slots_[slot].handle_id != handle_id) {
+		slot = (slot + 1) & mask;
+	}
+	return slot;
+}
+
+const IPCMsgHandlers* IPCMsgTable::find(uint64_t handle_id) const {
+	if (this->slots_.empty()) {
+		return nullptr;
+	}
+	return this->slots_[this->probe(handle_id)].handlers;
+}
+
+void IPCMsgTable::resize(size_t slot_count) {
+	std::vector<Slot> slots(slot_count, Slot{ 0, nullptr });
+	slots.swap(this->slots_);
+	for (const Slot& entry : slots) {
+		if (entry.handlers != nullptr) {
+			this->slots_[this->probe(entry.handle_id)] = entry;
+		}
+	}
+}
+
+std::unique_ptr<IPCMsgTable> IPCMsgTable::with(uint64_t handle_id, const IPCMsg& msg, std::unique_ptr<const IPCMsgHandlers>& replaced) const {
+	std::unique_ptr<IPCMsgTable> table(new IPCMsgTable(*this));
+	if ((table->count_ + 1) * 2 > table->slots_.size()) {
+		table->resize(std::max<size_t>(table->slots_.size() * 2, 16));
+	}
+
+	Slot& slot = table->slots_[table->probe(handle_id)];
+	std::unique_ptr<IPCMsgHandlers> handlers;
+	if (slot.handlers != nullptr) {
+		handlers.reset(new IPCMsgHandlers(*slot.handlers));
+		replaced.reset(slot.handlers);
+	}
+	else {
+		handlers.reset(new IPCMsgHandlers());
+		handlers->msg_handle = msg.msg_handle;
+		table->count_++;
+	}
+	handlers->msgs.push_back(msg);
+	slot.handle_id = handle_id;
+	slot.handlers = handlers.release();
+	return table;
+}
+
+std::unique_ptr<IPCMsgTable> IPCMsgTable::without(uint64_t handle_id, uint64_t msg_id, std::unique_ptr<const IPCMsgHandlers>& replaced) const {
+	std::unique_ptr<IPCMsgTable> table(new IPCMsgTable(*this));
+	size_t slot = table->slots_.empty() ? 0 : table->probe(handle_id);
+	if (table->slots_.empty() || table->slots_[slot].handlers == nullptr) {
+		return table;
+	}
+
+	std::unique_ptr<IPCMsgHandlers> handlers(new IPCMsgHandlers(*table->slots_[slot].handlers));
+	handlers->msgs.erase(std::remove_if(handlers->msgs.begin(), handlers->msgs.end(), [&](const IPCMsg& msg) {
+		return msg.msg_id == msg_id;
+		}), handlers->msgs.end());
+	replaced.reset(table->slots_[slot].handlers);
+	if (handlers->msgs.empty()) {
+		table->erase(slot);
+	}
+	else {
+		table->slots_[slot].handlers = handlers.release();
+	}
+	return table;
+}
+
+void IPCMsgTable::erase(size_t slot) {
+	size_t mask = this->slots_.size() - 1;
+	size_t hole = slot;
+	for (size_t next = (slot + 1) & mask; this->slots_[next].handlers != nullptr; next = (next + 1) & mask) {
+		// An entry can fill the hole when the hole lies on its probe sequence, between its home slot and next.
+		size_t home = this->home(this->slots_[next].handle_id);
+		if (((next - home) & mask) >= ((next - hole) & mask)) {
+			this->slots_[hole] = this->slots_[next];
+			hole = next;
+		}
+	}
+	this->slots_[hole] = Slot{ 0, nullptr };
+	this->count_--;
+}
+
+void IPCMsgTable::clear() {
+	for (Slot& slot : this->slots_) {
+		delete slot.handlers;
+		slot = Slot{ 0, nullptr };
+	}
+	this->count_ = 0;
+	this->patterns_.reset();
+}
+
+namespace {
+	typedef std::shared_ptr<const IPCPatternNode> IPCPatternPtr;
+
+	// The child whose label starts with c, or end().
+	std::vector<IPCPatternPtr>::const_iterator find_child(const std::vector<IPCPatternPtr>& children, char c) {
+		auto child = std::lower_bound(children.begin(), children.end(), c, [](const IPCPatternPtr& node, char first) {
+			return node->label[0] < first;
+			});
+		return child != children.end() && (*child)->label[0] == c ? child : children.end();
+	}
+
+	// Where the '*' at pos ends; repeated ones count as one.
+	size_t skip_wildcard(const std::string& pattern, size_t pos) {
+		while (pos < pattern.size() && pattern[pos] == '*') {
+			++pos;
+		}
+		return pos;
+	}
+
+	// A copy of node, which matched pattern up to pos, with msg added for the rest of pattern. Node may be null.
+	IPCPatternPtr insert_pattern(const IPCPatternNode* node, const std::string& pattern, size_t pos, const IPCMsg& msg) {
+		std::shared_ptr<IPCPatternNode> copy = node != nullptr ? std::make_shared<IPCPatternNode>(*node) : std::make_shared<IPCPatternNode>();
+		if (pos == pattern.size()) {
+			copy->msgs.push_back(msg);
+			return copy;
+		}
+
+		if (pattern[pos] == '*') {
+			size_t next = skip_wildcard(pattern, pos);
+			if (next == pattern.size()) {
+				copy->rest_msgs.push_back(msg);
+			}
+			else {
+				copy->wildcard = insert_pattern(copy->wildcard.get(), pattern, next, msg);
+			}
+			return copy;
+		}
+
+		size_t run_end = std::min(pattern.find('*', pos), pattern.size());
+		auto child = find_child(copy->children, pattern[pos]);
+		if (child == copy->children.end()) {
+			IPCPatternNode leaf;
+			leaf.label = pattern.substr(pos, run_end - pos);
+			IPCPatternPtr added = insert_pattern(&leaf, pattern, run_end, msg);
+			auto place = std::lower_bound(copy->children.begin(), copy->children.end(), pattern[pos], [](const IPCPatternPtr& node, char first) {
+				return node->label[0] < first;
+				});
+			copy->children.insert(place, added);
+			return copy;
+		}
+
+		const std::string& label = (*child)->label;
+		size_t common = 1;
+		while (common < label.size() && pos + common < run_end && label[common] == pattern[pos + common]) {
+			++common;
+		}
+
+		auto slot = copy->children.begin() + (child - copy->children.cbegin());
+		if (common == label.size()) {
+			*slot = insert_pattern(child->get(), pattern, pos + common, msg);
+		}
+		else {
+			// The pattern leaves the edge part way: split it at that point.
+			std::shared_ptr<IPCPatternNode> lower = std::make_shared<IPCPatternNode>(**child);
+			lower->label = label.substr(common);
+			IPCPatternNode split;
+			split.label = label.substr(0, common);
+			split.children.push_back(lower);
+			*slot = insert_pattern(&split, pattern, pos + common, msg);
+		}
+		return copy;
+	}
+
+	bool empty_node(const IPCPatternNode& node) {
+		return node.msgs.empty() && node.rest_msgs.empty() && node.wildcard == nullptr && node.children.empty();
+	}
+
+	void erase_msg(std::vector<IPCMsg>& msgs, uint64_t msg_id) {
+		msgs.erase(std::remove_if(msgs.begin(), msgs.end(), [&](const IPCMsg& msg) {
+			return msg.msg_id == msg_id;
+			}), msgs.end());
+	}
+
+	// node without msg_id under pattern[pos..]: null when nothing is left, node itself when the pattern is not there.
+	IPCPatternPtr remove_pattern(const IPCPatternPtr& node, const std::string& pattern, size_t pos, uint64_t msg_id) {
+		std::shared_ptr<IPCPatternNode> copy;
+		if (pos == pattern.size()) {
+			copy = std::make_shared<IPCPatternNode>(*node);
+			erase_msg(copy->msgs, msg_id);
+		}
+		else if (pattern[pos] == '*') {
+			size_t next = skip_wildcard(pattern, pos);
+			copy = std::make_shared<IPCPatternNode>(*node);
+			if (next == pattern.size()) {
+				erase_msg(copy->rest_msgs, msg_id);
+			}
+			else if (node->wildcard != nullptr) {
+				copy->wildcard = remove_pattern(node->wildcard, pattern, next, msg_id);
+			}
+		}
+		else {
+			auto child = find_child(node->children, pattern[pos]);
+			if (child == node->children.end() || pattern.compare(pos, (*child)->label.size(), (*child)->label) != 0) {
+				return node;
+			}
+			IPCPatternPtr changed = remove_pattern(*child, pattern, pos + (*child)->label.size(), msg_id);
+			copy = std::make_shared<IPCPatternNode>(*node);
+			auto slot = copy->children.begin() + (child - node->children.begin());
+			if (changed == nullptr) {
+				copy->children.erase(slot);
+			}
+			else {
+				*slot = changed;
+			}
+		}
+
+		if (empty_node(*copy)) {
+			return nullptr;
+		}
+		if (!copy->label.empty() && copy->msgs.empty() && copy->rest_msgs.empty() && copy->wildcard == nullptr &&
+			copy->children.size() == 1) {
+			// An edge left with a single continuation joins it.
+			std::shared_ptr<IPCPatternNode> merged = std::make_shared<IPCPatternNode>(*copy->children[0]);
+			merged->label = copy->label + merged->label;
+			return merged;
+		}
+		return copy;
+	}
+
+	void add_match(const std::vector<IPCMsg>& msgs, std::vector<const std::vector<IPCMsg>*>& matches) {
+		// A pattern with several '*' can match one handle in more than one way.
+		if (!msgs.empty() && std::find(matches.begin(), matches.end(), &msgs) == matches.end()) {
+			matches.push_back(&msgs);
+		}
+	}
+
+	// Matches the handle from pos on against node, whose label is already matched.
+	void match_node(const IPCPatternNode& node, const char* handle, size_t length, size_t pos,
+		std::vector<const std::vector<IPCMsg>*>& matches) {
+		add_match(node.rest_msgs, matches);
+		if (pos == length) {
+			add_match(node.msgs, matches);
+		}
+
+		if (node.wildcard != nullptr) {
+			size_t run_end = pos;
+			while (run_end < length && handle[run_end] != '.') {
+				++run_end;
+			}
+			for (size_t end = pos; end <= run_end; ++end) {
+				match_node(*node.wildcard, handle, length, end, matches);
+			}
+		}
+
+		if (pos < length) {
+			auto child = find_child(node.children, handle[pos]);
+			if (child != node.children.end()) {
+				const std::string& label = (*child)->label;
+				if (length - pos >= label.size() && memcmp(handle + pos, label.data(), label.size()) == 0) {
+					match_node(**child, handle, length, pos + label.size(), matches);
+				}
+			}
+		}
+	}
+}
+
+std::unique_ptr<IPCMsgTable> IPCMsgTable::with_pattern(const std::string& pattern, const IPCMsg& msg) const {
+	std::unique_ptr<IPCMsgTable> table(new IPCMsgTable(*this));
+	table->patterns_ = insert_pattern(this->patterns_.get(), pattern, 0, msg);
+	return table;
+}
+
+std::unique_ptr<IPCMsgTable> IPCMsgTable::without_pattern(const std::string& pattern, uint64_t msg_id) const {
+	std::unique_ptr<IPCMsgTable> table(new IPCMsgTable(*this));
+	if (table->patterns_ != nullptr) {
+		table->patterns_ = remove_pattern(table->patterns_, pattern, 0, msg_id);
+	}
+	return table;
+}
+
+void IPCMsgTable::match(const char* handle, size_t length, std::vector<const std::vector<IPCMsg>*>& matches) const {
+	if (this->patterns_ != nullptr) {
+		match_node(*this->patterns_, handle, length, 0, matches);
+	}
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cstring>
+#include "../include/common.h"
+
+
+// The messages registered for one handle, called in registration order.
+struct IPCMsgHandlers {
+	// Owned copy of the handle, handed to callbacks as data.msg_handle.
+	std::string msg_handle;
+	std::vector<IPCMsg> msgs;
+};
+
+// '*' matches a run without '.', and a trailing '*' any rest of the handle.
+inline bool is_ipc_pattern(const char* msg_handle) {
+	return strchr(msg_handle, '*') != nullptr;
+}
+
+// A node of the pattern trie. Never modified once built; updates copy the path down to it.
+struct IPCPatternNode {
+	// Characters on the edge from the parent. Empty for the root and for the node after a '*'.
+	std::string label;
+	// Sorted by the first character of their labels, which differ.
+	std::vector<std::shared_ptr<const IPCPatternNode>> children;
+	// Where a '*' in the middle of a pattern leads.
+	std::shared_ptr<const IPCPatternNode> wildcard;
+	// Patterns that end here, and the ones that end here with a trailing '*'.
+	std::vector<IPCMsg> msgs;
+	std::vector<IPCMsg> rest_msgs;
+};
+
+// Handlers by handle id with linear probing. Updates return a copy that shares the unchanged handler lists.
+class IPCMsgTable {
+public:
+	const IPCMsgHandlers* find(uint64_t handle_id) const;
+	// A copy with msg called after the handlers of handle_id. The handle of a new entry is taken from msg.
+	std::unique_ptr<IPCMsgTable> with(uint64_t handle_id, const IPCMsg& msg, std::unique_ptr<const IPCMsgHandlers>& replaced) const;
+	// A copy without the message msg_id of handle_id.
+	std::unique_ptr<IPCMsgTable> without(uint64_t handle_id, uint64_t msg_id, std::unique_ptr<const IPCMsgHandlers>& replaced) const;
+	// A copy with msg called for the handles matching pattern.
+	std::unique_ptr<IPCMsgTable> with_pattern(const std::string& pattern, const IPCMsg& msg) const;
+	// A copy without the message msg_id of pattern.
+	std::unique_ptr<IPCMsgTable> without_pattern(const std::string& pattern, uint64_t msg_id) const;
+	bool has_patterns() const { return this->patterns_ != nullptr; }
+	// Adds each matching pattern's handler list once.
+	void match(const char* handle, size_t length, std::vector<const std::vector<IPCMsg>*>& matches) const;
+	// Frees the handler lists. Only for the last table of a line of copies, once nothing reads it.
+	void clear();
+
+private:
+	struct Slot {
+		uint64_t handle_id;
+		// Null for a free slot.
+		const IPCMsgHandlers* handlers;
+	};
+
+	// A power of two at least twice the number of handles, or empty.
+	std::vector<Slot> slots_;
+	size_t count_ = 0;
+	// Root of the pattern trie, or null without patterns. Freed with the last table that holds it.
+	std::shared_ptr<const IPCPatternNode> patterns_;
+
+	size_t home(uint64_t handle_id) const;
+	// The slot holding handle_id, or the free slot that ends its probe sequence.
+	size_t probe(uint64_t handle_id) const;
+	void resize(size_t slot_count);
+	// Removes the entry in slot, moving back the entries probed past it.
+	void erase(size_t slot);
+};
@@ -0,0 +1,73 @@
+#include "IPCPayloadPool.h"
+#include <algorithm>
+#include <new>
+
+
+IPCPayloadPool::~IPCPayloadPool() {
+	for (Block*& head : this->free_) {
+		while (head != nullptr) {
+			Block* next = head->next;
+			::operator delete(head);
+			head = next;
+		}
+	}
+}
+
+wchar_t* IPCPayloadPool::Acquire(size_t chars) {
+	size_t size_class = 0;
+	while (size_class < CLASS_COUNT && class_chars(size_class) < chars) {
+		++size_class;
+	}
+
+	if (size_class < CLASS_COUNT) {
+		std::lock_guard<std::mutex> lock(this->mutex_);
+		Block* block = this->free_[size_class];
+		if (block != nullptr) {
+			this->free_[size_class] = block->next;
+			this->free_count_[size_class]--;
+			return buffer_of(block);
+		}
+	}
+
+	size_t capacity = size_class < CLASS_COUNT ? class_chars(size_class) : chars;
+	Block* block = static_cast<Block*>(::operator new(sizeof(Block) + capacity * sizeof(wchar_t)));
+	block->pool = this;
+	block->next = nullptr;
+	block->size_class = size_class;
+	return buffer_of(block);
+}
+
+void IPCPayloadPool::Release(const wchar_t* buffer) {
+	if (buffer == nullptr) {
+		return;
+	}
+	Block* block = block_of(buffer);
+	if (block->size_class == UNPOOLED) {
+		::operator delete(block);
+		return;
+	}
+	block->pool->recycle(block);
+}
+
+void IPCPayloadPool::recycle(Block* block) {
+	size_t size_class = block->size_class;
+	{
+		std::lock_guard<std::mutex> lock(this->mutex_);
+		size_t max_free = std::max<size_t>(MAX_FREE_BYTES_PER_CLASS / (class_chars(size_class) * sizeof(wchar_t)), 16);
+		if (this->free_count_[size_class] < max_free) {
+			block->next = this->free_[size_class];
+			this->free_[size_class] = block;
+			this->free_count_[size_class]++;
+			return;
+		}
+	}
+	::operator delete(block);
+}
+
+IPCPayloadPool::Block* IPCPayloadPool::block_of(const wchar_t* buffer) {
+	return reinterpret_cast<Block*>(const_cast<char*>(reinterpret_cast<const char*>(buffer)) - sizeof(Block));
+}
+
+wchar_t* IPCPayloadPool::buffer_of(Block* block) {
+	return reinterpret_cast<wchar_t*>(reinterpret_cast<char*>(block) + sizeof(Block));
+}
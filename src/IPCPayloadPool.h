@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+
+// Recycles receive buffers in power-of-two classes of up to about a megabyte each; larger payloads are not kept.
+class IPCPayloadPool {
+public:
+	IPCPayloadPool() {}
+	IPCPayloadPool(const IPCPayloadPool&) = delete;
+	IPCPayloadPool& operator=(const IPCPayloadPool&) = delete;
+	// Frees the buffers kept for reuse. Buffers still handed out must not be released afterwards.
+	~IPCPayloadPool();
+
+	// A buffer of at least chars wide characters.
+	wchar_t* Acquire(size_t chars);
+	// Gives a buffer from Acquire() back to the pool that handed it out. Null is ignored.
+	static void Release(const wchar_t* buffer);
+
+private:
+	// Precedes each buffer.
+	struct Block {
+		IPCPayloadPool* pool;
+		Block* next;
+		size_t size_class;
+	};
+
+	static const size_t MIN_CLASS_CHARS = 32;
+	static const size_t CLASS_COUNT = 10;
+	// The size class of buffers too large to pool.
+	static const size_t UNPOOLED = CLASS_COUNT;
+	static const size_t MAX_FREE_BYTES_PER_CLASS = 1024 * 1024;
+
+	std::mutex mutex_;
+	// Released buffers by size class, most recent first.
+	Block* free_[CLASS_COUNT] = {};
+	size_t free_count_[CLASS_COUNT] = {};
+
+	static size_t class_chars(size_t size_class) { return MIN_CLASS_CHARS << size_class; }
+	static Block* block_of(const wchar_t* buffer);
+	static wchar_t* buffer_of(Block* block);
+	void recycle(Block* block);
+};
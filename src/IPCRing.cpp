@@ -0,0 +1,48 @@
+#include "IPCRing.h"
+
+#if defined(__linux__)
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <time.h>
+#else
+#include <chrono>
+#endif
+
+
+void IPCDoorbell::ring() {
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (this->waiting_.load(std::memory_order_relaxed) && this->waiting_.exchange(false)) {
+		this->sequence_.fetch_add(1);
+		this->wake();
+	}
+}
+
+#if defined(__linux__)
+void IPCDoorbell::sleep(uint32_t sequence, int timeout_ms) {
+	timespec timeout = { timeout_ms / 1000, static_cast<long>(timeout_ms % 1000) * 1000000 };
+	// Returns at once if a ring() has bumped the sequence since the waiter read it.
+	syscall(SYS_futex, reinterpret_cast<uint32_t*>(&this->sequence_), FUTEX_WAIT_PRIVATE, sequence,
+		timeout_ms >= 0 ? &timeout : nullptr, nullptr, 0);
+}
+
+void IPCDoorbell::wake() {
+	syscall(SYS_futex, reinterpret_cast<uint32_t*>(&this->sequence_), FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+}
+#else
+void IPCDoorbell::sleep(uint32_t sequence, int timeout_ms) {
+	std::unique_lock<std::mutex> lock(this->mutex_);
+	auto rung = [&]() { return this->sequence_.load() != sequence; };
+	if (timeout_ms >= 0) {
+		this->cv_.wait_for(lock, std::chrono::milliseconds(timeout_ms), rung);
+	}
+	else {
+		this->cv_.wait(lock, rung);
+	}
+}
+
+void IPCDoorbell::wake() {
+	std::lock_guard<std::mutex> lock(this->mutex_);
+	this->cv_.notify_one();
+}
+#endif
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+
+#if !defined(__linux__)
+#include <mutex>
+#include <condition_variable>
+#endif
+
+
+// Bounded multi-producer, single-consumer ring with a sequence number per slot.
+template <typename T>
+class IPCRing {
+public:
+	IPCRing() {}
+	IPCRing(const IPCRing&) = delete;
+	IPCRing& operator=(const IPCRing&) = delete;
+
+	// slot_count is a power of two, at least 2, or 0 for a ring that is always full. Not thread-safe.
+	void reset(size_t slot_count);
+
+	// Leaves value alone when the ring is full.
+	bool try_push(T& value);
+	// Consumer only.
+	bool try_pop(T& value);
+	// Consumer only.
+	bool empty() const;
+	// A snapshot for all but the consumer.
+	size_t size() const;
+	size_t capacity() const { return this->capacity_; }
+
+private:
+	struct Slot {
+		std::atomic<size_t> sequence;
+		T value;
+	};
+
+	std::unique_ptr<Slot[]> slots_;
+	size_t capacity_ = 0;
+	size_t mask_ = 0;
+	alignas(64) std::atomic<size_t> tail_{ 0 };
+	alignas(64) std::atomic<size_t> head_{ 0 };
+};
+
+template <typename T>
+void IPCRing<T>::reset(size_t slot_count) {
+	this->slots_.reset(slot_count != 0 ? new Slot[slot_count] : nullptr);
+	this->capacity_ = slot_count;
+	this->mask_ = slot_count != 0 ? slot_count - 1 : 0;
+	for (size_t i = 0; i < slot_count; ++i) {
+		this->slots_[i].sequence.store(i, std::memory_order_relaxed);
+	}
+	this->tail_.store(0, std::memory_order_relaxed);
+	this->head_.store(0, std::memory_order_relaxed);
+}
+
+template <typename T>
+bool IPCRing<T>::try_push(T& value) {
+	if (!this->slots_) {
+		return false;
+	}
+
+	size_t position = this->tail_.load(std::memory_order_relaxed);
+	while (true) {
+		Slot& slot = this->slots_[position & this->mask_];
+		size_t sequence = slot.sequence.load(std::memory_order_acquire);
+		intptr_t lag = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+		if (lag == 0) {
+			if (this->tail_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+				slot.value = std::move(value);
+				slot.sequence.store(position + 1, std::memory_order_release);
+				return true;
+			}
+		}
+		else if (lag < 0) {
+			// The slot still holds the element from one lap ago.
+			return false;
+		}
+		else {
+			position = this->tail_.load(std::memory_order_relaxed);
+		}
+	}
+}
+
+template <typename T>
+bool IPCRing<T>::try_pop(T& value) {
+	if (!this->slots_) {
+		return false;
+	}
+
+	size_t position = this->head_.load(std::memory_order_relaxed);
+	Slot& slot = this->slots_[position & this->mask_];
+	if (slot.sequence.load(std::memory_order_acquire) != position + 1) {
+		// Empty, or the producer that claimed the slot has not finished writing it.
+		return false;
+	}
+	value = std::move(slot.value);
+	slot.sequence.store(position + this->mask_ + 1, std::memory_order_release);
+	this->head_.store(position + 1, std::memory_order_release);
+	return true;
+}
+
+template <typename T>
+bool IPCRing<T>::empty() const {
+	if (!this->slots_) {
+		return true;
+	}
+	size_t position = this->head_.load(std::memory_order_relaxed);
+	return this->slots_[position & this->mask_].sequence.load(std::memory_order_acquire) != position + 1;
+}
+
+template <typename T>
+size_t IPCRing<T>::size() const {
+	size_t head = this->head_.load(std::memory_order_acquire);
+	size_t tail = this->tail_.load(std::memory_order_acquire);
+	return tail > head ? tail - head : 0;
+}
+
+
+// Wakes one waiting thread; ring() only makes a syscall when the waiter is asleep.
+class IPCDoorbell {
+public:
+	// A negative timeout waits forever. May return spuriously.
+	template <typename Ready>
+	void wait(const Ready& ready, int timeout_ms = -1);
+	void ring();
+
+private:
+	std::atomic<uint32_t> sequence_{ 0 };
+	std::atomic<bool> waiting_{ false };
+#if !defined(__linux__)
+	std::mutex mutex_;
+	std::condition_variable cv_;
+#endif
+
+	void sleep(uint32_t sequence, int timeout_ms);
+	void wake();
+};
+
+template <typename Ready>
+void IPCDoorbell::wait(const Ready& ready, int timeout_ms) {
+	uint32_t sequence = this->sequence_.load();
+	this->waiting_.store(true);
+	// Pairs with the fence in ring(): either the producer sees waiting_ or ready() sees what it published.
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (!ready()) {
+		this->sleep(sequence, timeout_ms);
+	}
+	this->waiting_.store(false);
+}
@@ -13,22 +13,297 @@
 #endif 
 
 #include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
 #include "utils.h"
 #include "IPCWatcher.h"
+#include "IPCDispatchPool.h"
+#include "IPCCoalescer.h"
+#include "IPCGatherer.h"
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#if defined(__linux__)
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/random.h>
+#include "UnixSocket.h"
+#endif
+
+static thread_local IPCMsgRequest* dispatching_request = nullptr;
+// The data passed to the running callback, one for each request from dispatching_request on.
+static thread_local const IPCMsgData* dispatching_msgs = nullptr;
+static thread_local size_t dispatching_count = 0;
+// Set on process_thread_ under AG_DISPATCH_SINGLE_THREAD, which dispatches what it receives itself.
+static thread_local bool receiving_inline = false;
+
+// Sends the reply datagram for a call. Replies that cannot be delivered are dropped; the caller times out.
+static bool send_reply(IPCMsgRequest& request, const IPCMsgData& reply, uint32_t status) {
+#if defined(__linux__)
+	if (request.call_id == 0 || request.replied) {
+		return false;
+	}
+	request.replied = true;
+
+	try {
+		std::vector<char> record(serialized_ipc_reply_size(reply));
+		serialize_ipc_reply_into(reply, request.call_id, status, record.data());
+		return unix_datagram_send(make_abstract_address(request.reply_address), record.data(), record.size());
+	}
+	catch (const std::exception&) {
+		return false;
+	}
+#else
+	return false;
+#endif
+}
+
+#if defined(__linux__)
+// Random, so no other process can predict a caller's reply socket and bind it first.
+static uint64_t make_call_id() {
+	uint64_t call_id = 0;
+	while (call_id == 0) {
+		if (getrandom(&call_id, sizeof(call_id), 0) != static_cast<ssize_t>(sizeof(call_id))) {
+			call_id = 0;
+		}
+	}
+	return call_id;
+}
+#endif
+
+void release_ipc_request(IPCMsgRequest& request) {
+	IPCPayloadPool::Release(request.payload);
+	request.payload = nullptr;
+	request.data = { nullptr, nullptr };
+	request.bytes = nullptr;
+	request.bytes_length = 0;
+	request.binary = false;
+	request.handle = nullptr;
+	request.handle_length = 0;
+#ifndef _WIN32
+	for (int fd : request.fds) {
+		close(fd);
+	}
+#endif
+	request.fds.clear();
+	request.coalescing = false;
+}
+
+static void set_dispatching(IPCMsgRequest* requests, const IPCMsgData* msgs, size_t count) {
+	dispatching_request = requests;
+	dispatching_msgs = msgs;
+	dispatching_count = count;
+}
+
+static IPCMsgRequest* find_dispatching(const IPCMsgData* msg_data) {
+	uintptr_t offset = reinterpret_cast<uintptr_t>(msg_data) - reinterpret_cast<uintptr_t>(dispatching_msgs);
+	if (dispatching_request == nullptr || offset % sizeof(IPCMsgData) != 0 || offset / sizeof(IPCMsgData) >= dispatching_count) {
+		return nullptr;
+	}
+	return dispatching_request + offset / sizeof(IPCMsgData);
+}
+
+const IPCMsgRequest* IPCWatcher::current_request(const IPCMsgData* msg_data) {
+	return find_dispatching(msg_data);
+}
+
+bool IPCWatcher::Reply(const IPCMsgData* msg_data, const IPCMsgData& reply) {
+	IPCMsgRequest* request = find_dispatching(msg_data);
+	if (request == nullptr) {
+		return false;
+	}
+	return send_reply(*request, reply, IPC_REPLY_ANSWERED);
+}
+
+bool IPCWatcher::Call(IPCMsgData& msg, int timeout_ms, IPCMsgData& reply) {
+	reply = { nullptr, nullptr };
+#if defined(__linux__)
+	uint64_t call_id = 0;
+	std::string reply_name;
+	int reply_fd = -1;
+
+	// Each call listens on its own datagram socket, so concurrent callers never see each other's replies.
+	for (int attempt = 0; attempt < 4 && reply_fd == -1; ++attempt) {
+		call_id = make_call_id();
+		reply_name = "AppGuard.reply." + std::to_string(getpid()) + "." + std::to_string(call_id);
+		reply_fd = unix_datagram_bind(make_abstract_address(reply_name), true);
+	}
+	if (reply_fd == -1) {
+		return false;
+	}
+
+	bool answered = false;
+	try {
+		size_t record_length = serialized_ipc_call_size(msg, reply_name.length());
+		char* record = this->record_buffer(record_length);
+		serialize_ipc_call_into(msg, call_id, reply_name, record);
+
+		if (this->SendRecord(record, record_length)) {
+			auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+			std::vector<char> reply_record;
+			ucred sender;
+
+			while (!answered) {
+				int remaining_ms = timeout_ms < 0 ? -1 : static_cast<int>(std::max<int64_t>(0,
+					std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count()));
+				if (!unix_datagram_receive(reply_fd, reply_record, remaining_ms, &sender)) {
+					break;
+				}
+				if (sender.uid != geteuid()) {
+					continue;
+				}
+
+				uint64_t reply_id;
+				uint32_t status;
+				const char* message;
+				size_t message_length;
+				const char* record_data = reply_record.data();
+				size_t record_length = reply_record.size();
+				if (unwrap_ipc_record(record_data, record_length) == IPCWireCheck::Invalid ||
+					!parse_ipc_reply(record_data, record_length, reply_id, status, message, message_length) ||
+					reply_id != call_id) {
+					continue;
+				}
+				if (status != IPC_REPLY_ANSWERED) {
+					break;
+				}
+
+				reply = deserialize_from_ipc(message, message_length);
+				answered = reply.msg_handle != nullptr;
+			}
+		}
+	}
+	catch (const std::exception&) {
+		free_ipc_msg_data(reply);
+		answered = false;
+	}
+
+	close(reply_fd);
+	return answered;
+#else
+	return false;
+#endif
+}
 
 IPCWatcher::IPCWatcher(const char* app_handle) :
+	coalescer_(new IPCCoalescer()),
+	gatherer_(new IPCGatherer()),
+	messages_(new IPCMsgTable()),
 	processing(false), watching(false),
 	app_handle_(app_handle) {
+	this->ring_.reset(MAX_RING_SLOTS);
+	this->dispatchers_.emplace_back(new IPCDispatcher());
 	//this->start();
 }
 
 IPCWatcher::~IPCWatcher() {
 	this->stop();
+	IPCMsgTable* messages = this->messages_.load();
+	messages->clear();
+	delete messages;
+#ifndef _WIN32
+	for (int fd : { this->event_fd_, this->notify_fd_, this->poll_timer_fd_ }) {
+		if (fd != -1) {
+			close(fd);
+		}
+	}
+#endif
+}
+
+void IPCWatcher::Configure(const AGOptions& options) {
+	this->queue_capacity_ = options.queue_capacity;
+	this->transport_capacity_ = options.transport_capacity;
+	this->overflow_.policy = options.overflow_policy;
+	this->overflow_.send_timeout_ms = options.send_timeout_ms;
+	this->require_wire_header_ = options.require_wire_header != 0;
+	set_ipc_wire_header(options.wire_header);
+	set_ipc_handle_ids(options.handle_ids != 0);
+
+	// Drop-oldest can only evict from msg_requests_, so it keeps half of the capacity out of the ring.
+	size_t ring_limit = this->overflow_.policy == AG_OVERFLOW_DROP_OLDEST ? this->queue_capacity_ / 2 : this->queue_capacity_;
+	size_t ring_slots = MAX_RING_SLOTS;
+	while (this->queue_capacity_ != 0 && ring_slots > ring_limit) {
+		ring_slots /= 2;
+	}
+	this->ring_.reset(ring_slots >= 2 ? ring_slots : 0);
+
+#if defined(__linux__)
+	this->dispatch_mode_ = options.dispatch_mode;
+	this->dispatch_thread_name_ = options.dispatch_thread_name != nullptr ? options.dispatch_thread_name : "appguard-ipc";
+	this->dispatch_cpu_ = options.dispatch_cpu;
+	this->dispatch_priority_ = options.dispatch_priority;
+#endif
+	this->dispatch_threads_ = this->dispatch_mode_ != AG_DISPATCH_THREADS ? 1 : std::max<size_t>(options.dispatch_threads, 1);
+	std::lock_guard<std::mutex> lock(this->handlers_mutex_);
+	// Nothing dispatches before start(), so the epochs the retired tables wait on no longer matter.
+	this->retired_messages_.clear();
+	this->dispatchers_.clear();
+	for (size_t i = 0; i < this->dispatch_threads_; ++i) {
+		this->dispatchers_.emplace_back(new IPCDispatcher());
+	}
+}
+
+void IPCWatcher::GetQueueStats(AGQueueStats& stats) {
+	{
+		std::lock_guard<std::mutex> lock(this->mutex_);
+		stats.queue_length = this->queued_requests();
+	}
+	stats.queue_capacity = this->queue_capacity_;
+	stats.dropped_oldest = this->overflow_.dropped_oldest;
+	stats.dropped_newest = this->overflow_.dropped_newest;
+	stats.rejected = this->overflow_.rejected;
+	stats.timed_out = this->overflow_.timed_out;
+	stats.coalesced = this->coalescer_->Coalesced();
+	stats.invalid_records = this->invalid_records_;
+}
+
+void IPCWatcher::SetCoalescing(const char* msg_handle, AGCoalescePolicy policy, int window_ms) {
+	this->coalescer_->SetRule(ipc_handle_id(msg_handle), policy, window_ms);
+}
+
+void IPCWatcher::SetGathering(const char* msg_handle, IPCMsgBatchCallback callback, int max_delay_ms, size_t max_count) {
+	this->gatherer_->SetRule(ipc_handle_id(msg_handle), msg_handle, callback, max_delay_ms, max_count);
+	// A sleeping dispatch loop learns about the batches to time from the next request it receives.
 }
 
 void IPCWatcher::start() {
+	if (this->dispatch_mode_ == AG_DISPATCH_MANUAL) {
+		this->watching = true;
+		if (!this->processing) {
+			this->processing = true;
+			this->open_manual_receiver();
+		}
+		return;
+	}
+	if (this->dispatch_mode_ == AG_DISPATCH_SINGLE_THREAD) {
+		this->watching = true;
+		if (!this->processing) {
+			this->processing = true;
+			this->process_thread_ = std::thread([this]() {
+				this->configure_dispatch_thread();
+				receiving_inline = true;
+				process_messages();
+				});
+		}
+		return;
+	}
+
 	if (!this->watching) {
 		this->watching = true;
+		if (this->dispatch_threads_ > 1) {
+			this->pool_.reset(new IPCDispatchPool(this->dispatch_threads_, [this](IPCMsgRequest& request, size_t worker) {
+				this->dispatch_request(request, *this->dispatchers_[worker]);
+				this->notify_space();
+				}));
+		}
 		this->watcher_thread_ = std::thread([this]() {WatchProcess(); });
 			// this->watcher_thread_.detach();
 	}
@@ -42,60 +317,762 @@ void IPCWatcher::start() {
 void IPCWatcher::stop() {
 	this->watching = false;
 	this->processing = false;
-	this->cv_.notify_all();
+	this->interrupt_processing();
+	this->doorbell_.ring();
+	{
+		std::lock_guard<std::mutex> lock(this->mutex_);
+		this->space_cv_.notify_all();
+	}
+#if defined(__linux__)
+	if (this->notify_fd_ != -1) {
+		// Wakes ProcessMessages() out of its wait.
+		uint64_t count = 1;
+		write(this->notify_fd_, &count, sizeof(count));
+	}
+#endif
 	if (this->process_thread_.joinable()) {
 		this->process_thread_.join();
 	}
 	if (this->watcher_thread_.joinable()) {
 		this->watcher_thread_.join();
 	}
-	this->messages_.clear();
-	this->msg_requests_ = std::deque<IPCMsgData>();
+	if (this->dispatch_mode_ == AG_DISPATCH_MANUAL) {
+		std::lock_guard<std::mutex> lock(this->process_mutex_);
+		this->close_receiver();
+	}
+	this->pool_.reset();
+	{
+		// With the dispatch threads gone nothing reads the tables, and the current one holds every live handler list.
+		std::lock_guard<std::mutex> lock(this->handlers_mutex_);
+		IPCMsgTable* messages = this->messages_.exchange(new IPCMsgTable());
+		messages->clear();
+		delete messages;
+		this->retired_messages_.clear();
+		this->msg_handle_ids_.clear();
+		this->msg_patterns_.clear();
+		this->keep_handles_ = false;
+	}
+	IPCMsgRequest request;
+	while (this->ring_.try_pop(request)) {
+		release_ipc_request(request);
+	}
+	for (auto& request : this->msg_requests_) {
+		release_ipc_request(request);
+	}
+	this->msg_requests_ = std::deque<IPCMsgRequest>();
+	this->dispatching_ = 0;
+	this->spilling_ = false;
+	// The requests the rules counted in are gone with the queue.
+	this->coalescer_->Reset();
+	this->gatherer_->Clear();
 }
 
-void IPCWatcher::RegisterIPCMsg(IPCMsg& msg) {
-	this->mutex_.lock();
-	this->messages_.insert({ msg.msg_handle, msg });
-	this->mutex_.unlock();
+void IPCWatcher::publish_messages(std::unique_ptr<IPCMsgTable> messages, std::unique_ptr<const IPCMsgHandlers> replaced) {
+	IPCRetiredTable retired;
+	retired.messages.reset(this->messages_.exchange(messages.release()));
+	retired.handlers = std::move(replaced);
+	// After the exchange: a dispatcher whose epoch is even now, or changes later, reads the new table.
+	for (auto& dispatcher : this->dispatchers_) {
+		retired.epochs.push_back(dispatcher->epoch);
+	}
+	this->retired_messages_.push_back(std::move(retired));
+	this->reclaim_messages();
 }
 
-void IPCWatcher::UnregisterIPCMsg(int msg_id) {
-	this->mutex_.lock();
-	for (auto msg : this->messages_) {
-		if (msg_id == msg.second.msg_id) {
-			this->messages_.erase(msg.first);
-			break;
+void IPCWatcher::reclaim_messages() {
+	auto readable = [this](const IPCRetiredTable& retired) {
+		for (size_t i = 0; i < retired.epochs.size(); ++i) {
+			if (retired.epochs[i] % 2 != 0 && this->dispatchers_[i]->epoch == retired.epochs[i]) {
+				return true;
+			}
 		}
+		return false;
+	};
+	this->retired_messages_.erase(std::remove_if(this->retired_messages_.begin(), this->retired_messages_.end(),
+		[&](const IPCRetiredTable& retired) { return !readable(retired); }), this->retired_messages_.end());
+}
+
+bool IPCWatcher::RegisterIPCMsg(IPCMsg& msg) {
+	uint64_t handle_id = ipc_handle_id(msg.msg_handle);
+	std::lock_guard<std::mutex> lock(this->handlers_mutex_);
+	const IPCMsgTable* current = this->messages_.load();
+	auto pattern_iter = this->msg_patterns_.find(msg.msg_id);
+	if (pattern_iter != this->msg_patterns_.end()) {
+		return pattern_iter->second == msg.msg_handle;
+	}
+	if (is_ipc_pattern(msg.msg_handle)) {
+		if (this->msg_handle_ids_.count(msg.msg_id) != 0) {
+			return false;
+		}
+		std::string& pattern = this->msg_patterns_[msg.msg_id];
+		pattern = msg.msg_handle;
+		this->keep_handles_ = true;
+		this->publish_messages(current->with_pattern(pattern, msg), nullptr);
+		return true;
+	}
+
+	const IPCMsgHandlers* handlers = current->find(handle_id);
+	if (handlers != nullptr && handlers->msg_handle != msg.msg_handle) {
+		// Another handle has the same id; the first one registered keeps it.
+		return false;
+	}
+	auto id_iter = this->msg_handle_ids_.emplace(msg.msg_id, handle_id);
+	if (!id_iter.second) {
+		return id_iter.first->second == handle_id;
 	}
-	this->mutex_.unlock();
+	std::unique_ptr<const IPCMsgHandlers> replaced;
+	std::unique_ptr<IPCMsgTable> messages = current->with(handle_id, msg, replaced);
+	this->publish_messages(std::move(messages), std::move(replaced));
+	return true;
 }
 
-void IPCWatcher::send_request(IPCMsgData& msg_request) {
-	this->mutex_.lock();
-	this->msg_requests_.push_back(msg_request);
-	this->cv_.notify_one();
-	this->mutex_.unlock();
+void IPCWatcher::UnregisterIPCMsg(uint64_t msg_id) {
+	uint64_t handle_id = 0;
+	bool pattern = false;
+	{
+		std::lock_guard<std::mutex> lock(this->handlers_mutex_);
+		auto id_iter = this->msg_handle_ids_.find(msg_id);
+		auto pattern_iter = this->msg_patterns_.find(msg_id);
+		if (id_iter != this->msg_handle_ids_.end()) {
+			handle_id = id_iter->second;
+			this->msg_handle_ids_.erase(id_iter);
+			std::unique_ptr<const IPCMsgHandlers> replaced;
+			std::unique_ptr<IPCMsgTable> messages = this->messages_.load()->without(handle_id, msg_id, replaced);
+			this->publish_messages(std::move(messages), std::move(replaced));
+		}
+		else if (pattern_iter != this->msg_patterns_.end()) {
+			this->publish_messages(this->messages_.load()->without_pattern(pattern_iter->second, msg_id), nullptr);
+			this->msg_patterns_.erase(pattern_iter);
+			this->keep_handles_ = !this->msg_patterns_.empty();
+			pattern = true;
+		}
+		else {
+			return;
+		}
+	}
+
+	// Waits out dispatches from the old table that may run the handler, except inside a callback, where it could deadlock.
+	if (dispatching_request != nullptr) {
+		return;
+	}
+	for (auto& dispatcher : this->dispatchers_) {
+		uint64_t epoch = dispatcher->epoch;
+		if (epoch % 2 == 0) {
+			continue;
+		}
+		if (pattern ? !dispatcher->matching : dispatcher->handle_id != handle_id) {
+			continue;
+		}
+		this->epoch_waiters_++;
+		{
+			std::unique_lock<std::mutex> lock(this->epoch_mutex_);
+			this->epoch_cv_.wait(lock, [&]() { return dispatcher->epoch != epoch; });
+		}
+		this->epoch_waiters_--;
+	}
+
+	std::lock_guard<std::mutex> lock(this->handlers_mutex_);
+	this->reclaim_messages();
 }
 
-void IPCWatcher::WatchProcess() {
-	while (this->watching) {
+void IPCWatcher::send_request(IPCMsgRequest&& msg_request) {
+	if (this->coalescer_->Active()) {
+		this->coalescer_->Received(msg_request);
+	}
+	if (receiving_inline) {
+		// No hand-off: the callback runs here, after anything another receiving thread queued before it.
+		this->dispatch_queued();
+		this->route_request(msg_request);
+		return;
+	}
+
+	if (!this->spilling_.load(std::memory_order_acquire) && this->ring_.try_push(msg_request)) {
+		this->doorbell_.ring();
+	}
+	else {
+		std::vector<IPCMsgRequest> discarded;
 		std::unique_lock<std::mutex> lock(this->mutex_);
-		this->cv_.wait(lock, [&]() {
-			return !msg_requests_.empty() || !watching;
-			});
-		if (!this->watching) {
+		this->enqueue_request(lock, std::move(msg_request), discarded);
+		lock.unlock();
+		this->doorbell_.ring();
+		discard_requests(discarded);
+	}
+	if (this->dispatch_mode_ == AG_DISPATCH_SINGLE_THREAD) {
+		this->wake_receiver();
+	}
+}
+
+void IPCWatcher::dispatch_queued() {
+	if (!receiving_inline) {
+		return;
+	}
+	IPCMsgRequest request;
+	while (this->pop_request(request)) {
+		this->route_request(request);
+	}
+}
+
+size_t IPCWatcher::queued_requests() const {
+	size_t queued = this->ring_.size() + this->msg_requests_.size() + this->dispatching_.load(std::memory_order_relaxed);
+	return this->pool_ ? queued + this->pool_->Pending() : queued;
+}
+
+void IPCWatcher::enqueue_request(std::unique_lock<std::mutex>& lock, IPCMsgRequest&& request, std::vector<IPCMsgRequest>& discarded) {
+	if (this->queue_capacity_ != 0 && this->queued_requests() >= this->queue_capacity_) {
+		switch (this->overflow_.policy) {
+		case AG_OVERFLOW_DROP_OLDEST:
+			if (this->msg_requests_.empty()) {
+				// Everything older is already being dispatched.
+				this->overflow_.dropped_newest++;
+				discarded.push_back(std::move(request));
+				return;
+			}
+			discarded.push_back(std::move(this->msg_requests_.front()));
+			this->msg_requests_.pop_front();
+			this->overflow_.dropped_oldest++;
+			break;
+		case AG_OVERFLOW_DROP_NEWEST:
+			this->overflow_.dropped_newest++;
+			discarded.push_back(std::move(request));
+			return;
+		case AG_OVERFLOW_FAIL_FAST:
+			this->overflow_.rejected++;
+			discarded.push_back(std::move(request));
+			return;
+		default:
+			if (this->dispatch_mode_ == AG_DISPATCH_MANUAL) {
+				// This is the thread that drains the queue; ProcessMessages() stops reading instead.
+				break;
+			}
+			if (this->dispatch_mode_ == AG_DISPATCH_SINGLE_THREAD) {
+				// The draining thread only looks at the queue once woken; the receiver stops reading instead.
+				break;
+			}
+			this->space_waiters_++;
+			this->doorbell_.ring();
+			this->space_cv_.wait(lock, [&]() {
+				return this->queued_requests() < this->queue_capacity_ || !this->processing;
+				});
+			this->space_waiters_--;
+			if (!this->processing) {
+				discarded.push_back(std::move(request));
+				return;
+			}
+			break;
+		}
+	}
+
+	// With nothing spilled, the ring may have room again by now.
+	if (this->msg_requests_.empty() && this->ring_.try_push(request)) {
+		return;
+	}
+	this->msg_requests_.push_back(std::move(request));
+	this->spilling_.store(true, std::memory_order_release);
+}
+
+void IPCWatcher::notify_space() {
+	// Pairs with the waiter checking queued_requests() after it is counted in space_waiters_.
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (this->space_waiters_.load(std::memory_order_relaxed) != 0) {
+		std::lock_guard<std::mutex> lock(this->mutex_);
+		this->space_cv_.notify_all();
+	}
+}
+
+void IPCWatcher::discard_requests(std::vector<IPCMsgRequest>& discarded) {
+	for (auto& request : discarded) {
+		this->coalescer_->Discarded(request);
+		if (request.call_id != 0) {
+			IPCMsgData no_reply = { request.data.msg_handle, nullptr };
+			send_reply(request, no_reply, IPC_REPLY_UNANSWERED);
+		}
+		release_ipc_request(request);
+	}
+	discarded.clear();
+}
+
+namespace {
+	class WatcherIPCSender : public IPCSender {
+	public:
+		explicit WatcherIPCSender(IPCWatcher& watcher) : watcher_(watcher) {}
+
+		bool Send(IPCMsgData& msg) override {
+			std::lock_guard<std::mutex> lock(mutex_);
+			watcher_.SendMsg(msg);
+			return true;
+		}
+
+		size_t SendBatch(IPCMsgData* msgs, size_t count) override {
+			std::lock_guard<std::mutex> lock(mutex_);
+			return watcher_.SendMsgBatch(msgs, count);
+		}
+
+	private:
+		IPCWatcher& watcher_;
+		std::mutex mutex_;
+	};
+}
+
+size_t IPCSender::SendBatch(IPCMsgData* msgs, size_t count) {
+	size_t sent = 0;
+	while (sent < count && this->Send(msgs[sent])) {
+		++sent;
+	}
+	return sent;
+}
+
+IPCSender* IPCWatcher::CreateSender() {
+	return new WatcherIPCSender(*this);
+}
+
+size_t IPCWatcher::SendMsgBatch(IPCMsgData* msgs, size_t count) {
+	for (size_t i = 0; i < count; ++i) {
+		this->SendMsg(msgs[i]);
+	}
+	return count;
+}
+
+char* IPCWatcher::record_buffer(size_t length) {
+	return ipc_send_scratch(length);
+}
+
+bool IPCWatcher::SendBytes(const char* msg_handle, const void* data, size_t length) {
+	try {
+		IPCWireMsg wire_msg = make_ipc_binary_wire_msg(msg_handle, data, length);
+		size_t record_length = serialized_ipc_size(wire_msg);
+		char* record = this->record_buffer(record_length);
+		serialize_for_ipc_into(wire_msg, record);
+		return this->SendRecord(record, record_length);
+	}
+	catch (const std::exception&) {
+		return false;
+	}
+}
+
+void IPCWatcher::receive_record(const char* data, size_t length, std::vector<int>& fds) {
+	IPCMsgRequest request;
+	request.fds.swap(fds);
+
+	IPCWireCheck wire_check = unwrap_ipc_record(data, length);
+	if (wire_check == IPCWireCheck::Invalid || (wire_check == IPCWireCheck::Plain && this->require_wire_header_)) {
+		++this->invalid_records_;
+		release_ipc_request(request);
+		return;
+	}
+
+	if (is_ipc_call(data, length)) {
+		IPCCallHeader header;
+		if (!parse_ipc_call(data, length, header) || header.call_id == 0) {
+			release_ipc_request(request);
+			return;
+		}
+		request.call_id = header.call_id;
+		request.reply_address.assign(header.reply_address, header.reply_address_length);
+		data = header.message;
+		length = header.message_length;
+	}
+
+	if (is_ipc_batch(data, length)) {
+		// Descriptors and calls only ever travel with single messages.
+		release_ipc_request(request);
+		this->receive_batch(data, length);
+		return;
+	}
+
+	if (parse_message(data, length, request)) {
+		this->send_request(std::move(request));
+	}
+	else {
+		release_ipc_request(request);
+	}
+}
+
+bool IPCWatcher::parse_message(const char* data, size_t length, IPCMsgRequest& request) {
+	IPCMsgView view;
+	if (!parse_ipc_message(data, length, view)) {
+		return false;
+	}
+
+	// Decoded text, then the data as received, then the handle.
+	bool keep_handle = view.handle != nullptr && this->keep_handles_.load(std::memory_order_relaxed);
+	size_t text_chars = view.binary ? 0 : view.data_length + 1;
+	size_t byte_count = view.data_length + (keep_handle ? view.handle_length + 1 : 0);
+	wchar_t* buffer;
+	try {
+		buffer = this->payloads_.Acquire(text_chars + (byte_count + sizeof(wchar_t) - 1) / sizeof(wchar_t));
+	}
+	catch (const std::bad_alloc&) {
+		return false;
+	}
+	if (!view.binary && decode_ipc_data_into(view.data, view.data_length, buffer) == IPC_DECODE_INVALID) {
+		IPCPayloadPool::Release(buffer);
+		return false;
+	}
+	char* bytes = reinterpret_cast<char*>(buffer + text_chars);
+	memcpy(bytes, view.data, view.data_length);
+	if (keep_handle) {
+		char* handle = bytes + view.data_length;
+		memcpy(handle, view.handle, view.handle_length);
+		handle[view.handle_length] = '\0';
+		request.handle = handle;
+		request.handle_length = view.handle_length;
+	}
+	request.payload = buffer;
+	request.data.msg_data = view.binary ? nullptr : buffer;
+	request.bytes = bytes;
+	request.bytes_length = view.data_length;
+	request.binary = view.binary;
+	request.handle_id = view.handle_id;
+	return true;
+}
+
+void IPCWatcher::receive_batch(const char* data, size_t length) {
+	uint32_t header[2];
+	if (length < sizeof(header)) {
+		return;
+	}
+	memcpy(header, data, sizeof(header));
+	const char* current_pos = data + sizeof(header);
+	const char* const data_end = data + length;
+
+	for (uint32_t i = 0; i < header[1]; ++i) {
+		uint32_t entry_length;
+		if (static_cast<size_t>(data_end - current_pos) < sizeof(uint32_t)) {
+			break;
+		}
+		memcpy(&entry_length, current_pos, sizeof(uint32_t));
+		current_pos += sizeof(uint32_t);
+		if (static_cast<size_t>(data_end - current_pos) < entry_length) {
 			break;
 		}
-        while (!this->msg_requests_.empty()) {
-            auto request = this->msg_requests_.front();
-			auto callback_iter = this->messages_.find(std::string(request.msg_handle));
-			if (callback_iter != this->messages_.end()) {
-				callback_iter->second.callback(&request);
+
+		IPCMsgRequest request;
+		if (parse_message(current_pos, entry_length, request)) {
+			this->send_request(std::move(request));
+		}
+		current_pos += entry_length;
+	}
+}
+
+// Text callbacks get the decoded message and skip binary ones; bytes callbacks get the data as received.
+static void run_callback(const IPCMsg& msg, IPCMsgRequest& request) {
+	request.msg_id = msg.msg_id;
+	if (msg.callback != nullptr) {
+		if (!request.binary) {
+			msg.callback(&request.data);
+		}
+	}
+	else if (msg.bytes_callback != nullptr) {
+		IPCMsgBytes bytes = { request.data.msg_handle, request.bytes, request.bytes_length, msg.msg_id };
+		msg.bytes_callback(&bytes);
+	}
+}
+
+void IPCWatcher::dispatch_request(IPCMsgRequest& request, IPCDispatcher& dispatcher) {
+	dispatcher.handle_id = request.handle_id;
+	dispatcher.matching = request.handle != nullptr;
+	dispatcher.epoch++;
+	const IPCMsgTable* messages = this->messages_.load();
+	const IPCMsgHandlers* handlers = messages->find(request.handle_id);
+	if (handlers != nullptr) {
+		request.data.msg_handle = handlers->msg_handle.c_str();
+		set_dispatching(&request, &request.data, 1);
+		for (const IPCMsg& msg : handlers->msgs) {
+			run_callback(msg, request);
+		}
+		set_dispatching(nullptr, nullptr, 0);
+	}
+	if (request.handle != nullptr && messages->has_patterns()) {
+		// Patterns are matched after the exact handlers, against the handle as sent.
+		messages->match(request.handle, request.handle_length, dispatcher.matches);
+		if (!dispatcher.matches.empty()) {
+			request.data.msg_handle = request.handle;
+			set_dispatching(&request, &request.data, 1);
+			for (const std::vector<IPCMsg>* msgs : dispatcher.matches) {
+				for (const IPCMsg& msg : *msgs) {
+					run_callback(msg, request);
+				}
 			}
-			delete request.msg_handle;
-			delete request.msg_data;
-            this->msg_requests_.pop_front();
-        }
-		lock.unlock();
+			set_dispatching(nullptr, nullptr, 0);
+			dispatcher.matches.clear();
+		}
+	}
+	if (request.call_id != 0 && !request.replied) {
+		IPCMsgData no_reply = { request.data.msg_handle, nullptr };
+		send_reply(request, no_reply, IPC_REPLY_UNANSWERED);
+	}
+	// The handle belongs to the table, which may be freed once the epoch is even again.
+	request.data.msg_handle = nullptr;
+	dispatcher.epoch++;
+	if (this->epoch_waiters_ != 0) {
+		std::lock_guard<std::mutex> lock(this->epoch_mutex_);
+		this->epoch_cv_.notify_all();
+	}
+	release_ipc_request(request);
+}
+
+// Runs the callbacks of the batches and releases their messages. Returns how many messages they held.
+static size_t run_batches(std::vector<IPCGatherer::Batch>& batches) {
+	size_t ran = 0;
+	std::vector<IPCMsgData> msgs;
+	for (auto& batch : batches) {
+		msgs.clear();
+		for (auto& request : batch.requests) {
+			msgs.push_back({ batch.msg_handle.c_str(), request.data.msg_data });
+		}
+		set_dispatching(batch.requests.data(), msgs.data(), msgs.size());
+		batch.callback(msgs.data(), msgs.size());
+		set_dispatching(nullptr, nullptr, 0);
+		ran += batch.requests.size();
+		for (auto& request : batch.requests) {
+			release_ipc_request(request);
+		}
+	}
+	batches.clear();
+	return ran;
+}
+
+size_t IPCWatcher::route_request(IPCMsgRequest& request) {
+	// Both see the requests of a handle in the order received, which the pool would not keep across strands.
+	if (request.coalescing && !this->coalescer_->Admit(request)) {
+		release_ipc_request(request);
+		this->notify_space();
+		return 0;
+	}
+	if (this->gatherer_->Active() && !request.binary) {
+		std::vector<IPCGatherer::Batch> ready;
+		// Nothing times the batches under AG_DISPATCH_SINGLE_THREAD, where the receiver waits on the transport.
+		if (this->gatherer_->Add(request, this->dispatch_mode_ != AG_DISPATCH_SINGLE_THREAD, ready)) {
+			size_t ran = run_batches(ready);
+			this->notify_space();
+			return ran;
+		}
+	}
+
+	if (this->pool_) {
+		// Moving it to the pool leaves the queued count unchanged, so there is no room to signal yet.
+		this->pool_->Submit(std::move(request));
+		return 1;
+	}
+	this->dispatch_request(request, *this->dispatchers_[0]);
+	this->notify_space();
+	return 1;
+}
+
+size_t IPCWatcher::run_due_batches(int& next_ms) {
+	std::vector<IPCGatherer::Batch> ready;
+	next_ms = this->gatherer_->TakeDue(ready);
+	return run_batches(ready);
+}
+
+bool IPCWatcher::pop_request(IPCMsgRequest& request) {
+	if (this->ring_.try_pop(request)) {
+		return true;
+	}
+	if (!this->spilling_.load(std::memory_order_acquire)) {
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(this->mutex_);
+	if (this->msg_requests_.empty()) {
+		this->spilling_.store(false, std::memory_order_release);
+		return false;
+	}
+	request = std::move(this->msg_requests_.front());
+	this->msg_requests_.pop_front();
+	// Once the spilled requests are gone, later ones can go through the ring again.
+	this->spilling_.store(!this->msg_requests_.empty(), std::memory_order_release);
+	return true;
+}
+
+#if defined(__linux__)
+// Returns whether the descriptor was readable.
+static bool drain_event_fd(int fd) {
+	uint64_t count;
+	bool drained = false;
+	while (read(fd, &count, sizeof(count)) > 0) {
+		drained = true;
+	}
+	return drained;
+}
+#endif
+
+void IPCWatcher::open_manual_receiver() {
+#if defined(__linux__)
+	if (this->event_fd_ == -1) {
+		this->event_fd_ = epoll_create1(EPOLL_CLOEXEC);
+		this->notify_fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+		this->poll_timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+		for (int fd : { this->notify_fd_, this->poll_timer_fd_ }) {
+			epoll_event event = {};
+			event.events = EPOLLIN;
+			event.data.fd = fd;
+			epoll_ctl(this->event_fd_, EPOLL_CTL_ADD, fd, &event);
+		}
+	}
+
+	std::lock_guard<std::mutex> lock(this->process_mutex_);
+	if (this->event_fd_ == -1 || !this->open_receiver()) {
+		return;
+	}
+	std::vector<int> fds;
+	this->receiver_fds(fds);
+	for (int fd : fds) {
+		epoll_event event = {};
+		event.events = EPOLLIN;
+		event.data.fd = fd;
+		epoll_ctl(this->event_fd_, EPOLL_CTL_ADD, fd, &event);
+	}
+	// Messages may have been sent before the receiver was open.
+	uint64_t count = 1;
+	write(this->notify_fd_, &count, sizeof(count));
+#endif
+}
+
+void IPCWatcher::poll_receiver_in(int delay_ms) {
+#if defined(__linux__)
+	auto due = std::chrono::steady_clock::now() + std::chrono::milliseconds(delay_ms);
+	if (due >= this->poll_due_) {
+		return;
+	}
+	this->poll_due_ = due;
+	itimerspec timer = {};
+	timer.it_value.tv_sec = delay_ms / 1000;
+	timer.it_value.tv_nsec = static_cast<long>(delay_ms % 1000) * 1000000 + 1;
+	timerfd_settime(this->poll_timer_fd_, 0, &timer, nullptr);
+#endif
+}
+
+void IPCWatcher::configure_dispatch_thread() {
+#if defined(__linux__)
+	// Failures leave the thread as it was: unnamed, on any CPU, at the priority of the process.
+	pthread_setname_np(pthread_self(), this->dispatch_thread_name_.substr(0, 15).c_str());
+	if (this->dispatch_cpu_ >= 0 && this->dispatch_cpu_ < CPU_SETSIZE) {
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		CPU_SET(this->dispatch_cpu_, &cpus);
+		pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+	}
+	if (this->dispatch_priority_ != 0) {
+		// On Linux the nice value belongs to the thread, not the process.
+		setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), this->dispatch_priority_);
+	}
+#endif
+}
+
+size_t IPCWatcher::ProcessMessages(size_t max_messages, int timeout_ms) {
+	if (this->dispatch_mode_ != AG_DISPATCH_MANUAL) {
+		// The library's threads run the callbacks. Waiting out the timeout keeps a polling loop from spinning.
+		if (timeout_ms > 0 && dispatching_request == nullptr) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(timeout_ms));
+		}
+		return 0;
+	}
+#if defined(__linux__)
+	if (dispatching_request != nullptr) {
+		// Callbacks do not nest.
+		return 0;
+	}
+	std::lock_guard<std::mutex> process_lock(this->process_mutex_);
+	if (!this->processing || this->event_fd_ == -1) {
+		return 0;
+	}
+
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(std::max(timeout_ms, 0));
+	size_t dispatched = 0;
+	size_t taken = 0;
+	IPCMsgRequest request;
+	while (true) {
+		drain_event_fd(this->notify_fd_);
+		if (drain_event_fd(this->poll_timer_fd_)) {
+			this->poll_due_ = std::chrono::steady_clock::time_point::max();
+		}
+		bool room;
+		{
+			std::lock_guard<std::mutex> lock(this->mutex_);
+			room = this->queue_capacity_ == 0 || this->queued_requests() < this->queue_capacity_;
+		}
+		if (room) {
+			// A full queue leaves the rest in the transport, where senders feel the backpressure.
+			this->receive_available();
+		}
+
+		while ((max_messages == 0 || taken < max_messages) && this->pop_request(request)) {
+			dispatched += this->route_request(request);
+			taken++;
+		}
+		if (this->gatherer_->Active()) {
+			int next_ms;
+			dispatched += this->run_due_batches(next_ms);
+			if (next_ms >= 0) {
+				this->poll_receiver_in(next_ms);
+			}
+		}
+		if (taken != 0 || dispatched != 0 || timeout_ms == 0 || !this->processing) {
+			break;
+		}
+
+		int remaining_ms = -1;
+		if (timeout_ms > 0) {
+			remaining_ms = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(
+				deadline - std::chrono::steady_clock::now()).count());
+			if (remaining_ms <= 0) {
+				break;
+			}
+		}
+		epoll_event event;
+		if (epoll_wait(this->event_fd_, &event, 1, remaining_ms) == -1 && errno != EINTR) {
+			break;
+		}
+	}
+
+	if (!this->ring_.empty() || this->spilling_.load(std::memory_order_acquire)) {
+		// Keeps the event descriptor readable for what max_messages left behind.
+		uint64_t count = 1;
+		write(this->notify_fd_, &count, sizeof(count));
+	}
+	return dispatched;
+#else
+	return 0;
+#endif
 }
+
+// Drains the ring, then the spilled requests, dispatching with no lock held.
+void IPCWatcher::WatchProcess() {
+	IPCMsgRequest request;
+	std::deque<IPCMsgRequest> batch;
+
+	while (this->watching) {
+		if (this->ring_.try_pop(request)) {
+			this->route_request(request);
+			continue;
+		}
+
+		if (this->spilling_.load(std::memory_order_acquire)) {
+			{
+				std::lock_guard<std::mutex> lock(this->mutex_);
+				batch.swap(this->msg_requests_);
+				this->dispatching_.store(batch.size(), std::memory_order_relaxed);
+			}
+			for (auto& spilled : batch) {
+				// Counted from here like a request popped off the ring, so the pool does not count it twice.
+				this->dispatching_.fetch_sub(1, std::memory_order_relaxed);
+				this->route_request(spilled);
+			}
+			batch.clear();
+
+			std::lock_guard<std::mutex> lock(this->mutex_);
+			this->spilling_.store(!this->msg_requests_.empty(), std::memory_order_release);
+			this->space_cv_.notify_all();
+			continue;
+		}
+
+		int next_ms = -1;
+		if (this->gatherer_->Active()) {
+			this->run_due_batches(next_ms);
+		}
+		this->doorbell_.wait([&]() {
+			return !this->ring_.empty() || this->spilling_ || !this->watching;
+			}, next_ms);
+	}
 }
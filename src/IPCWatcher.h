@@ -13,41 +13,306 @@
 #include <functional>
 #include <unordered_map>
 #include <deque>
+#include <vector>
 #include <thread>
+#include <atomic>
 #include <mutex>
 #include <condition_variable>
+#include <chrono>
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include "IPCRing.h"
+#include "IPCMsgTable.h"
+#include "IPCPayloadPool.h"
 #include "../include/common.h"
 
+class IPCDispatchPool;
+class IPCCoalescer;
+class IPCGatherer;
 
 
+// A received message together with what travelled with it. Owned by the watcher until its callback returns.
+struct IPCMsgRequest {
+	// data points into payload, a buffer of the payload pool; data.msg_handle is set at dispatch.
+	uint64_t handle_id = 0;
+	wchar_t* payload = nullptr;
+	// The data as received; data.msg_data stays null for binary messages.
+	const char* bytes = nullptr;
+	size_t bytes_length = 0;
+	bool binary = false;
+	// The handle as sent, kept only while patterns are registered.
+	const char* handle = nullptr;
+	size_t handle_length = 0;
+	// The registered message whose callback is running.
+	uint64_t msg_id = 0;
+	IPCMsgData data = { nullptr, nullptr };
+	std::vector<int> fds;
+	// Set for calls.
+	uint64_t call_id = 0;
+	std::string reply_address;
+	bool replied = false;
+	// Set when a coalescing rule counted the request in.
+	bool coalescing = false;
+	std::chrono::steady_clock::time_point received;
+};
+
+void release_ipc_request(IPCMsgRequest& request);
+
+enum class IPCSendResult {
+	Sent,
+	// The transport is full for now.
+	Retry,
+	Failed
+};
+
+enum class IPCOverflowResult {
+	Sent,
+	// Discarded under a drop policy and reported to callers as sent.
+	Dropped,
+	Failed
+};
+
+// Overflow policy and drop counters of one instance, shared by the watcher and the senders it creates.
+class IPCOverflowControl {
+public:
+	AGOverflowPolicy policy = AG_OVERFLOW_BLOCK;
+	int send_timeout_ms = 1000;
+	std::atomic<uint64_t> dropped_oldest{ 0 };
+	std::atomic<uint64_t> dropped_newest{ 0 };
+	std::atomic<uint64_t> rejected{ 0 };
+	std::atomic<uint64_t> timed_out{ 0 };
+
+	// evict_oldest() returns how many messages the evicted record held, or 0 when it cannot evict.
+	template <typename Attempt, typename Evict>
+	IPCOverflowResult send(size_t message_count, const Attempt& attempt, const Evict& evict_oldest);
+	template <typename Attempt>
+	IPCOverflowResult send(size_t message_count, const Attempt& attempt) {
+		return send(message_count, attempt, []() { return static_cast<size_t>(0); });
+	}
+	// Waits for room up to send_timeout_ms, whatever the policy.
+	template <typename Attempt>
+	bool send_blocking(size_t message_count, const Attempt& attempt);
+
+private:
+	static const int MAX_EVICTIONS = 16;
+};
+
+template <typename Attempt, typename Evict>
+IPCOverflowResult IPCOverflowControl::send(size_t message_count, const Attempt& attempt, const Evict& evict_oldest) {
+	IPCSendResult result = attempt();
+	if (result != IPCSendResult::Retry) {
+		return result == IPCSendResult::Sent ? IPCOverflowResult::Sent : IPCOverflowResult::Failed;
+	}
+
+	switch (this->policy) {
+	case AG_OVERFLOW_FAIL_FAST:
+		this->rejected += message_count;
+		return IPCOverflowResult::Failed;
+	case AG_OVERFLOW_DROP_OLDEST:
+		for (int eviction = 0; eviction < MAX_EVICTIONS; ++eviction) {
+			size_t evicted = evict_oldest();
+			if (evicted == 0) {
+				break;
+			}
+			this->dropped_oldest += evicted;
+			result = attempt();
+			if (result != IPCSendResult::Retry) {
+				return result == IPCSendResult::Sent ? IPCOverflowResult::Sent : IPCOverflowResult::Failed;
+			}
+		}
+		this->dropped_newest += message_count;
+		return IPCOverflowResult::Dropped;
+	case AG_OVERFLOW_DROP_NEWEST:
+		this->dropped_newest += message_count;
+		return IPCOverflowResult::Dropped;
+	default:
+		return send_blocking(message_count, attempt) ? IPCOverflowResult::Sent : IPCOverflowResult::Failed;
+	}
+}
+
+template <typename Attempt>
+bool IPCOverflowControl::send_blocking(size_t message_count, const Attempt& attempt) {
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(std::max(this->send_timeout_ms, 0));
+	auto backoff = std::chrono::microseconds(20);
+
+	while (true) {
+		IPCSendResult result = attempt();
+		if (result != IPCSendResult::Retry) {
+			return result == IPCSendResult::Sent;
+		}
+
+		auto now = std::chrono::steady_clock::now();
+		if (this->send_timeout_ms >= 0 && now >= deadline) {
+			this->timed_out += message_count;
+			return false;
+		}
+		std::this_thread::sleep_for(this->send_timeout_ms >= 0 ?
+			std::min<std::chrono::steady_clock::duration>(backoff, deadline - now) : backoff);
+		backoff = std::min(backoff * 2, std::chrono::microseconds(2000));
+	}
+}
+
+// Sends to the primary instance with the target and send buffers resolved once.
+class IPCSender {
+public:
+	virtual ~IPCSender() {}
+	virtual bool Send(IPCMsgData& msg) = 0;
+	virtual bool SendId(uint64_t handle_id, const wchar_t* msg_data) { return false; }
+	virtual bool SendBytes(const char* msg_handle, const void* data, size_t length) { return false; }
+	virtual size_t SendBatch(IPCMsgData* msgs, size_t count);
+	// Does not wait for room in the transport.
+	virtual IPCSendResult TrySend(IPCMsgData& msg) { return Send(msg) ? IPCSendResult::Sent : IPCSendResult::Failed; }
+};
+
 class IPCWatcher {
 private:
+	// One per thread that runs callbacks.
+	struct IPCDispatcher {
+		// Odd while the dispatcher may be reading the handler table.
+		std::atomic<uint64_t> epoch{ 0 };
+		// Of the request being dispatched, stored before the epoch turns odd. matching: it may run pattern handlers.
+		std::atomic<uint64_t> handle_id{ 0 };
+		std::atomic<bool> matching{ false };
+		std::vector<const std::vector<IPCMsg>*> matches;
+	};
+
+	// A replaced handler table, with the dispatcher epochs seen when it was replaced.
+	struct IPCRetiredTable {
+		std::unique_ptr<IPCMsgTable> messages;
+		std::unique_ptr<const IPCMsgHandlers> handlers;
+		std::vector<uint64_t> epochs;
+	};
+
 	std::thread watcher_thread_;
 	std::thread process_thread_;
-	std::condition_variable cv_;
+	IPCPayloadPool payloads_;
+	// Requests spill to msg_requests_ while the ring is full, and keep spilling until it drains to stay in order.
+	IPCRing<IPCMsgRequest> ring_;
+	std::atomic<bool> spilling_{ false };
+	IPCDoorbell doorbell_;
+	std::condition_variable space_cv_;
+	std::atomic<int> space_waiters_{ 0 };
+	size_t queue_capacity_ = 0;
+	// Requests taken off msg_requests_ and not routed yet.
+	std::atomic<size_t> dispatching_{ 0 };
+	// Serializes handler table updates and guards the maps below and retired_messages_.
+	std::mutex handlers_mutex_;
+	std::unordered_map<uint64_t, uint64_t> msg_handle_ids_;
+	std::unordered_map<uint64_t, std::string> msg_patterns_;
+	std::atomic<bool> keep_handles_{ false };
+	std::vector<IPCRetiredTable> retired_messages_;
+	std::vector<std::unique_ptr<IPCDispatcher>> dispatchers_;
+	// Only with more than one dispatch thread.
+	std::unique_ptr<IPCDispatchPool> pool_;
+	std::unique_ptr<IPCCoalescer> coalescer_;
+	std::unique_ptr<IPCGatherer> gatherer_;
+	size_t dispatch_threads_ = 1;
+	std::atomic<int> epoch_waiters_{ 0 };
+	std::mutex epoch_mutex_;
+	std::condition_variable epoch_cv_;
+	AGDispatchMode dispatch_mode_ = AG_DISPATCH_THREADS;
+	std::string dispatch_thread_name_;
+	int dispatch_cpu_ = -1;
+	int dispatch_priority_ = 0;
+	std::mutex process_mutex_;
+	// Epoll set over notify_fd_, poll_timer_fd_ and the transport's descriptors.
+	int event_fd_ = -1;
+	int notify_fd_ = -1;
+	int poll_timer_fd_ = -1;
+	std::chrono::steady_clock::time_point poll_due_ = std::chrono::steady_clock::time_point::max();
 
+	static const size_t MAX_RING_SLOTS = 1024;
+
+	// With lock held. Requests the overflow policy turns away are moved to discarded.
+	void enqueue_request(std::unique_lock<std::mutex>& lock, IPCMsgRequest&& request, std::vector<IPCMsgRequest>& discarded);
+	void discard_requests(std::vector<IPCMsgRequest>& discarded);
+	// With mutex_ held.
+	size_t queued_requests() const;
+	void notify_space();
+	// With handlers_mutex_ held.
+	void publish_messages(std::unique_ptr<IPCMsgTable> messages, std::unique_ptr<const IPCMsgHandlers> replaced);
+	void reclaim_messages();
+	void dispatch_request(IPCMsgRequest& request, IPCDispatcher& dispatcher);
+	// Coalesces, gathers, dispatches or hands the request to the pool. Returns the messages whose callbacks ran.
+	size_t route_request(IPCMsgRequest& request);
+	// Sets next_ms to the milliseconds until the next batch is due, or -1.
+	size_t run_due_batches(int& next_ms);
+	bool pop_request(IPCMsgRequest& request);
+	void open_manual_receiver();
+	void configure_dispatch_thread();
 
 	void WatchProcess();
 
 public:
 	IPCWatcher(const char* app_handle);
-	~IPCWatcher();
+	virtual ~IPCWatcher();
 
+	// Must be called before start().
+	void Configure(const AGOptions& options);
 	void start();
 	void stop();
-	void RegisterIPCMsg(IPCMsg& msg);
-	void UnregisterIPCMsg(int msg_id);
+	// False when another registered handle has the same id, or msg_id is registered under another handle.
+	bool RegisterIPCMsg(IPCMsg& msg);
+	void UnregisterIPCMsg(uint64_t msg_id);
 
 	virtual void SendMsg(IPCMsgData& msg) = 0;
+	virtual bool SendMsgWithFds(IPCMsgData& msg, const int* fds, size_t fd_count) { return false; }
+	virtual size_t SendMsgBatch(IPCMsgData* msgs, size_t count);
+	bool SendBytes(const char* msg_handle, const void* data, size_t length);
+
+	// The default sender forwards to SendMsg and must not outlive the watcher.
+	virtual IPCSender* CreateSender();
+
+	bool Call(IPCMsgData& msg, int timeout_ms, IPCMsgData& reply);
+	static bool Reply(const IPCMsgData* msg_data, const IPCMsgData& reply);
+
+	// The request whose callback got msg_data and is running on this thread, or nullptr.
+	static const IPCMsgRequest* current_request(const IPCMsgData* msg_data);
+
+	void GetQueueStats(AGQueueStats& stats);
+	void SetCoalescing(const char* msg_handle, AGCoalescePolicy policy, int window_ms);
+	void SetGathering(const char* msg_handle, IPCMsgBatchCallback callback, int max_delay_ms, size_t max_count);
+
+	// -1 unless dispatch is manual.
+	int EventFd() const { return this->event_fd_; }
+	size_t ProcessMessages(size_t max_messages, int timeout_ms);
 
 protected:
-    void send_request(IPCMsgData& msg_request);
+	void send_request(IPCMsgRequest&& msg_request);
+	// Under AG_DISPATCH_SINGLE_THREAD, runs what other threads queued when called on the receiving thread.
+	void dispatch_queued();
+	virtual void wake_receiver() {}
+	// Takes ownership of fds.
+	void receive_record(const char* data, size_t length, std::vector<int>& fds);
+	bool parse_message(const char* data, size_t length, IPCMsgRequest& request);
+	void receive_batch(const char* data, size_t length);
+	// Valid until the thread's next send.
+	virtual char* record_buffer(size_t length);
+	// data comes from record_buffer() or lies outside the thread's send scratch.
+	virtual bool SendRecord(const char* data, size_t length) { return false; }
 	virtual void process_messages() = 0;
+	// Lets a transport blocked in a receive call return on stop().
+	virtual void interrupt_processing() {}
+
+	// The receiver split up for manual dispatch. Transports without it never receive in manual dispatch.
+	virtual bool open_receiver() { return false; }
+	virtual void receiver_fds(std::vector<int>& fds) {}
+	virtual void receive_available() {}
+	virtual void close_receiver() {}
+	void poll_receiver_in(int delay_ms);
 
+	// Never modified once published; updates copy it and swap the pointer.
+	std::atomic<IPCMsgTable*> messages_;
+	// Guards msg_requests_.
 	std::mutex mutex_;
-	std::unordered_map<std::string, IPCMsg> messages_;
-	std::deque<IPCMsgData> msg_requests_;
-	bool processing;
-	bool watching;
+	std::deque<IPCMsgRequest> msg_requests_;
+	IPCOverflowControl overflow_;
+	// 0 for the transport default.
+	size_t transport_capacity_ = 0;
+	bool require_wire_header_ = false;
+	std::atomic<uint64_t> invalid_records_{ 0 };
+	std::atomic<bool> processing;
+	std::atomic<bool> watching;
 	const char* app_handle_;
 };
@@ -11,8 +11,6 @@
 #include <cstdint>
 #include <cerrno>
 #include <algorithm>
-#include <codecvt>
-#include <locale>
 
 
 #ifdef _WIN32
@@ -36,7 +34,6 @@ WindowsIPCWatcher::~WindowsIPCWatcher() {
 void WindowsIPCWatcher::SendMsg(IPCMsgData& msg) {
     this->processing = true;
     HANDLE hClientPipe = INVALID_HANDLE_VALUE;
-    SerializedIPCBuffer ipc_buffer;
     BOOL success = FALSE;
     DWORD bytesWritten = 0;
 
@@ -71,29 +68,26 @@ void WindowsIPCWatcher::SendMsg(IPCMsgData& msg) {
             throw std::runtime_error("Failed to connect to pipe after retries.");
         }
 
-        ipc_buffer = serialize_for_ipc(msg);
-        if (!ipc_buffer.data && ipc_buffer.length > 0) {
-            throw std::runtime_error("IPC serialization error: null buffer with non-zero length.");
-        }
+        IPCWireMsg wire_msg = make_ipc_wire_msg(msg);
+        DWORD bufferTotalSizeBytes = static_cast<DWORD>(serialized_ipc_size(wire_msg));
+        char* ipc_buffer = ipc_send_scratch(bufferTotalSizeBytes);
+        serialize_for_ipc_into(wire_msg, ipc_buffer);
 
-        DWORD bufferTotalSizeBytes = static_cast<DWORD>(ipc_buffer.length);
+        // The pipe is message mode and read as a size message, then a data message, so they are written apart.
         success = WriteFile(hClientPipe, &bufferTotalSizeBytes, sizeof(bufferTotalSizeBytes), &bytesWritten, NULL);
         if (!success || bytesWritten != sizeof(bufferTotalSizeBytes)) {
-            free_serialized_ipc_buffer(ipc_buffer);
             throw std::runtime_error("Failed to write IPC buffer size to pipe. Error: " + std::to_string(GetLastError()));
         }
 
         if (bufferTotalSizeBytes > 0) {
-            success = WriteFile(hClientPipe, ipc_buffer.data, bufferTotalSizeBytes, &bytesWritten, NULL);
+            success = WriteFile(hClientPipe, ipc_buffer, bufferTotalSizeBytes, &bytesWritten, NULL);
             if (!success || bytesWritten != bufferTotalSizeBytes) {
-                free_serialized_ipc_buffer(ipc_buffer);
                 throw std::runtime_error("Failed to write IPC buffer data to pipe. Error: " + std::to_string(GetLastError()));
             }
         }
         FlushFileBuffers(hClientPipe);
     }
     catch (const std::exception&) {
-        free_serialized_ipc_buffer(ipc_buffer);
         if (hClientPipe != INVALID_HANDLE_VALUE) {
             CloseHandle(hClientPipe);
             hClientPipe = INVALID_HANDLE_VALUE;
@@ -101,7 +95,6 @@ void WindowsIPCWatcher::SendMsg(IPCMsgData& msg) {
         return;
     }
 
-    free_serialized_ipc_buffer(ipc_buffer);
     if (hClientPipe != INVALID_HANDLE_VALUE) {
         CloseHandle(hClientPipe);
     }
@@ -219,13 +212,6 @@ void WindowsIPCWatcher::process_messages() {
         }
 
         if (ipcMessageTotalSize == 0) {
-            IPCMsgData received_data = deserialize_from_ipc(nullptr, 0);
-            if (received_data.msg_handle != nullptr) {
-                send_request(received_data);
-            }
-            else {
-                free_ipc_msg_data(received_data);
-            }
             DisconnectNamedPipe(hPipe_); ResetEvent(overlapped.hEvent); continue;
         }
 
@@ -260,13 +246,8 @@ void WindowsIPCWatcher::process_messages() {
         if (readOvData.hEvent != NULL) CloseHandle(readOvData.hEvent);
 
         if (readSuccess) {
-            IPCMsgData received_data = deserialize_from_ipc(ipc_buffer_vector.data(), ipcMessageTotalSize);
-            if (received_data.msg_handle != nullptr) {
-                send_request(received_data);
-            }
-            else {
-                free_ipc_msg_data(received_data);
-            }
+            std::vector<int> no_fds;
+            receive_record(ipc_buffer_vector.data(), ipcMessageTotalSize, no_fds);
         }
         else {
             if (GetLastError() == ERROR_BROKEN_PIPE) isPrimary_ = false;
@@ -290,6 +271,60 @@ void WindowsIPCWatcher::process_messages() {
 #elif defined(__linux__) || defined(__unix__) || defined(__APPLE__) || defined(__DARWIN__)
 
 const uint32_t MAX_IPC_MESSAGE_BYTES_UNIX = 7 * 1024;
+// Limits for messages sent as fragment streams.
+const uint32_t MAX_IPC_STREAM_BYTES_UNIX = 64 * 1024 * 1024;
+const size_t MAX_PENDING_STREAM_BYTES_UNIX = 256 * 1024 * 1024;
+const int STREAM_RECEIVE_TIMEOUT_MS = 5000;
+const uint32_t MAX_IPC_MESSAGE_BYTES_FD_CHANNEL = 128 * 1024;
+const int FD_CHANNEL_SEND_TIMEOUT_MS = 150;
+
+static IPCSendResult try_queue_message(int target_queue, IPCMessageBuffer* msg_buffer, size_t msg_size) {
+    while (msgsnd(target_queue, msg_buffer, msg_size, IPC_NOWAIT) == -1) {
+        if (errno == EINTR) {
+            continue;
+        }
+        return errno == EAGAIN ? IPCSendResult::Retry : IPCSendResult::Failed;
+    }
+    return IPCSendResult::Sent;
+}
+
+// Returns how many messages the evicted queue message held, or 0 when none was taken.
+static size_t evict_queue_message(int target_queue, long msg_type) {
+    std::unique_ptr<char[]> scratch(new char[sizeof(IPCMessageBuffer) + MAX_IPC_MESSAGE_BYTES_UNIX]);
+    IPCMessageBuffer* evicted = reinterpret_cast<IPCMessageBuffer*>(scratch.get());
+
+    ssize_t msg_size;
+    do {
+        msg_size = msgrcv(target_queue, evicted, sizeof(uint32_t) + MAX_IPC_MESSAGE_BYTES_UNIX, msg_type,
+                          IPC_NOWAIT | MSG_NOERROR);
+    } while (msg_size == -1 && errno == EINTR);
+    if (msg_size < static_cast<ssize_t>(sizeof(uint32_t))) {
+        return 0;
+    }
+
+    size_t data_size = std::min<size_t>(evicted->data_size, static_cast<size_t>(msg_size) - sizeof(uint32_t));
+    const char* data = evicted->data;
+    if (check_ipc_wire_header(data, data_size) == IPCWireCheck::Valid) {
+        data += sizeof(IPCWireHeader);
+        data_size -= sizeof(IPCWireHeader);
+    }
+    if (is_ipc_batch(data, data_size)) {
+        uint32_t header[2];
+        memcpy(header, data, sizeof(header));
+        return std::max<uint32_t>(header[1], 1);
+    }
+    return 1;
+}
+
+// On failure errno is left as msgsnd set it.
+static IPCOverflowResult send_queue_message(int target_queue, IPCMessageBuffer* msg_buffer, size_t msg_size,
+                                            IPCOverflowControl& overflow, size_t message_count) {
+    return overflow.send(message_count, [&]() {
+        return try_queue_message(target_queue, msg_buffer, msg_size);
+    }, [&]() {
+        return evict_queue_message(target_queue, msg_buffer->msg_type);
+    });
+}
 
 key_t UnixIPCWatcher::generate_ipc_key(const char* app_handle) {
     std::string key_str = std::string(app_handle);
@@ -309,6 +344,11 @@ UnixIPCWatcher::UnixIPCWatcher(const char* app_handle) : IPCWatcher(app_handle)
     } catch (const std::exception&) {
         ipc_key_ = -1;
     }
+#if defined(__linux__)
+    if (app_handle_ != nullptr) {
+        fd_channel_address_ = make_abstract_address("AppGuard." + std::string(app_handle_) + ".fd");
+    }
+#endif
 }
 
 UnixIPCWatcher::~UnixIPCWatcher() {
@@ -324,7 +364,6 @@ UnixIPCWatcher::~UnixIPCWatcher() {
 
 void UnixIPCWatcher::SendMsg(IPCMsgData& msg) {
     this->processing = true;
-    SerializedIPCBuffer ipc_buffer;
     
     if (ipc_key_ == -1) {
         this->processing = false;
@@ -337,74 +376,458 @@ void UnixIPCWatcher::SendMsg(IPCMsgData& msg) {
             throw std::runtime_error("Target message queue not found");
         }
 
-        ipc_buffer = serialize_for_ipc(msg);
-        if (!ipc_buffer.data && ipc_buffer.length > 0) {
-            throw std::runtime_error("IPC serialization failed");
+        IPCWireMsg wire_msg = make_ipc_wire_msg(msg);
+        size_t data_size = serialized_ipc_size(wire_msg);
+        if (data_size > MAX_IPC_MESSAGE_BYTES_UNIX) {
+            char* data = ipc_send_scratch(data_size);
+            serialize_for_ipc_into(wire_msg, data);
+            send_fragments(target_queue, data, data_size);
+            this->processing = false;
+            return;
         }
 
-        if (ipc_buffer.length > MAX_IPC_MESSAGE_BYTES_UNIX) {
-            free_serialized_ipc_buffer(ipc_buffer);
-            //throw std::runtime_error("Message too large for System V message queue");
-            return ;
-        }
+        IPCMessageBuffer* msg_buffer = reinterpret_cast<IPCMessageBuffer*>(ipc_send_scratch(sizeof(IPCMessageBuffer) + data_size));
+        msg_buffer->msg_type = MSG_TYPE;
+        msg_buffer->data_size = static_cast<uint32_t>(serialize_for_ipc_into(wire_msg, msg_buffer->data));
 
+        send_queue_message(target_queue, msg_buffer, sizeof(uint32_t) + data_size, overflow_, 1);
 
-        size_t msg_buffer_size = sizeof(IPCMessageBuffer) + ipc_buffer.length;
-        IPCMessageBuffer* msg_buffer = (IPCMessageBuffer*)malloc(msg_buffer_size);
-        if (!msg_buffer) {
-            free_serialized_ipc_buffer(ipc_buffer);
-            throw std::runtime_error("Failed to allocate message buffer");
+    } catch (const std::exception&) {
+    }
+    
+    this->processing = false;
+}
+
+#if defined(__linux__)
+bool UnixIPCWatcher::SendMsgWithFds(IPCMsgData& msg, const int* fds, size_t fd_count) {
+    bool sent = false;
+
+    try {
+        IPCWireMsg wire_msg = make_ipc_wire_msg(msg);
+        size_t length = serialized_ipc_size(wire_msg);
+        if (length <= MAX_IPC_MESSAGE_BYTES_FD_CHANNEL) {
+            char* data = ipc_send_scratch(length);
+            serialize_for_ipc_into(wire_msg, data);
+            sent = unix_socket_send(fd_channel_address_, data, length, fds, fd_count, FD_CHANNEL_SEND_TIMEOUT_MS);
         }
+    } catch (const std::exception&) {
+    }
 
-        msg_buffer->msg_type = MSG_TYPE;
-        msg_buffer->data_size = static_cast<uint32_t>(ipc_buffer.length);
-        
-        if (ipc_buffer.length > 0) {
-            memcpy(msg_buffer->data, ipc_buffer.data, ipc_buffer.length);
+    return sent;
+}
+#endif
+
+// Shared by the watcher and every sender, so (pid, stream id) stays unique.
+static std::atomic<uint32_t> next_stream_id{ 1 };
+
+// msg_buffer is scratch for one fragment. Only the first fragment is subject to the overflow policy.
+static bool send_fragment_stream(int target_queue, long msg_type, const char* data, size_t length, IPCMessageBuffer* msg_buffer,
+                                 IPCOverflowControl& overflow) {
+    if (length == 0 || length > MAX_IPC_STREAM_BYTES_UNIX) {
+        return false;
+    }
+
+    const uint32_t fragment_size = MAX_IPC_MESSAGE_BYTES_UNIX - sizeof(IPCFragmentHeader);
+    IPCFragmentHeader header;
+    header.sender_pid = static_cast<uint32_t>(getpid());
+    header.stream_id = next_stream_id++;
+    header.fragment_count = static_cast<uint32_t>((length + fragment_size - 1) / fragment_size);
+    header.fragment_size = fragment_size;
+    header.total_length = static_cast<uint32_t>(length);
+    msg_buffer->msg_type = msg_type;
+
+    bool sent = true;
+    for (uint32_t index = 0; index < header.fragment_count && sent; ++index) {
+        size_t offset = static_cast<size_t>(index) * fragment_size;
+        size_t chunk_length = std::min<size_t>(fragment_size, length - offset);
+
+        header.fragment_index = index;
+        memcpy(msg_buffer->data, &header, sizeof(header));
+        memcpy(msg_buffer->data + sizeof(header), data + offset, chunk_length);
+        msg_buffer->data_size = static_cast<uint32_t>(sizeof(header) + chunk_length);
+
+        size_t msg_size = sizeof(uint32_t) + msg_buffer->data_size;
+        if (index == 0) {
+            IPCOverflowResult result = overflow.send(1, [&]() {
+                return try_queue_message(target_queue, msg_buffer, msg_size);
+            });
+            if (result == IPCOverflowResult::Dropped) {
+                return true;
+            }
+            sent = result == IPCOverflowResult::Sent;
+        } else {
+            sent = overflow.send_blocking(1, [&]() {
+                return try_queue_message(target_queue, msg_buffer, msg_size);
+            });
         }
+    }
+    return sent;
+}
+
+// One fragment per thread, kept apart from ipc_send_scratch(), which usually holds the record being split.
+static IPCMessageBuffer* fragment_scratch() {
+    static thread_local std::vector<long> scratch((sizeof(IPCMessageBuffer) + MAX_IPC_MESSAGE_BYTES_UNIX) / sizeof(long) + 1);
+    return reinterpret_cast<IPCMessageBuffer*>(scratch.data());
+}
+
+bool UnixIPCWatcher::send_fragments(int target_queue, const char* data, size_t length) {
+    return send_fragment_stream(target_queue, MSG_TYPE_FRAGMENT, data, length, fragment_scratch(), overflow_);
+}
 
-        int retries = 3;
+size_t UnixIPCWatcher::SendMsgBatch(IPCMsgData* msgs, size_t count) {
+    size_t sent = 0;
 
-        while (retries-- > 0) {
-            if (msgsnd(target_queue, msg_buffer, sizeof(uint32_t) + ipc_buffer.length, IPC_NOWAIT) == 0) {
+    if (ipc_key_ == -1 || msgs == nullptr || count == 0) {
+        return 0;
+    }
+
+    int target_queue = msgget(ipc_key_, 0);
+    if (target_queue == -1) {
+        return 0;
+    }
+
+    try {
+        size_t index = 0;
+        while (index < count) {
+            size_t record_bytes;
+            size_t batch_count = plan_ipc_batch(msgs + index, count - index, MAX_IPC_MESSAGE_BYTES_UNIX, record_bytes);
+
+            if (batch_count == 0) {
+                // Goes out as its own fragmented stream.
+                IPCWireMsg wire_msg = make_ipc_wire_msg(msgs[index]);
+                size_t data_size = serialized_ipc_size(wire_msg);
+                char* data = ipc_send_scratch(data_size);
+                serialize_for_ipc_into(wire_msg, data);
+                if (!send_fragments(target_queue, data, data_size)) {
+                    break;
+                }
+                ++sent;
+                ++index;
+                continue;
+            }
+
+            IPCMessageBuffer* msg_buffer = reinterpret_cast<IPCMessageBuffer*>(ipc_send_scratch(sizeof(IPCMessageBuffer) + record_bytes));
+            msg_buffer->msg_type = MSG_TYPE;
+            msg_buffer->data_size = static_cast<uint32_t>(serialize_ipc_batch_into(msgs + index, batch_count, msg_buffer->data));
+            if (send_queue_message(target_queue, msg_buffer, sizeof(uint32_t) + msg_buffer->data_size, overflow_,
+                                   batch_count) == IPCOverflowResult::Failed) {
                 break;
             }
+            sent += batch_count;
+            index += batch_count;
+        }
+    } catch (const std::exception&) {
+    }
+
+    return sent;
+}
+
+// Behind a queue message header, so SendRecord sends the record in place.
+char* UnixIPCWatcher::record_buffer(size_t length) {
+    return reinterpret_cast<IPCMessageBuffer*>(ipc_send_scratch(sizeof(IPCMessageBuffer) + length))->data;
+}
+
+bool UnixIPCWatcher::SendRecord(const char* data, size_t length) {
+    if (ipc_key_ == -1 || length == 0 || data == nullptr) {
+        return false;
+    }
+
+    int target_queue = msgget(ipc_key_, 0);
+    if (target_queue == -1) {
+        return false;
+    }
+    if (length > MAX_IPC_MESSAGE_BYTES_UNIX) {
+        return send_fragments(target_queue, data, length);
+    }
+
+    IPCMessageBuffer* msg_buffer = reinterpret_cast<IPCMessageBuffer*>(ipc_send_scratch(sizeof(IPCMessageBuffer) + length));
+    if (msg_buffer->data != data) {
+        memcpy(msg_buffer->data, data, length);
+    }
+    size_t header_bytes = check_ipc_wire_header(msg_buffer->data, length) == IPCWireCheck::Valid ? sizeof(IPCWireHeader) : 0;
+    bool call = is_ipc_call(msg_buffer->data + header_bytes, length - header_bytes);
+    msg_buffer->msg_type = call ? MSG_TYPE_CALL : MSG_TYPE;
+    msg_buffer->data_size = static_cast<uint32_t>(length);
+
+    bool sent;
+    if (call) {
+        // Calls never evict and are not counted as sent when dropped.
+        sent = overflow_.send(1, [&]() {
+            return try_queue_message(target_queue, msg_buffer, sizeof(uint32_t) + length);
+        }) == IPCOverflowResult::Sent;
+    } else {
+        sent = send_queue_message(target_queue, msg_buffer, sizeof(uint32_t) + length, overflow_, 1) != IPCOverflowResult::Failed;
+    }
+    return sent;
+}
+
+IPCSender* UnixIPCWatcher::CreateSender() {
+    if (ipc_key_ == -1) {
+        return nullptr;
+    }
+    return new UnixIPCSender(ipc_key_, overflow_);
+}
+
+
+UnixIPCSender::UnixIPCSender(key_t ipc_key, IPCOverflowControl& overflow) : ipc_key_(ipc_key), overflow_(overflow) {
+    msg_buffer_ = (IPCMessageBuffer*)malloc(sizeof(IPCMessageBuffer) + MAX_IPC_MESSAGE_BYTES_UNIX);
+}
+
+UnixIPCSender::~UnixIPCSender() {
+    free(msg_buffer_);
+}
+
+bool UnixIPCSender::resolve_queue() {
+    target_queue_ = msgget(ipc_key_, 0);
+    return target_queue_ != -1;
+}
+
+// Looks the queue up again once if the primary removed it.
+bool UnixIPCSender::send_message(size_t data_size, size_t message_count) {
+    if (target_queue_ == -1 && !resolve_queue()) {
+        return false;
+    }
+
+    msg_buffer_->msg_type = UnixIPCWatcher::MSG_TYPE;
+    msg_buffer_->data_size = static_cast<uint32_t>(data_size);
+    size_t msg_size = sizeof(uint32_t) + data_size;
+    if (send_queue_message(target_queue_, msg_buffer_, msg_size, overflow_, message_count) != IPCOverflowResult::Failed) {
+        return true;
+    }
+    if ((errno == EIDRM || errno == EINVAL) && resolve_queue()) {
+        return send_queue_message(target_queue_, msg_buffer_, msg_size, overflow_, message_count) != IPCOverflowResult::Failed;
+    }
+    return false;
+}
+
+bool UnixIPCSender::Send(IPCMsgData& msg) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (msg_buffer_ == nullptr) {
+        return false;
+    }
+    return send_single(make_ipc_wire_msg(msg));
+}
+
+bool UnixIPCSender::SendId(uint64_t handle_id, const wchar_t* msg_data) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (msg_buffer_ == nullptr) {
+        return false;
+    }
+    return send_single(IPCWireMsg{ handle_id, nullptr, 0, msg_data });
+}
+
+bool UnixIPCSender::SendBytes(const char* msg_handle, const void* data, size_t length) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (msg_buffer_ == nullptr) {
+        return false;
+    }
+    return send_single(make_ipc_binary_wire_msg(msg_handle, data, length));
+}
+
+bool UnixIPCSender::send_single(const IPCWireMsg& msg) {
+    try {
+        size_t data_size = serialized_ipc_size(msg);
+        if (data_size <= MAX_IPC_MESSAGE_BYTES_UNIX) {
+            serialize_for_ipc_into(msg, msg_buffer_->data);
+            return send_message(data_size, 1);
+        }
+
+        if (data_size > MAX_IPC_STREAM_BYTES_UNIX) {
+            return false;
+        }
+        stream_buffer_.resize(data_size);
+        serialize_for_ipc_into(msg, stream_buffer_.data());
+        if (target_queue_ == -1 && !resolve_queue()) {
+            return false;
+        }
+        return send_fragment_stream(target_queue_, UnixIPCWatcher::MSG_TYPE_FRAGMENT, stream_buffer_.data(), data_size, msg_buffer_,
+                                    overflow_);
+    } catch (const std::exception&) {
+        return false;
+    }
+}
+
+IPCSendResult UnixIPCSender::TrySend(IPCMsgData& msg) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (msg_buffer_ == nullptr) {
+        return IPCSendResult::Failed;
+    }
+
+    try {
+        size_t data_size = serialized_ipc_size(msg);
+        if (data_size > MAX_IPC_MESSAGE_BYTES_UNIX) {
+            // Sent whole, with its own backoff.
+            return send_single(make_ipc_wire_msg(msg)) ? IPCSendResult::Sent : IPCSendResult::Failed;
+        }
+        if (target_queue_ == -1 && !resolve_queue()) {
+            return IPCSendResult::Failed;
+        }
+
+        serialize_for_ipc_into(msg, msg_buffer_->data);
+        msg_buffer_->msg_type = UnixIPCWatcher::MSG_TYPE;
+        msg_buffer_->data_size = static_cast<uint32_t>(data_size);
+
+        bool resolved = false;
+        while (msgsnd(target_queue_, msg_buffer_, sizeof(uint32_t) + data_size, IPC_NOWAIT) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
             if (errno == EAGAIN) {
-                std::this_thread::sleep_for(std::chrono::milliseconds(50));
+                return IPCSendResult::Retry;
+            }
+            if ((errno == EIDRM || errno == EINVAL) && !resolved && resolve_queue()) {
+                resolved = true;
                 continue;
             }
-            //throw std::runtime_error("Failed to send message: " + std::string(strerror(errno)));
-            return ;
+            return IPCSendResult::Failed;
         }
+        return IPCSendResult::Sent;
+    } catch (const std::exception&) {
+        return IPCSendResult::Failed;
+    }
+}
+
+size_t UnixIPCSender::SendBatch(IPCMsgData* msgs, size_t count) {
+    size_t sent = 0;
+    size_t index = 0;
 
-        free_serialized_ipc_buffer(ipc_buffer);
-        free(msg_buffer);
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (msg_buffer_ == nullptr || msgs == nullptr) {
+        return 0;
+    }
+
+    try {
+        while (index < count) {
+            size_t record_bytes;
+            size_t batch_count = plan_ipc_batch(msgs + index, count - index, MAX_IPC_MESSAGE_BYTES_UNIX, record_bytes);
+            if (batch_count == 0) {
+                if (!send_single(make_ipc_wire_msg(msgs[index]))) {
+                    break;
+                }
+                ++sent;
+                ++index;
+                continue;
+            }
 
+            serialize_ipc_batch_into(msgs + index, batch_count, msg_buffer_->data);
+            if (!send_message(record_bytes, batch_count)) {
+                break;
+            }
+            sent += batch_count;
+            index += batch_count;
+        }
     } catch (const std::exception&) {
-        if (ipc_buffer.data) {
-            free_serialized_ipc_buffer(ipc_buffer);
+    }
+    return sent;
+}
+
+void UnixIPCWatcher::expire_streams(std::chrono::steady_clock::time_point now) {
+    for (auto it = pending_streams_.begin(); it != pending_streams_.end();) {
+        if (now - it->second.last_update > std::chrono::milliseconds(STREAM_RECEIVE_TIMEOUT_MS)) {
+            pending_stream_bytes_ -= it->second.total_length;
+            it = pending_streams_.erase(it);
+        } else {
+            ++it;
         }
     }
-    
-    this->processing = false;
 }
 
-void UnixIPCWatcher::process_messages() {
-    if (ipc_key_ == -1) {
+void UnixIPCWatcher::receive_fragment(const char* data, size_t length) {
+    if (length < sizeof(IPCFragmentHeader)) {
+        return;
+    }
+
+    IPCFragmentHeader header;
+    memcpy(&header, data, sizeof(header));
+    const char* chunk = data + sizeof(header);
+    size_t chunk_length = length - sizeof(header);
+
+    if (header.total_length == 0 || header.total_length > MAX_IPC_STREAM_BYTES_UNIX ||
+        header.fragment_size == 0 || header.fragment_index >= header.fragment_count ||
+        static_cast<uint64_t>(header.fragment_count) * header.fragment_size < header.total_length ||
+        static_cast<uint64_t>(header.fragment_count - 1) * header.fragment_size >= header.total_length) {
+        return;
+    }
+
+    size_t offset = static_cast<size_t>(header.fragment_index) * header.fragment_size;
+    if (chunk_length != std::min<size_t>(header.fragment_size, header.total_length - offset)) {
+        return;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    expire_streams(now);
+
+    uint64_t stream_key = (static_cast<uint64_t>(header.sender_pid) << 32) | header.stream_id;
+    auto stream_iter = pending_streams_.find(stream_key);
+    if (stream_iter == pending_streams_.end()) {
+        if (pending_stream_bytes_ + header.total_length > MAX_PENDING_STREAM_BYTES_UNIX) {
+            return;
+        }
+        // Streams with a bad wire header are dropped at their first fragment.
+        if (header.fragment_index == 0) {
+            IPCWireCheck wire_check = check_ipc_wire_header(chunk, chunk_length);
+            if (wire_check == IPCWireCheck::Invalid || (wire_check == IPCWireCheck::Plain && require_wire_header_)) {
+                ++invalid_records_;
+                return;
+            }
+        }
+        else if (require_wire_header_) {
+            return;
+        }
+
+        PendingStream stream;
+        stream.data.reset(new char[header.total_length]);
+        stream.total_length = header.total_length;
+        stream.fragment_size = header.fragment_size;
+        stream.fragment_count = header.fragment_count;
+        stream.fragments_received = 0;
+        stream.received.assign(header.fragment_count, false);
+        stream_iter = pending_streams_.emplace(stream_key, std::move(stream)).first;
+        pending_stream_bytes_ += header.total_length;
+    }
+
+    PendingStream& stream = stream_iter->second;
+    if (stream.total_length != header.total_length || stream.fragment_size != header.fragment_size ||
+        stream.fragment_count != header.fragment_count) {
+        return;
+    }
+
+    if (!stream.received[header.fragment_index]) {
+        memcpy(stream.data.get() + offset, chunk, chunk_length);
+        stream.received[header.fragment_index] = true;
+        ++stream.fragments_received;
+    }
+    stream.last_update = now;
+
+    if (stream.fragments_received < stream.fragment_count) {
         return;
     }
 
+    std::unique_ptr<char[]> complete_data = std::move(stream.data);
+    uint32_t complete_length = stream.total_length;
+    pending_stream_bytes_ -= complete_length;
+    pending_streams_.erase(stream_iter);
+
+    std::vector<int> no_fds;
+    receive_record(complete_data.get(), complete_length, no_fds);
+}
+
+bool UnixIPCWatcher::open_receiver() {
+    if (ipc_key_ == -1) {
+        return false;
+    }
+
     msg_queue_id_ = msgget(ipc_key_, IPC_CREAT | IPC_EXCL | 0600);
     if (msg_queue_id_ == -1) {
         if (errno == EEXIST) {
             msg_queue_id_ = msgget(ipc_key_, 0);
             if (msg_queue_id_ == -1) {
-                return;
+                return false;
             }
 
             isPrimary_ = false;
         } else {
-            return;
+            return false;
         }
 
     } else {
@@ -412,71 +835,161 @@ void UnixIPCWatcher::process_messages() {
     }
 
     if (!isPrimary_) {
-        return;
+        return false;
+    }
+
+    if (transport_capacity_ > 0) {
+        // Above msgmnb this needs CAP_SYS_RESOURCE; the default size stays when refused.
+        msqid_ds queue_stat;
+        if (msgctl(msg_queue_id_, IPC_STAT, &queue_stat) == 0) {
+            queue_stat.msg_qbytes = static_cast<msglen_t>(std::max(transport_capacity_, sizeof(uint32_t) + MAX_IPC_MESSAGE_BYTES_UNIX));
+            msgctl(msg_queue_id_, IPC_SET, &queue_stat);
+        }
     }
 
     size_t max_msg_buffer_size = sizeof(IPCMessageBuffer) + MAX_IPC_MESSAGE_BYTES_UNIX;
-    IPCMessageBuffer* msg_buffer = (IPCMessageBuffer*)malloc(max_msg_buffer_size);
+    receive_buffer_ = (IPCMessageBuffer*)malloc(max_msg_buffer_size);
 
-    if (!msg_buffer) {
+    if (!receive_buffer_) {
+        return false;
+    }
+
+#if defined(__linux__)
+    fd_channel_.open(fd_channel_address_, MAX_IPC_MESSAGE_BYTES_FD_CHANNEL, true);
+#endif
+    return true;
+}
+
+void UnixIPCWatcher::receive_queue_message(size_t msg_size) {
+    if (msg_size < sizeof(uint32_t)) {
         return;
     }
 
+    if (receive_buffer_->msg_type == MSG_TYPE_FRAGMENT) {
+        if (msg_size == sizeof(uint32_t) + receive_buffer_->data_size) {
+            receive_fragment(receive_buffer_->data, receive_buffer_->data_size);
+        }
+        return;
+    }
+
+    if (receive_buffer_->msg_type != MSG_TYPE && receive_buffer_->msg_type != MSG_TYPE_CALL) {
+        return;
+    }
+
+    uint32_t data_size = receive_buffer_->data_size;
+    
+    if (data_size == 0) {
+        return;
+    }
+
+    if (data_size > MAX_IPC_MESSAGE_BYTES_UNIX) {
+        return;
+    }
+
+    if (msg_size != sizeof(uint32_t) + data_size) {
+        return;
+    }
+
+    std::vector<int> no_fds;
+    receive_record(receive_buffer_->data, data_size, no_fds);
+}
+
+void UnixIPCWatcher::process_messages() {
+    if (!open_receiver()) {
+        close_receiver();
+        return;
+    }
+
+#if defined(__linux__)
+    if (fd_channel_.poll_fd() != -1) {
+        fd_channel_thread_ = std::thread([this]() {
+            fd_channel_.run(processing, [this](const char* data, size_t length, std::vector<int>& fds) {
+                receive_record(data, length, fds);
+            });
+        });
+    }
+#endif
+
     while (processing && isPrimary_) {
         try {
-            ssize_t msg_size = msgrcv(msg_queue_id_, msg_buffer, MAX_IPC_MESSAGE_BYTES_UNIX + sizeof(uint32_t), 
-                                    MSG_TYPE, IPC_NOWAIT);
+            // Any type is accepted so the queue stays FIFO.
+            ssize_t msg_size = msgrcv(msg_queue_id_, receive_buffer_, MAX_IPC_MESSAGE_BYTES_UNIX + sizeof(uint32_t), 
+                                    0, 0);
             
             if (msg_size == -1) {
-                if (errno == ENOMSG) {
-                    std::this_thread::sleep_for(std::chrono::milliseconds(100));
-                    continue;
-                }
                 if (errno == EINTR) {
                     continue;
                 }
+                if (errno == EIDRM || errno == EINVAL) {
+                    break;
+                }
 
                 std::this_thread::sleep_for(std::chrono::milliseconds(250));
                 continue;
             }
 
-            if (msg_size < sizeof(uint32_t)) {
-                continue;
-            }
+            receive_queue_message(static_cast<size_t>(msg_size));
+            // Posted by the fd channel thread.
+            dispatch_queued();
 
-            uint32_t data_size = msg_buffer->data_size;
-            
-            if (data_size == 0) {
-                IPCMsgData received_data = deserialize_from_ipc(nullptr, 0);
-                if (received_data.msg_handle != nullptr) {
-                    send_request(received_data);
-                } else {
-                    free_ipc_msg_data(received_data);
-                }
-                continue;
-            }
+        } catch (const std::exception&) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+    }
 
-            if (data_size > MAX_IPC_MESSAGE_BYTES_UNIX) {
-                continue;
-            }
+    close_receiver();
+}
 
-            if (msg_size != sizeof(uint32_t) + data_size) {
-                continue;
-            }
+#if defined(__linux__)
+void UnixIPCWatcher::receiver_fds(std::vector<int>& fds) {
+    if (fd_channel_.poll_fd() != -1) {
+        fds.push_back(fd_channel_.poll_fd());
+    }
+}
+#endif
 
-            IPCMsgData received_data = deserialize_from_ipc(msg_buffer->data, data_size);
-            if (received_data.msg_handle != nullptr) {
-                send_request(received_data);
-            } else {
-                free_ipc_msg_data(received_data);
-            }
+void UnixIPCWatcher::receive_available() {
+    if (!isPrimary_ || receive_buffer_ == nullptr) {
+        return;
+    }
 
+    size_t received = 0;
+    while (received < MAX_QUEUE_READS) {
+        ssize_t msg_size = msgrcv(msg_queue_id_, receive_buffer_, MAX_IPC_MESSAGE_BYTES_UNIX + sizeof(uint32_t), 0, IPC_NOWAIT);
+        if (msg_size == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        ++received;
+        try {
+            receive_queue_message(static_cast<size_t>(msg_size));
         } catch (const std::exception&) {
-            std::this_thread::sleep_for(std::chrono::milliseconds(100));
         }
     }
 
-    free(msg_buffer);
+#if defined(__linux__)
+    fd_channel_.serve_ready([this](const char* data, size_t length, std::vector<int>& fds) {
+        receive_record(data, length, fds);
+    });
+#endif
+    // The queue cannot be polled, so an empty one is read again after an interval.
+    poll_receiver_in(received == 0 ? QUEUE_POLL_INTERVAL_MS : 0);
+}
+
+void UnixIPCWatcher::close_receiver() {
+    free(receive_buffer_);
+    receive_buffer_ = nullptr;
+#if defined(__linux__)
+    fd_channel_.interrupt();
+    if (fd_channel_thread_.joinable()) {
+        fd_channel_thread_.join();
+    }
+    fd_channel_.close();
+#endif
+    pending_streams_.clear();
+    pending_stream_bytes_ = 0;
     
     if (msg_queue_id_ != -1) {
         if (isPrimary_) {
@@ -487,4 +1000,25 @@ void UnixIPCWatcher::process_messages() {
     isPrimary_ = false;
 }
 
+void UnixIPCWatcher::interrupt_processing() {
+#if defined(__linux__)
+    fd_channel_.interrupt();
+#endif
+    wake_receiver();
+}
+
+void UnixIPCWatcher::wake_receiver() {
+    int queue_id = msg_queue_id_;
+    if (!isPrimary_ || queue_id == -1) {
+        return;
+    }
+
+    // A full queue needs no wakeup: the receiver is about to read it anyway.
+    IPCMessageBuffer wakeup_msg;
+    wakeup_msg.msg_type = MSG_TYPE_WAKEUP;
+    wakeup_msg.data_size = 0;
+    while (msgsnd(queue_id, &wakeup_msg, sizeof(uint32_t), IPC_NOWAIT) == -1 && errno == EINTR) {
+    }
+}
+
 #endif // Platform check
\ No newline at end of file
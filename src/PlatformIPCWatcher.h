@@ -20,6 +20,13 @@
 #include <cstring>
 #include <unistd.h>
 #include <cstdint>
+#include <memory>
+#include <chrono>
+#include <unordered_map>
+#endif
+
+#if defined(__linux__)
+#include "UnixSocket.h"
 #endif
 
 #ifdef _WIN32
@@ -49,23 +56,110 @@ struct IPCMessageBuffer {
     char data[1];
 };
 
+// Prefix of every MSG_TYPE_FRAGMENT payload, keyed by sender pid and stream id.
+struct IPCFragmentHeader {
+    uint32_t sender_pid;
+    uint32_t stream_id;
+    uint32_t fragment_index;
+    uint32_t fragment_count;
+    uint32_t fragment_size;
+    uint32_t total_length;
+};
+
 class UnixIPCWatcher : public IPCWatcher {
 private:
-    int msg_queue_id_ = -1;
+    std::atomic<int> msg_queue_id_{ -1 };
     key_t ipc_key_;
-    bool isPrimary_ = false;
+    std::atomic<bool> isPrimary_{ false };
+
+    // Reassembly state of a fragmented message.
+    struct PendingStream {
+        std::unique_ptr<char[]> data;
+        uint32_t total_length;
+        uint32_t fragment_size;
+        uint32_t fragment_count;
+        uint32_t fragments_received;
+        std::vector<bool> received;
+        std::chrono::steady_clock::time_point last_update;
+    };
+
+    std::unordered_map<uint64_t, PendingStream> pending_streams_;
+    size_t pending_stream_bytes_ = 0;
+    // Holds the largest queue message while the receiver is open.
+    IPCMessageBuffer* receive_buffer_ = nullptr;
+
+#if defined(__linux__)
+    // Messages carrying file descriptors bypass the queue.
+    UnixSocketAddress fd_channel_address_;
+    UnixSocketServer fd_channel_;
+    std::thread fd_channel_thread_;
+#endif
 
     key_t generate_ipc_key(const char* app_handle);
+    bool send_fragments(int target_queue, const char* data, size_t length);
+    void receive_fragment(const char* data, size_t length);
+    void expire_streams(std::chrono::steady_clock::time_point now);
+    // Handles the queue message of msg_size bytes in receive_buffer_.
+    void receive_queue_message(size_t msg_size);
     static const size_t MAX_MSG_SIZE = 8192;
+    // Under manual dispatch: how often an empty queue is read, and the most messages one read takes.
+    static const int QUEUE_POLL_INTERVAL_MS = 10;
+    static const size_t MAX_QUEUE_READS = 1024;
     static const long MSG_TYPE = 1;
+    // Empty message the primary posts to its own queue to release a blocked msgrcv on stop().
+    static const long MSG_TYPE_WAKEUP = 2;
+    static const long MSG_TYPE_FRAGMENT = 3;
+    // Call records, kept apart so AG_OVERFLOW_DROP_OLDEST never evicts them.
+    static const long MSG_TYPE_CALL = 4;
+
+    friend class UnixIPCSender;
 
 public:
     UnixIPCWatcher(const char* app_handle);
     ~UnixIPCWatcher();
     void SendMsg(IPCMsgData& msg) override;
+#if defined(__linux__)
+    bool SendMsgWithFds(IPCMsgData& msg, const int* fds, size_t fd_count) override;
+#endif
+    size_t SendMsgBatch(IPCMsgData* msgs, size_t count) override;
+    IPCSender* CreateSender() override;
 
 protected:
+    char* record_buffer(size_t length) override;
+    bool SendRecord(const char* data, size_t length) override;
     void process_messages() override;
+    void interrupt_processing() override;
+    void wake_receiver() override;
+    bool open_receiver() override;
+#if defined(__linux__)
+    void receiver_fds(std::vector<int>& fds) override;
+#endif
+    void receive_available() override;
+    void close_receiver() override;
+};
+
+// Keeps the queue id and a buffer for the largest queue message, which messages are serialized into.
+class UnixIPCSender : public IPCSender {
+private:
+    key_t ipc_key_;
+    int target_queue_ = -1;
+    IPCMessageBuffer* msg_buffer_ = nullptr;
+    std::vector<char> stream_buffer_;
+    IPCOverflowControl& overflow_;
+    std::mutex mutex_;
+
+    bool resolve_queue();
+    bool send_message(size_t data_size, size_t message_count);
+    bool send_single(const IPCWireMsg& msg);
+
+public:
+    UnixIPCSender(key_t ipc_key, IPCOverflowControl& overflow);
+    ~UnixIPCSender();
+    bool Send(IPCMsgData& msg) override;
+    bool SendId(uint64_t handle_id, const wchar_t* msg_data) override;
+    bool SendBytes(const char* msg_handle, const void* data, size_t length) override;
+    size_t SendBatch(IPCMsgData* msgs, size_t count) override;
+    IPCSendResult TrySend(IPCMsgData& msg) override;
 };
 
 #endif
\ No newline at end of file
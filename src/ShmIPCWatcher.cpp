@@ -0,0 +1,591 @@
+#include "ShmIPCWatcher.h"
+#include "utils.h"
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <climits>
+#include <cstring>
+#include <cerrno>
+#include <thread>
+#include <chrono>
+#include <stdexcept>
+#include <algorithm>
+
+const uint32_t SHM_RING_MAGIC = 0x41475232; // "AGR2"
+const uint32_t MAX_IPC_MESSAGE_BYTES_SHM = 256 * 1024;
+// A head record that stays reserved but unwritten for SHM_STALL_LIMIT polls is skipped once its producer has exited.
+const int SHM_STALL_POLL_MS = 10;
+const int SHM_STALL_LIMIT = 100;
+// Spins on a held reservation lock between checks that its holder is still alive.
+const int SHM_LOCK_SPINS = 4096;
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "The shared ring needs address-free 64-bit atomics");
+static_assert(sizeof(ShmRecordHeader) == 16, "Record spans are aligned to the header size");
+
+static size_t ring_segment_size(uint32_t capacity) {
+    return sizeof(ShmRingHeader) + capacity;
+}
+
+static char* ring_data(ShmRingHeader* ring) {
+    return reinterpret_cast<char*>(ring) + sizeof(ShmRingHeader);
+}
+
+// Spans are whole headers, so the space left before the end of the ring always fits a padding record.
+static uint64_t record_span(uint32_t payload_length) {
+    const uint64_t align = sizeof(ShmRecordHeader);
+    return (align + payload_length + align - 1) & ~(align - 1);
+}
+
+// Process-shared futex: the word lives in the shared mapping, so FUTEX_PRIVATE_FLAG must not be used.
+static void futex_wait(std::atomic<uint32_t>* word, uint32_t expected, int timeout_ms) {
+    timespec timeout = { timeout_ms / 1000, (timeout_ms % 1000) * 1000000L };
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAIT, expected,
+            timeout_ms >= 0 ? &timeout : nullptr, nullptr, 0);
+}
+
+static void futex_wake(std::atomic<uint32_t>* word, int count) {
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAKE, count, nullptr, nullptr, 0);
+}
+
+// EPERM means the pid exists under another user, so only ESRCH counts as gone.
+static bool process_gone(int32_t pid) {
+    return pid > 0 && kill(pid, 0) == -1 && errno == ESRCH;
+}
+
+// Held only while reserving space, so the lock of a producer that died holding it can be taken over.
+static void lock_reservation(ShmRingHeader* ring) {
+    const int32_t self = static_cast<int32_t>(getpid());
+    for (int spins = 0;; ++spins) {
+        int32_t holder = 0;
+        if (ring->reserve_lock.compare_exchange_weak(holder, self, std::memory_order_acquire, std::memory_order_relaxed)) {
+            return;
+        }
+        if (spins >= SHM_LOCK_SPINS) {
+            spins = 0;
+            if (process_gone(holder) &&
+                ring->reserve_lock.compare_exchange_strong(holder, self, std::memory_order_acquire, std::memory_order_relaxed)) {
+                return;
+            }
+            std::this_thread::yield();
+        }
+    }
+}
+
+static void unlock_reservation(ShmRingHeader* ring) {
+    ring->reserve_lock.store(0, std::memory_order_release);
+}
+
+static void reserve_record_header(char* data, uint64_t offset, uint32_t payload_length, int32_t sender_pid) {
+    ShmRecordHeader* record = reinterpret_cast<ShmRecordHeader*>(data + offset);
+    record->kind.store(0, std::memory_order_relaxed);
+    record->length.store(payload_length, std::memory_order_relaxed);
+    record->sender_pid.store(sender_pid, std::memory_order_relaxed);
+}
+
+
+static std::string ring_name(const char* app_handle) {
+    if (app_handle == nullptr) {
+        return std::string();
+    }
+    std::string name = "/AppGuard." + std::string(app_handle);
+    std::replace(name.begin() + 1, name.end(), '/', '_');
+    return name;
+}
+
+
+ShmIPCWatcher::ShmIPCWatcher(const char* app_handle) : IPCWatcher(app_handle),
+    shm_name_(ring_name(app_handle)), sender_(shm_name_, overflow_) {
+}
+
+ShmIPCWatcher::~ShmIPCWatcher() {
+    stop();
+    unmap_ring();
+}
+
+bool ShmIPCWatcher::owner_alive(const ShmRingHeader* ring) const {
+    int32_t owner_pid = ring->owner_pid.load(std::memory_order_acquire);
+    return owner_pid > 0 && (kill(owner_pid, 0) == 0 || errno == EPERM);
+}
+
+bool ShmIPCWatcher::sender_gone(const ShmRecordHeader* record) const {
+    return process_gone(record->sender_pid.load(std::memory_order_relaxed));
+}
+
+// The transport capacity rounded up to a power of two, so ring offsets can be masked.
+uint32_t ShmIPCWatcher::ring_capacity() const {
+    uint32_t capacity = RING_CAPACITY;
+    while (capacity < transport_capacity_ && capacity < MAX_RING_CAPACITY) {
+        capacity <<= 1;
+    }
+    return capacity;
+}
+
+bool ShmIPCWatcher::create_ring() {
+    const uint32_t capacity = ring_capacity();
+    const size_t segment_size = ring_segment_size(capacity);
+
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        int shm_fd = shm_open(shm_name_.c_str(), O_CREAT | O_EXCL | O_RDWR | O_CLOEXEC, 0600);
+        if (shm_fd == -1) {
+            if (errno != EEXIST) {
+                return false;
+            }
+
+            // A live owner makes this instance a secondary. A segment left by a primary that died is replaced.
+            int existing_fd = shm_open(shm_name_.c_str(), O_RDONLY | O_CLOEXEC, 0);
+            if (existing_fd == -1) {
+                continue;
+            }
+            bool stale = false;
+            struct stat segment_stat;
+            if (fstat(existing_fd, &segment_stat) == 0 && static_cast<size_t>(segment_stat.st_size) >= sizeof(ShmRingHeader)) {
+                void* mapped = mmap(nullptr, sizeof(ShmRingHeader), PROT_READ, MAP_SHARED, existing_fd, 0);
+                if (mapped != MAP_FAILED) {
+                    const ShmRingHeader* existing = static_cast<const ShmRingHeader*>(mapped);
+                    stale = existing->closed.load() != 0 ||
+                        (existing->owner_pid.load(std::memory_order_acquire) > 0 && !owner_alive(existing));
+                    munmap(mapped, sizeof(ShmRingHeader));
+                }
+            }
+            close(existing_fd);
+            if (!stale) {
+                return false;
+            }
+            shm_unlink(shm_name_.c_str());
+            continue;
+        }
+
+        if (ftruncate(shm_fd, static_cast<off_t>(segment_size)) == -1) {
+            close(shm_fd);
+            shm_unlink(shm_name_.c_str());
+            return false;
+        }
+        void* mapped = mmap(nullptr, segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+        close(shm_fd);
+        if (mapped == MAP_FAILED) {
+            shm_unlink(shm_name_.c_str());
+            return false;
+        }
+
+        // The segment comes zero-filled, so every record slot starts out unwritten.
+        ShmRingHeader* ring = static_cast<ShmRingHeader*>(mapped);
+        ring->capacity = capacity;
+        ring->magic = SHM_RING_MAGIC;
+        ring->owner_pid.store(static_cast<int32_t>(getpid()), std::memory_order_release);
+
+        ShmRingHeader* previous = ring_.exchange(ring);
+        if (previous != nullptr) {
+            munmap(previous, ring_segment_size(previous->capacity));
+        }
+        return true;
+    }
+    return false;
+}
+
+void ShmIPCWatcher::close_ring() {
+    ShmRingHeader* ring = ring_;
+    if (ring == nullptr) {
+        return;
+    }
+    // Unmapped in the destructor, as interrupt_processing() may still ring the doorbell.
+    ring->closed.store(1, std::memory_order_release);
+    shm_unlink(shm_name_.c_str());
+}
+
+void ShmIPCWatcher::unmap_ring() {
+    ShmRingHeader* ring = ring_.exchange(nullptr);
+    if (ring != nullptr) {
+        munmap(ring, ring_segment_size(ring->capacity));
+    }
+}
+
+void ShmIPCWatcher::SendMsg(IPCMsgData& msg) {
+    sender_.Send(msg);
+}
+
+size_t ShmIPCWatcher::SendMsgBatch(IPCMsgData* msgs, size_t count) {
+    return sender_.SendBatch(msgs, count);
+}
+
+bool ShmIPCWatcher::SendRecord(const char* data, size_t length) {
+    return sender_.SendRecord(data, length);
+}
+
+IPCSender* ShmIPCWatcher::CreateSender() {
+    if (shm_name_.empty()) {
+        return nullptr;
+    }
+    return new ShmIPCSender(shm_name_, overflow_);
+}
+
+void ShmIPCWatcher::consume_record(ShmRingHeader* ring, ShmRecordHeader* record, uint32_t kind) {
+    const uint64_t capacity = ring->capacity;
+    const uint64_t lap_left = capacity - (read_pos_ & (capacity - 1));
+    uint32_t payload_length = record->length.load(std::memory_order_relaxed);
+    uint64_t span = record_span(payload_length);
+    if (span > lap_left) {
+        // A corrupt length: nothing past the end of the ring is read, and the rest of the lap is dropped.
+        ++this->invalid_records_;
+        kind = RECORD_PADDING;
+        span = lap_left;
+    }
+    if (kind == RECORD_MESSAGE) {
+        try {
+            std::vector<int> no_fds;
+            receive_record(reinterpret_cast<char*>(record) + sizeof(ShmRecordHeader), payload_length, no_fds);
+        } catch (const std::exception&) {
+        }
+    }
+
+    // Clear the slot so stale payload bytes never read as a committed header on the next lap.
+    memset(static_cast<void*>(record), 0, static_cast<size_t>(span));
+    read_pos_ += span;
+    ring->read_pos.store(read_pos_, std::memory_order_release);
+}
+
+bool ShmIPCWatcher::open_receiver() {
+    if (shm_name_.empty() || !create_ring()) {
+        return false;
+    }
+    isPrimary_ = true;
+    read_pos_ = ring_.load()->read_pos.load(std::memory_order_relaxed);
+    stalled_pos_ = UINT64_MAX;
+    return true;
+}
+
+void ShmIPCWatcher::process_messages() {
+    if (!open_receiver()) {
+        return;
+    }
+
+    ShmRingHeader* ring = ring_;
+    char* data = ring_data(ring);
+    const uint64_t capacity = ring->capacity;
+    int stalled_polls = 0;
+
+    while (processing && isPrimary_) {
+        ShmRecordHeader* record = reinterpret_cast<ShmRecordHeader*>(data + (read_pos_ & (capacity - 1)));
+        uint32_t kind = record->kind.load();
+
+        if (kind == 0) {
+            // Announced before the final check so a producer committing now sees it.
+            uint32_t doorbell = ring->doorbell.load(std::memory_order_acquire);
+            ring->consumer_waiting.store(1);
+            if (record->kind.load() == 0 && processing) {
+                bool reserved = ring->write_pos.load(std::memory_order_acquire) != read_pos_;
+                futex_wait(&ring->doorbell, doorbell, reserved ? SHM_STALL_POLL_MS : -1);
+                stalled_polls = reserved ? stalled_polls + 1 : 0;
+            }
+            ring->consumer_waiting.store(0);
+
+            kind = record->kind.load();
+            // A sender that died between reserving and committing would block the ring forever.
+            if (kind == 0 && stalled_polls >= SHM_STALL_LIMIT && sender_gone(record)) {
+                kind = RECORD_PADDING;
+            }
+            if (kind == 0) {
+                continue;
+            }
+        }
+        stalled_polls = 0;
+        consume_record(ring, record, kind);
+    }
+
+    close_receiver();
+}
+
+void ShmIPCWatcher::receiver_fds(std::vector<int>& fds) {
+    ShmRingHeader* ring = ring_;
+    if (wake_fd_ == -1) {
+        wake_fd_ = unix_datagram_bind(make_abstract_address(shm_name_ + ".wake"));
+    }
+    if (wake_fd_ != -1 && ring != nullptr) {
+        ring->wake_socket.store(1);
+        fds.push_back(wake_fd_);
+    }
+}
+
+void ShmIPCWatcher::receive_available() {
+    ShmRingHeader* ring = ring_;
+    if (!isPrimary_ || ring == nullptr) {
+        return;
+    }
+
+    char wake[16];
+    while (wake_fd_ != -1 && recv(wake_fd_, wake, sizeof(wake), MSG_DONTWAIT) >= 0) {
+    }
+
+    char* data = ring_data(ring);
+    const uint64_t capacity = ring->capacity;
+    for (size_t received = 0; received < MAX_RING_READS; ++received) {
+        ShmRecordHeader* record = reinterpret_cast<ShmRecordHeader*>(data + (read_pos_ & (capacity - 1)));
+        uint32_t kind = record->kind.load();
+
+        if (kind == 0) {
+            // The caller waits, so producers send a wake datagram from now on.
+            ring->consumer_waiting.store(1);
+            kind = record->kind.load();
+            if (kind == 0) {
+                if (ring->write_pos.load(std::memory_order_acquire) == read_pos_) {
+                    stalled_pos_ = UINT64_MAX;
+                    if (wake_fd_ == -1) {
+                        // Nothing to wake on: the ring is polled instead.
+                        poll_receiver_in(SHM_STALL_POLL_MS);
+                    }
+                    return;
+                }
+
+                auto now = std::chrono::steady_clock::now();
+                if (stalled_pos_ != read_pos_) {
+                    stalled_pos_ = read_pos_;
+                    stalled_since_ = now;
+                }
+                if (now - stalled_since_ < std::chrono::milliseconds(SHM_STALL_POLL_MS * SHM_STALL_LIMIT) ||
+                    !sender_gone(record)) {
+                    poll_receiver_in(SHM_STALL_POLL_MS);
+                    return;
+                }
+                kind = RECORD_PADDING;
+            }
+            ring->consumer_waiting.store(0);
+        }
+        stalled_pos_ = UINT64_MAX;
+        consume_record(ring, record, kind);
+    }
+    // Stopped short of the end: the caller comes back at once.
+    poll_receiver_in(0);
+}
+
+void ShmIPCWatcher::close_receiver() {
+    ShmRingHeader* ring = ring_;
+    if (ring != nullptr) {
+        ring->wake_socket.store(0);
+    }
+    if (wake_fd_ != -1) {
+        close(wake_fd_);
+        wake_fd_ = -1;
+    }
+    close_ring();
+    isPrimary_ = false;
+}
+
+void ShmIPCWatcher::interrupt_processing() {
+    ShmRingHeader* ring = ring_;
+    if (!isPrimary_ || ring == nullptr) {
+        return;
+    }
+
+    ring->doorbell.fetch_add(1);
+    futex_wake(&ring->doorbell, INT_MAX);
+}
+
+
+ShmIPCSender::ShmIPCSender(const std::string& shm_name, IPCOverflowControl& overflow) : shm_name_(shm_name), overflow_(overflow) {
+    if (!shm_name_.empty()) {
+        wake_address_ = make_abstract_address(shm_name_ + ".wake");
+    }
+}
+
+ShmIPCSender::~ShmIPCSender() {
+    if (ring_ != nullptr) {
+        munmap(ring_, ring_segment_size(ring_->capacity));
+        ring_ = nullptr;
+    }
+}
+
+bool ShmIPCSender::map_ring() {
+    if (ring_ != nullptr) {
+        if (ring_->closed.load(std::memory_order_acquire) == 0) {
+            return true;
+        }
+        munmap(ring_, ring_segment_size(ring_->capacity));
+        ring_ = nullptr;
+    }
+
+    int shm_fd = shm_open(shm_name_.c_str(), O_RDWR | O_CLOEXEC, 0);
+    if (shm_fd == -1) {
+        return false;
+    }
+
+    // The ring size is chosen by the primary, so it is taken from the segment and checked against the header.
+    struct stat segment_stat;
+    if (fstat(shm_fd, &segment_stat) == -1 || static_cast<size_t>(segment_stat.st_size) < ring_segment_size(ShmIPCWatcher::RING_CAPACITY)) {
+        close(shm_fd);
+        return false;
+    }
+    const size_t segment_size = static_cast<size_t>(segment_stat.st_size);
+    void* mapped = mmap(nullptr, segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+    close(shm_fd);
+    if (mapped == MAP_FAILED) {
+        return false;
+    }
+
+    ShmRingHeader* ring = static_cast<ShmRingHeader*>(mapped);
+    const uint32_t capacity = ring->owner_pid.load(std::memory_order_acquire) != 0 ? ring->capacity : 0;
+    if (capacity < ShmIPCWatcher::RING_CAPACITY || (capacity & (capacity - 1)) != 0 ||
+        ring_segment_size(capacity) != segment_size || ring->magic != SHM_RING_MAGIC || ring->closed.load() != 0) {
+        munmap(mapped, segment_size);
+        return false;
+    }
+    ring_ = ring;
+    return true;
+}
+
+template <typename PayloadWriter>
+bool ShmIPCSender::write_record(size_t payload_length, const PayloadWriter& write_payload) {
+    ShmRingHeader* ring = ring_;
+    const uint64_t capacity = ring->capacity;
+    const uint64_t span = record_span(static_cast<uint32_t>(payload_length));
+    const int32_t self = static_cast<int32_t>(getpid());
+    char* data = ring_data(ring);
+
+    // Records never wrap; a padding record fills the end of the ring instead.
+    lock_reservation(ring);
+    uint64_t write_pos = ring->write_pos.load(std::memory_order_relaxed);
+    uint64_t read_pos = ring->read_pos.load(std::memory_order_acquire);
+    uint64_t offset = write_pos & (capacity - 1);
+    uint64_t padding = (capacity - offset < span) ? capacity - offset : 0;
+    if (write_pos + padding + span - read_pos > capacity) {
+        unlock_reservation(ring);
+        return false;
+    }
+    if (padding > 0) {
+        reserve_record_header(data, offset, static_cast<uint32_t>(padding - sizeof(ShmRecordHeader)), self);
+        offset = 0;
+    }
+    reserve_record_header(data, offset, static_cast<uint32_t>(payload_length), self);
+    ring->write_pos.store(write_pos + padding + span, std::memory_order_release);
+    unlock_reservation(ring);
+
+    if (padding > 0) {
+        reinterpret_cast<ShmRecordHeader*>(data + (write_pos & (capacity - 1)))->kind.store(ShmIPCWatcher::RECORD_PADDING);
+    }
+    write_payload(data + offset + sizeof(ShmRecordHeader));
+    reinterpret_cast<ShmRecordHeader*>(data + offset)->kind.store(ShmIPCWatcher::RECORD_MESSAGE);
+
+    // Only a consumer that found the ring empty and went to sleep costs a syscall.
+    if (ring->consumer_waiting.load() != 0 && ring->consumer_waiting.exchange(0) != 0) {
+        ring->doorbell.fetch_add(1);
+        futex_wake(&ring->doorbell, 1);
+        if (ring->wake_socket.load() != 0) {
+            char wake = 0;
+            unix_datagram_send(wake_address_, &wake, 1);
+        }
+    }
+    return true;
+}
+
+// Called with mutex_ held. A record dropped under a drop policy counts as sent.
+template <typename PayloadWriter>
+bool ShmIPCSender::commit_record(size_t payload_length, size_t message_count, const PayloadWriter& write_payload) {
+    return overflow_.send(message_count, [&]() {
+        return write_record(payload_length, write_payload) ? IPCSendResult::Sent : IPCSendResult::Retry;
+    }) != IPCOverflowResult::Failed;
+}
+
+bool ShmIPCSender::Send(IPCMsgData& msg) {
+    return send_wire(make_ipc_wire_msg(msg));
+}
+
+bool ShmIPCSender::SendId(uint64_t handle_id, const wchar_t* msg_data) {
+    return send_wire(IPCWireMsg{ handle_id, nullptr, 0, msg_data });
+}
+
+bool ShmIPCSender::SendBytes(const char* msg_handle, const void* data, size_t length) {
+    return send_wire(make_ipc_binary_wire_msg(msg_handle, data, length));
+}
+
+bool ShmIPCSender::send_wire(const IPCWireMsg& msg) {
+    if (shm_name_.empty()) {
+        return false;
+    }
+
+    size_t payload_length = serialized_ipc_size(msg);
+    if (payload_length > MAX_IPC_MESSAGE_BYTES_SHM) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!map_ring()) {
+        return false;
+    }
+    return commit_record(payload_length, 1, [&msg](char* payload) {
+        serialize_for_ipc_into(msg, payload);
+    });
+}
+
+IPCSendResult ShmIPCSender::TrySend(IPCMsgData& msg) {
+    if (shm_name_.empty()) {
+        return IPCSendResult::Failed;
+    }
+
+    size_t payload_length = serialized_ipc_size(msg);
+    if (payload_length > MAX_IPC_MESSAGE_BYTES_SHM) {
+        return IPCSendResult::Failed;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!map_ring()) {
+        return IPCSendResult::Failed;
+    }
+    bool written = write_record(payload_length, [&msg](char* payload) {
+        serialize_for_ipc_into(msg, payload);
+    });
+    return written ? IPCSendResult::Sent : IPCSendResult::Retry;
+}
+
+bool ShmIPCSender::SendRecord(const char* data, size_t length) {
+    if (shm_name_.empty() || length > MAX_IPC_MESSAGE_BYTES_SHM) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!map_ring()) {
+        return false;
+    }
+    return commit_record(length, 1, [data, length](char* payload) {
+        memcpy(payload, data, length);
+    });
+}
+
+size_t ShmIPCSender::SendBatch(IPCMsgData* msgs, size_t count) {
+    size_t sent = 0;
+
+    if (shm_name_.empty() || msgs == nullptr || count == 0) {
+        return 0;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!map_ring()) {
+        return 0;
+    }
+
+    size_t index = 0;
+    while (index < count) {
+        size_t record_bytes;
+        size_t batch_count = plan_ipc_batch(msgs + index, count - index, MAX_IPC_MESSAGE_BYTES_SHM, record_bytes);
+        if (batch_count == 0) {
+            // Larger than a ring record.
+            break;
+        }
+
+        bool committed = commit_record(record_bytes, batch_count, [msgs, index, batch_count](char* payload) {
+            serialize_ipc_batch_into(msgs + index, batch_count, payload);
+        });
+        if (!committed) {
+            break;
+        }
+        sent += batch_count;
+        index += batch_count;
+    }
+    return sent;
+}
+
+#endif // __linux__
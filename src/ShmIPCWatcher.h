@@ -0,0 +1,120 @@
+#pragma once
+
+#include "IPCWatcher.h"
+#include "UnixSocket.h"
+#include "utils.h"
+
+#if defined(__linux__)
+#include <sys/types.h>
+#include <string>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+// Layout of the shared segment: this header followed by a power-of-two byte ring of framed records.
+struct ShmRingHeader {
+    uint32_t magic;
+    uint32_t capacity;
+    std::atomic<int32_t> owner_pid;
+    std::atomic<uint32_t> closed;
+    // Futex word. Bumped by a producer that finds the consumer asleep, and by stop().
+    std::atomic<uint32_t> doorbell;
+    std::atomic<uint32_t> consumer_waiting;
+    // Set under manual dispatch, where the primary waits on the ".wake" datagram socket instead of the futex.
+    std::atomic<uint32_t> wake_socket;
+    // Pid of the producer reserving space.
+    alignas(64) std::atomic<int32_t> reserve_lock;
+    std::atomic<uint64_t> write_pos;
+    alignas(64) std::atomic<uint64_t> read_pos;
+};
+
+// Record framing inside the ring. kind stays 0 until the producer has written the whole record.
+struct ShmRecordHeader {
+    std::atomic<uint32_t> kind;
+    std::atomic<uint32_t> length;
+    // The producer that reserved the record.
+    std::atomic<int32_t> sender_pid;
+    uint32_t reserved;
+};
+
+// Producer side of the ring. The mapping is kept across sends and replaced once the primary marks it closed.
+class ShmIPCSender : public IPCSender {
+private:
+    std::string shm_name_;
+    UnixSocketAddress wake_address_;
+    ShmRingHeader* ring_ = nullptr;
+    IPCOverflowControl& overflow_;
+    std::mutex mutex_;
+
+    bool map_ring();
+    // write_payload(char* out) fills the payload_length bytes of a reserved record.
+    template <typename PayloadWriter>
+    bool write_record(size_t payload_length, const PayloadWriter& write_payload);
+    // Writes one record of message_count messages, resolving a full ring by the overflow policy.
+    template <typename PayloadWriter>
+    bool commit_record(size_t payload_length, size_t message_count, const PayloadWriter& write_payload);
+    bool send_wire(const IPCWireMsg& msg);
+
+public:
+    ShmIPCSender(const std::string& shm_name, IPCOverflowControl& overflow);
+    ~ShmIPCSender();
+    bool Send(IPCMsgData& msg) override;
+    bool SendId(uint64_t handle_id, const wchar_t* msg_data) override;
+    bool SendBytes(const char* msg_handle, const void* data, size_t length) override;
+    size_t SendBatch(IPCMsgData* msgs, size_t count) override;
+    IPCSendResult TrySend(IPCMsgData& msg) override;
+    bool SendRecord(const char* data, size_t length);
+};
+
+class ShmIPCWatcher : public IPCWatcher {
+private:
+    std::string shm_name_;
+    std::atomic<ShmRingHeader*> ring_{ nullptr };
+    std::atomic<bool> isPrimary_{ false };
+    ShmIPCSender sender_;
+    // Consumer position, and where a reserved record was first found unwritten, with the time.
+    uint64_t read_pos_ = 0;
+    uint64_t stalled_pos_ = UINT64_MAX;
+    std::chrono::steady_clock::time_point stalled_since_;
+    // Datagram socket producers wake a primary under manual dispatch on.
+    int wake_fd_ = -1;
+
+    // Room for two records of the largest message.
+    static const uint32_t RING_CAPACITY = 1024 * 1024;
+    static const uint32_t MAX_RING_CAPACITY = 1024 * 1024 * 1024;
+    static const uint32_t RECORD_MESSAGE = 1;
+    static const uint32_t RECORD_PADDING = 2;
+    // Most records one read takes under manual dispatch.
+    static const size_t MAX_RING_READS = 1024;
+
+    uint32_t ring_capacity() const;
+    bool create_ring();
+    void close_ring();
+    void unmap_ring();
+    bool owner_alive(const ShmRingHeader* ring) const;
+    // Whether the reserved record at read_pos_ can be skipped because its producer has exited.
+    bool sender_gone(const ShmRecordHeader* record) const;
+    // Hands the committed record at read_pos_ on and moves past it.
+    void consume_record(ShmRingHeader* ring, ShmRecordHeader* record, uint32_t kind);
+
+    friend class ShmIPCSender;
+
+public:
+    ShmIPCWatcher(const char* app_handle);
+    ~ShmIPCWatcher();
+    void SendMsg(IPCMsgData& msg) override;
+    size_t SendMsgBatch(IPCMsgData* msgs, size_t count) override;
+    IPCSender* CreateSender() override;
+
+protected:
+    bool SendRecord(const char* data, size_t length) override;
+    void process_messages() override;
+    void interrupt_processing() override;
+    bool open_receiver() override;
+    void receiver_fds(std::vector<int>& fds) override;
+    void receive_available() override;
+    void close_receiver() override;
+};
+
+#endif // __linux__
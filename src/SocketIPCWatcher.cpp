@@ -0,0 +1,316 @@
+#include "SocketIPCWatcher.h"
+#include "utils.h"
+
+#if defined(__linux__)
+#include <unistd.h>
+#include <cstring>
+#include <cerrno>
+#include <stdexcept>
+
+const uint32_t MAX_IPC_MESSAGE_BYTES_SOCKET = 128 * 1024;
+
+
+SocketIPCWatcher::SocketIPCWatcher(const char* app_handle) : IPCWatcher(app_handle) {
+    if (app_handle_ != nullptr) {
+        address_ = make_abstract_address("AppGuard." + std::string(app_handle_));
+    }
+}
+
+SocketIPCWatcher::~SocketIPCWatcher() {
+    stop();
+}
+
+bool SocketIPCWatcher::send_record(IPCMsgData& msg, const int* fds, size_t fd_count) {
+    bool sent = false;
+
+    if (address_.length == 0) {
+        return false;
+    }
+
+    try {
+        IPCWireMsg wire_msg = make_ipc_wire_msg(msg);
+        size_t length = serialized_ipc_size(wire_msg);
+        if (length > MAX_IPC_MESSAGE_BYTES_SOCKET) {
+            throw std::runtime_error("Message too large for socket transport");
+        }
+
+        char* data = ipc_send_scratch(length);
+        serialize_for_ipc_into(wire_msg, data);
+        sent = deliver_record(data, length, fds, fd_count, 1);
+    } catch (const std::exception&) {
+    }
+
+    return sent;
+}
+
+bool SocketIPCWatcher::deliver_record(const char* data, size_t length, const int* fds, size_t fd_count, size_t message_count) {
+    std::unique_ptr<SocketIPCSender> connection;
+    {
+        std::lock_guard<std::mutex> lock(connections_mutex_);
+        if (!idle_connections_.empty()) {
+            connection = std::move(idle_connections_.back());
+            idle_connections_.pop_back();
+        }
+    }
+    if (!connection) {
+        connection.reset(new SocketIPCSender(address_, overflow_, transport_capacity_));
+    }
+
+    bool sent = connection->SendRecord(data, length, fds, fd_count, message_count);
+    int send_error = errno;
+    {
+        std::lock_guard<std::mutex> lock(connections_mutex_);
+        if (idle_connections_.size() < MAX_IDLE_CONNECTIONS) {
+            idle_connections_.push_back(std::move(connection));
+        }
+    }
+    // Closing a connection that was not kept must not change the error the caller reads.
+    connection.reset();
+    errno = send_error;
+    return sent;
+}
+
+void SocketIPCWatcher::SendMsg(IPCMsgData& msg) {
+    send_record(msg, nullptr, 0);
+}
+
+bool SocketIPCWatcher::SendMsgWithFds(IPCMsgData& msg, const int* fds, size_t fd_count) {
+    return send_record(msg, fds, fd_count);
+}
+
+size_t SocketIPCWatcher::SendMsgBatch(IPCMsgData* msgs, size_t count) {
+    size_t sent = 0;
+
+    if (address_.length == 0 || msgs == nullptr || count == 0) {
+        return 0;
+    }
+
+    try {
+        size_t index = 0;
+        while (index < count) {
+            size_t record_bytes;
+            size_t batch_count = plan_ipc_batch(msgs + index, count - index, MAX_IPC_MESSAGE_BYTES_SOCKET, record_bytes);
+            if (batch_count == 0) {
+                // Larger than a socket record.
+                break;
+            }
+
+            char* record = ipc_send_scratch(record_bytes);
+            serialize_ipc_batch_into(msgs + index, batch_count, record);
+            if (!deliver_record(record, record_bytes, nullptr, 0, batch_count)) {
+                break;
+            }
+            sent += batch_count;
+            index += batch_count;
+        }
+    } catch (const std::exception&) {
+    }
+
+    return sent;
+}
+
+bool SocketIPCWatcher::SendRecord(const char* data, size_t length) {
+    if (length > MAX_IPC_MESSAGE_BYTES_SOCKET) {
+        return false;
+    }
+    return deliver_record(data, length, nullptr, 0, 1);
+}
+
+IPCSender* SocketIPCWatcher::CreateSender() {
+    if (address_.length == 0) {
+        return nullptr;
+    }
+    return new SocketIPCSender(address_, overflow_, transport_capacity_);
+}
+
+void SocketIPCWatcher::process_messages() {
+    if (!open_receiver()) {
+        return;
+    }
+
+    server_.run(processing, [this](const char* data, size_t length, std::vector<int>& fds) {
+        receive_record(data, length, fds);
+    });
+
+    close_receiver();
+}
+
+void SocketIPCWatcher::interrupt_processing() {
+    server_.interrupt();
+}
+
+bool SocketIPCWatcher::open_receiver() {
+    // Failing to bind means another instance already serves this app handle.
+    if (!server_.open(address_, MAX_IPC_MESSAGE_BYTES_SOCKET)) {
+        return false;
+    }
+    isPrimary_ = true;
+    return true;
+}
+
+void SocketIPCWatcher::receiver_fds(std::vector<int>& fds) {
+    fds.push_back(server_.poll_fd());
+}
+
+void SocketIPCWatcher::receive_available() {
+    server_.serve_ready([this](const char* data, size_t length, std::vector<int>& fds) {
+        receive_record(data, length, fds);
+    });
+}
+
+void SocketIPCWatcher::close_receiver() {
+    server_.close();
+    isPrimary_ = false;
+}
+
+
+
+SocketIPCSender::SocketIPCSender(const UnixSocketAddress& address, IPCOverflowControl& overflow, size_t send_buffer_bytes) :
+    address_(address), overflow_(overflow), send_buffer_bytes_(send_buffer_bytes) {
+}
+
+SocketIPCSender::~SocketIPCSender() {
+    if (socket_fd_ != -1) {
+        close(socket_fd_);
+    }
+}
+
+// A connection the primary has closed fails with EPIPE or ECONNRESET; the record is retried once on a new one.
+bool SocketIPCSender::send_record(const char* data, size_t length, const int* fds, size_t fd_count, int send_flags) {
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        if (socket_fd_ == -1) {
+            socket_fd_ = unix_socket_connect(address_, overflow_.send_timeout_ms, send_buffer_bytes_);
+            if (socket_fd_ == -1) {
+                return false;
+            }
+        }
+
+        if (unix_socket_send_record(socket_fd_, data, length, fds, fd_count, send_flags)) {
+            return true;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            // The connection stays usable; nothing of the record was sent.
+            return false;
+        }
+
+        bool reconnect = (errno == EPIPE || errno == ECONNRESET || errno == ENOTCONN);
+        close(socket_fd_);
+        socket_fd_ = -1;
+        if (!reconnect) {
+            return false;
+        }
+    }
+    return false;
+}
+
+IPCSendResult SocketIPCSender::try_record(const char* data, size_t length, const int* fds, size_t fd_count) {
+    if (send_record(data, length, fds, fd_count, MSG_DONTWAIT)) {
+        return IPCSendResult::Sent;
+    }
+    return (errno == EAGAIN || errno == EWOULDBLOCK) ? IPCSendResult::Retry : IPCSendResult::Failed;
+}
+
+// A primary that stops accepting or reading fills the listen backlog, so connecting waits for room as well.
+bool SocketIPCSender::deliver_record(const char* data, size_t length, const int* fds, size_t fd_count, size_t message_count) {
+    if (overflow_.policy == AG_OVERFLOW_BLOCK) {
+        // The connection's SO_SNDTIMEO bounds the wait.
+        if (send_record(data, length, fds, fd_count)) {
+            return true;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            overflow_.timed_out += message_count;
+        }
+        return false;
+    }
+
+    return overflow_.send(message_count, [&]() {
+        return try_record(data, length, fds, fd_count);
+    }) != IPCOverflowResult::Failed;
+}
+
+bool SocketIPCSender::SendRecord(const char* data, size_t length, const int* fds, size_t fd_count, size_t message_count) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return deliver_record(data, length, fds, fd_count, message_count);
+}
+
+bool SocketIPCSender::Send(IPCMsgData& msg) {
+    return send_wire(make_ipc_wire_msg(msg));
+}
+
+bool SocketIPCSender::SendId(uint64_t handle_id, const wchar_t* msg_data) {
+    return send_wire(IPCWireMsg{ handle_id, nullptr, 0, msg_data });
+}
+
+bool SocketIPCSender::SendBytes(const char* msg_handle, const void* data, size_t length) {
+    return send_wire(make_ipc_binary_wire_msg(msg_handle, data, length));
+}
+
+bool SocketIPCSender::send_wire(const IPCWireMsg& msg) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    try {
+        size_t length = serialized_ipc_size(msg);
+        if (length > MAX_IPC_MESSAGE_BYTES_SOCKET) {
+            return false;
+        }
+        if (record_.size() < length) {
+            record_.resize(length);
+        }
+        serialize_for_ipc_into(msg, record_.data());
+        return deliver_record(record_.data(), length, nullptr, 0, 1);
+    } catch (const std::exception&) {
+        return false;
+    }
+}
+
+IPCSendResult SocketIPCSender::TrySend(IPCMsgData& msg) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    try {
+        size_t length = serialized_ipc_size(msg);
+        if (length > MAX_IPC_MESSAGE_BYTES_SOCKET) {
+            return IPCSendResult::Failed;
+        }
+        if (record_.size() < length) {
+            record_.resize(length);
+        }
+        serialize_for_ipc_into(msg, record_.data());
+        return try_record(record_.data(), length, nullptr, 0);
+    } catch (const std::exception&) {
+        return IPCSendResult::Failed;
+    }
+}
+
+size_t SocketIPCSender::SendBatch(IPCMsgData* msgs, size_t count) {
+    size_t sent = 0;
+    size_t index = 0;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (msgs == nullptr) {
+        return 0;
+    }
+
+    try {
+        while (index < count) {
+            size_t record_bytes;
+            size_t batch_count = plan_ipc_batch(msgs + index, count - index, MAX_IPC_MESSAGE_BYTES_SOCKET, record_bytes);
+            if (batch_count == 0) {
+                break;
+            }
+
+            if (record_.size() < record_bytes) {
+                record_.resize(record_bytes);
+            }
+            serialize_ipc_batch_into(msgs + index, batch_count, record_.data());
+            if (!deliver_record(record_.data(), record_bytes, nullptr, 0, batch_count)) {
+                break;
+            }
+            sent += batch_count;
+            index += batch_count;
+        }
+    } catch (const std::exception&) {
+    }
+    return sent;
+}
+
+#endif // __linux__
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "IPCWatcher.h"
+#include "UnixSocket.h"
+#include "utils.h"
+
+#if defined(__linux__)
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+
+class SocketIPCSender;
+
+class SocketIPCWatcher : public IPCWatcher {
+private:
+    std::atomic<bool> isPrimary_{ false };
+    UnixSocketAddress address_;
+    UnixSocketServer server_;
+    // Connections to the primary kept between sends. A send takes one, so threads sending at once do not share one.
+    std::mutex connections_mutex_;
+    std::vector<std::unique_ptr<SocketIPCSender>> idle_connections_;
+
+    static const size_t MAX_IDLE_CONNECTIONS = 8;
+
+    bool send_record(IPCMsgData& msg, const int* fds, size_t fd_count);
+    // Sends one record of message_count messages on a kept connection, resolving a full socket by the overflow policy.
+    bool deliver_record(const char* data, size_t length, const int* fds, size_t fd_count, size_t message_count);
+
+public:
+    SocketIPCWatcher(const char* app_handle);
+    ~SocketIPCWatcher();
+    void SendMsg(IPCMsgData& msg) override;
+    bool SendMsgWithFds(IPCMsgData& msg, const int* fds, size_t fd_count) override;
+    size_t SendMsgBatch(IPCMsgData* msgs, size_t count) override;
+    IPCSender* CreateSender() override;
+
+protected:
+    bool SendRecord(const char* data, size_t length) override;
+    void process_messages() override;
+    void interrupt_processing() override;
+    bool open_receiver() override;
+    void receiver_fds(std::vector<int>& fds) override;
+    void receive_available() override;
+    void close_receiver() override;
+};
+
+// Holds one connection to the primary for all of its sends and reconnects when the primary closes it.
+class SocketIPCSender : public IPCSender {
+private:
+    UnixSocketAddress address_;
+    int socket_fd_ = -1;
+    std::vector<char> record_;
+    IPCOverflowControl& overflow_;
+    size_t send_buffer_bytes_;
+    std::mutex mutex_;
+
+    bool send_record(const char* data, size_t length, const int* fds, size_t fd_count, int send_flags = 0);
+    IPCSendResult try_record(const char* data, size_t length, const int* fds, size_t fd_count);
+    // Sends a record of message_count messages, resolving a full connection by the overflow policy.
+    bool deliver_record(const char* data, size_t length, const int* fds, size_t fd_count, size_t message_count);
+    bool send_wire(const IPCWireMsg& msg);
+
+public:
+    SocketIPCSender(const UnixSocketAddress& address, IPCOverflowControl& overflow, size_t send_buffer_bytes);
+    ~SocketIPCSender();
+    bool Send(IPCMsgData& msg) override;
+    bool SendId(uint64_t handle_id, const wchar_t* msg_data) override;
+    bool SendBytes(const char* msg_handle, const void* data, size_t length) override;
+    size_t SendBatch(IPCMsgData* msgs, size_t count) override;
+    IPCSendResult TrySend(IPCMsgData& msg) override;
+    // Sends a record serialized by the caller.
+    bool SendRecord(const char* data, size_t length, const int* fds, size_t fd_count, size_t message_count);
+};
+
+#endif // __linux__
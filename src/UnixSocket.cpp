@@ -0,0 +1,448 @@
+#include "UnixSocket.h"
+
+#if defined(__linux__)
+#include <sys/epoll.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <cstddef>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <chrono>
+#include <climits>
+
+
+// Abstract sockets have no permissions, so both ends check that the other runs as the same user.
+static bool peer_is_same_user(int socket_fd) {
+    ucred credentials = {};
+    socklen_t length = sizeof(credentials);
+    return getsockopt(socket_fd, SOL_SOCKET, SO_PEERCRED, &credentials, &length) == 0 &&
+        length == sizeof(credentials) && credentials.uid == geteuid();
+}
+
+UnixSocketAddress make_abstract_address(const std::string& name) {
+    UnixSocketAddress result;
+    memset(&result.address, 0, sizeof(result.address));
+    result.address.sun_family = AF_UNIX;
+
+    // sun_path starts with a NUL byte for the abstract namespace.
+    size_t name_length = std::min(name.length(), sizeof(result.address.sun_path) - 1);
+    memcpy(result.address.sun_path + 1, name.data(), name_length);
+    result.length = static_cast<socklen_t>(offsetof(sockaddr_un, sun_path) + 1 + name_length);
+    return result;
+}
+
+bool unix_socket_send(const UnixSocketAddress& address, const char* data, size_t length,
+                      const int* fds, size_t fd_count, int timeout_ms, size_t send_buffer_bytes) {
+    if (fd_count > MAX_IPC_RECORD_FDS) {
+        errno = EINVAL;
+        return false;
+    }
+
+    int client_fd = unix_socket_connect(address, timeout_ms, send_buffer_bytes);
+    if (client_fd == -1) {
+        return false;
+    }
+
+    bool sent = unix_socket_send_record(client_fd, data, length, fds, fd_count);
+    int send_error = errno;
+    close(client_fd);
+    errno = send_error;
+    return sent;
+}
+
+int unix_socket_connect(const UnixSocketAddress& address, int timeout_ms, size_t send_buffer_bytes) {
+    if (address.length == 0) {
+        return -1;
+    }
+
+    int client_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC | (timeout_ms == 0 ? SOCK_NONBLOCK : 0), 0);
+    if (client_fd == -1) {
+        return -1;
+    }
+
+    // Set before connecting: a server whose backlog is full holds connect() for the same timeout.
+    if (timeout_ms > 0) {
+        timeval send_timeout = { timeout_ms / 1000, (timeout_ms % 1000) * 1000 };
+        setsockopt(client_fd, SOL_SOCKET, SO_SNDTIMEO, &send_timeout, sizeof(send_timeout));
+    }
+    if (send_buffer_bytes > 0) {
+        int buffer_bytes = static_cast<int>(std::min<size_t>(send_buffer_bytes, INT_MAX));
+        setsockopt(client_fd, SOL_SOCKET, SO_SNDBUF, &buffer_bytes, sizeof(buffer_bytes));
+    }
+
+    if (connect(client_fd, reinterpret_cast<const sockaddr*>(&address.address), address.length) == -1) {
+        int connect_error = errno;
+        close(client_fd);
+        errno = connect_error;
+        return -1;
+    }
+    if (!peer_is_same_user(client_fd)) {
+        close(client_fd);
+        errno = EACCES;
+        return -1;
+    }
+    return client_fd;
+}
+
+bool unix_socket_send_record(int socket_fd, const char* data, size_t length, const int* fds, size_t fd_count,
+                             int send_flags) {
+    if (fd_count > MAX_IPC_RECORD_FDS) {
+        errno = EINVAL;
+        return false;
+    }
+
+    iovec data_vector = { const_cast<char*>(data), length };
+    msghdr message = {};
+    message.msg_iov = &data_vector;
+    message.msg_iovlen = 1;
+
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * MAX_IPC_RECORD_FDS)];
+    if (fd_count > 0) {
+        message.msg_control = control;
+        message.msg_controllen = CMSG_SPACE(sizeof(int) * fd_count);
+        cmsghdr* control_header = CMSG_FIRSTHDR(&message);
+        control_header->cmsg_level = SOL_SOCKET;
+        control_header->cmsg_type = SCM_RIGHTS;
+        control_header->cmsg_len = CMSG_LEN(sizeof(int) * fd_count);
+        memcpy(CMSG_DATA(control_header), fds, sizeof(int) * fd_count);
+    }
+
+    ssize_t sent;
+    do {
+        sent = sendmsg(socket_fd, &message, MSG_NOSIGNAL | send_flags);
+    } while (sent == -1 && errno == EINTR);
+
+    return sent == static_cast<ssize_t>(length);
+}
+
+int unix_datagram_bind(const UnixSocketAddress& address, bool pass_credentials) {
+    if (address.length == 0) {
+        return -1;
+    }
+
+    int socket_fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (socket_fd == -1) {
+        return -1;
+    }
+    int pass = 1;
+    if ((pass_credentials && setsockopt(socket_fd, SOL_SOCKET, SO_PASSCRED, &pass, sizeof(pass)) == -1) ||
+        bind(socket_fd, reinterpret_cast<const sockaddr*>(&address.address), address.length) == -1) {
+        close(socket_fd);
+        return -1;
+    }
+    return socket_fd;
+}
+
+bool unix_datagram_send(const UnixSocketAddress& address, const char* data, size_t length) {
+    if (address.length == 0) {
+        return false;
+    }
+
+    int socket_fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (socket_fd == -1) {
+        return false;
+    }
+
+    ssize_t sent;
+    do {
+        sent = sendto(socket_fd, data, length, MSG_DONTWAIT | MSG_NOSIGNAL,
+                      reinterpret_cast<const sockaddr*>(&address.address), address.length);
+    } while (sent == -1 && errno == EINTR);
+
+    close(socket_fd);
+    return sent == static_cast<ssize_t>(length);
+}
+
+bool unix_datagram_receive(int socket_fd, std::vector<char>& buffer, int timeout_ms, ucred* sender) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+
+    while (true) {
+        int wait_ms = -1;
+        if (timeout_ms >= 0) {
+            auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+            wait_ms = static_cast<int>(std::max<int64_t>(remaining.count(), 0));
+        }
+
+        pollfd poll_fd = { socket_fd, POLLIN, 0 };
+        int ready = poll(&poll_fd, 1, wait_ms);
+        if (ready == -1 && errno == EINTR) {
+            continue;
+        }
+        if (ready <= 0) {
+            return false;
+        }
+
+        // MSG_TRUNC reports the full datagram length, so the buffer is sized exactly.
+        ssize_t length = recv(socket_fd, nullptr, 0, MSG_PEEK | MSG_TRUNC | MSG_DONTWAIT);
+        if (length == -1) {
+            if (errno == EINTR || errno == EAGAIN) {
+                continue;
+            }
+            return false;
+        }
+        buffer.resize(static_cast<size_t>(length));
+        iovec data_vector = { buffer.data(), buffer.size() };
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(ucred))];
+        msghdr message = {};
+        message.msg_iov = &data_vector;
+        message.msg_iovlen = 1;
+        if (sender != nullptr) {
+            message.msg_control = control;
+            message.msg_controllen = sizeof(control);
+        }
+        ssize_t received = recvmsg(socket_fd, &message, MSG_DONTWAIT);
+        if (received == length) {
+            if (sender != nullptr) {
+                *sender = { 0, static_cast<uid_t>(-1), static_cast<gid_t>(-1) };
+                cmsghdr* control_header = CMSG_FIRSTHDR(&message);
+                if (control_header != nullptr && control_header->cmsg_level == SOL_SOCKET &&
+                    control_header->cmsg_type == SCM_CREDENTIALS && control_header->cmsg_len == CMSG_LEN(sizeof(ucred))) {
+                    memcpy(sender, CMSG_DATA(control_header), sizeof(ucred));
+                }
+            }
+            return true;
+        }
+        if (received == -1 && (errno == EINTR || errno == EAGAIN)) {
+            continue;
+        }
+        return false;
+    }
+}
+
+
+UnixSocketServer::UnixSocketServer() {
+    wake_fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+}
+
+UnixSocketServer::~UnixSocketServer() {
+    close();
+    if (wake_fd_ != -1) {
+        ::close(wake_fd_);
+        wake_fd_ = -1;
+    }
+}
+
+bool UnixSocketServer::open(const UnixSocketAddress& address, size_t max_record_length, bool check_record_credentials) {
+    if (address.length == 0 || wake_fd_ == -1) {
+        return false;
+    }
+
+    int listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (listen_fd == -1) {
+        return false;
+    }
+
+    // Accepted sockets inherit SO_PASSCRED, so records queued before accept() carry credentials too.
+    int pass_credentials = 1;
+    if ((check_record_credentials &&
+         setsockopt(listen_fd, SOL_SOCKET, SO_PASSCRED, &pass_credentials, sizeof(pass_credentials)) == -1) ||
+        bind(listen_fd, reinterpret_cast<const sockaddr*>(&address.address), address.length) == -1 ||
+        listen(listen_fd, SOMAXCONN) == -1) {
+        ::close(listen_fd);
+        return false;
+    }
+
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd_ == -1) {
+        ::close(listen_fd);
+        return false;
+    }
+
+    epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.fd = listen_fd;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, listen_fd, &event);
+    event.data.fd = wake_fd_;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &event);
+
+    // Drop a wakeup left over from an interrupt() while the server was not running.
+    uint64_t wake_count;
+    while (read(wake_fd_, &wake_count, sizeof(wake_count)) > 0) {
+    }
+
+    max_record_length_ = max_record_length;
+    check_record_credentials_ = check_record_credentials;
+    recv_buffer_.resize(max_record_length + 1);
+    listen_fd_ = listen_fd;
+    return true;
+}
+
+void UnixSocketServer::run(const std::atomic<bool>& running, const RecordHandler& handler) {
+    if (epoll_fd_ == -1) {
+        return;
+    }
+
+    epoll_event events[MAX_EPOLL_EVENTS];
+    while (running) {
+        int event_count = epoll_wait(epoll_fd_, events, MAX_EPOLL_EVENTS, -1);
+        if (event_count == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        for (int i = 0; i < event_count; ++i) {
+            int fd = events[i].data.fd;
+            if (fd == wake_fd_) {
+                uint64_t wake_count;
+                while (read(wake_fd_, &wake_count, sizeof(wake_count)) > 0) {
+                }
+                return;
+            } else if (fd == listen_fd_) {
+                accept_clients();
+            } else {
+                read_client(fd, handler);
+            }
+        }
+    }
+}
+
+void UnixSocketServer::serve_ready(const RecordHandler& handler) {
+    if (epoll_fd_ == -1) {
+        return;
+    }
+
+    epoll_event events[MAX_EPOLL_EVENTS];
+    int event_count;
+    do {
+        event_count = epoll_wait(epoll_fd_, events, MAX_EPOLL_EVENTS, 0);
+        for (int i = 0; i < event_count; ++i) {
+            int fd = events[i].data.fd;
+            if (fd == wake_fd_) {
+                uint64_t wake_count;
+                while (read(wake_fd_, &wake_count, sizeof(wake_count)) > 0) {
+                }
+            } else if (fd == listen_fd_) {
+                accept_clients();
+            } else {
+                read_client(fd, handler);
+            }
+        }
+    } while (event_count == MAX_EPOLL_EVENTS || (event_count == -1 && errno == EINTR));
+}
+
+void UnixSocketServer::interrupt() {
+    if (wake_fd_ == -1) {
+        return;
+    }
+
+    uint64_t wake_count = 1;
+    while (write(wake_fd_, &wake_count, sizeof(wake_count)) == -1 && errno == EINTR) {
+    }
+}
+
+void UnixSocketServer::close() {
+    for (int client_fd : clients_) {
+        ::close(client_fd);
+    }
+    clients_.clear();
+    if (epoll_fd_ != -1) {
+        ::close(epoll_fd_);
+        epoll_fd_ = -1;
+    }
+    if (listen_fd_ != -1) {
+        ::close(listen_fd_);
+        listen_fd_ = -1;
+    }
+}
+
+void UnixSocketServer::accept_clients() {
+    while (true) {
+        int client_fd = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC | SOCK_NONBLOCK);
+        if (client_fd == -1) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            return;
+        }
+        if (!peer_is_same_user(client_fd)) {
+            ::close(client_fd);
+            continue;
+        }
+
+        epoll_event event = {};
+        event.events = EPOLLIN | EPOLLRDHUP;
+        event.data.fd = client_fd;
+        if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, client_fd, &event) == -1) {
+            ::close(client_fd);
+            continue;
+        }
+        clients_.push_back(client_fd);
+    }
+}
+
+void UnixSocketServer::read_client(int client_fd, const RecordHandler& handler) {
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * MAX_IPC_RECORD_FDS) + CMSG_SPACE(sizeof(ucred))];
+    std::vector<int> fds;
+
+    while (true) {
+        iovec data_vector = { recv_buffer_.data(), recv_buffer_.size() };
+        msghdr message = {};
+        message.msg_iov = &data_vector;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+
+        ssize_t msg_size = recvmsg(client_fd, &message, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+        if (msg_size > 0) {
+            fds.clear();
+            bool same_user = false;
+            for (cmsghdr* control_header = CMSG_FIRSTHDR(&message); control_header != nullptr;
+                 control_header = CMSG_NXTHDR(&message, control_header)) {
+                if (control_header->cmsg_level == SOL_SOCKET && control_header->cmsg_type == SCM_CREDENTIALS &&
+                    control_header->cmsg_len == CMSG_LEN(sizeof(ucred))) {
+                    ucred credentials;
+                    memcpy(&credentials, CMSG_DATA(control_header), sizeof(credentials));
+                    same_user = credentials.uid == geteuid();
+                } else if (control_header->cmsg_level == SOL_SOCKET && control_header->cmsg_type == SCM_RIGHTS) {
+                    size_t fd_count = (control_header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+                    const unsigned char* fd_data = CMSG_DATA(control_header);
+                    for (size_t n = 0; n < fd_count; ++n) {
+                        int fd;
+                        memcpy(&fd, fd_data + n * sizeof(int), sizeof(int));
+                        fds.push_back(fd);
+                    }
+                }
+            }
+
+            // Oversized, short of descriptors or from another user: dropped whole.
+            if (static_cast<size_t>(msg_size) > max_record_length_ || (message.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) ||
+                (check_record_credentials_ && !same_user)) {
+                for (int fd : fds) {
+                    ::close(fd);
+                }
+                continue;
+            }
+
+            handler(recv_buffer_.data(), static_cast<size_t>(msg_size), fds);
+            continue;
+        }
+
+        if (msg_size == -1 && errno == EINTR) {
+            continue;
+        }
+        if (msg_size == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return;
+        }
+
+        // Zero means the sender closed its end; anything else is a broken connection.
+        close_client(client_fd);
+        return;
+    }
+}
+
+void UnixSocketServer::close_client(int client_fd) {
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, client_fd, nullptr);
+    auto client = std::find(clients_.begin(), clients_.end(), client_fd);
+    if (client != clients_.end()) {
+        *client = clients_.back();
+        clients_.pop_back();
+    }
+    ::close(client_fd);
+}
+
+#endif // __linux__
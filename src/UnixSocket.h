@@ -0,0 +1,75 @@
+#pragma once
+
+#if defined(__linux__)
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <functional>
+#include <cstdint>
+
+// Most descriptors that can travel with one record.
+const size_t MAX_IPC_RECORD_FDS = 64;
+
+struct UnixSocketAddress {
+    sockaddr_un address;
+    socklen_t length = 0;
+};
+
+// Builds an abstract-namespace address. The name disappears with the last socket bound to it.
+UnixSocketAddress make_abstract_address(const std::string& name);
+
+// Connects to address and sends one SOCK_SEQPACKET record, passing fds with SCM_RIGHTS. errno is left set on failure.
+bool unix_socket_send(const UnixSocketAddress& address, const char* data, size_t length,
+                      const int* fds, size_t fd_count, int timeout_ms, size_t send_buffer_bytes = 0);
+// Connecting and sending fail with EAGAIN once the server has had no room for timeout_ms. Returns -1 on failure.
+int unix_socket_connect(const UnixSocketAddress& address, int timeout_ms, size_t send_buffer_bytes = 0);
+// Sends one record on a connection from unix_socket_connect. errno is left set on failure.
+bool unix_socket_send_record(int socket_fd, const char* data, size_t length, const int* fds, size_t fd_count,
+                             int send_flags = 0);
+
+// pass_credentials lets unix_datagram_receive report the sender. Returns -1 on failure.
+int unix_datagram_bind(const UnixSocketAddress& address, bool pass_credentials = false);
+// Sends one datagram to address without blocking.
+bool unix_datagram_send(const UnixSocketAddress& address, const char* data, size_t length);
+// A negative timeout waits forever. sender gets uid -1 when the datagram came without credentials.
+bool unix_datagram_receive(int socket_fd, std::vector<char>& buffer, int timeout_ms, ucred* sender = nullptr);
+
+// Epoll server on an abstract SOCK_SEQPACKET socket. The handler owns the descriptors it is given.
+class UnixSocketServer {
+public:
+    typedef std::function<void(const char* data, size_t length, std::vector<int>& fds)> RecordHandler;
+
+    UnixSocketServer();
+    ~UnixSocketServer();
+
+    // With check_record_credentials, records without the same user's credentials are dropped.
+    bool open(const UnixSocketAddress& address, size_t max_record_length, bool check_record_credentials = false);
+    // Serves clients until interrupt() is called. Returns at once if running is already false.
+    void run(const std::atomic<bool>& running, const RecordHandler& handler);
+    // Accepts the clients and reads the records that are ready, without waiting.
+    void serve_ready(const RecordHandler& handler);
+    // Polls readable while serve_ready() has something to do, -1 when not open.
+    int poll_fd() const { return epoll_fd_; }
+    void interrupt();
+    void close();
+
+private:
+    int listen_fd_ = -1;
+    int epoll_fd_ = -1;
+    int wake_fd_ = -1;
+    std::vector<int> clients_;
+    std::vector<char> recv_buffer_;
+    size_t max_record_length_ = 0;
+    bool check_record_credentials_ = false;
+
+    void accept_clients();
+    void read_client(int client_fd, const RecordHandler& handler);
+    void close_client(int client_fd);
+
+    static const int MAX_EPOLL_EVENTS = 64;
+};
+
+#endif // __linux__
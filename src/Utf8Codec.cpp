@@ -0,0 +1,772 @@
+#include "Utf8Codec.h"
+
+#include <algorithm>
+#include <cstring>
+#include <cwchar>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define UTF8_CODEC_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define UTF8_TARGET_AVX2
+#else
+#define UTF8_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define UTF8_CODEC_NEON 1
+#include <arm_neon.h>
+#endif
+
+#if WCHAR_MAX > 0xFFFF
+#define UTF8_WCHAR_UTF32 1
+#endif
+
+
+namespace {
+
+// Each kernel returns how far it got before input it does not handle. Null where an instruction set has none.
+struct Utf8Kernels {
+    const char* name;
+    size_t (*decode_ascii)(const unsigned char* in, size_t length, wchar_t* out);
+    // Decodes runs of three-byte sequences, eight characters from 24 bytes at a time.
+    size_t (*decode_three_byte)(const unsigned char* in, size_t length, wchar_t* out);
+    size_t (*encode_ascii)(const wchar_t* in, size_t length, char* out);
+    // Encode runs of characters below U+0800, and runs of three-byte characters. These advance out themselves.
+    size_t (*encode_two_byte)(const wchar_t* in, size_t length, char*& out);
+    size_t (*encode_three_byte)(const wchar_t* in, size_t length, char*& out);
+    // Adds the UTF-8 length of the characters it counts to bytes. Stops at surrogates and values above U+10FFFF.
+    size_t (*measure)(const wchar_t* in, size_t length, size_t& bytes);
+};
+
+// The next code point of UTF-32 or UTF-16 text. Unpaired surrogates and values above U+10FFFF become U+FFFD.
+inline uint32_t next_code_point(const wchar_t*& in, const wchar_t* in_end) {
+    uint32_t code_point = static_cast<uint32_t>(*in++);
+#ifndef UTF8_WCHAR_UTF32
+    if (code_point >= 0xD800 && code_point <= 0xDBFF) {
+        if (in < in_end) {
+            uint32_t low = static_cast<uint32_t>(*in);
+            if (low >= 0xDC00 && low <= 0xDFFF) {
+                ++in;
+                return 0x10000 + ((code_point - 0xD800) << 10) + (low - 0xDC00);
+            }
+        }
+        return 0xFFFD;
+    }
+#else
+    (void)in_end;
+#endif
+    if ((code_point >= 0xD800 && code_point <= 0xDFFF) || code_point > 0x10FFFF) {
+        return 0xFFFD;
+    }
+    return code_point;
+}
+
+inline size_t encoded_length(uint32_t code_point) {
+    return code_point < 0x80 ? 1 : code_point < 0x800 ? 2 : code_point < 0x10000 ? 3 : 4;
+}
+
+// UTF-8 length of the next character, as next_code_point() would read it.
+inline size_t next_encoded_length(const wchar_t*& in, const wchar_t* in_end) {
+#ifdef UTF8_WCHAR_UTF32
+    (void)in_end;
+    uint32_t code_point = static_cast<uint32_t>(*in++);
+    // Surrogates and values above U+10FFFF take three bytes, like the U+FFFD written for them.
+    return 1 + (code_point > 0x7F) + (code_point > 0x7FF) + (code_point > 0xFFFF && code_point <= 0x10FFFF);
+#else
+    return encoded_length(next_code_point(in, in_end));
+#endif
+}
+
+inline char* encode_code_point(uint32_t code_point, char* out) {
+    if (code_point < 0x800) {
+        *out++ = static_cast<char>(0xC0 | (code_point >> 6));
+        *out++ = static_cast<char>(0x80 | (code_point & 0x3F));
+    } else if (code_point < 0x10000) {
+        *out++ = static_cast<char>(0xE0 | (code_point >> 12));
+        *out++ = static_cast<char>(0x80 | ((code_point >> 6) & 0x3F));
+        *out++ = static_cast<char>(0x80 | (code_point & 0x3F));
+    } else {
+        *out++ = static_cast<char>(0xF0 | (code_point >> 18));
+        *out++ = static_cast<char>(0x80 | ((code_point >> 12) & 0x3F));
+        *out++ = static_cast<char>(0x80 | ((code_point >> 6) & 0x3F));
+        *out++ = static_cast<char>(0x80 | (code_point & 0x3F));
+    }
+    return out;
+}
+
+inline wchar_t* put_code_point(uint32_t code_point, wchar_t* out) {
+#ifndef UTF8_WCHAR_UTF32
+    if (code_point >= 0x10000) {
+        code_point -= 0x10000;
+        *out++ = static_cast<wchar_t>(0xD800 + (code_point >> 10));
+        *out++ = static_cast<wchar_t>(0xDC00 + (code_point & 0x3FF));
+        return out;
+    }
+#endif
+    *out++ = static_cast<wchar_t>(code_point);
+    return out;
+}
+
+#if defined(UTF8_CODEC_X86)
+
+size_t decode_ascii_sse2(const unsigned char* in, size_t length, wchar_t* out) {
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+        if (_mm_movemask_epi8(bytes) != 0) {
+            break;
+        }
+        __m128i low = _mm_unpacklo_epi8(bytes, zero);
+        __m128i high = _mm_unpackhi_epi8(bytes, zero);
+        __m128i* dst = reinterpret_cast<__m128i*>(out + i);
+#ifdef UTF8_WCHAR_UTF32
+        _mm_storeu_si128(dst, _mm_unpacklo_epi16(low, zero));
+        _mm_storeu_si128(dst + 1, _mm_unpackhi_epi16(low, zero));
+        _mm_storeu_si128(dst + 2, _mm_unpacklo_epi16(high, zero));
+        _mm_storeu_si128(dst + 3, _mm_unpackhi_epi16(high, zero));
+#else
+        _mm_storeu_si128(dst, low);
+        _mm_storeu_si128(dst + 1, high);
+#endif
+    }
+    return i;
+}
+
+size_t encode_ascii_sse2(const wchar_t* in, size_t length, char* out) {
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        const __m128i* src = reinterpret_cast<const __m128i*>(in + i);
+#ifdef UTF8_WCHAR_UTF32
+        __m128i chars0 = _mm_loadu_si128(src);
+        __m128i chars1 = _mm_loadu_si128(src + 1);
+        __m128i chars2 = _mm_loadu_si128(src + 2);
+        __m128i chars3 = _mm_loadu_si128(src + 3);
+        __m128i any = _mm_or_si128(_mm_or_si128(chars0, chars1), _mm_or_si128(chars2, chars3));
+        __m128i high_bits = _mm_and_si128(any, _mm_set1_epi32(~0x7F));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(high_bits, zero)) != 0xFFFF) {
+            break;
+        }
+        __m128i bytes = _mm_packus_epi16(_mm_packs_epi32(chars0, chars1), _mm_packs_epi32(chars2, chars3));
+#else
+        __m128i chars0 = _mm_loadu_si128(src);
+        __m128i chars1 = _mm_loadu_si128(src + 1);
+        __m128i high_bits = _mm_and_si128(_mm_or_si128(chars0, chars1), _mm_set1_epi16(static_cast<short>(0xFF80)));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi16(high_bits, zero)) != 0xFFFF) {
+            break;
+        }
+        __m128i bytes = _mm_packus_epi16(chars0, chars1);
+#endif
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), bytes);
+    }
+    return i;
+}
+
+#ifdef UTF8_WCHAR_UTF32
+size_t measure_sse2(const wchar_t* in, size_t length, size_t& bytes) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i max_code_point = _mm_set1_epi32(0x10FFFF);
+    // Each lane counts the bytes its characters take beyond the first, as negated compare masks.
+    __m128i extra = zero;
+    size_t i = 0;
+    for (; i + 4 <= length; i += 4) {
+        __m128i chars = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+        __m128i out_of_range = _mm_or_si128(_mm_cmpgt_epi32(chars, max_code_point), _mm_cmplt_epi32(chars, zero));
+        if (_mm_movemask_epi8(out_of_range) != 0) {
+            break;
+        }
+        extra = _mm_sub_epi32(extra, _mm_cmpgt_epi32(chars, _mm_set1_epi32(0x7F)));
+        extra = _mm_sub_epi32(extra, _mm_cmpgt_epi32(chars, _mm_set1_epi32(0x7FF)));
+        extra = _mm_sub_epi32(extra, _mm_cmpgt_epi32(chars, _mm_set1_epi32(0xFFFF)));
+    }
+    uint32_t lanes[4];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), extra);
+    bytes += i + lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    return i;
+}
+#else
+size_t measure_sse2(const wchar_t* in, size_t length, size_t& bytes) {
+    const __m128i zero = _mm_setzero_si128();
+    // Flipping the top bit makes the signed 16-bit compares unsigned.
+    const __m128i flip = _mm_set1_epi16(static_cast<short>(0x8000));
+    const __m128i above_ascii = _mm_set1_epi16(static_cast<short>(0x7F ^ 0x8000));
+    const __m128i above_two_byte = _mm_set1_epi16(static_cast<short>(0x7FF ^ 0x8000));
+    __m128i extra = zero;
+    size_t i = 0;
+    bool stopped = false;
+    while (!stopped && i + 8 <= length) {
+        // The 16-bit lanes are folded into extra before they can overflow.
+        __m128i extra16 = zero;
+        size_t chunk_end = std::min(length, i + 8 * 8192);
+        for (; i + 8 <= chunk_end; i += 8) {
+            __m128i chars = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+            __m128i surrogate = _mm_cmpeq_epi16(_mm_and_si128(chars, _mm_set1_epi16(static_cast<short>(0xF800))),
+                                                _mm_set1_epi16(static_cast<short>(0xD800)));
+            if (_mm_movemask_epi8(surrogate) != 0) {
+                stopped = true;
+                break;
+            }
+            __m128i flipped = _mm_xor_si128(chars, flip);
+            extra16 = _mm_sub_epi16(extra16, _mm_cmpgt_epi16(flipped, above_ascii));
+            extra16 = _mm_sub_epi16(extra16, _mm_cmpgt_epi16(flipped, above_two_byte));
+        }
+        extra = _mm_add_epi32(extra, _mm_madd_epi16(extra16, _mm_set1_epi16(1)));
+    }
+    uint32_t lanes[4];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), extra);
+    bytes += i + lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    return i;
+}
+#endif
+
+UTF8_TARGET_AVX2 size_t decode_ascii_avx2(const unsigned char* in, size_t length, wchar_t* out) {
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+        if (_mm256_movemask_epi8(bytes) != 0) {
+            return i;
+        }
+#ifdef UTF8_WCHAR_UTF32
+        for (size_t part = 0; part < 32; part += 8) {
+            __m128i eight = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(in + i + part));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i + part), _mm256_cvtepu8_epi32(eight));
+        }
+#else
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_cvtepu8_epi16(_mm256_castsi256_si128(bytes)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i + 16), _mm256_cvtepu8_epi16(_mm256_extracti128_si256(bytes, 1)));
+#endif
+    }
+    return i + decode_ascii_sse2(in + i, length - i, out + i);
+}
+
+UTF8_TARGET_AVX2 size_t decode_three_byte_avx2(const unsigned char* in, size_t length, wchar_t* out) {
+    // Each 16-byte lane holds four sequences in its low 12 bytes, with leads at 0, 3, 6 and 9.
+    const __m256i pattern_mask = _mm256_setr_epi32(static_cast<int>(0xF0C0C0F0u), static_cast<int>(0xC0F0C0C0u),
+        static_cast<int>(0xC0C0F0C0u), 0, static_cast<int>(0xF0C0C0F0u), static_cast<int>(0xC0F0C0C0u),
+        static_cast<int>(0xC0C0F0C0u), 0);
+    const __m256i pattern = _mm256_setr_epi32(static_cast<int>(0xE08080E0u), static_cast<int>(0x80E08080u),
+        static_cast<int>(0x8080E080u), 0, static_cast<int>(0xE08080E0u), static_cast<int>(0x80E08080u),
+        static_cast<int>(0x8080E080u), 0);
+    // Moves each sequence into a 32-bit lane, its last byte lowest.
+    const __m256i gather = _mm256_setr_epi32(static_cast<int>(0x80000102u), static_cast<int>(0x80030405u),
+        static_cast<int>(0x80060708u), static_cast<int>(0x80090A0Bu), static_cast<int>(0x80000102u),
+        static_cast<int>(0x80030405u), static_cast<int>(0x80060708u), static_cast<int>(0x80090A0Bu));
+    size_t done = 0;
+    // Eight sequences take 24 bytes, and the second load reads 16 from byte 12.
+    while (length - done >= 28) {
+        __m128i first = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + done));
+        __m128i second = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + done + 12));
+        __m256i bytes = _mm256_inserti128_si256(_mm256_castsi128_si256(first), second, 1);
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(bytes, pattern_mask), pattern)) != -1) {
+            break;
+        }
+        __m256i lanes = _mm256_shuffle_epi8(bytes, gather);
+        __m256i code_points = _mm256_or_si256(_mm256_and_si256(lanes, _mm256_set1_epi32(0x3F)),
+            _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi32(lanes, 2), _mm256_set1_epi32(0xFC0)),
+                            _mm256_and_si256(_mm256_srli_epi32(lanes, 4), _mm256_set1_epi32(0xF000))));
+        __m256i overlong = _mm256_cmpgt_epi32(_mm256_set1_epi32(0x800), code_points);
+        __m256i surrogate = _mm256_cmpeq_epi32(_mm256_and_si256(code_points, _mm256_set1_epi32(0xF800)),
+                                               _mm256_set1_epi32(0xD800));
+        __m256i invalid = _mm256_or_si256(overlong, surrogate);
+        if (!_mm256_testz_si256(invalid, invalid)) {
+            break;
+        }
+#ifdef UTF8_WCHAR_UTF32
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + done / 3), code_points);
+#else
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(code_points, code_points), 0x08);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + done / 3), _mm256_castsi256_si128(packed));
+#endif
+        done += 24;
+    }
+    return done;
+}
+
+UTF8_TARGET_AVX2 size_t encode_ascii_avx2(const wchar_t* in, size_t length, char* out) {
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        const __m256i* src = reinterpret_cast<const __m256i*>(in + i);
+#ifdef UTF8_WCHAR_UTF32
+        __m256i chars0 = _mm256_loadu_si256(src);
+        __m256i chars1 = _mm256_loadu_si256(src + 1);
+        __m256i chars2 = _mm256_loadu_si256(src + 2);
+        __m256i chars3 = _mm256_loadu_si256(src + 3);
+        __m256i any = _mm256_or_si256(_mm256_or_si256(chars0, chars1), _mm256_or_si256(chars2, chars3));
+        if (!_mm256_testz_si256(any, _mm256_set1_epi32(~0x7F))) {
+            return i;
+        }
+        // The packs work within 128-bit halves, which leaves the groups of four characters interleaved.
+        __m256i bytes = _mm256_packus_epi16(_mm256_packs_epi32(chars0, chars1), _mm256_packs_epi32(chars2, chars3));
+        bytes = _mm256_permutevar8x32_epi32(bytes, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+#else
+        __m256i chars0 = _mm256_loadu_si256(src);
+        __m256i chars1 = _mm256_loadu_si256(src + 1);
+        if (!_mm256_testz_si256(_mm256_or_si256(chars0, chars1), _mm256_set1_epi16(static_cast<short>(0xFF80)))) {
+            return i;
+        }
+        __m256i bytes = _mm256_permute4x64_epi64(_mm256_packus_epi16(chars0, chars1), 0xD8);
+#endif
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), bytes);
+    }
+    return i + encode_ascii_sse2(in + i, length - i, out + i);
+}
+
+// pshufb controls that pack eight two-byte slots into UTF-8, indexed by the mask of ASCII slots.
+struct TwoByteCompress {
+    uint8_t shuffle[256][16];
+    uint8_t length[256];
+};
+
+constexpr TwoByteCompress make_two_byte_compress() {
+    TwoByteCompress table{};
+    for (int mask = 0; mask < 256; ++mask) {
+        int length = 0;
+        for (int slot = 0; slot < 8; ++slot) {
+            table.shuffle[mask][length++] = static_cast<uint8_t>(2 * slot);
+            if ((mask & (1 << slot)) == 0) {
+                table.shuffle[mask][length++] = static_cast<uint8_t>(2 * slot + 1);
+            }
+        }
+        table.length[mask] = static_cast<uint8_t>(length);
+        for (; length < 16; ++length) {
+            table.shuffle[mask][length] = 0x80;
+        }
+    }
+    return table;
+}
+
+constexpr TwoByteCompress TWO_BYTE_COMPRESS = make_two_byte_compress();
+
+UTF8_TARGET_AVX2 size_t encode_two_byte_avx2(const wchar_t* in, size_t length, char*& out) {
+    size_t i = 0;
+    // Each half stores 16 bytes for as few as eight, so eight characters must remain past the block.
+    for (; i + 24 <= length; i += 16) {
+#ifdef UTF8_WCHAR_UTF32
+        __m256i chars0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+        __m256i chars1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i + 8));
+        if (!_mm256_testz_si256(_mm256_or_si256(chars0, chars1), _mm256_set1_epi32(~0x7FF))) {
+            break;
+        }
+        __m256i units = _mm256_permute4x64_epi64(_mm256_packus_epi32(chars0, chars1), 0xD8);
+#else
+        __m256i units = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+        if (!_mm256_testz_si256(units, _mm256_set1_epi16(static_cast<short>(0xF800)))) {
+            break;
+        }
+#endif
+        __m256i ascii = _mm256_cmpgt_epi16(_mm256_set1_epi16(0x80), units);
+        __m256i lead = _mm256_or_si256(_mm256_srli_epi16(units, 6), _mm256_set1_epi16(0xC0));
+        __m256i trail = _mm256_or_si256(_mm256_and_si256(units, _mm256_set1_epi16(0x3F)), _mm256_set1_epi16(0x80));
+        __m256i slots = _mm256_blendv_epi8(_mm256_or_si256(lead, _mm256_slli_epi16(trail, 8)), units, ascii);
+
+        uint32_t ascii_mask = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_packs_epi16(ascii, _mm256_setzero_si256())));
+        uint32_t low_mask = ascii_mask & 0xFF;
+        uint32_t high_mask = (ascii_mask >> 16) & 0xFF;
+        __m256i shuffle = _mm256_inserti128_si256(
+            _mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(TWO_BYTE_COMPRESS.shuffle[low_mask]))),
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(TWO_BYTE_COMPRESS.shuffle[high_mask])), 1);
+        __m256i packed = _mm256_shuffle_epi8(slots, shuffle);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm256_castsi256_si128(packed));
+        out += TWO_BYTE_COMPRESS.length[low_mask];
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm256_extracti128_si256(packed, 1));
+        out += TWO_BYTE_COMPRESS.length[high_mask];
+    }
+    return i;
+}
+
+UTF8_TARGET_AVX2 size_t encode_three_byte_avx2(const wchar_t* in, size_t length, char*& out) {
+    // Drops the fourth byte of each 32-bit lane.
+    const __m256i compress = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+                                              0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    size_t i = 0;
+    // The second store writes four bytes past the block, which the next four characters cover.
+    for (; i + 12 <= length; i += 8) {
+#ifdef UTF8_WCHAR_UTF32
+        __m256i chars = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+#else
+        __m256i chars = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i)));
+#endif
+        __m256i below = _mm256_cmpgt_epi32(_mm256_set1_epi32(0x800), chars);
+        __m256i above = _mm256_cmpgt_epi32(chars, _mm256_set1_epi32(0xFFFF));
+        __m256i surrogate = _mm256_cmpeq_epi32(_mm256_and_si256(chars, _mm256_set1_epi32(0xF800)),
+                                               _mm256_set1_epi32(0xD800));
+        __m256i invalid = _mm256_or_si256(_mm256_or_si256(below, above), surrogate);
+        if (!_mm256_testz_si256(invalid, invalid)) {
+            break;
+        }
+        __m256i lead = _mm256_or_si256(_mm256_srli_epi32(chars, 12), _mm256_set1_epi32(0xE0));
+        __m256i middle = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi32(chars, 6), _mm256_set1_epi32(0x3F)),
+                                         _mm256_set1_epi32(0x80));
+        __m256i last = _mm256_or_si256(_mm256_and_si256(chars, _mm256_set1_epi32(0x3F)), _mm256_set1_epi32(0x80));
+        __m256i sequences = _mm256_or_si256(lead, _mm256_or_si256(_mm256_slli_epi32(middle, 8), _mm256_slli_epi32(last, 16)));
+        __m256i packed = _mm256_shuffle_epi8(sequences, compress);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm256_castsi256_si128(packed));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 12), _mm256_extracti128_si256(packed, 1));
+        out += 24;
+    }
+    return i;
+}
+
+#ifdef UTF8_WCHAR_UTF32
+UTF8_TARGET_AVX2 size_t measure_avx2(const wchar_t* in, size_t length, size_t& bytes) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i max_code_point = _mm256_set1_epi32(0x10FFFF);
+    __m256i extra = zero;
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8) {
+        __m256i chars = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+        __m256i out_of_range = _mm256_or_si256(_mm256_cmpgt_epi32(chars, max_code_point), _mm256_cmpgt_epi32(zero, chars));
+        if (!_mm256_testz_si256(out_of_range, out_of_range)) {
+            break;
+        }
+        extra = _mm256_sub_epi32(extra, _mm256_cmpgt_epi32(chars, _mm256_set1_epi32(0x7F)));
+        extra = _mm256_sub_epi32(extra, _mm256_cmpgt_epi32(chars, _mm256_set1_epi32(0x7FF)));
+        extra = _mm256_sub_epi32(extra, _mm256_cmpgt_epi32(chars, _mm256_set1_epi32(0xFFFF)));
+    }
+    uint32_t lanes[8];
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), extra);
+    for (uint32_t lane : lanes) {
+        bytes += lane;
+    }
+    bytes += i;
+    return i;
+}
+#else
+UTF8_TARGET_AVX2 size_t measure_avx2(const wchar_t* in, size_t length, size_t& bytes) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i flip = _mm256_set1_epi16(static_cast<short>(0x8000));
+    const __m256i above_ascii = _mm256_set1_epi16(static_cast<short>(0x7F ^ 0x8000));
+    const __m256i above_two_byte = _mm256_set1_epi16(static_cast<short>(0x7FF ^ 0x8000));
+    __m256i extra = zero;
+    size_t i = 0;
+    bool stopped = false;
+    while (!stopped && i + 16 <= length) {
+        __m256i extra16 = zero;
+        size_t chunk_end = std::min(length, i + 16 * 8192);
+        for (; i + 16 <= chunk_end; i += 16) {
+            __m256i chars = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+            __m256i surrogate = _mm256_cmpeq_epi16(_mm256_and_si256(chars, _mm256_set1_epi16(static_cast<short>(0xF800))),
+                                                   _mm256_set1_epi16(static_cast<short>(0xD800)));
+            if (!_mm256_testz_si256(surrogate, surrogate)) {
+                stopped = true;
+                break;
+            }
+            __m256i flipped = _mm256_xor_si256(chars, flip);
+            extra16 = _mm256_sub_epi16(extra16, _mm256_cmpgt_epi16(flipped, above_ascii));
+            extra16 = _mm256_sub_epi16(extra16, _mm256_cmpgt_epi16(flipped, above_two_byte));
+        }
+        extra = _mm256_add_epi32(extra, _mm256_madd_epi16(extra16, _mm256_set1_epi16(1)));
+    }
+    uint32_t lanes[8];
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), extra);
+    for (uint32_t lane : lanes) {
+        bytes += lane;
+    }
+    bytes += i;
+    return i;
+}
+#endif
+
+bool cpu_has_avx2() {
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) {
+        return false;
+    }
+    __cpuid(info, 1);
+    // The OS must save the YMM registers on context switches as well.
+    bool ymm_saved = (info[2] & (1 << 27)) != 0 && (_xgetbv(0) & 6) == 6;
+    __cpuidex(info, 7, 0);
+    return ymm_saved && (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#elif defined(UTF8_CODEC_NEON)
+
+size_t decode_ascii_neon(const unsigned char* in, size_t length, wchar_t* out) {
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        uint8x16_t bytes = vld1q_u8(in + i);
+        if (vmaxvq_u8(bytes) >= 0x80) {
+            break;
+        }
+        uint16x8_t low = vmovl_u8(vget_low_u8(bytes));
+        uint16x8_t high = vmovl_u8(vget_high_u8(bytes));
+#ifdef UTF8_WCHAR_UTF32
+        uint32_t* dst = reinterpret_cast<uint32_t*>(out + i);
+        vst1q_u32(dst, vmovl_u16(vget_low_u16(low)));
+        vst1q_u32(dst + 4, vmovl_u16(vget_high_u16(low)));
+        vst1q_u32(dst + 8, vmovl_u16(vget_low_u16(high)));
+        vst1q_u32(dst + 12, vmovl_u16(vget_high_u16(high)));
+#else
+        uint16_t* dst = reinterpret_cast<uint16_t*>(out + i);
+        vst1q_u16(dst, low);
+        vst1q_u16(dst + 8, high);
+#endif
+    }
+    return i;
+}
+
+size_t encode_ascii_neon(const wchar_t* in, size_t length, char* out) {
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+#ifdef UTF8_WCHAR_UTF32
+        const uint32_t* src = reinterpret_cast<const uint32_t*>(in + i);
+        uint32x4_t chars0 = vld1q_u32(src);
+        uint32x4_t chars1 = vld1q_u32(src + 4);
+        uint32x4_t chars2 = vld1q_u32(src + 8);
+        uint32x4_t chars3 = vld1q_u32(src + 12);
+        if (vmaxvq_u32(vorrq_u32(vorrq_u32(chars0, chars1), vorrq_u32(chars2, chars3))) >= 0x80) {
+            break;
+        }
+        uint16x8_t low = vcombine_u16(vmovn_u32(chars0), vmovn_u32(chars1));
+        uint16x8_t high = vcombine_u16(vmovn_u32(chars2), vmovn_u32(chars3));
+#else
+        const uint16_t* src = reinterpret_cast<const uint16_t*>(in + i);
+        uint16x8_t low = vld1q_u16(src);
+        uint16x8_t high = vld1q_u16(src + 8);
+        if (vmaxvq_u16(vorrq_u16(low, high)) >= 0x80) {
+            break;
+        }
+#endif
+        vst1q_u8(reinterpret_cast<uint8_t*>(out + i), vcombine_u8(vmovn_u16(low), vmovn_u16(high)));
+    }
+    return i;
+}
+
+#ifdef UTF8_WCHAR_UTF32
+size_t measure_neon(const wchar_t* in, size_t length, size_t& bytes) {
+    uint32x4_t extra = vdupq_n_u32(0);
+    size_t i = 0;
+    for (; i + 4 <= length; i += 4) {
+        uint32x4_t chars = vld1q_u32(reinterpret_cast<const uint32_t*>(in + i));
+        if (vmaxvq_u32(chars) > 0x10FFFF) {
+            break;
+        }
+        // Compares yield all ones, so subtracting them counts.
+        extra = vsubq_u32(extra, vcgtq_u32(chars, vdupq_n_u32(0x7F)));
+        extra = vsubq_u32(extra, vcgtq_u32(chars, vdupq_n_u32(0x7FF)));
+        extra = vsubq_u32(extra, vcgtq_u32(chars, vdupq_n_u32(0xFFFF)));
+    }
+    bytes += i + vaddvq_u32(extra);
+    return i;
+}
+#else
+size_t measure_neon(const wchar_t* in, size_t length, size_t& bytes) {
+    uint32x4_t extra = vdupq_n_u32(0);
+    size_t i = 0;
+    bool stopped = false;
+    while (!stopped && i + 8 <= length) {
+        uint16x8_t extra16 = vdupq_n_u16(0);
+        size_t chunk_end = std::min(length, i + 8 * 8192);
+        for (; i + 8 <= chunk_end; i += 8) {
+            uint16x8_t chars = vld1q_u16(reinterpret_cast<const uint16_t*>(in + i));
+            if (vmaxvq_u16(vceqq_u16(vandq_u16(chars, vdupq_n_u16(0xF800)), vdupq_n_u16(0xD800))) != 0) {
+                stopped = true;
+                break;
+            }
+            extra16 = vsubq_u16(extra16, vcgtq_u16(chars, vdupq_n_u16(0x7F)));
+            extra16 = vsubq_u16(extra16, vcgtq_u16(chars, vdupq_n_u16(0x7FF)));
+        }
+        extra = vaddq_u32(extra, vpaddlq_u16(extra16));
+    }
+    bytes += i + vaddvq_u32(extra);
+    return i;
+}
+#endif
+
+#endif // UTF8_CODEC_X86
+
+// The kernels this build and CPU can run, fastest first.
+size_t available_kernels(Utf8Kernels* out) {
+    size_t count = 0;
+#if defined(UTF8_CODEC_X86)
+    if (cpu_has_avx2()) {
+        out[count++] = { "avx2", decode_ascii_avx2, decode_three_byte_avx2, encode_ascii_avx2, encode_two_byte_avx2,
+                         encode_three_byte_avx2, measure_avx2 };
+    }
+    out[count++] = { "sse2", decode_ascii_sse2, nullptr, encode_ascii_sse2, nullptr, nullptr, measure_sse2 };
+#elif defined(UTF8_CODEC_NEON)
+    out[count++] = { "neon", decode_ascii_neon, nullptr, encode_ascii_neon, nullptr, nullptr, measure_neon };
+#endif
+    out[count++] = { "scalar", nullptr, nullptr, nullptr, nullptr, nullptr, nullptr };
+    return count;
+}
+
+const size_t MAX_KERNELS = 3;
+
+Utf8Kernels select_kernels() {
+    Utf8Kernels available[MAX_KERNELS];
+    available_kernels(available);
+    return available[0];
+}
+
+Utf8Kernels& kernels() {
+    static Utf8Kernels selected = select_kernels();
+    return selected;
+}
+
+// Units left to the scalar loop after a kernel converts nothing, before it is tried again.
+const size_t KERNEL_BACKOFF = 8;
+
+} // namespace
+
+const char* utf8_kernel_name() {
+    return kernels().name;
+}
+
+bool utf8_use_kernels(const char* name) {
+    Utf8Kernels available[MAX_KERNELS];
+    size_t count = available_kernels(available);
+    for (size_t i = 0; i < count; ++i) {
+        if (strcmp(available[i].name, name) == 0) {
+            kernels() = available[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t utf8_encoded_length(const wchar_t* in, size_t length) {
+    const Utf8Kernels& kernels = ::kernels();
+    const wchar_t* const in_end = in + length;
+    size_t bytes = 0;
+
+    while (in < in_end) {
+        if (kernels.measure != nullptr) {
+            in += kernels.measure(in, static_cast<size_t>(in_end - in), bytes);
+        }
+        // Whatever stopped the kernel, and a tail shorter than a vector, is counted a character at a time.
+        const wchar_t* const scalar_end = kernels.measure != nullptr ? std::min(in_end, in + 16) : in_end;
+        while (in < scalar_end) {
+            bytes += next_encoded_length(in, in_end);
+        }
+    }
+    return bytes;
+}
+
+size_t utf8_encode(const wchar_t* in, size_t length, char* out) {
+    const Utf8Kernels& kernels = ::kernels();
+    const wchar_t* const in_end = in + length;
+    char* const out_start = out;
+    const wchar_t* vector_from = in;
+    const wchar_t* multibyte_vector_from = in;
+
+    while (in < in_end) {
+        if (static_cast<uint32_t>(*in) < 0x80) {
+            if (kernels.encode_ascii != nullptr && in >= vector_from) {
+                size_t converted = kernels.encode_ascii(in, static_cast<size_t>(in_end - in), out);
+                in += converted;
+                out += converted;
+                if (converted == 0) {
+                    vector_from = in + KERNEL_BACKOFF;
+                }
+            }
+            while (in_end - in >= 4 && (static_cast<uint32_t>(in[0] | in[1] | in[2] | in[3]) & ~0x7Fu) == 0) {
+                out[0] = static_cast<char>(in[0]);
+                out[1] = static_cast<char>(in[1]);
+                out[2] = static_cast<char>(in[2]);
+                out[3] = static_cast<char>(in[3]);
+                in += 4;
+                out += 4;
+            }
+            while (in < in_end && static_cast<uint32_t>(*in) < 0x80) {
+                *out++ = static_cast<char>(*in++);
+            }
+            continue;
+        }
+        size_t (*encode_run)(const wchar_t*, size_t, char*&) =
+            static_cast<uint32_t>(*in) < 0x800 ? kernels.encode_two_byte : kernels.encode_three_byte;
+        if (encode_run != nullptr && in >= multibyte_vector_from) {
+            size_t converted = encode_run(in, static_cast<size_t>(in_end - in), out);
+            if (converted != 0) {
+                in += converted;
+                continue;
+            }
+            multibyte_vector_from = in + KERNEL_BACKOFF;
+        }
+        out = encode_code_point(next_code_point(in, in_end), out);
+    }
+    return static_cast<size_t>(out - out_start);
+}
+
+size_t utf8_decode(const char* data, size_t length, wchar_t* out) {
+    const Utf8Kernels& kernels = ::kernels();
+    const unsigned char* in = reinterpret_cast<const unsigned char*>(data);
+    const unsigned char* const in_end = in + length;
+    wchar_t* const out_start = out;
+    const unsigned char* ascii_vector_from = in;
+    const unsigned char* three_byte_vector_from = in;
+
+    while (in < in_end) {
+        uint32_t lead = *in;
+        if (lead < 0x80) {
+            if (kernels.decode_ascii != nullptr && in >= ascii_vector_from) {
+                size_t converted = kernels.decode_ascii(in, static_cast<size_t>(in_end - in), out);
+                in += converted;
+                out += converted;
+                if (converted == 0) {
+                    ascii_vector_from = in + KERNEL_BACKOFF;
+                }
+            }
+            uint64_t word;
+            while (in_end - in >= 8 && (memcpy(&word, in, sizeof(word)), (word & 0x8080808080808080ULL) == 0)) {
+                for (int i = 0; i < 8; ++i) {
+                    out[i] = static_cast<wchar_t>(in[i]);
+                }
+                in += 8;
+                out += 8;
+            }
+            while (in < in_end && *in < 0x80) {
+                *out++ = static_cast<wchar_t>(*in++);
+            }
+            continue;
+        }
+
+        size_t available = static_cast<size_t>(in_end - in);
+        if (lead >= 0xC2 && lead <= 0xDF) {
+            if (available < 2 || (in[1] & 0xC0) != 0x80) {
+                return UTF8_INVALID;
+            }
+            *out++ = static_cast<wchar_t>(((lead & 0x1F) << 6) | (in[1] & 0x3F));
+            in += 2;
+        } else if ((lead & 0xF0) == 0xE0) {
+            if (kernels.decode_three_byte != nullptr && in >= three_byte_vector_from) {
+                size_t converted = kernels.decode_three_byte(in, available, out);
+                if (converted != 0) {
+                    in += converted;
+                    out += converted / 3;
+                    continue;
+                }
+                three_byte_vector_from = in + KERNEL_BACKOFF;
+            }
+            if (available < 3 || (in[1] & 0xC0) != 0x80 || (in[2] & 0xC0) != 0x80) {
+                return UTF8_INVALID;
+            }
+            uint32_t code_point = ((lead & 0x0F) << 12) | ((in[1] & 0x3F) << 6) | (in[2] & 0x3F);
+            if (code_point < 0x800 || (code_point >= 0xD800 && code_point <= 0xDFFF)) {
+                return UTF8_INVALID;
+            }
+            *out++ = static_cast<wchar_t>(code_point);
+            in += 3;
+        } else if (lead >= 0xF0 && lead <= 0xF4) {
+            if (available < 4 || (in[1] & 0xC0) != 0x80 || (in[2] & 0xC0) != 0x80 || (in[3] & 0xC0) != 0x80) {
+                return UTF8_INVALID;
+            }
+            uint32_t code_point = ((lead & 0x07) << 18) | ((in[1] & 0x3F) << 12) | ((in[2] & 0x3F) << 6) | (in[3] & 0x3F);
+            if (code_point < 0x10000 || code_point > 0x10FFFF) {
+                return UTF8_INVALID;
+            }
+            out = put_code_point(code_point, out);
+            in += 4;
+        } else {
+            return UTF8_INVALID;
+        }
+    }
+    return static_cast<size_t>(out - out_start);
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+
+// UTF-8 to and from wchar_t in caller buffers, with AVX2, SSE2 or NEON kernels picked at run time. Never allocates.
+
+// Returned by utf8_decode for malformed input.
+const size_t UTF8_INVALID = static_cast<size_t>(-1);
+
+// Bytes utf8_encode writes for the length wide characters at in.
+size_t utf8_encoded_length(const wchar_t* in, size_t length);
+// Returns the bytes written. Unpaired surrogates and values above U+10FFFF are written as U+FFFD.
+size_t utf8_encode(const wchar_t* in, size_t length, char* out);
+// out needs room for length characters. Returns those written, or UTF8_INVALID for malformed input, including a
+// truncated sequence at the end, where std::codecvt_utf8 would return the characters before it.
+size_t utf8_decode(const char* in, size_t length, wchar_t* out);
+// Name of the kernels in use: "avx2", "sse2", "neon" or "scalar".
+const char* utf8_kernel_name();
+// Switches to the named kernels, for tests; false if this build or CPU lacks them. Not while converting.
+bool utf8_use_kernels(const char* name);
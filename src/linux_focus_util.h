@@ -12,8 +12,7 @@
 #include <cstdlib>
 #include <cstring>
 #include <cwchar>
-#include <locale>
-#include <codecvt>
+#include "Utf8Codec.h"
 
 
 #ifndef APP_HAS_X11_SUPPORT_LNX_UTIL 
@@ -33,18 +32,6 @@
 #endif
 
 
-#if defined(__GNUC__) || defined(__clang__)
-#define LFU_DISABLE_DEPRECATED_WARNING \
-    _Pragma("GCC diagnostic push") \
-    _Pragma("GCC diagnostic ignored \"-Wdeprecated-declarations\"")
-#define LFU_ENABLE_DEPRECATED_WARNING \
-    _Pragma("GCC diagnostic pop")
-#else
-#define LFU_DISABLE_DEPRECATED_WARNING
-#define LFU_ENABLE_DEPRECATED_WARNING
-#endif
-
-
 namespace LinuxFocusImpl {
 
     enum DisplayServerType {
@@ -56,15 +43,10 @@ namespace LinuxFocusImpl {
     inline std::string linux_wchar_to_utf8_string_for_focus(const wchar_t* wstr) {
         if (!wstr) return std::string();
 
-        LFU_DISABLE_DEPRECATED_WARNING
-            std::wstring_convert<std::codecvt_utf8<wchar_t>, wchar_t> converter;
-        LFU_ENABLE_DEPRECATED_WARNING
-            try {
-            return converter.to_bytes(wstr);
-        }
-        catch (const std::range_error&) {
-            return std::string();
-        }
+        size_t length = wcslen(wstr);
+        std::string result(utf8_encoded_length(wstr, length), '\0');
+        utf8_encode(wstr, length, &result[0]);
+        return result;
     }
 
 
@@ -6,155 +6,335 @@
 #include <cstring>
 #include <random>
 #include <algorithm>
-#include <locale> 
-#include <codecvt>
-
-#ifdef _WIN32
-#include <Windows.h>
-#endif
+#include <cstdint>
+#include <cwchar>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include "Utf8Codec.h"
+#include "Crc32c.h"
 
 std::wstring string_to_wstring(const std::string& str) {
-    DISABLE_DEPRECATED_WARNING
-        std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>> converter;
-    try {
-        return converter.from_bytes(str);
-    }
-    catch (const std::range_error&) {
-        std::wstring result;
-
-        for (char c : str) {
-            result += static_cast<wchar_t>(static_cast<unsigned char>(c));
+    std::wstring result(str.size(), L'\0');
+    size_t length = utf8_decode(str.data(), str.size(), &result[0]);
+    if (length == UTF8_INVALID) {
+        // Not UTF-8: take the bytes as Latin-1.
+        for (size_t i = 0; i < str.size(); ++i) {
+            result[i] = static_cast<wchar_t>(static_cast<unsigned char>(str[i]));
         }
         return result;
     }
-    ENABLE_DEPRECATED_WARNING
+    result.resize(length);
+    return result;
 }
 
 
 std::string wstring_to_string(const std::wstring& wstr) {
-    DISABLE_DEPRECATED_WARNING
-        std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>> converter;
+    std::string result(utf8_encoded_length(wstr.data(), wstr.size()), '\0');
+    utf8_encode(wstr.data(), wstr.size(), &result[0]);
+    return result;
+}
 
-    try {
-        return converter.to_bytes(wstr);
+static std::string internal_platform_wchar_to_utf8_string(const wchar_t* wstr) {
+    if (!wstr) return std::string();
+    size_t length = wcslen(wstr);
+    std::string utf8_str(utf8_encoded_length(wstr, length), '\0');
+    utf8_encode(wstr, length, &utf8_str[0]);
+    return utf8_str;
+}
+
+static wchar_t* internal_utf8_string_to_platform_wchar(const char* utf8_str, size_t utf8_len) {
+    wchar_t* wstr = new wchar_t[utf8_len + 1];
+    size_t wstr_len = utf8_decode(utf8_str, utf8_len, wstr);
+    if (wstr_len == UTF8_INVALID) {
+        delete[] wstr;
+        throw std::runtime_error("UTF-8 to wchar_t conversion failed: invalid UTF-8");
     }
-    catch (const std::range_error&) {
-        std::string result;
+    wstr[wstr_len] = L'\0';
+    return wstr;
+}
 
-        for (wchar_t wc : wstr) {
-            if (wc < 128) result += static_cast<char>(wc);
-            else result += '?';
-        }
+static const uint64_t FNV_OFFSET_BASIS = 14695981039346656037ULL;
+static const uint64_t FNV_PRIME = 1099511628211ULL;
 
-        return result;
+uint64_t ipc_handle_id(const char* msg_handle, size_t length) {
+    uint64_t hash = FNV_OFFSET_BASIS;
+    for (size_t i = 0; i < length; ++i) {
+        hash = (hash ^ static_cast<unsigned char>(msg_handle[i])) * FNV_PRIME;
     }
-    ENABLE_DEPRECATED_WARNING
+    return hash;
 }
 
-static std::string internal_platform_wchar_to_utf8_string(const wchar_t* wstr) {
-    if (!wstr) return std::string();
+uint64_t ipc_handle_id(const char* msg_handle) {
+    return msg_handle ? ipc_handle_id(msg_handle, strlen(msg_handle)) : FNV_OFFSET_BASIS;
+}
 
-#ifdef _WIN32
-    int wstr_len = static_cast<int>(wcslen(wstr));
-    if (wstr_len == 0) return std::string();
-    int utf8_len = WideCharToMultiByte(CP_UTF8, 0, wstr, wstr_len, nullptr, 0, nullptr, nullptr);
-    if (utf8_len == 0) throw std::runtime_error("WideCharToMultiByte: Failed to get UTF-8 size");
-    std::string utf8_str(utf8_len, 0);
-    if (WideCharToMultiByte(CP_UTF8, 0, wstr, wstr_len, &utf8_str[0], utf8_len, nullptr, nullptr) == 0) {
-        throw std::runtime_error("WideCharToMultiByte: Failed to convert to UTF-8");
-    }
-    return utf8_str;
+// Writes [u32 data length][data] and returns the end of it.
+static char* write_ipc_data(const wchar_t* msg_data, char* current_pos) {
+    // The data length is patched in once the payload is encoded.
+    char* data_len_pos = current_pos;
+    current_pos += sizeof(uint32_t);
+    size_t encoded = msg_data ? utf8_encode(msg_data, wcslen(msg_data), current_pos) : 0;
+    uint32_t data_len = static_cast<uint32_t>(encoded);
+    memcpy(data_len_pos, &data_len, sizeof(uint32_t));
+    return current_pos + encoded;
+}
+
+static std::atomic<int> wire_header_mode{ AG_WIRE_HEADER_NONE };
+static std::atomic<bool> handle_id_forms{ false };
+static std::atomic<uint32_t> wire_sequence{ 0 };
 
-#else
-    DISABLE_DEPRECATED_WARNING
-        std::wstring_convert<std::codecvt_utf8<wchar_t>, wchar_t> converter;
-    ENABLE_DEPRECATED_WARNING
-        try {
-        return converter.to_bytes(wstr);
+// The checksum covers the header from the sequence on, and the body.
+static const size_t IPC_WIRE_CRC_OFFSET = offsetof(IPCWireHeader, sequence);
+
+void set_ipc_wire_header(AGWireHeader wire_header) {
+    wire_header_mode.store(wire_header, std::memory_order_relaxed);
+}
+
+void set_ipc_handle_ids(bool handle_ids) {
+    handle_id_forms.store(handle_ids, std::memory_order_relaxed);
+}
+
+size_t ipc_wire_header_bytes() {
+    return wire_header_mode.load(std::memory_order_relaxed) != AG_WIRE_HEADER_NONE ? sizeof(IPCWireHeader) : 0;
+}
+
+// Fills the header_bytes left in front of the body and returns the record length.
+static size_t seal_ipc_record(char* buffer, size_t header_bytes, size_t body_length) {
+    if (header_bytes == 0) {
+        return body_length;
     }
-    catch (const std::range_error& e) {
-        throw std::runtime_error("UTF-32 to UTF-8 conversion failed: " + std::string(e.what()));
+
+    IPCWireHeader header;
+    header.marker = IPC_WIRE_MARKER;
+    header.magic = IPC_WIRE_MAGIC;
+    header.version = IPC_WIRE_VERSION;
+    header.flags = wire_header_mode.load(std::memory_order_relaxed) == AG_WIRE_HEADER_CRC32C ? IPC_WIRE_FLAG_CRC32C : 0;
+    header.crc = 0;
+    header.sequence = wire_sequence.fetch_add(1, std::memory_order_relaxed);
+    header.timestamp_ns = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+    memcpy(buffer, &header, sizeof(header));
+
+    if (header.flags & IPC_WIRE_FLAG_CRC32C) {
+        uint32_t crc = crc32c(0, buffer + IPC_WIRE_CRC_OFFSET, sizeof(header) - IPC_WIRE_CRC_OFFSET + body_length);
+        memcpy(buffer + offsetof(IPCWireHeader, crc), &crc, sizeof(crc));
     }
-#endif
+    return sizeof(header) + body_length;
 }
 
-static wchar_t* internal_utf8_string_to_platform_wchar(const std::string& utf8_str) {
-    if (utf8_str.empty()) {
-        wchar_t* empty_wstr = new wchar_t[1];
-        empty_wstr[0] = L'\0';
-        return empty_wstr;
+IPCWireCheck check_ipc_wire_header(const char* ipc_buffer, size_t buffer_length) {
+    uint32_t marker;
+    if (!ipc_buffer || buffer_length < sizeof(uint32_t)) {
+        return IPCWireCheck::Plain;
+    }
+    memcpy(&marker, ipc_buffer, sizeof(uint32_t));
+    if (marker != IPC_WIRE_MARKER) {
+        return IPCWireCheck::Plain;
     }
 
-#ifdef _WIN32
-    int utf8_len = static_cast<int>(utf8_str.length());
+    IPCWireHeader header;
+    if (buffer_length < sizeof(header)) {
+        return IPCWireCheck::Invalid;
+    }
+    memcpy(&header, ipc_buffer, sizeof(header));
+    if (header.magic != IPC_WIRE_MAGIC || header.version != IPC_WIRE_VERSION || (header.flags & ~IPC_WIRE_FLAG_CRC32C) != 0) {
+        return IPCWireCheck::Invalid;
+    }
+    return IPCWireCheck::Valid;
+}
 
-    int wstr_len = MultiByteToWideChar(CP_UTF8, 0, utf8_str.c_str(), utf8_len, nullptr, 0);
-    if (wstr_len == 0) throw std::runtime_error("MultiByteToWideChar: Failed to get wchar_t size");
-    wchar_t* wstr = new wchar_t[wstr_len + 1];
+IPCWireCheck unwrap_ipc_record(const char*& ipc_buffer, size_t& buffer_length) {
+    IPCWireCheck check = check_ipc_wire_header(ipc_buffer, buffer_length);
+    if (check != IPCWireCheck::Valid) {
+        return check;
+    }
 
-    if (MultiByteToWideChar(CP_UTF8, 0, utf8_str.c_str(), utf8_len, wstr, wstr_len) == 0) {
-        delete[] wstr;
-        throw std::runtime_error("MultiByteToWideChar: Failed to convert to wchar_t");
+    IPCWireHeader header;
+    memcpy(&header, ipc_buffer, sizeof(header));
+    uint32_t crc = (header.flags & IPC_WIRE_FLAG_CRC32C)
+        ? crc32c(0, ipc_buffer + IPC_WIRE_CRC_OFFSET, buffer_length - IPC_WIRE_CRC_OFFSET) : 0;
+    if (crc != header.crc) {
+        return IPCWireCheck::Invalid;
     }
-    wstr[wstr_len] = L'\0';
-    return wstr;
 
-#else
-    DISABLE_DEPRECATED_WARNING
+    ipc_buffer += sizeof(header);
+    buffer_length -= sizeof(header);
+    return IPCWireCheck::Valid;
+}
 
-        std::wstring_convert<std::codecvt_utf8<wchar_t>, wchar_t> converter;
-    ENABLE_DEPRECATED_WARNING
+// Text messages with a handle keep the named form unless handle ids are enabled.
+static bool ipc_legacy_named(const IPCWireMsg& msg) {
+    return msg.msg_handle && !msg.binary && !handle_id_forms.load(std::memory_order_relaxed);
+}
 
-        try {
-        std::wstring temp_wstr = converter.from_bytes(utf8_str);
-        wchar_t* wstr = new wchar_t[temp_wstr.length() + 1];
-        std::copy(temp_wstr.begin(), temp_wstr.end(), wstr);
-        wstr[temp_wstr.length()] = L'\0';
-        return wstr;
-    }
-    catch (const std::range_error& e) {
-        throw std::runtime_error("UTF-8 to UTF-32 conversion failed: " + std::string(e.what()));
+// A message without the wire header, as records carry it and batches and calls embed it.
+static size_t ipc_message_size(const IPCWireMsg& msg) {
+    if (ipc_legacy_named(msg)) {
+        size_t data_len = msg.msg_data ? utf8_encoded_length(msg.msg_data, wcslen(msg.msg_data)) : 0;
+        return sizeof(uint32_t) + msg.handle_length + sizeof(uint32_t) + data_len;
     }
-#endif
+    size_t handle_len = msg.msg_handle ? sizeof(uint32_t) + msg.handle_length : 0;
+    size_t data_len = msg.binary ? msg.bytes_length : msg.msg_data ? utf8_encoded_length(msg.msg_data, wcslen(msg.msg_data)) : 0;
+    return sizeof(uint32_t) + sizeof(uint64_t) + handle_len + sizeof(uint32_t) + data_len;
 }
 
+size_t serialized_ipc_size(const IPCWireMsg& msg) {
+    return ipc_wire_header_bytes() + ipc_message_size(msg);
+}
 
-SerializedIPCBuffer serialize_for_ipc(const IPCMsgData& platform_msg_data) {
-    std::string handle_utf8;
+size_t serialized_ipc_size(const IPCMsgData& platform_msg_data) {
+    return serialized_ipc_size(make_ipc_wire_msg(platform_msg_data));
+}
 
-    if (platform_msg_data.msg_handle) {
-        handle_utf8 = platform_msg_data.msg_handle;
+static size_t write_ipc_message(const IPCWireMsg& msg, char* buffer) {
+    char* current_pos = buffer;
+    if (ipc_legacy_named(msg)) {
+        uint32_t handle_len = static_cast<uint32_t>(msg.handle_length);
+        memcpy(current_pos, &handle_len, sizeof(uint32_t));
+        memcpy(current_pos + sizeof(uint32_t), msg.msg_handle, handle_len);
+        return static_cast<size_t>(write_ipc_data(msg.msg_data, current_pos + sizeof(uint32_t) + handle_len) - buffer);
     }
 
-    std::string data_utf8;
-    if (platform_msg_data.msg_data) {
-        data_utf8 = internal_platform_wchar_to_utf8_string(platform_msg_data.msg_data);
+    uint32_t marker = msg.binary ? (msg.msg_handle ? IPC_BINARY_NAMED_MARKER : IPC_BINARY_ID_MARKER)
+                                 : (msg.msg_handle ? IPC_HANDLE_ID_NAMED_MARKER : IPC_HANDLE_ID_MARKER);
+    memcpy(current_pos, &marker, sizeof(uint32_t));
+    current_pos += sizeof(uint32_t);
+    memcpy(current_pos, &msg.handle_id, sizeof(uint64_t));
+    current_pos += sizeof(uint64_t);
+
+    if (msg.msg_handle) {
+        uint32_t handle_len = static_cast<uint32_t>(msg.handle_length);
+        memcpy(current_pos, &handle_len, sizeof(uint32_t));
+        current_pos += sizeof(uint32_t);
+        memcpy(current_pos, msg.msg_handle, handle_len);
+        current_pos += handle_len;
     }
 
-    uint32_t handle_len = static_cast<uint32_t>(handle_utf8.length());
-    uint32_t data_len = static_cast<uint32_t>(data_utf8.length());
+    if (msg.binary) {
+        uint32_t data_len = static_cast<uint32_t>(msg.bytes_length);
+        memcpy(current_pos, &data_len, sizeof(uint32_t));
+        current_pos += sizeof(uint32_t);
+        if (data_len > 0) {
+            memcpy(current_pos, msg.bytes, data_len);
+        }
+        return static_cast<size_t>(current_pos + data_len - buffer);
+    }
+    char* data_end = write_ipc_data(msg.msg_data, current_pos);
+    return static_cast<size_t>(data_end - buffer);
+}
+
+size_t serialize_for_ipc_into(const IPCWireMsg& msg, char* buffer) {
+    size_t header_bytes = ipc_wire_header_bytes();
+    return seal_ipc_record(buffer, header_bytes, write_ipc_message(msg, buffer + header_bytes));
+}
+
+size_t serialize_for_ipc_into(const IPCMsgData& platform_msg_data, char* buffer) {
+    return serialize_for_ipc_into(make_ipc_wire_msg(platform_msg_data), buffer);
+}
+
+size_t serialized_ipc_named_size(const IPCMsgData& platform_msg_data) {
+    size_t handle_len = platform_msg_data.msg_handle ? strlen(platform_msg_data.msg_handle) : 0;
+    size_t data_len = platform_msg_data.msg_data ? utf8_encoded_length(platform_msg_data.msg_data, wcslen(platform_msg_data.msg_data)) : 0;
+    return sizeof(uint32_t) + handle_len + sizeof(uint32_t) + data_len;
+}
 
-    size_t total_buffer_size = sizeof(uint32_t) + handle_len + sizeof(uint32_t) + data_len;
-    char* buffer = new char[total_buffer_size];
+size_t serialize_ipc_named_into(const IPCMsgData& platform_msg_data, char* buffer) {
     char* current_pos = buffer;
 
+    uint32_t handle_len = platform_msg_data.msg_handle ? static_cast<uint32_t>(strlen(platform_msg_data.msg_handle)) : 0;
     memcpy(current_pos, &handle_len, sizeof(uint32_t));
     current_pos += sizeof(uint32_t);
     if (handle_len > 0) {
-        memcpy(current_pos, handle_utf8.data(), handle_len);
+        memcpy(current_pos, platform_msg_data.msg_handle, handle_len);
         current_pos += handle_len;
     }
 
-    memcpy(current_pos, &data_len, sizeof(uint32_t));
+    char* data_end = write_ipc_data(platform_msg_data.msg_data, current_pos);
+    return static_cast<size_t>(data_end - buffer);
+}
+
+// Larger scratch buffers are given back once the thread sends something smaller again.
+static const size_t IPC_SEND_SCRATCH_KEPT_BYTES = 64 * 1024;
+
+char* ipc_send_scratch(size_t length) {
+    static thread_local std::vector<char> scratch;
+    if (scratch.size() < length || (scratch.size() > IPC_SEND_SCRATCH_KEPT_BYTES && length <= IPC_SEND_SCRATCH_KEPT_BYTES)) {
+        size_t size = std::max(length, std::min(scratch.size() * 2, IPC_SEND_SCRATCH_KEPT_BYTES));
+        std::vector<char>(size).swap(scratch);
+    }
+    return scratch.data();
+}
+
+bool parse_ipc_message(const char* ipc_buffer, size_t buffer_length, IPCMsgView& view) {
+    if (!ipc_buffer || buffer_length < sizeof(uint32_t)) {
+        return false;
+    }
+
+    const char* current_pos = ipc_buffer;
+    const char* const buffer_end = ipc_buffer + buffer_length;
+    uint32_t head;
+    memcpy(&head, current_pos, sizeof(uint32_t));
     current_pos += sizeof(uint32_t);
-    if (data_len > 0) {
-        memcpy(current_pos, data_utf8.data(), data_len);
+
+    view.handle = nullptr;
+    view.handle_length = 0;
+    view.binary = head == IPC_BINARY_ID_MARKER || head == IPC_BINARY_NAMED_MARKER;
+    if (head == IPC_HANDLE_ID_MARKER || head == IPC_HANDLE_ID_NAMED_MARKER || view.binary) {
+        if (static_cast<size_t>(buffer_end - current_pos) < sizeof(uint64_t)) {
+            return false;
+        }
+        memcpy(&view.handle_id, current_pos, sizeof(uint64_t));
+        current_pos += sizeof(uint64_t);
+
+        if (head == IPC_HANDLE_ID_NAMED_MARKER || head == IPC_BINARY_NAMED_MARKER) {
+            uint32_t handle_len;
+            if (static_cast<size_t>(buffer_end - current_pos) < sizeof(uint32_t)) {
+                return false;
+            }
+            memcpy(&handle_len, current_pos, sizeof(uint32_t));
+            current_pos += sizeof(uint32_t);
+            if (static_cast<size_t>(buffer_end - current_pos) < handle_len) {
+                return false;
+            }
+            view.handle = current_pos;
+            view.handle_length = handle_len;
+            current_pos += handle_len;
+        }
+    }
+    else {
+        if (static_cast<size_t>(buffer_end - current_pos) < head) {
+            return false;
+        }
+        view.handle_id = ipc_handle_id(current_pos, head);
+        view.handle = current_pos;
+        view.handle_length = head;
+        current_pos += head;
     }
 
-    SerializedIPCBuffer result;
-    result.data = buffer;
-    result.length = total_buffer_size;
-    return result;
+    uint32_t data_len;
+    if (static_cast<size_t>(buffer_end - current_pos) < sizeof(uint32_t)) {
+        return false;
+    }
+    memcpy(&data_len, current_pos, sizeof(uint32_t));
+    current_pos += sizeof(uint32_t);
+    if (static_cast<size_t>(buffer_end - current_pos) < data_len) {
+        return false;
+    }
+
+    view.data = current_pos;
+    view.data_length = data_len;
+    return true;
+}
+
+// Strict UTF-8 to UTF-32 (UTF-16 on Windows), see utf8_decode.
+size_t decode_ipc_data_into(const char* data, size_t data_length, wchar_t* out) {
+    size_t length = utf8_decode(data, data_length, out);
+    if (length == UTF8_INVALID) {
+        return IPC_DECODE_INVALID;
+    }
+    out[length] = L'\0';
+    return length;
 }
 
 
@@ -170,6 +350,7 @@ IPCMsgData deserialize_from_ipc(const char* ipc_buffer, size_t buffer_length) {
     memcpy(&handle_len, current_pos, sizeof(uint32_t));
     current_pos += sizeof(uint32_t);
 
+    if (handle_len == IPC_HANDLE_ID_MARKER || handle_len == IPC_HANDLE_ID_NAMED_MARKER) return result;
     if (static_cast<size_t>(buffer_end - current_pos) < handle_len) return result;
     if (handle_len > 0) {
         char* msg_handle_alloc = new char[handle_len + 1];
@@ -195,25 +376,164 @@ IPCMsgData deserialize_from_ipc(const char* ipc_buffer, size_t buffer_length) {
     if (static_cast<size_t>(buffer_end - current_pos) < data_len) {
         free_ipc_msg_data(result); result = { nullptr, nullptr }; return result;
     }
-    if (data_len > 0) {
-        std::string data_utf8(current_pos, data_len);
-        result.msg_data = internal_utf8_string_to_platform_wchar(data_utf8);
+    result.msg_data = internal_utf8_string_to_platform_wchar(current_pos, data_len);
+
+    return result;
+}
+
+size_t plan_ipc_batch(const IPCMsgData* msgs, size_t count, size_t max_record_bytes, size_t& record_bytes) {
+    record_bytes = 0;
+    if (count == 0) {
+        return 0;
     }
 
-    else {
-        result.msg_data = internal_utf8_string_to_platform_wchar("");
+    size_t header_bytes = ipc_wire_header_bytes();
+    size_t first_length = ipc_message_size(make_ipc_wire_msg(msgs[0]));
+    if (header_bytes + first_length > max_record_bytes) {
+        return 0;
     }
 
-    return result;
+    size_t batch_bytes = header_bytes + IPC_BATCH_HEADER_BYTES + sizeof(uint32_t) + first_length;
+    size_t batch_count = 1;
+    while (batch_count < count) {
+        size_t entry_bytes = sizeof(uint32_t) + ipc_message_size(make_ipc_wire_msg(msgs[batch_count]));
+        if (batch_bytes + entry_bytes > max_record_bytes) {
+            break;
+        }
+        batch_bytes += entry_bytes;
+        ++batch_count;
+    }
+
+    record_bytes = (batch_count == 1) ? header_bytes + first_length : batch_bytes;
+    return batch_count;
+}
+
+size_t serialize_ipc_batch_into(const IPCMsgData* msgs, size_t count, char* buffer) {
+    if (count == 1) {
+        return serialize_for_ipc_into(msgs[0], buffer);
+    }
+
+    size_t header_bytes = ipc_wire_header_bytes();
+    char* const body = buffer + header_bytes;
+    char* current_pos = body;
+    uint32_t header[2] = { IPC_BATCH_MARKER, static_cast<uint32_t>(count) };
+    memcpy(current_pos, header, sizeof(header));
+    current_pos += sizeof(header);
+
+    for (size_t i = 0; i < count; ++i) {
+        uint32_t entry_length = static_cast<uint32_t>(write_ipc_message(make_ipc_wire_msg(msgs[i]), current_pos + sizeof(uint32_t)));
+        memcpy(current_pos, &entry_length, sizeof(uint32_t));
+        current_pos += sizeof(uint32_t) + entry_length;
+    }
+
+    return seal_ipc_record(buffer, header_bytes, static_cast<size_t>(current_pos - body));
 }
 
+bool is_ipc_batch(const char* ipc_buffer, size_t buffer_length) {
+    uint32_t marker;
+    if (!ipc_buffer || buffer_length < IPC_BATCH_HEADER_BYTES) {
+        return false;
+    }
+    memcpy(&marker, ipc_buffer, sizeof(uint32_t));
+    return marker == IPC_BATCH_MARKER;
+}
 
-void free_serialized_ipc_buffer(SerializedIPCBuffer& buffer) {
-    delete[] buffer.data;
-    buffer.data = nullptr;
-    buffer.length = 0;
+size_t serialized_ipc_call_size(const IPCMsgData& platform_msg_data, size_t reply_address_length) {
+    return ipc_wire_header_bytes() + sizeof(uint32_t) + sizeof(uint64_t) + sizeof(uint32_t) + reply_address_length +
+           ipc_message_size(make_ipc_wire_msg(platform_msg_data));
 }
 
+size_t serialize_ipc_call_into(const IPCMsgData& platform_msg_data, uint64_t call_id,
+                               const std::string& reply_address, char* buffer) {
+    size_t header_bytes = ipc_wire_header_bytes();
+    char* const body = buffer + header_bytes;
+    char* current_pos = body;
+    uint32_t marker = IPC_CALL_MARKER;
+    uint32_t address_length = static_cast<uint32_t>(reply_address.length());
+
+    memcpy(current_pos, &marker, sizeof(uint32_t));
+    current_pos += sizeof(uint32_t);
+    memcpy(current_pos, &call_id, sizeof(uint64_t));
+    current_pos += sizeof(uint64_t);
+    memcpy(current_pos, &address_length, sizeof(uint32_t));
+    current_pos += sizeof(uint32_t);
+    memcpy(current_pos, reply_address.data(), address_length);
+    current_pos += address_length;
+    current_pos += write_ipc_message(make_ipc_wire_msg(platform_msg_data), current_pos);
+
+    return seal_ipc_record(buffer, header_bytes, static_cast<size_t>(current_pos - body));
+}
+
+size_t serialized_ipc_reply_size(const IPCMsgData& platform_msg_data) {
+    return ipc_wire_header_bytes() + sizeof(uint32_t) + sizeof(uint64_t) + sizeof(uint32_t) + serialized_ipc_named_size(platform_msg_data);
+}
+
+size_t serialize_ipc_reply_into(const IPCMsgData& platform_msg_data, uint64_t call_id, uint32_t status, char* buffer) {
+    size_t header_bytes = ipc_wire_header_bytes();
+    char* const body = buffer + header_bytes;
+    char* current_pos = body;
+    uint32_t marker = IPC_REPLY_MARKER;
+
+    memcpy(current_pos, &marker, sizeof(uint32_t));
+    current_pos += sizeof(uint32_t);
+    memcpy(current_pos, &call_id, sizeof(uint64_t));
+    current_pos += sizeof(uint64_t);
+    memcpy(current_pos, &status, sizeof(uint32_t));
+    current_pos += sizeof(uint32_t);
+    current_pos += serialize_ipc_named_into(platform_msg_data, current_pos);
+
+    return seal_ipc_record(buffer, header_bytes, static_cast<size_t>(current_pos - body));
+}
+
+bool is_ipc_call(const char* ipc_buffer, size_t buffer_length) {
+    uint32_t marker;
+    if (!ipc_buffer || buffer_length < sizeof(uint32_t)) {
+        return false;
+    }
+    memcpy(&marker, ipc_buffer, sizeof(uint32_t));
+    return marker == IPC_CALL_MARKER;
+}
+
+bool parse_ipc_call(const char* ipc_buffer, size_t buffer_length, IPCCallHeader& header) {
+    const size_t fixed_length = sizeof(uint32_t) + sizeof(uint64_t) + sizeof(uint32_t);
+    if (!is_ipc_call(ipc_buffer, buffer_length) || buffer_length < fixed_length) {
+        return false;
+    }
+
+    uint32_t address_length;
+    memcpy(&header.call_id, ipc_buffer + sizeof(uint32_t), sizeof(uint64_t));
+    memcpy(&address_length, ipc_buffer + sizeof(uint32_t) + sizeof(uint64_t), sizeof(uint32_t));
+    if (buffer_length - fixed_length < address_length) {
+        return false;
+    }
+
+    header.reply_address = ipc_buffer + fixed_length;
+    header.reply_address_length = address_length;
+    header.message = header.reply_address + address_length;
+    header.message_length = buffer_length - fixed_length - address_length;
+    return true;
+}
+
+bool parse_ipc_reply(const char* ipc_buffer, size_t buffer_length, uint64_t& call_id, uint32_t& status,
+                     const char*& message, size_t& message_length) {
+    const size_t fixed_length = sizeof(uint32_t) + sizeof(uint64_t) + sizeof(uint32_t);
+    uint32_t marker;
+    if (!ipc_buffer || buffer_length < fixed_length) {
+        return false;
+    }
+
+    memcpy(&marker, ipc_buffer, sizeof(uint32_t));
+    if (marker != IPC_REPLY_MARKER) {
+        return false;
+    }
+    memcpy(&call_id, ipc_buffer + sizeof(uint32_t), sizeof(uint64_t));
+    memcpy(&status, ipc_buffer + sizeof(uint32_t) + sizeof(uint64_t), sizeof(uint32_t));
+    message = ipc_buffer + fixed_length;
+    message_length = buffer_length - fixed_length;
+    return true;
+}
+
+
 void free_ipc_msg_data(IPCMsgData& data) {
     if (data.msg_handle) {
         delete[] data.msg_handle;
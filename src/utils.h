@@ -1,25 +1,10 @@
 #pragma once
 
 
-#if defined(__GNUC__) || defined(__clang__)
-#define DISABLE_DEPRECATED_WARNING \
-    _Pragma("GCC diagnostic push") \
-    _Pragma("GCC diagnostic ignored \"-Wdeprecated-declarations\"")
-#define ENABLE_DEPRECATED_WARNING \
-    _Pragma("GCC diagnostic pop")
-#elif defined(_MSC_VER)
-#define DISABLE_DEPRECATED_WARNING \
-    __pragma(warning(push)) \
-    __pragma(warning(disable: 4996))
-#define ENABLE_DEPRECATED_WARNING \
-    __pragma(warning(pop))
-#else
-#define DISABLE_DEPRECATED_WARNING
-#define ENABLE_DEPRECATED_WARNING
-#endif
-
 #include <string>
 #include <vector>
+#include <cstdint>
+#include <cstring>
 #include "../include/common.h"
 
 std::wstring string_to_wstring(const std::string& str);
@@ -27,15 +12,131 @@ std::string wstring_to_string(const std::wstring& wstr);
 std::string public_platform_wchar_to_utf8_string(const wchar_t* wstr);
 
 
-struct SerializedIPCBuffer {
-    char* data;
-    size_t length;
-    SerializedIPCBuffer() : data(nullptr), length(0) {}
+// 64-bit FNV-1a, as AG_handle_id.
+uint64_t ipc_handle_id(const char* msg_handle);
+uint64_t ipc_handle_id(const char* msg_handle, size_t length);
+
+// A message as senders put it on the wire; msg_handle is null for sends by id alone.
+struct IPCWireMsg {
+    uint64_t handle_id;
+    const char* msg_handle;
+    size_t handle_length;
+    const wchar_t* msg_data;
+    bool binary = false;
+    const void* bytes = nullptr;
+    size_t bytes_length = 0;
 };
 
-SerializedIPCBuffer serialize_for_ipc(const IPCMsgData& platform_msg_data);
+inline IPCWireMsg make_ipc_binary_wire_msg(const char* msg_handle, const void* bytes, size_t bytes_length) {
+    size_t handle_length = msg_handle ? strlen(msg_handle) : 0;
+    return { ipc_handle_id(msg_handle, handle_length), msg_handle, handle_length, nullptr, true, bytes, bytes_length };
+}
+
+inline IPCWireMsg make_ipc_wire_msg(const IPCMsgData& platform_msg_data) {
+    size_t handle_length = platform_msg_data.msg_handle ? strlen(platform_msg_data.msg_handle) : 0;
+    return { ipc_handle_id(platform_msg_data.msg_handle, handle_length), platform_msg_data.msg_handle, handle_length,
+             platform_msg_data.msg_data };
+}
+
+// [u32 handle length][handle][u32 data length][data], or behind [u32 marker][u64 handle id] for the markers below.
+const uint32_t IPC_HANDLE_ID_MARKER = 0xFFFFFFFC;
+const uint32_t IPC_HANDLE_ID_NAMED_MARKER = 0xFFFFFFFB;
+const uint32_t IPC_BINARY_ID_MARKER = 0xFFFFFFFA;
+const uint32_t IPC_BINARY_NAMED_MARKER = 0xFFFFFFF9;
+
+size_t serialized_ipc_size(const IPCMsgData& platform_msg_data);
+size_t serialized_ipc_size(const IPCWireMsg& msg);
+size_t serialize_for_ipc_into(const IPCMsgData& platform_msg_data, char* buffer);
+size_t serialize_for_ipc_into(const IPCWireMsg& msg, char* buffer);
+// Per-thread send buffer, reused by the thread's next send.
+char* ipc_send_scratch(size_t length);
+size_t serialized_ipc_named_size(const IPCMsgData& platform_msg_data);
+size_t serialize_ipc_named_into(const IPCMsgData& platform_msg_data, char* buffer);
+// Allocates the handle and data of a named message. Messages sent by id yield { nullptr, nullptr }.
 IPCMsgData deserialize_from_ipc(const char* ipc_buffer, size_t buffer_length);
 
-void free_serialized_ipc_buffer(SerializedIPCBuffer& buffer);
+// Points into the record; handle is null for messages sent by id alone.
+struct IPCMsgView {
+    uint64_t handle_id;
+    const char* handle;
+    size_t handle_length;
+    const char* data;
+    size_t data_length;
+    bool binary;
+};
+
+bool parse_ipc_message(const char* ipc_buffer, size_t buffer_length, IPCMsgView& view);
+// out has room for data_length + 1 characters.
+const size_t IPC_DECODE_INVALID = static_cast<size_t>(-1);
+size_t decode_ipc_data_into(const char* data, size_t data_length, wchar_t* out);
+
+// [u32 IPC_BATCH_MARKER][u32 count], then [u32 length][message] for each message.
+const uint32_t IPC_BATCH_MARKER = 0xFFFFFFFF;
+const size_t IPC_BATCH_HEADER_BYTES = 2 * sizeof(uint32_t);
+
+// Number of leading messages that fit in max_record_bytes, 0 when the first does not.
+size_t plan_ipc_batch(const IPCMsgData* msgs, size_t count, size_t max_record_bytes, size_t& record_bytes);
+// A single message is written without the batch header.
+size_t serialize_ipc_batch_into(const IPCMsgData* msgs, size_t count, char* buffer);
+bool is_ipc_batch(const char* ipc_buffer, size_t buffer_length);
+
+// [u32 IPC_CALL_MARKER][u64 call id][u32 address length][reply address][message]
+const uint32_t IPC_CALL_MARKER = 0xFFFFFFFE;
+// [u32 IPC_REPLY_MARKER][u64 call id][u32 status][message]
+const uint32_t IPC_REPLY_MARKER = 0xFFFFFFFD;
+const uint32_t IPC_REPLY_ANSWERED = 0;
+const uint32_t IPC_REPLY_UNANSWERED = 1;
+
+struct IPCCallHeader {
+    uint64_t call_id;
+    const char* reply_address;
+    size_t reply_address_length;
+    const char* message;
+    size_t message_length;
+};
+
+size_t serialized_ipc_call_size(const IPCMsgData& platform_msg_data, size_t reply_address_length);
+size_t serialize_ipc_call_into(const IPCMsgData& platform_msg_data, uint64_t call_id,
+                               const std::string& reply_address, char* buffer);
+size_t serialized_ipc_reply_size(const IPCMsgData& platform_msg_data);
+size_t serialize_ipc_reply_into(const IPCMsgData& platform_msg_data, uint64_t call_id, uint32_t status, char* buffer);
+bool is_ipc_call(const char* ipc_buffer, size_t buffer_length);
+bool parse_ipc_call(const char* ipc_buffer, size_t buffer_length, IPCCallHeader& header);
+bool parse_ipc_reply(const char* ipc_buffer, size_t buffer_length, uint64_t& call_id, uint32_t& status,
+                     const char*& message, size_t& message_length);
+
+// Put in front of every record when a wire header is set.
+const uint32_t IPC_WIRE_MARKER = 0xFFFFFFF8;
+const uint16_t IPC_WIRE_MAGIC = 0x4741;
+const uint8_t IPC_WIRE_VERSION = 1;
+const uint8_t IPC_WIRE_FLAG_CRC32C = 0x01;
+
+struct IPCWireHeader {
+    uint32_t marker;
+    uint16_t magic;
+    uint8_t version;
+    uint8_t flags;
+    uint32_t crc;
+    uint32_t sequence;
+    uint64_t timestamp_ns;
+};
+static_assert(sizeof(IPCWireHeader) == 24, "IPCWireHeader must match the wire layout");
+
+// Process-wide; must not change while anything sends.
+void set_ipc_wire_header(AGWireHeader wire_header);
+void set_ipc_handle_ids(bool handle_ids);
+size_t ipc_wire_header_bytes();
+
+enum class IPCWireCheck {
+    Plain,
+    Valid,
+    Invalid
+};
+
+// Without the checksum.
+IPCWireCheck check_ipc_wire_header(const char* ipc_buffer, size_t buffer_length);
+// Checks the checksum too and moves ipc_buffer and buffer_length past the header.
+IPCWireCheck unwrap_ipc_record(const char*& ipc_buffer, size_t& buffer_length);
+
 void free_ipc_msg_data(IPCMsgData& data);
 int random_number(int min, int max);
\ No newline at end of file
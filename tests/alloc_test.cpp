@@ -0,0 +1,212 @@
+// Checks that sending and dispatching a message allocate nothing once warmed up, on every transport.
+// The heap is counted by interposing malloc, which operator new also goes through. Exits non-zero on failure.
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "../include/AppGuard.h"
+
+#if defined(__GLIBC__)
+extern "C" void* __libc_malloc(size_t size);
+extern "C" void* __libc_calloc(size_t count, size_t size);
+extern "C" void* __libc_realloc(void* ptr, size_t size);
+
+static std::atomic<long> allocations{ 0 };
+static std::atomic<bool> counting_process{ false };
+static thread_local bool counting_thread = false;
+
+static void count_allocation() {
+    if (counting_thread || counting_process.load(std::memory_order_relaxed)) {
+        allocations.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+extern "C" void* malloc(size_t size) {
+    count_allocation();
+    return __libc_malloc(size);
+}
+
+extern "C" void* calloc(size_t count, size_t size) {
+    count_allocation();
+    return __libc_calloc(count, size);
+}
+
+extern "C" void* realloc(void* ptr, size_t size) {
+    count_allocation();
+    return __libc_realloc(ptr, size);
+}
+
+static const char* MSG_HANDLE = "AllocTest.Open";
+static const char* BYTES_HANDLE = "AllocTest.Bytes";
+// The secondary sends bursts of BURST messages and waits for the primary to dispatch each one, which bounds how
+// many messages are in flight. The first burst is held in the queue, so the payload pool grows to that bound.
+static const int BURST = 64;
+// Messages per AG_send_msg_batch call; each round of a burst sends four single messages and one batch.
+static const int BATCH = 4;
+static const int WARMUP_BURSTS = 32;
+static const int MEASURED_BURSTS = 320;
+static const int TOTAL_BURSTS = 1 + WARMUP_BURSTS + MEASURED_BURSTS;
+
+static std::atomic<long> received{ 0 };
+static std::atomic<long> expected{ 0 };
+static std::atomic<int> held{ 0 };
+static std::atomic<bool> holding{ false };
+
+static void on_message(const IPCMsgData* msg_data) {
+    if (holding.load()) {
+        held++;
+        while (holding.load()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+    received.fetch_add(1, std::memory_order_relaxed);
+}
+
+static void on_bytes(const IPCMsgBytes* msg) {
+    received.fetch_add(1, std::memory_order_relaxed);
+}
+
+static AGOptions make_options(AGTransport transport) {
+    AGOptions options;
+    AG_init_options(&options);
+    options.transport = transport;
+    return options;
+}
+
+// Runs in the secondary: counts what the sending thread allocates during the measured bursts.
+static int send_messages(AGTransport transport, int ack_fd) {
+    char ack;
+    if (read(ack_fd, &ack, 1) != 1) {
+        return 2;
+    }
+    AGOptions options = make_options(transport);
+    AG_init_ex("AllocTest", nullptr, false, &options);
+    std::wstring payload = L"--open /home/user/documents/report.txt";
+    IPCMsgData msg = { MSG_HANDLE, payload.c_str() };
+    IPCMsgData batch[BATCH] = { msg, msg, msg, msg };
+
+    AGSender* sender = AG_sender_create();
+    allocations = 0;
+    bool acked = true;
+    for (int burst = 0; burst < TOTAL_BURSTS && acked; ++burst) {
+        counting_thread = burst > WARMUP_BURSTS;
+        for (int i = 0; i < BURST; i += 4 + BATCH) {
+            AG_sender_send(sender, &msg);
+            AG_send_msg_request(&msg);
+            AG_send_bytes(BYTES_HANDLE, payload.data(), payload.size() * sizeof(wchar_t));
+            AG_sender_send_bytes(sender, BYTES_HANDLE, payload.data(), payload.size() * sizeof(wchar_t));
+            AG_send_msg_batch(batch, BATCH);
+        }
+        counting_thread = false;
+        acked = read(ack_fd, &ack, 1) == 1;
+    }
+    long send_allocations = allocations.load();
+    AG_sender_destroy(sender);
+    AG_release();
+
+    printf("transport %d: send path %ld allocations over %d messages\n", transport, send_allocations,
+           MEASURED_BURSTS * BURST);
+    fflush(stdout);
+    return acked && send_allocations == 0 ? 0 : 1;
+}
+
+static bool wait_for(const std::chrono::steady_clock::time_point& deadline, bool (*done)()) {
+    while (!done()) {
+        if (std::chrono::steady_clock::now() >= deadline) {
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+    return true;
+}
+
+static bool burst_queued() {
+    AGQueueStats stats;
+    AG_get_queue_stats(&stats);
+    return held == 1 && stats.queue_length == BURST - 1;
+}
+
+static bool burst_dispatched() {
+    return received >= expected;
+}
+
+// Runs in the primary: counts what every thread allocates while the measured bursts are received and dispatched.
+static int test_transport(AGTransport transport) {
+    int acks[2];
+    if (pipe(acks) == -1) {
+        return 2;
+    }
+    fflush(stdout);
+    pid_t child = fork();
+    if (child == 0) {
+        close(acks[1]);
+        _exit(send_messages(transport, acks[0]));
+    }
+    close(acks[0]);
+
+    AGOptions options = make_options(transport);
+    AG_init_ex("AllocTest", nullptr, false, &options);
+    IPCMsg msg;
+    AG_create_IPCMsg(&msg, MSG_HANDLE, on_message);
+    AG_register_msg(&msg);
+    IPCMsg bytes_msg;
+    AG_create_IPCMsg_bytes(&bytes_msg, BYTES_HANDLE, on_bytes);
+    AG_register_msg(&bytes_msg);
+    received = 0;
+    held = 0;
+    holding = true;
+    // The receiver opens the transport on its own thread, which must be done before the secondary starts.
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+    bool on_time = write(acks[1], "g", 1) == 1 && wait_for(deadline, burst_queued);
+    holding = false;
+    long dispatched = 0;
+    for (int burst = 0; burst < TOTAL_BURSTS && on_time; ++burst) {
+        expected = static_cast<long>(burst + 1) * BURST;
+        on_time = wait_for(deadline, burst_dispatched);
+        if (burst == WARMUP_BURSTS) {
+            allocations = 0;
+            dispatched = received;
+            counting_process = true;
+        }
+        on_time = on_time && write(acks[1], "a", 1) == 1;
+    }
+    counting_process = false;
+    dispatched = received - dispatched;
+    long dispatch_allocations = allocations.load();
+    close(acks[1]);
+
+    int status = 0;
+    waitpid(child, &status, 0);
+    AG_unregister_msg(msg.msg_id);
+    AG_unregister_msg(bytes_msg.msg_id);
+    AG_release();
+
+    printf("transport %d: dispatch path %ld allocations over %ld messages\n", transport, dispatch_allocations, dispatched);
+    fflush(stdout);
+    bool passed = on_time && WIFEXITED(status) && WEXITSTATUS(status) == 0 && dispatch_allocations == 0;
+    return passed ? 0 : 1;
+}
+
+int main() {
+    int failures = 0;
+    const AGTransport transports[] = { AG_TRANSPORT_SYSV_QUEUE, AG_TRANSPORT_UNIX_SOCKET, AG_TRANSPORT_SHARED_MEMORY };
+    for (AGTransport transport : transports) {
+        if (test_transport(transport) != 0) {
+            printf("transport %d: FAILED\n", transport);
+            ++failures;
+        }
+    }
+    return failures == 0 ? 0 : 1;
+}
+#else
+int main() {
+    printf("alloc_test: needs glibc to count allocations, skipped\n");
+    return 0;
+}
+#endif
@@ -0,0 +1,104 @@
+// Checks every CRC-32C implementation this CPU can run against the RFC 3720 check values and a bit-at-a-time
+// reference, from unaligned starts and split into continued calls. Exits non-zero on failure.
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <vector>
+#include "../src/Crc32c.h"
+
+static const int BUFFERS = 2000;
+// Longer than three of the long blocks the hardware kernels stripe over.
+static const size_t MAX_LENGTH = 3 * 8192 * 2 + 100;
+
+static uint32_t reference_crc32c(const unsigned char* data, size_t length) {
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < length; ++i) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc >> 1) ^ ((crc & 1) ? 0x82F63B78 : 0);
+        }
+    }
+    return ~crc;
+}
+
+// The check value and the examples of RFC 3720, appendix B.4.
+static long test_check_values() {
+    long failures = 0;
+    auto expect = [&](const char* what, const std::vector<unsigned char>& data, uint32_t expected) {
+        uint32_t crc = crc32c(0, data.data(), data.size());
+        if (crc != expected) {
+            printf("%s: %s gave %08x, expected %08x\n", crc32c_kernel_name(), what, crc, expected);
+            ++failures;
+        }
+    };
+    std::vector<unsigned char> digits = { '1', '2', '3', '4', '5', '6', '7', '8', '9' };
+    std::vector<unsigned char> zeros(32, 0x00);
+    std::vector<unsigned char> ones(32, 0xFF);
+    std::vector<unsigned char> increasing(32);
+    std::vector<unsigned char> decreasing(32);
+    for (int i = 0; i < 32; ++i) {
+        increasing[i] = static_cast<unsigned char>(i);
+        decreasing[i] = static_cast<unsigned char>(31 - i);
+    }
+    expect("\"123456789\"", digits, 0xE3069283);
+    expect("32 zero bytes", zeros, 0x8A9136AA);
+    expect("32 0xFF bytes", ones, 0x62A8AB43);
+    expect("32 increasing bytes", increasing, 0x46DD794E);
+    expect("32 decreasing bytes", decreasing, 0x113FDB5C);
+    return failures;
+}
+
+// Random buffers from every alignment, whole and split in two at a random point.
+static long test_random_buffers(long& cases) {
+    std::mt19937 rng(7);
+    std::vector<unsigned char> buffer(MAX_LENGTH + 16);
+    for (unsigned char& byte : buffer) {
+        byte = static_cast<unsigned char>(rng());
+    }
+    long failures = 0;
+    for (int i = 0; i < BUFFERS; ++i) {
+        size_t offset = i % 16;
+        size_t length = i % 20 == 0 ? rng() % MAX_LENGTH : rng() % 1100;
+        const unsigned char* data = buffer.data() + offset;
+        uint32_t expected = reference_crc32c(data, length);
+        size_t split = length == 0 ? 0 : rng() % (length + 1);
+        uint32_t whole = crc32c(0, data, length);
+        uint32_t continued = crc32c(crc32c(0, data, split), data + split, length - split);
+        cases += 2;
+        if (whole != expected || continued != expected) {
+            if (failures++ < 5) {
+                printf("%s: %zu bytes at offset %zu, split at %zu: %08x and %08x, expected %08x\n", crc32c_kernel_name(),
+                       length, offset, split, whole, continued, expected);
+            }
+        }
+    }
+    // Byte by byte, through every alignment of every kernel's tail loop.
+    uint32_t crc = 0;
+    for (size_t i = 0; i < 100; ++i) {
+        crc = crc32c(crc, buffer.data() + i, 1);
+    }
+    ++cases;
+    if (crc != reference_crc32c(buffer.data(), 100)) {
+        printf("%s: byte-by-byte calls gave %08x\n", crc32c_kernel_name(), crc);
+        ++failures;
+    }
+    return failures;
+}
+
+int main() {
+    int failures = 0;
+    const char* kernel_names[] = { "sse4.2", "armv8-crc", "table" };
+    for (const char* name : kernel_names) {
+        if (!crc32c_use_kernel(name)) {
+            printf("%s: not available, skipped\n", name);
+            continue;
+        }
+        long cases = 5;
+        long mismatches = test_check_values() + test_random_buffers(cases);
+        printf("%s: %ld cases, %ld mismatches\n", name, cases, mismatches);
+        if (mismatches != 0) {
+            ++failures;
+        }
+    }
+    return failures == 0 ? 0 : 1;
+}
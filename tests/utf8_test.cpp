@@ -0,0 +1,253 @@
+// Checks Utf8Codec against a plain reference converter on random text, with every kernel this CPU can run.
+// Output buffers carry a sentinel past the end to catch overruns. Exits non-zero on failure.
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#include "../src/Utf8Codec.h"
+
+static const bool WIDE32 = sizeof(wchar_t) == 4;
+static const int TEXTS = 100000;
+static const size_t SENTINEL_BYTES = 64;
+static const char SENTINEL_BYTE = 0x55;
+static const wchar_t SENTINEL_CHAR = static_cast<wchar_t>(0x1234);
+
+// The next code point, with unpaired surrogates and values above U+10FFFF as U+FFFD.
+static uint32_t reference_next(const wchar_t*& in, const wchar_t* end) {
+    uint32_t c = WIDE32 ? static_cast<uint32_t>(*in) : static_cast<uint16_t>(*in);
+    ++in;
+    if (!WIDE32 && c >= 0xD800 && c <= 0xDBFF && in < end) {
+        uint32_t low = static_cast<uint16_t>(*in);
+        if (low >= 0xDC00 && low <= 0xDFFF) {
+            ++in;
+            return 0x10000 + ((c - 0xD800) << 10) + (low - 0xDC00);
+        }
+    }
+    if ((c >= 0xD800 && c <= 0xDFFF) || c > 0x10FFFF) {
+        return 0xFFFD;
+    }
+    return c;
+}
+
+static void append_wide(std::wstring& text, uint32_t c) {
+    if (!WIDE32 && c >= 0x10000 && c <= 0x10FFFF) {
+        c -= 0x10000;
+        text += static_cast<wchar_t>(0xD800 + (c >> 10));
+        text += static_cast<wchar_t>(0xDC00 + (c & 0x3FF));
+        return;
+    }
+    text += static_cast<wchar_t>(c);
+}
+
+static std::string reference_encode(const std::wstring& text) {
+    std::string out;
+    const wchar_t* in = text.data();
+    const wchar_t* end = in + text.size();
+    while (in < end) {
+        uint32_t c = reference_next(in, end);
+        if (c < 0x80) {
+            out += static_cast<char>(c);
+        }
+        else if (c < 0x800) {
+            out += static_cast<char>(0xC0 | (c >> 6));
+            out += static_cast<char>(0x80 | (c & 0x3F));
+        }
+        else if (c < 0x10000) {
+            out += static_cast<char>(0xE0 | (c >> 12));
+            out += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (c & 0x3F));
+        }
+        else {
+            out += static_cast<char>(0xF0 | (c >> 18));
+            out += static_cast<char>(0x80 | ((c >> 12) & 0x3F));
+            out += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (c & 0x3F));
+        }
+    }
+    return out;
+}
+
+// False for malformed input, a truncated sequence at the end included.
+static bool reference_decode(const std::string& utf8, std::wstring& out) {
+    out.clear();
+    const unsigned char* in = reinterpret_cast<const unsigned char*>(utf8.data());
+    size_t length = utf8.size();
+    size_t i = 0;
+    while (i < length) {
+        uint32_t c = in[i];
+        int continuations = 0;
+        uint32_t smallest = 0;
+        if (c >= 0xC2 && c <= 0xDF) {
+            continuations = 1;
+            c &= 0x1F;
+            smallest = 0x80;
+        }
+        else if ((c & 0xF0) == 0xE0) {
+            continuations = 2;
+            c &= 0x0F;
+            smallest = 0x800;
+        }
+        else if (c >= 0xF0 && c <= 0xF4) {
+            continuations = 3;
+            c &= 0x07;
+            smallest = 0x10000;
+        }
+        else if (c >= 0x80) {
+            return false;
+        }
+        if (i + continuations >= length && continuations > 0) {
+            return false;
+        }
+        for (int j = 1; j <= continuations; ++j) {
+            if ((in[i + j] & 0xC0) != 0x80) {
+                return false;
+            }
+            c = (c << 6) | (in[i + j] & 0x3F);
+        }
+        if (c < smallest || (c >= 0xD800 && c <= 0xDFFF) || c > 0x10FFFF) {
+            return false;
+        }
+        i += continuations + 1;
+        append_wide(out, c);
+    }
+    return true;
+}
+
+// Random text shaped like ASCII, Latin, CJK or mixed messages, with invalid code units now and then.
+static std::wstring random_text(std::mt19937& rng, int text_index) {
+    auto pick = [&](int kind) -> uint32_t {
+        static const uint32_t edges[] = { 0xD800, 0xDBFF, 0xDC00, 0xDFFF, 0x110000, 0xFFFFFFFF, 0x7FFFFFFF,
+                                          0x7F, 0x80, 0x7FF, 0xFFFF, 0xFFFD };
+        switch (kind) {
+        case 0: return rng() % 0x80;
+        case 1: return 0x80 + rng() % 0x780;
+        case 2: return 0x800 + rng() % (0x10000 - 0x800);
+        case 3: return 0x10000 + rng() % 0x100000;
+        case 4: return 0x4E00 + rng() % 0x5000;
+        default: return edges[rng() % (sizeof(edges) / sizeof(edges[0]))];
+        }
+    };
+    int length = rng() % (text_index % 10 == 0 ? 2000 : 140);
+    int shape = rng() % 5;
+    std::wstring text;
+    for (int i = 0; i < length; ++i) {
+        int r = rng() % 100;
+        int kind;
+        switch (shape) {
+        case 0: kind = 0; break;
+        case 1: kind = r < 90 ? 0 : 1; break;
+        case 2: kind = r < 95 ? 4 : (r < 98 ? 0 : 2); break;
+        case 3: kind = r < 97 ? (r % 4 == 0 ? 0 : 4) : 5; break;
+        default: kind = rng() % 6; break;
+        }
+        uint32_t c = pick(kind);
+        if (WIDE32 || c < 0x10000 || c > 0x10FFFF) {
+            text += static_cast<wchar_t>(c);
+        }
+        else {
+            append_wide(text, c);
+        }
+    }
+    return text;
+}
+
+// Flips, drops or inserts a few bytes, which usually makes the text malformed.
+static void mutate(std::mt19937& rng, std::string& utf8) {
+    int changes = 1 + rng() % 3;
+    for (int i = 0; i < changes && !utf8.empty(); ++i) {
+        size_t pos = rng() % utf8.size();
+        switch (rng() % 4) {
+        case 0: utf8[pos] = static_cast<char>(rng() & 0xFF); break;
+        case 1: utf8.erase(pos, 1); break;
+        case 2: utf8[pos] = static_cast<char>(0x80 | (rng() & 0x3F)); break;
+        default: utf8.insert(pos, 1, static_cast<char>(0xE0 | (rng() & 0x0F))); break;
+        }
+    }
+}
+
+static bool check_encode(const std::wstring& text, const std::string& expected) {
+    size_t length = utf8_encoded_length(text.data(), text.size());
+    std::vector<char> out(length + SENTINEL_BYTES, SENTINEL_BYTE);
+    size_t written = utf8_encode(text.data(), text.size(), out.data());
+    if (length != expected.size() || written != length || memcmp(out.data(), expected.data(), length) != 0) {
+        return false;
+    }
+    for (size_t i = length; i < out.size(); ++i) {
+        if (out[i] != SENTINEL_BYTE) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool check_decode(const std::string& utf8) {
+    std::wstring expected;
+    bool valid = reference_decode(utf8, expected);
+    std::vector<wchar_t> out(utf8.size() + 8, SENTINEL_CHAR);
+    size_t written = utf8_decode(utf8.data(), utf8.size(), out.data());
+    if (!valid) {
+        return written == UTF8_INVALID;
+    }
+    return written == expected.size() && memcmp(out.data(), expected.data(), written * sizeof(wchar_t)) == 0 &&
+           out[written] == SENTINEL_CHAR;
+}
+
+// Runs the same texts through the kernels in use. Returns the number of mismatches.
+static long test_kernels(long& cases) {
+    std::mt19937 rng(42);
+    long failures = 0;
+    for (int i = 0; i < TEXTS; ++i) {
+        std::wstring text = random_text(rng, i);
+        std::string utf8 = reference_encode(text);
+        ++cases;
+        if (!check_encode(text, utf8)) {
+            if (failures++ < 5) {
+                printf("%s: encode mismatch for text %d, %zu characters\n", utf8_kernel_name(), i, text.size());
+            }
+            continue;
+        }
+        for (int round = 0; round < 3; ++round) {
+            std::string input = utf8;
+            if (round > 0) {
+                mutate(rng, input);
+            }
+            ++cases;
+            if (!check_decode(input)) {
+                if (failures++ < 5) {
+                    printf("%s: decode mismatch for text %d, round %d\n", utf8_kernel_name(), i, round);
+                }
+            }
+        }
+    }
+    // Truncated sequences at the end are rejected, unlike std::codecvt_utf8, which returns what comes before them.
+    const char* truncated[] = { "ab\xC6", "\xF1\x8E\x88\xB5\xF1", "\xE2\x82", "abcdefghijklmnopqrstuvwxyz0123456789\xE4\xB8" };
+    for (const char* input : truncated) {
+        std::vector<wchar_t> out(strlen(input) + 1);
+        ++cases;
+        if (utf8_decode(input, strlen(input), out.data()) != UTF8_INVALID) {
+            printf("%s: accepted a truncated sequence\n", utf8_kernel_name());
+            ++failures;
+        }
+    }
+    return failures;
+}
+
+int main() {
+    int failures = 0;
+    const char* kernel_names[] = { "avx2", "sse2", "neon", "scalar" };
+    for (const char* name : kernel_names) {
+        if (!utf8_use_kernels(name)) {
+            printf("%s: not available, skipped\n", name);
+            continue;
+        }
+        long cases = 0;
+        long mismatches = test_kernels(cases);
+        printf("%s: %ld cases, %ld mismatches\n", name, cases, mismatches);
+        if (mismatches != 0) {
+            ++failures;
+        }
+    }
+    return failures == 0 ? 0 : 1;
+}